@@ -96,6 +96,28 @@ GIT_EXTERN(const void *) git_blob_rawcontent(const git_blob *blob);
  */
 GIT_EXTERN(git_off_t) git_blob_rawsize(const git_blob *blob);
 
+/**
+ * Open a stream to read the raw content of a blob.
+ *
+ * Unlike `git_blob_lookup`, this does not load the whole blob in
+ * memory: loose blobs and blobs stored whole in a packfile are
+ * inflated as the stream is read, so that blobs larger than the
+ * available memory can be read in chunks with `git_odb_stream_read`.
+ * Blobs which are already loaded are read from the loaded copy, which
+ * the stream keeps a reference to.
+ *
+ * The size of the blob is given by the stream's `declared_size`.
+ * The stream must be free'd with `git_odb_stream_free` before the
+ * repository.
+ *
+ * @param out pointer where to store the stream
+ * @param repo the repo to use when locating the blob.
+ * @param id identity of the blob to read.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_blob_open_rstream(
+	git_odb_stream **out, git_repository *repo, const git_oid *id);
+
 /**
  * Get a buffer with the filtered content of a blob.
  *
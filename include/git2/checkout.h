@@ -292,6 +292,16 @@ typedef struct git_checkout_options {
 	/** Optional callback to notify the consumer of performance data. */
 	git_checkout_perfdata_cb perfdata_cb;
 	void *perfdata_payload;
+
+	/** The number of threads that read, filter and write the files to
+	 *  check out, when there are at least `checkout.thresholdForParallelism`
+	 *  of them (100 unless configured).  When 0, `checkout.workers` is
+	 *  used, which defaults to one; a negative value (or a configured
+	 *  value below one) means one thread per CPU.  Directories are still
+	 *  created, and the index updated, by the calling thread, and files
+	 *  that need filters other than the built-in ones are written by it.
+	 */
+	int workers;
 } git_checkout_options;
 
 #define GIT_CHECKOUT_OPTIONS_VERSION 1
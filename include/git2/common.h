@@ -150,6 +150,13 @@ typedef enum {
 	GIT_OPT_SET_USER_AGENT,
 	GIT_OPT_ENABLE_STRICT_OBJECT_CREATION,
 	GIT_OPT_SET_SSL_CIPHERS,
+	GIT_OPT_GET_CACHE_SHARDS,
+	GIT_OPT_GET_CACHE_SHARD_STATS,
+	GIT_OPT_SET_CACHE_TYPE_MAX_SIZE,
+	GIT_OPT_GET_CACHED_TYPE_MEMORY,
+	GIT_OPT_ENABLE_LAZY_INDEX_LOOKUP,
+	GIT_OPT_SET_CONNECTION_POOL,
+	GIT_OPT_GET_CONNECTION_POOL_STATS,
 } git_libgit2_opt_t;
 
 /**
@@ -211,6 +218,15 @@ typedef enum {
  *		> briefly exceed it, but will start aggressively evicting objects
  *		> from cache when that happens.  The default cache size is 256MB.
  *
+ *	* opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, git_otype type, ssize_t max_storage_bytes)
+ *
+ *		> Set the maximum data size that objects of the given type
+ *		> may take up in the cache, within the maximum total size.  When
+ *		> storing an object would go over it, objects of the same type
+ *		> which have not been looked up recently are evicted first.
+ *		> Pass 0 to let the type use the whole cache, which is the
+ *		> default for every type.
+ *
  *	* opts(GIT_OPT_ENABLE_CACHING, int enabled)
  *
  *		> Enable or disable caching completely.
@@ -224,6 +240,26 @@ typedef enum {
  *		> Get the current bytes in cache and the maximum that would be
  *		> allowed in the cache.
  *
+ *	* opts(GIT_OPT_GET_CACHE_SHARDS, size_t *count)
+ *
+ *		> Get the number of shards each object cache is split in.
+ *		> Objects are spread across the shards by id, and every shard
+ *		> has its own lock.
+ *
+ *	* opts(GIT_OPT_GET_CACHE_SHARD_STATS, size_t shard, size_t *hits,
+ *	       size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of lookups which found an object in the
+ *		> given shard, the number which did not, and the number of
+ *		> objects evicted from it to stay below the maximum cache
+ *		> size.  These are counted across the caches of every
+ *		> repository.
+ *
+ *	* opts(GIT_OPT_GET_CACHED_TYPE_MEMORY, git_otype type, ssize_t *current, ssize_t *allowed)
+ *
+ *		> Get the current bytes in cache taken up by objects of the
+ *		> given type and the maximum that would be allowed for them.
+ *
  *	* opts(GIT_OPT_GET_TEMPLATE_PATH, git_buf *out)
  *
  *		> Get the default template path.
@@ -267,6 +303,30 @@ typedef enum {
  *		>
  *		> - `ciphers` is the list of ciphers that are eanbled.
  *
+ *	* opts(GIT_OPT_ENABLE_LAZY_INDEX_LOOKUP, int enabled)
+ *
+ *		> Only build the table that finds index entries by path the first
+ *		> time an entry is looked up by path, rather than each time the
+ *		> index is read.  This makes reading an index faster for callers
+ *		> that only iterate over its entries, but means that the first
+ *		> lookup by path modifies the index, so that lookups from several
+ *		> threads need to be serialized.  This defaults to disabled.
+ *
+ *	* opts(GIT_OPT_SET_CONNECTION_POOL, size_t max_idle, int idle_timeout)
+ *
+ *		> Keep up to `max_idle` HTTP(S) connections open once their
+ *		> requests are done, each for at most `idle_timeout` seconds,
+ *		> so that later requests to the same server (by any remote in
+ *		> the process) do not have to connect and go through the TLS
+ *		> handshake again.  Connections are only shared between
+ *		> requests with the same scheme, host, port and proxy.  The
+ *		> default is 0 connections (no pooling) and 15 seconds.
+ *
+ *	* opts(GIT_OPT_GET_CONNECTION_POOL_STATS, size_t *idle, size_t *reused)
+ *
+ *		> Get the number of connections kept open in the pool, and the
+ *		> number of times a connection was taken out of it.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
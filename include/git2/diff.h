@@ -167,6 +167,12 @@ typedef enum {
 	/** Include unreadable files in the diff */
 	GIT_DIFF_INCLUDE_UNREADABLE_AS_UNTRACKED = (1u << 17),
 
+	/** Read the directories and `lstat` the files of the working
+	 *  directory from several threads.  This speeds up diffs against
+	 *  large working directories; the results are the same.
+	 */
+	GIT_DIFF_PARALLEL_WORKDIR_SCAN = (1u << 18),
+
 	/*
 	 * Options controlling how output will be generated
 	 */
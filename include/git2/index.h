@@ -132,6 +132,9 @@ typedef enum {
 
 	GIT_IDXENTRY_UNPACKED          =  (1 << 8),
 	GIT_IDXENTRY_NEW_SKIP_WORKTREE =  (1 << 9),
+
+	/** the filesystem monitor reports no change since the last `lstat` */
+	GIT_IDXENTRY_FSMONITOR_VALID   =  (1 << 10),
 } git_idxentry_extended_flag_t;
 
 /** Capabilities of system that affect index actions. */
@@ -251,6 +254,32 @@ GIT_EXTERN(int) git_index_caps(const git_index *index);
  */
 GIT_EXTERN(int) git_index_set_caps(git_index *index, int caps);
 
+/**
+ * Get index on-disk version.
+ *
+ * Valid return values are 2, 3, or 4.  If 3 is returned, an index
+ * with version 2 may be written instead, if the extension data in
+ * version 3 is not necessary.
+ *
+ * @param index An existing index object
+ * @return the index version
+ */
+GIT_EXTERN(unsigned int) git_index_version(git_index *index);
+
+/**
+ * Set index on-disk version.
+ *
+ * Valid values are 2, 3, or 4.  If 2 is given, git_index_write may
+ * write an index with version 3 instead, if necessary to accurately
+ * represent the index.  Version 4 compresses each path against the
+ * one before it, which makes the index of large trees much smaller.
+ *
+ * @param index An existing index object
+ * @param version The new version number
+ * @return 0 on success, -1 on failure
+ */
+GIT_EXTERN(int) git_index_set_version(git_index *index, unsigned int version);
+
 /**
  * Update the contents of an existing index object in memory by reading
  * from the hard disk.
@@ -35,6 +35,35 @@ GIT_EXTERN(int) git_indexer_new(
 		git_transfer_progress_cb progress_cb,
 		void *progress_cb_payload);
 
+/**
+ * Set the number of threads used to resolve deltas
+ *
+ * The deltas of the pack are resolved by as many threads as there are
+ * CPUs by default, or when set to 0.  When more than one thread is used,
+ * the progress callback may be called from any of them (but never from
+ * two at the same time).
+ *
+ * @param idx the indexer
+ * @param n number of threads to use
+ * @return number of threads that will be used
+ */
+GIT_EXTERN(unsigned int) git_indexer_set_threads(git_indexer *idx, unsigned int n);
+
+/**
+ * Resolve deltas while the pack is being received
+ *
+ * When enabled, a background thread resolves the OFS_DELTA objects
+ * whose base is already in the pack as `git_indexer_append` receives
+ * them, so that most of the work of `git_indexer_commit` overlaps with
+ * the transfer.  This must be set before any data is appended, and it
+ * has no effect when libgit2 is built without thread support.
+ *
+ * @param idx the indexer
+ * @param enabled whether to resolve deltas as they arrive
+ * @return 1 if deltas will be resolved as they arrive, 0 otherwise
+ */
+GIT_EXTERN(int) git_indexer_set_streaming(git_indexer *idx, int enabled);
+
 /**
  * Add data to the indexer
  *
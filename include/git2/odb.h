@@ -99,6 +99,43 @@ GIT_EXTERN(void) git_odb_free(git_odb *db);
  */
 GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id);
 
+/**
+ * Callback for each object read by `git_odb_read_many`.
+ *
+ * The object is freed once the callback returns; use `git_odb_object_dup`
+ * to keep it longer.  `position` is the index of its id in the array
+ * given to `git_odb_read_many`.  Return non-zero to stop reading.
+ */
+typedef int (*git_odb_read_many_cb)(
+	git_odb_object *object, size_t position, void *payload);
+
+/**
+ * Read several objects from the database.
+ *
+ * The objects are not read in the order of `ids` but in the order they
+ * are stored in: first those that are cached or not in a packfile, then
+ * those of each packfile by their offset in it.  This keeps the reads
+ * close together, and lets the deltas share their bases through the
+ * delta base cache of the packfile.  An id may be given several times,
+ * and is then given to the callback as many times.
+ *
+ * @param db database to search for the objects in
+ * @param ids the ids of the objects to read
+ * @param count the number of ids
+ * @param cb callback to call with each object
+ * @param payload payload to pass to the callback
+ * @return
+ * - 0 if all of the objects were read;
+ * - GIT_ENOTFOUND if one of them is not in the database;
+ * - the non-zero value returned by the callback to stop reading.
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	git_odb_read_many_cb cb,
+	void *payload);
+
 /**
  * Read an object from the database, given a prefix
  * of its identifier.
@@ -326,7 +363,11 @@ GIT_EXTERN(int) git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stre
 /**
  * Read from an odb stream
  *
- * Most backends don't implement streaming reads
+ * @param stream the stream
+ * @param buffer the buffer to read into
+ * @param len the size of the buffer
+ * @return the number of bytes read, 0 once the whole object has been
+ *         read, or an error code
  */
 GIT_EXTERN(int) git_odb_stream_read(git_odb_stream *stream, char *buffer, size_t len);
 
@@ -340,11 +381,11 @@ GIT_EXTERN(void) git_odb_stream_free(git_odb_stream *stream);
 /**
  * Open a stream to read an object from the ODB
  *
- * Note that most backends do *not* support streaming reads
- * because they store their objects as compressed/delta'ed blobs.
- *
- * It's recommended to use `git_odb_read` instead, which is
- * assured to work on all backends.
+ * Loose objects and objects stored whole in a packfile are inflated
+ * as they are read, so that objects which do not fit in memory can be
+ * read in chunks.  Objects which are already in the object cache are
+ * read from the cached copy, and objects that the backends cannot
+ * stream (like deltas) are read whole with `git_odb_read` first.
  *
  * The returned stream will be of type `GIT_STREAM_RDONLY` and
  * will have the following methods:
@@ -352,16 +393,24 @@ GIT_EXTERN(void) git_odb_stream_free(git_odb_stream *stream);
  *		- stream->read: read `n` bytes from the stream
  *		- stream->free: free the stream
  *
- * The stream must always be free'd or will leak memory.
+ * The stream must always be free'd or will leak memory, and must be
+ * free'd before the object database.
  *
  * @see git_odb_stream
  *
  * @param out pointer where to store the stream
+ * @param len pointer where to store the length of the object
+ * @param type pointer where to store the type of the object
  * @param db object database where the stream will read from
  * @param oid oid of the object the stream will read from
  * @return 0 if the stream was created; error code otherwise
  */
-GIT_EXTERN(int) git_odb_open_rstream(git_odb_stream **out, git_odb *db, const git_oid *oid);
+GIT_EXTERN(int) git_odb_open_rstream(
+	git_odb_stream **out,
+	size_t *len,
+	git_otype *type,
+	git_odb *db,
+	const git_oid *oid);
 
 /**
  * Open a stream for writing a pack file to the ODB.
@@ -512,6 +512,42 @@ typedef enum {
 	GIT_REMOTE_DOWNLOAD_TAGS_ALL,
 } git_remote_autotag_option_t;
 
+/**
+ * How to choose the local commits which are sent to the server while
+ * negotiating what a fetch needs to download.  Sending fewer commits
+ * takes fewer round-trips, at the risk of downloading objects which
+ * were already there.
+ */
+typedef enum {
+	/**
+	 * Use the setting from `fetch.negotiationAlgorithm`, which is
+	 * "consecutive" when it isn't set.
+	 */
+	GIT_FETCH_NEGOTIATION_UNSPECIFIED = 0,
+	/**
+	 * Send every commit, newest first, until the server knows one of
+	 * them.
+	 */
+	GIT_FETCH_NEGOTIATION_CONSECUTIVE,
+	/**
+	 * Send every commit in decreasing order of generation number, so
+	 * that clock skew doesn't matter, and keep going after the server
+	 * knows one of them with the commits that aren't its ancestors.
+	 * Generation numbers are read from the commit-graph; commits outside
+	 * of it are sent newest first.
+	 */
+	GIT_FETCH_NEGOTIATION_CONSECUTIVE_GENERATION,
+	/**
+	 * Skip exponentially further back through each line of history
+	 * after every commit sent, like git's "skipping" algorithm.
+	 */
+	GIT_FETCH_NEGOTIATION_SKIPPING,
+	/**
+	 * Don't send any commit.
+	 */
+	GIT_FETCH_NEGOTIATION_NOOP,
+} git_fetch_negotiation_t;
+
 /**
  * Fetch options structure.
  *
@@ -552,9 +588,41 @@ typedef struct {
 	 * Extra headers for this fetch operation
 	 */
 	git_strarray custom_headers;
+
+	/**
+	 * How to negotiate what to download.  The default is to use the
+	 * configuration.
+	 */
+	git_fetch_negotiation_t negotiation;
+
+	/**
+	 * Fetch at most this many commits of the history of each ref,
+	 * which makes the repository shallow.  Fetching into a shallow
+	 * repository with a larger depth deepens it, and
+	 * `GIT_FETCH_DEPTH_UNSHALLOW` fetches all of the history it is
+	 * missing.  The default of 0 fetches the whole history of the new
+	 * commits.
+	 */
+	int depth;
+
+	/**
+	 * Leave out the commits older than this time; 0 for no limit.
+	 */
+	git_time_t shallow_since;
+
+	/**
+	 * Leave out the commits which are reachable from these refs of the
+	 * remote.
+	 *
+	 * Neither this nor `shallow_since` can be combined with `depth`.
+	 */
+	git_strarray shallow_exclude;
 } git_fetch_options;
 
-#define GIT_FETCH_OPTIONS_VERSION 1
+/** The `depth` which fetches all the missing history of a shallow repository */
+#define GIT_FETCH_DEPTH_UNSHALLOW 2147483647
+
+#define GIT_FETCH_OPTIONS_VERSION 3
 #define GIT_FETCH_OPTIONS_INIT { GIT_FETCH_OPTIONS_VERSION, GIT_REMOTE_CALLBACKS_INIT, GIT_FETCH_PRUNE_UNSPECIFIED, 1 }
 
 /**
@@ -687,6 +755,103 @@ GIT_EXTERN(int) git_remote_fetch(
 		const git_fetch_options *opts,
 		const char *reflog_message);
 
+/**
+ * A fetch to run with `git_remote_fetch_batch()`
+ */
+typedef struct {
+	/** The remote to fetch from; its repository is the one updated */
+	git_remote *remote;
+
+	/** The refspecs to fetch, or NULL to use the base refspecs */
+	const git_strarray *refspecs;
+
+	/** The reflog message, or NULL for the default of `git_remote_fetch()` */
+	const char *reflog_message;
+
+	/** Set to the result of the fetch: 0 or an error code */
+	int error;
+} git_fetch_batch_job;
+
+/**
+ * Progress of one of the fetches of a batch
+ *
+ * @param job the index of the job in the array given to `git_remote_fetch_batch()`
+ * @param stats the progress of its transfer
+ * @param payload the payload of the batch options
+ * @return 0 to continue, non-zero to cancel that fetch
+ */
+typedef int (*git_fetch_batch_progress_cb)(
+	size_t job, const git_transfer_progress *stats, void *payload);
+
+/**
+ * Options for `git_remote_fetch_batch()`
+ *
+ * Initialize with `GIT_FETCH_BATCH_OPTIONS_INIT` to set the `version`
+ * field.
+ */
+typedef struct {
+	unsigned int version;
+
+	/**
+	 * The options of every fetch.  Their callbacks are shared by all the
+	 * jobs, but are called for one job at a time.
+	 */
+	git_fetch_options fetch_opts;
+
+	/** How many fetches run at the same time; 0 for 4 */
+	unsigned int threads;
+
+	/**
+	 * How many fetches from the same host run at the same time; 0 for
+	 * no limit.  Fetches from local repositories are not limited.
+	 */
+	unsigned int max_per_host;
+
+	/** Called with the progress of each job, one job at a time */
+	git_fetch_batch_progress_cb progress;
+
+	/** Payload for `progress` */
+	void *payload;
+} git_fetch_batch_options;
+
+#define GIT_FETCH_BATCH_OPTIONS_VERSION 1
+#define GIT_FETCH_BATCH_OPTIONS_INIT { GIT_FETCH_BATCH_OPTIONS_VERSION, GIT_FETCH_OPTIONS_INIT }
+
+/**
+ * Initializes a `git_fetch_batch_options` with default values. Equivalent
+ * to creating an instance with GIT_FETCH_BATCH_OPTIONS_INIT.
+ *
+ * @param opts the `git_fetch_batch_options` instance to initialize.
+ * @param version the version of the struct; you should pass
+ *        `GIT_FETCH_BATCH_OPTIONS_VERSION` here.
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fetch_batch_init_options(
+	git_fetch_batch_options *opts,
+	unsigned int version);
+
+/**
+ * Run several fetches from a pool of threads
+ *
+ * Each job does what `git_remote_fetch()` does.  The fetches into the
+ * same repository run one after the other, as a repository may only be
+ * used by one thread at a time; the remotes and repositories of the
+ * jobs must not be used by anybody else until this returns.
+ *
+ * Every job is run, even when some of them fail; the result of each is
+ * set in its `error` field.
+ *
+ * @param jobs the fetches to run
+ * @param count the number of jobs
+ * @param opts options for the batch, or NULL for the defaults
+ * @return 0 when every fetch succeeded, or the error code of the first
+ *         job which failed, whose error message is then the last error
+ */
+GIT_EXTERN(int) git_remote_fetch_batch(
+	git_fetch_batch_job *jobs,
+	size_t count,
+	const git_fetch_batch_options *opts);
+
 /**
  * Prune tracking refs that are no longer present on remote
  *
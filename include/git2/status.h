@@ -128,6 +128,9 @@ typedef enum {
  *   information in the index.  It will result in less work being done on
  *   subsequent calls to get status.  This is mutually exclusive with the
  *   NO_REFRESH option.
+ * - GIT_STATUS_OPT_PARALLEL_WORKDIR_SCAN reads the directories and stats
+ *   the files of the working directory from several threads, which is
+ *   faster on large working directories.
  *
  * Calling `git_status_foreach()` is like calling the extended version
  * with: GIT_STATUS_OPT_INCLUDE_IGNORED, GIT_STATUS_OPT_INCLUDE_UNTRACKED,
@@ -151,6 +154,7 @@ typedef enum {
 	GIT_STATUS_OPT_UPDATE_INDEX                     = (1u << 13),
 	GIT_STATUS_OPT_INCLUDE_UNREADABLE               = (1u << 14),
 	GIT_STATUS_OPT_INCLUDE_UNREADABLE_AS_UNTRACKED  = (1u << 15),
+	GIT_STATUS_OPT_PARALLEL_WORKDIR_SCAN            = (1u << 16),
 } git_status_opt_t;
 
 #define GIT_STATUS_OPT_DEFAULTS \
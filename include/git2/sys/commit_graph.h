@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_commit_graph_h__
+#define INCLUDE_sys_git_commit_graph_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/commit_graph.h
+ * @brief Git commit-graph
+ * @defgroup git_commit_graph Git commit-graph APIs
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * A writer for `commit-graph` files.
+ *
+ * The commit-graph file (`objects/info/commit-graph`) caches the
+ * parents, root tree, commit time and generation number of every
+ * commit it contains, so that history walks and merge-base
+ * computations can be performed without inflating the commits.
+ */
+typedef struct git_commit_graph_writer git_commit_graph_writer;
+
+/**
+ * Create a new writer for `commit-graph` files.
+ *
+ * @param out Location to store the writer pointer.
+ * @param objects_info_dir The `objects/info` directory.
+ * The `commit-graph` file will be written in this directory.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_new(
+	git_commit_graph_writer **out,
+	const char *objects_info_dir);
+
+/**
+ * Free the commit-graph writer and its resources.
+ *
+ * @param w The writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_commit_graph_writer_free(git_commit_graph_writer *w);
+
+/**
+ * Add all the commits produced by a revwalk to the writer.
+ *
+ * Since the commit-graph must be closed under reachability, the
+ * revwalk should not hide any commits.  As in git, shallow repositories
+ * have no commit-graph, and this fails for them.
+ *
+ * @param w The writer.
+ * @param walk The git_revwalk.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_add_revwalk(
+	git_commit_graph_writer *w,
+	git_revwalk *walk);
+
+/**
+ * Write a `commit-graph` file to a buffer.
+ *
+ * @param buffer Buffer where to store the contents of the `commit-graph`.
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_dump(
+	git_buf *buffer,
+	git_commit_graph_writer *w);
+
+/**
+ * Write a `commit-graph` file to disk, replacing any existing one.
+ *
+ * Open repositories will pick the new file up on their next
+ * `git_odb_refresh`.
+ *
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_writer_commit(
+	git_commit_graph_writer *w);
+
+/** @} */
+GIT_END_DECL
+#endif
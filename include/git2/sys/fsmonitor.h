@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_fsmonitor_h__
+#define INCLUDE_sys_git_fsmonitor_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/fsmonitor.h
+ * @brief Git filesystem monitor routines
+ * @defgroup git_fsmonitor Git filesystem monitor routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Callback for each path that a filesystem monitor reports as changed.
+ *
+ * @param path The path, relative to the root of the working directory
+ * @param payload The payload given to the `query` callback
+ * @return 0 to continue, or an error code to stop
+ */
+typedef int (*git_fsmonitor_path_cb)(const char *path, void *payload);
+
+/**
+ * A filesystem monitor, which knows which paths of a working directory
+ * have changed since some point in time.
+ *
+ * When one is set on a repository, status and diffs of the index to the
+ * working directory remember which index entries the monitor has not
+ * reported as changed since they were last compared to the working
+ * directory, and take their `stat` information from the index instead
+ * of calling `lstat`.
+ *
+ * The points in time are identified by tokens of the monitor's own
+ * choosing, which are stored in the index (in the `FSMN` extension, the
+ * same one core git uses with its `core.fsmonitor` hook).
+ */
+struct git_fsmonitor {
+	unsigned int version;
+
+	/**
+	 * Report the paths that changed since `token` was handed out, by
+	 * calling `path_cb` for each of them, and set `token_out` to the
+	 * token to ask about the changes made from now on.
+	 *
+	 * A path with a trailing slash stands for a directory and all the
+	 * files beneath it; the path "/" stands for the whole working
+	 * directory, for when the monitor cannot tell what changed.
+	 *
+	 * `token` is NULL when there is no token in the index yet, in which
+	 * case there is no need to report anything.  When this returns an
+	 * error, every path is considered to have changed.
+	 */
+	int (*query)(
+		git_fsmonitor *monitor,
+		git_buf *token_out,
+		const char *token,
+		git_fsmonitor_path_cb path_cb,
+		void *payload);
+
+	/**
+	 * Free the monitor, when it is replaced or the repository is freed.
+	 */
+	void (*free)(git_fsmonitor *monitor);
+};
+
+#define GIT_FSMONITOR_VERSION 1
+#define GIT_FSMONITOR_INIT {GIT_FSMONITOR_VERSION}
+
+/**
+ * Initializes a `git_fsmonitor` with default values. Equivalent to
+ * creating an instance with GIT_FSMONITOR_INIT.
+ *
+ * @param monitor the `git_fsmonitor` struct to initialize.
+ * @param version Version the struct; pass `GIT_FSMONITOR_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fsmonitor_init(
+	git_fsmonitor *monitor,
+	unsigned int version);
+
+/**
+ * Set the filesystem monitor of a repository.
+ *
+ * The repository takes ownership of the monitor and frees it when it is
+ * replaced or when the repository is freed.  Without a monitor set this
+ * way, the hook named by the `core.fsmonitor` configuration option is
+ * run to find out what changed, as core git does.
+ *
+ * @param repo The repository
+ * @param monitor The monitor, or NULL to go back to `core.fsmonitor`
+ * @return 0 on success, or an error code
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo,
+	git_fsmonitor *monitor);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -55,8 +55,17 @@ struct git_odb_backend {
 	int (* writestream)(
 		git_odb_stream **, git_odb_backend *, git_off_t, git_otype);
 
+	/**
+	 * Open a stream to read an object, storing its length and type.
+	 * Return GIT_PASSTHROUGH when the object cannot be streamed, in
+	 * which case it will be read whole with `read` instead.
+	 *
+	 * This is only called for backends of version 2 and up; those of
+	 * version 1 had a different `readstream` and are read whole.
+	 */
 	int (* readstream)(
-		git_odb_stream **, git_odb_backend *, const git_oid *);
+		git_odb_stream **, size_t *, git_otype *,
+		git_odb_backend *, const git_oid *);
 
 	int (* exists)(
 		git_odb_backend *, const git_oid *);
@@ -90,7 +99,7 @@ struct git_odb_backend {
 	void (* free)(git_odb_backend *);
 };
 
-#define GIT_ODB_BACKEND_VERSION 1
+#define GIT_ODB_BACKEND_VERSION 2
 #define GIT_ODB_BACKEND_INIT {GIT_ODB_BACKEND_VERSION}
 
 /**
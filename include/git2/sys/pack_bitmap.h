@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_pack_bitmap_h__
+#define INCLUDE_sys_git_pack_bitmap_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+#include "git2/oid.h"
+
+/**
+ * @file git2/sys/pack_bitmap.h
+ * @brief Git reachability bitmap routines
+ * @defgroup git_bitmap Git reachability bitmap routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * A writer for reachability bitmap (`.bitmap`) files.
+ *
+ * A reachability bitmap records, for a selection of commits, which
+ * objects of a packfile are reachable from them.  When a bitmap is
+ * present, `git_packbuilder_insert_walk` uses it to compute the objects
+ * to send with bitwise operations instead of walking every tree.
+ *
+ * Every object reachable from the selected commits must be stored in
+ * the packfile.
+ */
+typedef struct git_bitmap_writer git_bitmap_writer;
+
+/**
+ * Create a new writer for the reachability bitmap of a packfile.
+ *
+ * @param out Location to store the writer pointer.
+ * @param repo The repository the packfile belongs to.
+ * @param idx_path The path of the `.idx` file of the packfile. The
+ * `.bitmap` file will be written next to it.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_bitmap_writer_new(
+	git_bitmap_writer **out,
+	git_repository *repo,
+	const char *idx_path);
+
+/**
+ * Free the bitmap writer and its resources.
+ *
+ * @param w The writer to free. If NULL no action is taken.
+ */
+GIT_EXTERN(void) git_bitmap_writer_free(git_bitmap_writer *w);
+
+/**
+ * Select a commit to store a bitmap for.
+ *
+ * Walks are fastest when the tips of the branches and a commit every
+ * few hundred commits of history have a bitmap.
+ *
+ * @param w The writer.
+ * @param commit_id The id of the commit.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_bitmap_writer_add_commit(
+	git_bitmap_writer *w,
+	const git_oid *commit_id);
+
+/**
+ * Write a `.bitmap` file to a buffer.
+ *
+ * @param bitmap Buffer where to store the contents of the `.bitmap` file.
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_bitmap_writer_dump(
+	git_buf *bitmap,
+	git_bitmap_writer *w);
+
+/**
+ * Write the `.bitmap` file next to the `.idx` file, replacing any
+ * existing one.
+ *
+ * @param w The writer.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_bitmap_writer_commit(
+	git_bitmap_writer *w);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -98,6 +98,9 @@ typedef struct git_refdb git_refdb;
 /** A custom backend for refs */
 typedef struct git_refdb_backend git_refdb_backend;
 
+/** A monitor of the changes made to a working directory */
+typedef struct git_fsmonitor git_fsmonitor;
+
 /**
  * Representation of an existing git repository,
  * including all its object contents
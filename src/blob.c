@@ -28,6 +28,54 @@ git_off_t git_blob_rawsize(const git_blob *blob)
 	return (git_off_t)git_odb_object_size(blob->odb_object);
 }
 
+int git_blob_open_rstream(
+	git_odb_stream **out, git_repository *repo, const git_oid *id)
+{
+	git_object *cached;
+	git_odb *odb;
+	git_otype type;
+	size_t len;
+	int error;
+
+	assert(out && repo && id);
+
+	*out = NULL;
+
+	/* a blob which has been looked up already holds its contents */
+	if ((cached = git_cache_get_parsed(&repo->objects, id)) != NULL) {
+		git_odb_object *odb_obj = NULL;
+
+		if (cached->cached.type == GIT_OBJ_BLOB) {
+			odb_obj = ((git_blob *)cached)->odb_object;
+			git_cached_obj_incref(odb_obj);
+		}
+
+		git_object_free(cached);
+
+		if (odb_obj)
+			return git_odb__object_rstream(out, odb_obj);
+
+		giterr_set(GITERR_INVALID,
+			"the requested type does not match the type in the ODB");
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+		(error = git_odb_open_rstream(out, &len, &type, odb, id)) < 0)
+		return error;
+
+	if (type != GIT_OBJ_BLOB) {
+		git_odb_stream_free(*out);
+		*out = NULL;
+
+		giterr_set(GITERR_INVALID,
+			"the requested type does not match the type in the ODB");
+		return GIT_ENOTFOUND;
+	}
+
+	return 0;
+}
+
 int git_blob__getbuf(git_buf *buffer, git_blob *blob)
 {
 	return git_buf_set(
@@ -20,8 +20,13 @@ GIT__USE_OIDMAP
 bool git_cache__enabled = true;
 ssize_t git_cache__max_storage = (256 * 1024 * 1024);
 git_atomic_ssize git_cache__current_storage = {0};
+git_cache_stats git_cache__stats[GIT_CACHE_SHARDS];
 
-static size_t git_cache__max_object_size[8] = {
+/* How much each type of object may take up; 0 to only share the total */
+static ssize_t git_cache__max_type_storage[GIT_CACHE_OTYPES];
+static git_atomic_ssize git_cache__current_type_storage[GIT_CACHE_OTYPES];
+
+static size_t git_cache__max_object_size[GIT_CACHE_OTYPES] = {
 	0,     /* GIT_OBJ__EXT1 */
 	4096,  /* GIT_OBJ_COMMIT */
 	4096,  /* GIT_OBJ_TREE */
@@ -43,103 +48,298 @@ int git_cache_set_max_object_size(git_otype type, size_t size)
 	return 0;
 }
 
-void git_cache_dump_stats(git_cache *cache)
+int git_cache_set_max_type_storage(git_otype type, ssize_t size)
 {
-	git_cached_obj *object;
+	if (type < 0 || type >= GIT_CACHE_OTYPES) {
+		giterr_set(GITERR_INVALID, "type out of range");
+		return -1;
+	}
 
-	if (kh_size(cache->map) == 0)
-		return;
+	git_cache__max_type_storage[type] = size > 0 ? size : 0;
+	return 0;
+}
 
-	printf("Cache %p: %d items cached, %"PRIdZ" bytes\n",
-		cache, kh_size(cache->map), cache->used_memory);
+int git_cache_type_storage(ssize_t *current, ssize_t *allowed, git_otype type)
+{
+	if (type < 0 || type >= GIT_CACHE_OTYPES) {
+		giterr_set(GITERR_INVALID, "type out of range");
+		return -1;
+	}
 
-	kh_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%"PRIuZ")\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			object->size
-		);
-	});
+	*current = git_cache__current_type_storage[type].val;
+	*allowed = git_cache__max_type_storage[type] ?
+		git_cache__max_type_storage[type] : git_cache__max_storage;
+	return 0;
+}
+
+int git_cache_shard_stats(
+	size_t *hits, size_t *misses, size_t *evictions, size_t shard)
+{
+	git_cache_stats *stats;
+
+	if (shard >= GIT_CACHE_SHARDS) {
+		giterr_set(GITERR_INVALID, "cache shard out of range");
+		return -1;
+	}
+
+	stats = &git_cache__stats[shard];
+	*hits = (size_t)stats->hits.val;
+	*misses = (size_t)stats->misses.val;
+	*evictions = (size_t)stats->evictions.val;
+	return 0;
+}
+
+GIT_INLINE(size_t) cache_shard_pos(const git_oid *oid)
+{
+	/* the map hashes the first bytes of the id; use the other end */
+	return oid->id[GIT_OID_RAWSZ - 1] % GIT_CACHE_SHARDS;
+}
+
+void git_cache_dump_stats(git_cache *cache)
+{
+	git_cache_shard *shard;
+	git_cached_obj *object;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (kh_size(shard->map) == 0)
+			continue;
+
+		printf("Cache %p shard %"PRIuZ": %d items cached, %"PRIdZ" bytes\n",
+			cache, i, kh_size(shard->map), shard->used_memory);
+
+		kh_foreach_value(shard->map, object, {
+			char oid_str[9];
+			printf(" %s%c %s (%"PRIuZ")\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				object->size
+			);
+		});
+	}
 }
 
 int git_cache_init(git_cache *cache)
 {
+	git_cache_shard *shard;
+	size_t i;
+
 	memset(cache, 0, sizeof(*cache));
-	cache->map = git_oidmap_alloc();
-	GITERR_CHECK_ALLOC(cache->map);
-	if (git_rwlock_init(&cache->lock)) {
-		giterr_set(GITERR_OS, "Failed to initialize cache rwlock");
-		return -1;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		shard->map = git_oidmap_alloc();
+		GITERR_CHECK_ALLOC(shard->map);
+		if (git_rwlock_init(&shard->lock)) {
+			giterr_set(GITERR_OS, "Failed to initialize cache rwlock");
+			return -1;
+		}
 	}
+
 	return 0;
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static size_t clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
+	git_cache_ring *ring;
+	size_t count = kh_size(shard->map), i;
 
-	if (kh_size(cache->map) == 0)
-		return;
+	if (count == 0)
+		return 0;
 
-	kh_foreach_value(cache->map, evict, {
+	kh_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	kh_clear(oid, cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	kh_clear(oid, shard->map);
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
+
+	for (i = 0; i < GIT_CACHE_OTYPES; i++) {
+		ring = &shard->rings[i];
+
+		git_atomic_ssize_add(&git_cache__current_type_storage[i], -ring->used_memory);
+		git_array_clear(ring->ids);
+		ring->hand = 0;
+		ring->used_memory = 0;
+	}
+
+	return count;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	git_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (!shard->map || git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
 
-	clear_cache(cache);
+		clear_shard(shard);
 
-	git_rwlock_wrunlock(&cache->lock);
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 void git_cache_free(git_cache *cache)
 {
+	git_cache_shard *shard;
+	size_t i, j;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		shard = &cache->shards[i];
+
+		if (!shard->map)
+			continue;
+
+		/* a shard emptied by eviction still has room in its rings */
+		for (j = 0; j < GIT_CACHE_OTYPES; j++)
+			git_array_clear(shard->rings[j].ids);
+
+		git_oidmap_free(shard->map);
+		git_rwlock_free(&shard->lock);
+	}
+
 	git__memzero(cache, sizeof(*cache));
 }
 
-/* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+/* Called with lock; evict objects of `type` until `needed` bytes are freed */
+static ssize_t cache_evict_type(
+	git_cache_shard *shard, git_otype type, ssize_t needed, git_cache_stats *stats)
 {
-	uint32_t seed = rand();
-	size_t evict_count = 8;
+	git_cache_ring *ring = &shard->rings[type];
+	git_cached_obj *evict;
 	ssize_t evicted_memory = 0;
+	size_t evict_count = 0, last;
+	khiter_t pos;
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > kh_size(cache->map)) {
-		clear_cache(cache);
-		return;
-	}
+	while (evicted_memory < needed && git_array_size(ring->ids) > 0) {
+		if (ring->hand >= git_array_size(ring->ids))
+			ring->hand = 0;
 
-	while (evict_count > 0) {
-		khiter_t pos = seed++ % kh_end(cache->map);
+		pos = kh_get(oid, shard->map, git_array_get(ring->ids, ring->hand));
+		assert(pos != kh_end(shard->map));
+		evict = kh_val(shard->map, pos);
 
-		if (kh_exist(cache->map, pos)) {
-			git_cached_obj *evict = kh_val(cache->map, pos);
+		/* it has been looked up since we last came by; give it another chance */
+		if (git_atomic_get(&evict->referenced)) {
+			git_atomic_set(&evict->referenced, 0);
+			ring->hand++;
+			continue;
+		}
+
+		evict_count++;
+		evicted_memory += evict->size;
 
-			evict_count--;
-			evicted_memory += evict->size;
-			git_cached_obj_decref(evict);
+		kh_del(oid, shard->map, pos);
+		git_cached_obj_decref(evict);
 
-			kh_del(oid, cache->map, pos);
+		/*
+		 * The most recently stored object takes its place; skip over
+		 * it, as it would only have been reached at the end of the
+		 * sweep.
+		 */
+		last = git_array_size(ring->ids) - 1;
+		if (ring->hand != last) {
+			git_oid_cpy(git_array_get(ring->ids, ring->hand),
+				git_array_get(ring->ids, last));
+			ring->hand++;
 		}
+
+		git_array_pop(ring->ids);
 	}
 
-	cache->used_memory -= evicted_memory;
+	ring->used_memory -= evicted_memory;
+	shard->used_memory -= evicted_memory;
+	git_atomic_ssize_add(&git_cache__current_type_storage[type], -evicted_memory);
 	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
+	git_atomic_ssize_add(&stats->evictions, (ssize_t)evict_count);
+
+	return evicted_memory;
+}
+
+/* Called with lock; evict from the types taking up the most memory first */
+static void cache_evict_entries(
+	git_cache_shard *shard, ssize_t needed, git_cache_stats *stats)
+{
+	ssize_t evicted_memory = 0, evicted;
+	size_t i, largest;
+
+	while (evicted_memory < needed && shard->used_memory > 0) {
+		largest = 0;
+
+		for (i = 1; i < GIT_CACHE_OTYPES; i++) {
+			if (shard->rings[i].used_memory > shard->rings[largest].used_memory)
+				largest = i;
+		}
+
+		if ((evicted = cache_evict_type(shard, (git_otype)largest,
+				needed - evicted_memory, stats)) == 0)
+			break;
+
+		evicted_memory += evicted;
+	}
+}
+
+static bool cache_over_budget(ssize_t size)
+{
+	return git_cache__current_storage.val + size > git_cache__max_storage;
+}
+
+static bool cache_over_type_budget(git_otype type, ssize_t size)
+{
+	return git_cache__max_type_storage[type] > 0 &&
+		git_cache__current_type_storage[type].val + size >
+		git_cache__max_type_storage[type];
+}
+
+/*
+ * Evict from every shard in turn, starting with `shard_pos`, until `size`
+ * more bytes of `type` fit within the budget of the type and the total.
+ * Each shard is locked on its own, so this must be called without holding
+ * any of them.
+ */
+static void cache_make_room(
+	git_cache *cache, size_t shard_pos, git_otype type, ssize_t size)
+{
+	git_cache_shard *shard;
+	git_cache_stats *stats;
+	size_t i, pos;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		if (!cache_over_type_budget(type, size) && !cache_over_budget(size))
+			break;
+
+		pos = (shard_pos + i) % GIT_CACHE_SHARDS;
+		shard = &cache->shards[pos];
+		stats = &git_cache__stats[pos];
+
+		if (git_rwlock_wrlock(&shard->lock) < 0)
+			continue;
+
+		if (cache_over_type_budget(type, size))
+			cache_evict_type(shard, type,
+				git_cache__current_type_storage[type].val + size -
+				git_cache__max_type_storage[type], stats);
+
+		if (cache_over_budget(size))
+			cache_evict_entries(shard,
+				git_cache__current_storage.val + size -
+				git_cache__max_storage, stats);
+
+		git_rwlock_wrunlock(&shard->lock);
+	}
 }
 
 static bool cache_should_store(git_otype object_type, size_t object_size)
@@ -151,23 +351,30 @@ static bool cache_should_store(git_otype object_type, size_t object_size)
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
 	khiter_t pos;
+	size_t shard_pos = cache_shard_pos(oid);
+	git_cache_shard *shard = &cache->shards[shard_pos];
 	git_cached_obj *entry = NULL;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled || git_rwlock_rdlock(&shard->lock) < 0)
 		return NULL;
 
-	pos = kh_get(oid, cache->map, oid);
-	if (pos != kh_end(cache->map)) {
-		entry = kh_val(cache->map, pos);
+	pos = kh_get(oid, shard->map, oid);
+	if (pos != kh_end(shard->map)) {
+		entry = kh_val(shard->map, pos);
 
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
 			git_cached_obj_incref(entry);
+			git_atomic_set(&entry->referenced, 1);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	git_rwlock_rdunlock(&shard->lock);
+
+	git_atomic_ssize_add(entry ?
+		&git_cache__stats[shard_pos].hits :
+		&git_cache__stats[shard_pos].misses, 1);
 
 	return entry;
 }
@@ -175,42 +382,81 @@ static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
 	khiter_t pos;
+	size_t shard_pos = cache_shard_pos(&entry->oid);
+	git_cache_shard *shard = &cache->shards[shard_pos];
+	git_otype type = entry->type;
+	ssize_t size = (ssize_t)entry->size;
+	bool made_room = false;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
-		git_cache_clear(cache);
+	if (!git_cache__enabled) {
+		ssize_t used = 0;
+
+		/* drop what was cached before the cache got disabled */
+		if (git_rwlock_rdlock(&shard->lock) == 0) {
+			used = shard->used_memory;
+			git_rwlock_rdunlock(&shard->lock);
+		}
+
+		if (used > 0)
+			git_cache_clear(cache);
+
 		return entry;
 	}
 
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+retry:
+	if (git_rwlock_wrlock(&shard->lock) < 0)
 		return entry;
 
-	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
-
-	pos = kh_get(oid, cache->map, &entry->oid);
+	pos = kh_get(oid, shard->map, &entry->oid);
 
 	/* not found */
-	if (pos == kh_end(cache->map)) {
+	if (pos == kh_end(shard->map)) {
+		git_cache_ring *ring = &shard->rings[type];
+		git_oid *id;
 		int rval;
 
-		pos = kh_put(oid, cache->map, &entry->oid, &rval);
+		/*
+		 * The budgets are shared by every shard; make room across all
+		 * of them once, and leave the object out if the memory is held
+		 * by other caches.
+		 */
+		if (cache_over_type_budget(type, size) || cache_over_budget(size)) {
+			if (made_room)
+				goto done;
+
+			git_rwlock_wrunlock(&shard->lock);
+			cache_make_room(cache, shard_pos, type, size);
+			made_room = true;
+			goto retry;
+		}
+
+		if ((id = git_array_alloc(ring->ids)) == NULL)
+			goto done;
+
+		pos = kh_put(oid, shard->map, &entry->oid, &rval);
 		if (rval >= 0) {
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
-			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+			git_atomic_set(&entry->referenced, 0);
+			git_oid_cpy(id, &entry->oid);
+
+			ring->used_memory += size;
+			shard->used_memory += size;
+			git_atomic_ssize_add(&git_cache__current_type_storage[type], size);
+			git_atomic_ssize_add(&git_cache__current_storage, size);
+		} else {
+			git_array_pop(ring->ids);
 		}
 	}
 	/* found */
 	else {
-		git_cached_obj *stored_entry = kh_val(cache->map, pos);
+		git_cached_obj *stored_entry = kh_val(shard->map, pos);
 
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
@@ -218,17 +464,20 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			entry->flags == GIT_CACHE_STORE_PARSED) {
+			git_atomic_set(&entry->referenced,
+				git_atomic_get(&stored_entry->referenced));
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
 
-			kh_key(cache->map, pos) = &entry->oid;
-			kh_val(cache->map, pos) = entry;
+			kh_key(shard->map, pos) = &entry->oid;
+			kh_val(shard->map, pos) = entry;
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+done:
+	git_rwlock_wrunlock(&shard->lock);
 	return entry;
 }
 
@@ -13,6 +13,7 @@
 
 #include "thread-utils.h"
 #include "oidmap.h"
+#include "array.h"
 
 enum {
 	GIT_CACHE_STORE_ANY = 0,
@@ -26,19 +27,60 @@ typedef struct {
 	uint16_t   flags; /* GIT_CACHE_STORE value */
 	size_t     size;
 	git_atomic refcount;
+	git_atomic referenced; /* looked up since the clock hand last passed */
 } git_cached_obj;
 
+/*
+ * The cache is split in shards, picked by the last byte of the object
+ * id, so that threads looking up different objects do not all contend
+ * on the same lock.
+ */
+#define GIT_CACHE_SHARDS 32
+
+/* One slot for every git_otype value */
+#define GIT_CACHE_OTYPES 8
+
+/*
+ * Objects are evicted with the CLOCK algorithm: the ids of the cached
+ * objects of each type are kept in a ring, and the hand sweeps over it
+ * evicting the first object that has not been looked up since the last
+ * time the hand passed over it.
+ */
+typedef struct {
+	git_array_t(git_oid) ids;
+	size_t  hand;
+	ssize_t used_memory;
+} git_cache_ring;
+
 typedef struct {
 	git_oidmap *map;
 	git_rwlock  lock;
 	ssize_t     used_memory;
+	git_cache_ring rings[GIT_CACHE_OTYPES];
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
 } git_cache;
 
+typedef struct {
+	git_atomic_ssize hits;
+	git_atomic_ssize misses;
+	git_atomic_ssize evictions;
+} git_cache_stats;
+
 extern bool git_cache__enabled;
 extern ssize_t git_cache__max_storage;
 extern git_atomic_ssize git_cache__current_storage;
 
+/* Per-shard counters, shared by every cache */
+extern git_cache_stats git_cache__stats[GIT_CACHE_SHARDS];
+
 int git_cache_set_max_object_size(git_otype type, size_t size);
+int git_cache_set_max_type_storage(git_otype type, ssize_t size);
+int git_cache_type_storage(ssize_t *current, ssize_t *allowed, git_otype type);
+int git_cache_shard_stats(
+	size_t *hits, size_t *misses, size_t *evictions, size_t shard);
 
 int git_cache_init(git_cache *cache);
 void git_cache_free(git_cache *cache);
@@ -53,7 +95,12 @@ void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
 GIT_INLINE(size_t) git_cache_size(git_cache *cache)
 {
-	return (size_t)kh_size(cache->map);
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++)
+		size += (size_t)kh_size(cache->shards[i].map);
+
+	return size;
 }
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
@@ -22,9 +22,11 @@
 
 #include "refs.h"
 #include "repository.h"
+#include "config.h"
 #include "index.h"
 #include "filter.h"
 #include "blob.h"
+#include "object.h"
 #include "diff.h"
 #include "pathspec.h"
 #include "buf_text.h"
@@ -77,6 +79,8 @@ typedef struct {
 	git_checkout_perfdata perfdata;
 	git_strmap *mkdir_map;
 	git_attr_session attr_session;
+	size_t workers;
+	size_t parallel_threshold;
 } checkout_data;
 
 typedef struct {
@@ -1447,30 +1451,25 @@ static void checkout_stream_free(git_writestream *s)
 	GIT_UNUSED(s);
 }
 
-static int blob_content_to_file(
+/* Write the filtered content of the blob to a file whose directory
+ * exists.  This only reads `data`, so that checkout workers can call it.
+ */
+static int blob_content_to_filtered_file(
 	checkout_data *data,
 	struct stat *st,
 	git_blob *blob,
+	git_filter_list *fl,
 	const char *path,
-	const char *hint_path,
 	mode_t entry_filemode)
 {
 	int flags = data->opts.file_open_flags;
 	mode_t file_mode = data->opts.file_mode ?
 		data->opts.file_mode : entry_filemode;
-	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
 	struct checkout_stream writer;
 	mode_t mode;
-	git_filter_list *fl = NULL;
 	int fd;
 	int error = 0;
 
-	if (hint_path == NULL)
-		hint_path = path;
-
-	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
-		return error;
-
 	if (flags <= 0)
 		flags = O_CREAT | O_TRUNC | O_WRONLY;
 	if (!(mode = file_mode))
@@ -1481,17 +1480,6 @@ static int blob_content_to_file(
 		return fd;
 	}
 
-	filter_opts.attr_session = &data->attr_session;
-	filter_opts.temp_buf = &data->tmp;
-
-	if (!data->opts.disable_filters &&
-		(error = git_filter_list__load_ext(
-			&fl, data->repo, blob, hint_path,
-			GIT_FILTER_TO_WORKTREE, &filter_opts))) {
-		p_close(fd);
-		return error;
-	}
-
 	/* setup the writer */
 	memset(&writer, 0, sizeof(struct checkout_stream));
 	writer.base.write = checkout_stream_write;
@@ -1505,14 +1493,10 @@ static int blob_content_to_file(
 
 	assert(writer.open == 0);
 
-	git_filter_list_free(fl);
-
 	if (error < 0)
 		return error;
 
 	if (st) {
-		data->perfdata.stat_calls++;
-
 		if ((error = p_stat(path, st)) < 0) {
 			giterr_set(GITERR_OS, "Error statting '%s'", path);
 			return error;
@@ -1524,6 +1508,44 @@ static int blob_content_to_file(
 	return 0;
 }
 
+static int blob_content_to_file(
+	checkout_data *data,
+	struct stat *st,
+	git_blob *blob,
+	const char *path,
+	const char *hint_path,
+	mode_t entry_filemode)
+{
+	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
+	git_filter_list *fl = NULL;
+	int error = 0;
+
+	if (hint_path == NULL)
+		hint_path = path;
+
+	if ((error = mkpath2file(data, path, data->opts.dir_mode)) < 0)
+		return error;
+
+	filter_opts.attr_session = &data->attr_session;
+	filter_opts.temp_buf = &data->tmp;
+
+	if (!data->opts.disable_filters &&
+		(error = git_filter_list__load_ext(
+			&fl, data->repo, blob, hint_path,
+			GIT_FILTER_TO_WORKTREE, &filter_opts)))
+		return error;
+
+	if (st)
+		data->perfdata.stat_calls++;
+
+	error = blob_content_to_filtered_file(
+		data, st, blob, fl, path, entry_filemode);
+
+	git_filter_list_free(fl);
+
+	return error;
+}
+
 static int blob_content_to_link(
 	checkout_data *data,
 	struct stat *st,
@@ -1679,27 +1701,21 @@ static int checkout_safe_for_update_only(
 	return 0;
 }
 
-static int checkout_write_content(
+static int checkout_write_blob(
 	checkout_data *data,
-	const git_oid *oid,
+	git_blob *blob,
 	const char *full_path,
 	const char *hint_path,
 	unsigned int mode,
 	struct stat *st)
 {
 	int error = 0;
-	git_blob *blob;
-
-	if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
-		return error;
 
 	if (S_ISLNK(mode))
 		error = blob_content_to_link(data, st, blob, full_path);
 	else
 		error = blob_content_to_file(data, st, blob, full_path, hint_path, mode);
 
-	git_blob_free(blob);
-
 	/* if we try to create the blob and an existing directory blocks it from
 	 * being written, then there must have been a typechange conflict in a
 	 * parent directory - suppress the error and try to continue.
@@ -1714,9 +1730,32 @@ static int checkout_write_content(
 	return error;
 }
 
+static int checkout_write_content(
+	checkout_data *data,
+	const git_oid *oid,
+	const char *full_path,
+	const char *hint_path,
+	unsigned int mode,
+	struct stat *st)
+{
+	int error = 0;
+	git_blob *blob;
+
+	if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
+		return error;
+
+	error = checkout_write_blob(data, blob, full_path, hint_path, mode, st);
+
+	git_blob_free(blob);
+
+	return error;
+}
+
+/* Check out the file, with its blob when it has already been read */
 static int checkout_blob(
 	checkout_data *data,
-	const git_diff_file *file)
+	const git_diff_file *file,
+	git_blob *blob)
 {
 	int error = 0;
 	struct stat st;
@@ -1732,8 +1771,12 @@ static int checkout_blob(
 			return rval;
 	}
 
-	error = checkout_write_content(
-		data, &file->id, git_buf_cstr(&data->path), NULL, file->mode, &st);
+	if (blob)
+		error = checkout_write_blob(
+			data, blob, git_buf_cstr(&data->path), NULL, file->mode, &st);
+	else
+		error = checkout_write_content(
+			data, &file->id, git_buf_cstr(&data->path), NULL, file->mode, &st);
 
 	/* update the index unless prevented */
 	if (!error && (data->strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX) == 0)
@@ -1822,6 +1865,392 @@ static int checkout_deferred_remove(git_repository *repo, const char *path)
 #endif
 }
 
+#ifdef GIT_THREADS
+
+/* A file to write; see `checkout_create_the_new_parallel` */
+typedef struct {
+	const git_diff_file *file;
+	const char *path;
+	git_filter_list *filters;
+	struct stat st;
+	int local; /* written (and added to the index) by the calling thread */
+	int done;
+	int error;
+	git_error_state error_state;
+} checkout_job;
+
+typedef struct {
+	checkout_data *data;
+	checkout_job *jobs;
+	size_t prepared; /* jobs whose directory exists */
+	size_t taken;
+	bool finished; /* no more jobs will be prepared */
+	bool cancelled;
+	git_mutex lock;
+	git_cond work;
+	git_cond done;
+	git_thread *threads;
+	size_t nthreads;
+} checkout_workers;
+
+/* Create the directory of the file and load its filters; returns 1 when
+ * the file is left to the calling thread: symlinks, files that need a
+ * filter other than the built-in ones (which may not be thread-safe) and
+ * the cases that `checkout_blob` already knows how to deal with.
+ */
+static int checkout_job_prepare(
+	checkout_data *data, checkout_job *job, const git_diff_file *file)
+{
+	git_filter_options filter_opts = GIT_FILTER_OPTIONS_INIT;
+	size_t builtin;
+	int error;
+
+	job->file = file;
+
+	git_buf_truncate(&data->path, data->workdir_len);
+	if (git_buf_puts(&data->path, file->path) < 0 ||
+		(job->path = git_pool_strdup(&data->pool, data->path.ptr)) == NULL)
+		return -1;
+
+	if (S_ISLNK(file->mode) ||
+		(data->strategy & GIT_CHECKOUT_UPDATE_ONLY) != 0)
+		return 1;
+
+	if ((error = mkpath2file(data, job->path, data->opts.dir_mode)) < 0) {
+		if ((data->strategy & GIT_CHECKOUT_ALLOW_CONFLICTS) != 0 &&
+			(error == GIT_ENOTFOUND || error == GIT_EEXISTS)) {
+			giterr_clear();
+			return 1;
+		}
+
+		return error;
+	}
+
+	/* the blob is read by the worker, which gives the filters its id
+	 * when they are applied; the streams get their own buffers
+	 */
+	filter_opts.attr_session = &data->attr_session;
+
+	if (!data->opts.disable_filters &&
+		(error = git_filter_list__load_ext(
+			&job->filters, data->repo, NULL, job->path,
+			GIT_FILTER_TO_WORKTREE, &filter_opts)) < 0)
+		return error;
+
+	builtin = git_filter_list_contains(job->filters, GIT_FILTER_CRLF) +
+		git_filter_list_contains(job->filters, GIT_FILTER_IDENT);
+
+	if (git_filter_list_length(job->filters) > builtin) {
+		git_filter_list_free(job->filters);
+		job->filters = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int checkout_job_write(checkout_data *data, checkout_job *job)
+{
+	git_blob *blob;
+	int error;
+
+	if ((error = git_blob_lookup(&blob, data->repo, &job->file->id)) == 0) {
+		error = blob_content_to_filtered_file(data,
+			&job->st, blob, job->filters, job->path, job->file->mode);
+		git_blob_free(blob);
+	}
+
+	/* see checkout_write_content */
+	if ((data->strategy & GIT_CHECKOUT_ALLOW_CONFLICTS) != 0 &&
+		(error == GIT_ENOTFOUND || error == GIT_EEXISTS))
+	{
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static void *checkout_worker(void *payload)
+{
+	checkout_workers *workers = payload;
+	checkout_job *job;
+	int error;
+
+	git_mutex_lock(&workers->lock);
+
+	while (!workers->cancelled) {
+		if (workers->taken == workers->prepared) {
+			if (workers->finished)
+				break;
+
+			git_cond_wait(&workers->work, &workers->lock);
+			continue;
+		}
+
+		job = &workers->jobs[workers->taken++];
+
+		if (job->local)
+			continue;
+
+		git_mutex_unlock(&workers->lock);
+
+		if ((error = checkout_job_write(workers->data, job)) < 0)
+			giterr_state_capture(&job->error_state, error);
+
+		git_mutex_lock(&workers->lock);
+
+		job->error = error;
+		job->done = 1;
+
+		if (error < 0)
+			workers->cancelled = true;
+
+		git_cond_broadcast(&workers->done);
+	}
+
+	git_mutex_unlock(&workers->lock);
+
+	return NULL;
+}
+
+static int checkout_workers_start(
+	checkout_workers *workers, checkout_data *data, size_t count)
+{
+	memset(workers, 0, sizeof(checkout_workers));
+	workers->data = data;
+
+	workers->jobs = git__calloc(count, sizeof(checkout_job));
+	GITERR_CHECK_ALLOC(workers->jobs);
+
+	workers->threads = git__calloc(data->workers, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(workers->threads);
+
+	if (git_mutex_init(&workers->lock) < 0 ||
+		git_cond_init(&workers->work) < 0 ||
+		git_cond_init(&workers->done) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize checkout mutex");
+		git__free(workers->threads);
+		workers->threads = NULL;
+		return -1;
+	}
+
+	for (; workers->nthreads < data->workers; workers->nthreads++) {
+		if (git_thread_create(&workers->threads[workers->nthreads],
+				NULL, checkout_worker, workers) != 0) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void checkout_workers_stop(checkout_workers *workers, size_t count)
+{
+	size_t i;
+
+	if (workers->threads) {
+		git_mutex_lock(&workers->lock);
+		workers->cancelled = true;
+		git_cond_broadcast(&workers->work);
+		git_mutex_unlock(&workers->lock);
+	}
+
+	for (i = 0; i < workers->nthreads; i++)
+		git_thread_join(&workers->threads[i], NULL);
+
+	for (i = 0; workers->jobs && i < count; i++) {
+		git_filter_list_free(workers->jobs[i].filters);
+		giterr_state_free(&workers->jobs[i].error_state);
+	}
+
+	if (workers->threads) {
+		git_cond_free(&workers->done);
+		git_cond_free(&workers->work);
+		git_mutex_free(&workers->lock);
+	}
+
+	git__free(workers->threads);
+	git__free(workers->jobs);
+}
+
+/*
+ * Write the new blobs from several threads.  This thread creates the
+ * directories, in the same order as a serial checkout, so that none of
+ * them is made twice or raced with, and loads the filters (which looks
+ * up attributes) before handing each file to the workers, which read,
+ * filter and write it.  The index and the progress are then updated here
+ * in the order of the deltas.
+ */
+static int checkout_create_the_new_parallel(
+	unsigned int *actions,
+	checkout_data *data,
+	size_t count)
+{
+	checkout_workers workers;
+	checkout_job *job;
+	git_diff_delta *delta;
+	size_t i, n = 0;
+	int error;
+
+	if ((error = checkout_workers_start(&workers, data, count)) < 0)
+		goto done;
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
+			if ((error = checkout_deferred_remove(
+					data->repo, delta->old_file.path)) < 0)
+				goto done;
+		}
+
+		if ((actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) == 0)
+			continue;
+
+		assert(n < count);
+		job = &workers.jobs[n];
+
+		if ((error = checkout_job_prepare(data, job, &delta->new_file)) < 0)
+			goto done;
+
+		if (error > 0) {
+			if ((error = checkout_blob(data, &delta->new_file, NULL)) < 0)
+				goto done;
+
+			job->local = job->done = 1;
+		}
+
+		git_mutex_lock(&workers.lock);
+		workers.prepared = ++n;
+		git_cond_signal(&workers.work);
+		git_mutex_unlock(&workers.lock);
+	}
+
+	git_mutex_lock(&workers.lock);
+	workers.finished = true;
+	git_cond_broadcast(&workers.work);
+	git_mutex_unlock(&workers.lock);
+
+	for (i = 0; i < n; i++) {
+		job = &workers.jobs[i];
+
+		git_mutex_lock(&workers.lock);
+		while (!job->done)
+			git_cond_wait(&workers.done, &workers.lock);
+		git_mutex_unlock(&workers.lock);
+
+		if (job->error < 0) {
+			giterr_state_restore(&job->error_state);
+			error = job->error;
+			goto done;
+		}
+
+		git_filter_list_free(job->filters);
+		job->filters = NULL;
+
+		if (!job->local) {
+			data->perfdata.stat_calls++;
+
+			if ((data->strategy & GIT_CHECKOUT_DONT_UPDATE_INDEX) == 0 &&
+				(error = checkout_update_index(data, job->file, &job->st)) < 0)
+				goto done;
+
+			if (strcmp(job->file->path, ".gitmodules") == 0)
+				data->reload_submodules = true;
+		}
+
+		data->completed_steps++;
+		report_progress(data, job->file->path);
+	}
+
+done:
+	checkout_workers_stop(&workers, count);
+	return error;
+}
+
+#endif
+
+typedef struct {
+	checkout_data *data;
+	git_diff_delta **deltas;
+} checkout_read_many_payload;
+
+static int checkout_create_read_blob(
+	git_odb_object *object, size_t position, void *payload)
+{
+	checkout_read_many_payload *p = payload;
+	git_diff_delta *delta = p->deltas[position];
+	git_object *blob;
+	int error;
+
+	if ((error = git_object__from_odb_object(
+			&blob, p->data->repo, object, GIT_OBJ_BLOB)) < 0)
+		return error;
+
+	error = checkout_blob(p->data, &delta->new_file, (git_blob *)blob);
+	git_blob_free((git_blob *)blob);
+
+	if (error < 0)
+		return error;
+
+	p->data->completed_steps++;
+	report_progress(p->data, delta->new_file.path);
+
+	return 0;
+}
+
+/* Write the files in the order their blobs are stored in, so that the
+ * packfiles are read from front to back and deltas find their bases in
+ * the cache
+ */
+static int checkout_create_the_new_in_storage_order(
+	unsigned int *actions,
+	checkout_data *data,
+	size_t count)
+{
+	checkout_read_many_payload payload;
+	git_diff_delta *delta;
+	git_oid *ids;
+	git_odb *odb;
+	size_t i, n = 0;
+	int error = 0;
+
+	if ((error = git_repository_odb__weakptr(&odb, data->repo)) < 0)
+		return error;
+
+	ids = git__calloc(count, sizeof(git_oid));
+	payload.data = data;
+	payload.deltas = git__calloc(count, sizeof(git_diff_delta *));
+
+	if (!ids || !payload.deltas) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
+			/* this had a blocker directory that should only be removed iff
+			 * all of the contents of the directory were safely removed
+			 */
+			if ((error = checkout_deferred_remove(
+					data->repo, delta->old_file.path)) < 0)
+				goto done;
+		}
+
+		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) {
+			git_oid_cpy(&ids[n], &delta->new_file.id);
+			payload.deltas[n++] = delta;
+		}
+	}
+
+	error = git_odb_read_many(odb, ids, n, checkout_create_read_blob, &payload);
+
+done:
+	git__free(payload.deltas);
+	git__free(ids);
+	return error;
+}
+
 static int checkout_create_the_new(
 	unsigned int *actions,
 	checkout_data *data)
@@ -1830,6 +2259,28 @@ static int checkout_create_the_new(
 	git_diff_delta *delta;
 	size_t i;
 
+	/* on case insensitive filesystems, writing a file may remove another
+	 * one that folds to the same name, which must happen in order
+	 */
+	if (!should_remove_existing(data)) {
+		size_t count = 0;
+
+		for (i = 0; i < data->diff->deltas.length; i++) {
+			if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB)
+				count++;
+		}
+
+#ifdef GIT_THREADS
+		if (data->workers > 1 &&
+			count > 1 && count >= data->parallel_threshold)
+			return checkout_create_the_new_parallel(actions, data, count);
+#endif
+
+		if (count > 1)
+			return checkout_create_the_new_in_storage_order(
+				actions, data, count);
+	}
+
 	git_vector_foreach(&data->diff->deltas, i, delta) {
 		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
 			/* this had a blocker directory that should only be removed iff
@@ -1841,7 +2292,7 @@ static int checkout_create_the_new(
 		}
 
 		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) {
-			error = checkout_blob(data, &delta->new_file);
+			error = checkout_blob(data, &delta->new_file, NULL);
 			if (error < 0)
 				return error;
 
@@ -2275,6 +2726,38 @@ done:
 	return error;
 }
 
+#define CHECKOUT_PARALLEL_THRESHOLD 100
+
+/* The number of threads writing files, as `git_checkout_options` and
+ * core git's `checkout.workers` and `checkout.thresholdForParallelism`
+ * ask for.
+ */
+static int checkout_workers_config(checkout_data *data)
+{
+#ifdef GIT_THREADS
+	git_config *cfg;
+	int workers = data->opts.workers, threshold;
+	int error;
+
+	if ((error = git_repository_config__weakptr(&cfg, data->repo)) < 0)
+		return error;
+
+	if (!workers && (workers = git_config__get_int_force(
+			cfg, "checkout.workers", 1)) < 1)
+		workers = -1;
+
+	threshold = git_config__get_int_force(
+		cfg, "checkout.thresholdforparallelism", CHECKOUT_PARALLEL_THRESHOLD);
+
+	data->workers = (workers < 0) ? (size_t)git_online_cpus() : (size_t)workers;
+	data->parallel_threshold = (threshold < 0) ? 0 : (size_t)threshold;
+#else
+	data->workers = 1;
+#endif
+
+	return 0;
+}
+
 static void checkout_data_clear(checkout_data *data)
 {
 	if (data->opts_free_baseline) {
@@ -2456,6 +2939,8 @@ static int checkout_data_init(
 
 	git_attr_session__init(&data->attr_session, data->repo);
 
+	error = checkout_workers_config(data);
+
 cleanup:
 	if (error < 0)
 		checkout_data_clear(data);
@@ -19,6 +19,8 @@
 #include "refs.h"
 #include "object.h"
 #include "oidarray.h"
+#include "thread-utils.h"
+#include "shallow.h"
 
 void git_commit__free(void *_commit)
 {
@@ -35,6 +37,7 @@ void git_commit__free(void *_commit)
 	git__free(commit->summary);
 	git__free(commit->body);
 
+	git_odb_object_free(commit->odb_obj);
 	git__free(commit);
 }
 
@@ -379,15 +382,23 @@ int git_commit_amend(
 	return error;
 }
 
+/*
+ * Only the tree, the parents and the commit time are read here, which
+ * is all that history walks need; the signatures, the encoding, the
+ * header and the message are checked but left in the object data.
+ */
 int git_commit__parse(void *_commit, git_odb_object *odb_obj)
 {
 	git_commit *commit = _commit;
-	const char *buffer_start = git_odb_object_data(odb_obj), *buffer;
-	const char *buffer_end = buffer_start + git_odb_object_size(odb_obj);
+	const char *buffer_start, *buffer_end, *buffer;
 	git_oid parent_id;
-	size_t header_len;
-	git_signature dummy_sig;
+	git_time dummy_time;
 
+	if (git_odb_object_dup(&commit->odb_obj, odb_obj) < 0)
+		return -1;
+
+	buffer_start = git_odb_object_data(commit->odb_obj);
+	buffer_end = buffer_start + git_odb_object_size(commit->odb_obj);
 	buffer = buffer_start;
 
 	/* Allocate for one, which will allow not to realloc 90% of the time  */
@@ -398,10 +409,6 @@ int git_commit__parse(void *_commit, git_odb_object *odb_obj)
 	if (git_oid__parse(&commit->tree_id, &buffer, buffer_end, "tree ") < 0)
 		goto bad_buffer;
 
-	/*
-	 * TODO: commit grafts!
-	 */
-
 	while (git_oid__parse(&parent_id, &buffer, buffer_end, "parent ") == 0) {
 		git_oid *new_id = git_array_alloc(commit->parent_ids);
 		GITERR_CHECK_ALLOC(new_id);
@@ -409,26 +416,32 @@ int git_commit__parse(void *_commit, git_odb_object *odb_obj)
 		git_oid_cpy(new_id, &parent_id);
 	}
 
-	commit->author = git__malloc(sizeof(git_signature));
-	GITERR_CHECK_ALLOC(commit->author);
+	/* The parents of the boundary commits of a shallow repository aren't there */
+	if (git_array_size(commit->parent_ids) && commit->object.repo) {
+		bool root;
+
+		if (git_shallow__is_root(&root, commit->object.repo, &commit->object.cached.oid) < 0)
+			return -1;
+
+		if (root)
+			commit->parent_ids.size = 0;
+	}
+
+	commit->author_offset = buffer - buffer_start;
 
-	if (git_signature__parse(commit->author, &buffer, buffer_end, "author ", '\n') < 0)
+	if (git_signature__parse_time(&dummy_time, &buffer, buffer_end, "author ", '\n') < 0)
 		return -1;
 
 	/* Some tools create multiple author fields, ignore the extra ones */
 	while ((size_t)(buffer_end - buffer) >= strlen("author ") && !git__prefixcmp(buffer, "author ")) {
-		if (git_signature__parse(&dummy_sig, &buffer, buffer_end, "author ", '\n') < 0)
+		if (git_signature__parse_time(&dummy_time, &buffer, buffer_end, "author ", '\n') < 0)
 			return -1;
-
-		git__free(dummy_sig.name);
-		git__free(dummy_sig.email);
 	}
 
 	/* Always parse the committer; we need the commit time */
-	commit->committer = git__malloc(sizeof(git_signature));
-	GITERR_CHECK_ALLOC(commit->committer);
+	commit->committer_offset = buffer - buffer_start;
 
-	if (git_signature__parse(commit->committer, &buffer, buffer_end, "committer ", '\n') < 0)
+	if (git_signature__parse_time(&commit->commit_time, &buffer, buffer_end, "committer ", '\n') < 0)
 		return -1;
 
 	/* Parse add'l header entries */
@@ -443,8 +456,8 @@ int git_commit__parse(void *_commit, git_odb_object *odb_obj)
 		if (git__prefixcmp(buffer, "encoding ") == 0) {
 			buffer += strlen("encoding ");
 
-			commit->message_encoding = git__strndup(buffer, eoln - buffer);
-			GITERR_CHECK_ALLOC(commit->message_encoding);
+			commit->encoding_offset = buffer - buffer_start;
+			commit->encoding_len = eoln - buffer;
 		}
 
 		if (eoln < buffer_end && *eoln == '\n')
@@ -452,18 +465,10 @@ int git_commit__parse(void *_commit, git_odb_object *odb_obj)
 		buffer = eoln;
 	}
 
-	header_len = buffer - buffer_start;
-	commit->raw_header = git__strndup(buffer_start, header_len);
-	GITERR_CHECK_ALLOC(commit->raw_header);
+	commit->header_len = buffer - buffer_start;
 
-	/* point "buffer" to data after header, +1 for the final LF */
-	buffer = buffer_start + header_len + 1;
-
-	/* extract commit message */
-	if (buffer <= buffer_end) {
-		commit->raw_message = git__strndup(buffer, buffer_end - buffer);
-		GITERR_CHECK_ALLOC(commit->raw_message);
-	}
+	/* the message starts after the header, +1 for the final LF */
+	commit->message_offset = commit->header_len + 1;
 
 	return 0;
 
@@ -472,6 +477,57 @@ bad_buffer:
 	return -1;
 }
 
+/*
+ * The lazily parsed fields are filled in the first time they are asked
+ * for; a commit may be shared by threads through the object cache, so
+ * only the first copy to be made is kept.
+ */
+static const char *commit_lazy_string(
+	char **field, const git_commit *commit, size_t offset, size_t len)
+{
+	const char *data = git_odb_object_data(commit->odb_obj);
+	char *str;
+
+	if (*field != NULL)
+		return *field;
+
+	if ((str = git__strndup(data + offset, len)) == NULL)
+		return NULL;
+
+	if ((str = git__compare_and_swap(field, NULL, str)) != NULL)
+		git__free(str);
+
+	return *field;
+}
+
+static const git_signature *commit_lazy_signature(
+	git_signature **field, const git_commit *commit,
+	size_t offset, const char *header)
+{
+	const char *buffer = git_odb_object_data(commit->odb_obj);
+	const char *buffer_end = buffer + git_odb_object_size(commit->odb_obj);
+	git_signature *sig;
+
+	if (*field != NULL)
+		return *field;
+
+	if ((sig = git__malloc(sizeof(git_signature))) == NULL)
+		return NULL;
+
+	buffer += offset;
+
+	/* this was checked when the commit was parsed */
+	if (git_signature__parse(sig, &buffer, buffer_end, header, '\n') < 0) {
+		git_signature_free(sig);
+		return NULL;
+	}
+
+	if ((sig = git__compare_and_swap(field, NULL, sig)) != NULL)
+		git_signature_free(sig);
+
+	return *field;
+}
+
 #define GIT_COMMIT_GETTER(_rvalue, _name, _return) \
 	_rvalue git_commit_##_name(const git_commit *commit) \
 	{\
@@ -479,23 +535,72 @@ bad_buffer:
 		return _return; \
 	}
 
-GIT_COMMIT_GETTER(const git_signature *, author, commit->author)
-GIT_COMMIT_GETTER(const git_signature *, committer, commit->committer)
-GIT_COMMIT_GETTER(const char *, message_raw, commit->raw_message)
-GIT_COMMIT_GETTER(const char *, message_encoding, commit->message_encoding)
-GIT_COMMIT_GETTER(const char *, raw_header, commit->raw_header)
-GIT_COMMIT_GETTER(git_time_t, time, commit->committer->when.time)
-GIT_COMMIT_GETTER(int, time_offset, commit->committer->when.offset)
+GIT_COMMIT_GETTER(git_time_t, time, commit->commit_time.time)
+GIT_COMMIT_GETTER(int, time_offset, commit->commit_time.offset)
 GIT_COMMIT_GETTER(unsigned int, parentcount, (unsigned int)git_array_size(commit->parent_ids))
 GIT_COMMIT_GETTER(const git_oid *, tree_id, &commit->tree_id)
 
+const git_signature *git_commit_author(const git_commit *commit)
+{
+	assert(commit);
+
+	return commit_lazy_signature((git_signature **)&commit->author,
+		commit, commit->author_offset, "author ");
+}
+
+const git_signature *git_commit_committer(const git_commit *commit)
+{
+	assert(commit);
+
+	return commit_lazy_signature((git_signature **)&commit->committer,
+		commit, commit->committer_offset, "committer ");
+}
+
+const char *git_commit_message_raw(const git_commit *commit)
+{
+	size_t size;
+
+	assert(commit);
+
+	if (commit->raw_message != NULL)
+		return commit->raw_message;
+
+	size = git_odb_object_size(commit->odb_obj);
+
+	if (commit->message_offset > size)
+		return NULL;
+
+	return commit_lazy_string((char **)&commit->raw_message, commit,
+		commit->message_offset, size - commit->message_offset);
+}
+
+const char *git_commit_message_encoding(const git_commit *commit)
+{
+	assert(commit);
+
+	if (!commit->encoding_offset)
+		return NULL;
+
+	return commit_lazy_string((char **)&commit->message_encoding, commit,
+		commit->encoding_offset, commit->encoding_len);
+}
+
+const char *git_commit_raw_header(const git_commit *commit)
+{
+	assert(commit);
+
+	return commit_lazy_string((char **)&commit->raw_header, commit,
+		0, commit->header_len);
+}
+
 const char *git_commit_message(const git_commit *commit)
 {
 	const char *message;
 
 	assert(commit);
 
-	message = commit->raw_message;
+	if ((message = git_commit_message_raw(commit)) == NULL)
+		return NULL;
 
 	/* trim leading newlines from raw message */
 	while (*message && *message == '\n')
@@ -640,10 +745,13 @@ int git_commit_nth_gen_ancestor(
 
 int git_commit_header_field(git_buf *out, const git_commit *commit, const char *field)
 {
-	const char *eol, *buf = commit->raw_header;
+	const char *eol, *buf = git_commit_raw_header(commit);
 
 	git_buf_sanitize(out);
 
+	if (buf == NULL)
+		return -1;
+
 	while ((eol = strchr(buf, '\n'))) {
 		/* We can skip continuations here */
 		if (buf[0] == ' ') {
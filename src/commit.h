@@ -19,6 +19,19 @@ struct git_commit {
 
 	git_array_t(git_oid) parent_ids;
 	git_oid tree_id;
+	git_time commit_time;
+
+	/*
+	 * The raw object, and where its other fields are in it: these are
+	 * only copied out of it the first time they are asked for.
+	 */
+	git_odb_object *odb_obj;
+	size_t author_offset;
+	size_t committer_offset;
+	size_t encoding_offset; /* 0 if there is none */
+	size_t encoding_len;
+	size_t header_len;
+	size_t message_offset; /* past the end if there is no message */
 
 	git_signature *author;
 	git_signature *committer;
@@ -0,0 +1,879 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "oid.h"
+#include "oidarray.h"
+#include "revwalk.h"
+#include "sha1_lookup.h"
+
+#include "git2/revwalk.h"
+
+#define GIT_COMMIT_GRAPH_MISSING_PARENT_MASK 0x80000000u
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+
+#define COMMIT_GRAPH_CHUNK_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+#define COMMIT_GRAPH_COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 4 * sizeof(uint32_t))
+
+typedef struct {
+	size_t offset;
+	size_t length;
+} commit_graph_chunk;
+
+static int commit_graph_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid commit-graph file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ntohl(*((const uint32_t *)p));
+}
+
+static int commit_graph_parse_oid_fanout(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	commit_graph_chunk *chunk)
+{
+	uint32_t i, nr;
+
+	if (chunk->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	commit_graph_chunk *chunk)
+{
+	uint32_t i;
+	git_oid *oid, *prev_oid;
+
+	if (chunk->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk->length == 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (chunk->length != (size_t)file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (git_oid *)(data + chunk->offset);
+	prev_oid = NULL;
+	for (i = 0; i < file->num_commits; ++i, ++oid) {
+		if (prev_oid && git_oid__cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	commit_graph_chunk *chunk)
+{
+	if (chunk->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk->length == 0)
+		return commit_graph_error("empty Commit Data chunk");
+	if (chunk->length != (size_t)file->num_commits * COMMIT_GRAPH_COMMIT_DATA_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+	git_commit_graph_file *file,
+	const unsigned char *data,
+	commit_graph_chunk *chunk)
+{
+	if (chunk->length == 0)
+		return 0;
+	if (chunk->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = data + chunk->offset;
+	file->num_extra_edge_list = chunk->length / 4;
+
+	return 0;
+}
+
+int git_commit_graph_parse(
+	git_commit_graph_file *file, const unsigned char *data, size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	commit_graph_chunk *last_chunk;
+	uint32_t i;
+	uint64_t last_chunk_offset, chunk_offset, trailer_offset;
+	commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+		chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+		chunk_unsupported = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+		hdr->version != COMMIT_GRAPH_VERSION ||
+		hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION)
+		return commit_graph_error("unsupported commit-graph version");
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+	if (hdr->base_graph_files != 0)
+		return commit_graph_error("split commit-graphs are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_commit_graph_header) +
+		(1 + hdr->chunks) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+	git_oid_fromraw(&file->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += COMMIT_GRAPH_CHUNK_ENTRY_SIZE) {
+		chunk_offset = ((uint64_t)get_be32(chunk_hdr + 4)) << 32 |
+			get_be32(chunk_hdr + 8);
+
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (get_be32(chunk_hdr)) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		default:
+			/* Bloom filters and future chunks are skipped */
+			chunk_unsupported.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if (commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout) < 0 ||
+		commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup) < 0 ||
+		commit_graph_parse_commit_data(file, data, &chunk_commit_data) < 0 ||
+		commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list) < 0)
+		return -1;
+
+	return 0;
+}
+
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "Unable to stat commit-graph '%s'", path);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "Invalid commit-graph file '%s'", path);
+		return -1;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+	file->filename = git__strdup(path);
+	GITERR_CHECK_ALLOC(file->filename);
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_parse(
+			file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_file_free(file);
+		return error;
+	}
+
+	GIT_REFCOUNT_INC(file);
+	*file_out = file;
+	return 0;
+}
+
+bool git_commit_graph_needs_refresh(
+	const git_commit_graph_file *file, const char *path)
+{
+	git_file fd = -1;
+	struct stat st;
+	ssize_t bytes_read;
+	git_oid cgraph_checksum = {{0}};
+
+	if (path == NULL)
+		path = file->filename;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return true;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		return true;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size) ||
+		(size_t)st.st_size != file->graph_map.len) {
+		p_close(fd);
+		return true;
+	}
+
+	if (p_lseek(fd, -GIT_OID_RAWSZ, SEEK_END) < 0) {
+		p_close(fd);
+		return true;
+	}
+
+	bytes_read = p_read(fd, cgraph_checksum.id, GIT_OID_RAWSZ);
+	p_close(fd);
+	if (bytes_read != GIT_OID_RAWSZ)
+		return true;
+
+	return !git_oid_equal(&cgraph_checksum, &file->checksum);
+}
+
+int git_commit_graph_entry_get_byindex(
+	git_commit_graph_entry *e,
+	const git_commit_graph_file *file,
+	size_t pos)
+{
+	const unsigned char *commit_data;
+	uint32_t generation_and_time;
+
+	assert(e && file);
+
+	if (pos >= file->num_commits) {
+		giterr_set(GITERR_INVALID, "commit index %" PRIuZ " does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	commit_data = file->commit_data + pos * COMMIT_GRAPH_COMMIT_DATA_SIZE;
+	git_oid_fromraw(&e->tree_oid, commit_data);
+	e->parent_indices[0] = get_be32(commit_data + GIT_OID_RAWSZ);
+	e->parent_indices[1] = get_be32(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+		+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+
+	generation_and_time = get_be32(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t));
+	e->generation = generation_and_time >> 2;
+	e->commit_time = ((uint64_t)(generation_and_time & 0x3)) << 32 |
+		get_be32(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t));
+
+	e->extra_parents_index = 0;
+	if (file->extra_edge_list &&
+		(e->parent_indices[1] & GIT_COMMIT_GRAPH_MISSING_PARENT_MASK)) {
+		size_t extra_edge_list_pos =
+			e->parent_indices[1] & ~GIT_COMMIT_GRAPH_MISSING_PARENT_MASK;
+
+		/* Make sure we're not being sent out of bounds */
+		if (extra_edge_list_pos >= file->num_extra_edge_list) {
+			giterr_set(GITERR_INVALID,
+				"commit %u does not exist", (unsigned int)extra_edge_list_pos);
+			return GIT_ENOTFOUND;
+		}
+
+		e->extra_parents_index = extra_edge_list_pos;
+		while (extra_edge_list_pos < file->num_extra_edge_list &&
+			(get_be32(file->extra_edge_list + extra_edge_list_pos * sizeof(uint32_t))
+				& GIT_COMMIT_GRAPH_MISSING_PARENT_MASK) == 0) {
+			extra_edge_list_pos++;
+			e->parent_count++;
+		}
+	}
+
+	git_oid_cpy(&e->sha1, &file->oid_lookup[pos]);
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+	git_commit_graph_entry *e,
+	const git_commit_graph_file *file,
+	const git_oid *oid)
+{
+	int pos;
+	uint32_t hi, lo;
+
+	assert(e && file && oid);
+
+	hi = ntohl(file->oid_fanout[(int)oid->id[0]]);
+	lo = ((oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)oid->id[0] - 1]));
+
+	if (lo >= hi)
+		return GIT_ENOTFOUND;
+
+	pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, oid->id);
+	if (pos < 0)
+		return GIT_ENOTFOUND;
+
+	return git_commit_graph_entry_get_byindex(e, file, (size_t)pos);
+}
+
+int git_commit_graph_entry_parent(
+	git_commit_graph_entry *parent,
+	const git_commit_graph_file *file,
+	const git_commit_graph_entry *entry,
+	size_t n)
+{
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		giterr_set(GITERR_INVALID, "parent index %" PRIuZ " does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return git_commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	return git_commit_graph_entry_get_byindex(
+		parent,
+		file,
+		get_be32(file->extra_edge_list +
+			(entry->extra_parents_index + n - 1) * sizeof(uint32_t))
+			& ~GIT_COMMIT_GRAPH_MISSING_PARENT_MASK);
+}
+
+static void commit_graph_file__free(git_commit_graph_file *file)
+{
+	git_futils_mmap_free(&file->graph_map);
+	git__free(file->filename);
+	git__free(file);
+}
+
+void git_commit_graph_file_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	GIT_REFCOUNT_DEC(file, commit_graph_file__free);
+}
+
+/*
+ * Writing
+ */
+
+struct git_commit_graph_writer {
+	git_buf objects_info_dir;
+
+	/* The commits that will be written, sorted by OID once dumped */
+	git_vector commits;
+};
+
+struct packed_commit {
+	size_t index;
+	git_oid sha1;
+	git_oid tree_oid;
+	uint32_t generation;
+	git_time_t commit_time;
+	git_array_oid_t parents;
+	git_array_t(size_t) parent_indices;
+};
+
+static void packed_commit_free(struct packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git_array_clear(p->parent_indices);
+	git__free(p);
+}
+
+static void packed_commit_free_cb(void *p)
+{
+	packed_commit_free(p);
+}
+
+static struct packed_commit *packed_commit_new(const git_commit *commit)
+{
+	unsigned int i, parentcount = git_commit_parentcount(commit);
+	struct packed_commit *p = git__calloc(1, sizeof(struct packed_commit));
+
+	if (!p)
+		return NULL;
+
+	git_array_init_to_size(p->parents, parentcount);
+	if (parentcount && !p->parents.ptr)
+		goto on_error;
+
+	git_oid_cpy(&p->sha1, git_commit_id(commit));
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = git_commit_time(commit);
+
+	for (i = 0; i < parentcount; ++i) {
+		git_oid *parent_id = git_array_alloc(p->parents);
+		if (!parent_id)
+			goto on_error;
+
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	return p;
+
+on_error:
+	packed_commit_free(p);
+	return NULL;
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+
+	return git_oid__cmp(&a->sha1, &b->sha1);
+}
+
+static int packed_commit__oid_cmp(const void *key, const void *entry)
+{
+	const struct packed_commit *p = entry;
+
+	return git_oid__cmp(key, &p->sha1);
+}
+
+int git_commit_graph_writer_new(
+	git_commit_graph_writer **out,
+	const char *objects_info_dir)
+{
+	git_commit_graph_writer *w;
+
+	assert(out && objects_info_dir);
+
+	w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0 ||
+		git_vector_init(&w->commits, 0, packed_commit__cmp) < 0) {
+		git_commit_graph_writer_free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_free(&w->commits);
+	git_buf_free(&w->objects_info_dir);
+	git__free(w);
+}
+
+int git_commit_graph_writer_add_revwalk(
+	git_commit_graph_writer *w,
+	git_revwalk *walk)
+{
+	int error;
+	git_oid id;
+	git_repository *repo = git_revwalk_repository(walk);
+	git_commit *commit;
+	struct packed_commit *packed_commit;
+
+	assert(w && walk);
+
+	/* the boundary commits would be written as roots */
+	if ((error = git_repository_is_shallow(repo)) != 0) {
+		if (error > 0) {
+			giterr_set(GITERR_INVALID,
+				"cannot write a commit-graph for a shallow repository");
+			error = -1;
+		}
+
+		return error;
+	}
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = git_commit_lookup(&commit, repo, &id)) < 0)
+			return error;
+
+		packed_commit = packed_commit_new(commit);
+		git_commit_free(commit);
+		GITERR_CHECK_ALLOC(packed_commit);
+
+		if ((error = git_vector_insert(&w->commits, packed_commit)) < 0) {
+			packed_commit_free(packed_commit);
+			return error;
+		}
+	}
+
+	if (error == GIT_ITEROVER) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static int compute_parent_indices(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	git_oid *parent_id;
+	size_t i, j, pos, *parent_index;
+
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		packed_commit->index = i;
+		git_array_clear(packed_commit->parent_indices);
+
+		for (j = 0; j < git_array_size(packed_commit->parents); ++j) {
+			parent_id = git_array_get(packed_commit->parents, j);
+
+			if (git_vector_bsearch2(&pos, &w->commits,
+					packed_commit__oid_cmp, parent_id) < 0) {
+				char oid_str[GIT_OID_HEXSZ + 1];
+				git_oid_tostr(oid_str, sizeof(oid_str), parent_id);
+				giterr_set(GITERR_ODB,
+					"commit-graph is not closed under reachability: "
+					"missing parent %s", oid_str);
+				return -1;
+			}
+
+			parent_index = git_array_alloc(packed_commit->parent_indices);
+			GITERR_CHECK_ALLOC(parent_index);
+			*parent_index = pos;
+		}
+	}
+
+	return 0;
+}
+
+static int compute_generation_numbers(git_commit_graph_writer *w)
+{
+	git_array_t(size_t) index_stack = GIT_ARRAY_INIT;
+	struct packed_commit *packed_commit, *parent;
+	size_t i, j, *parent_index, *index;
+	uint32_t max_parent_generation;
+	bool parents_ready;
+	int error = 0;
+
+	git_vector_foreach(&w->commits, i, packed_commit)
+		packed_commit->generation = GIT_COMMIT_GRAPH_GENERATION_NONE;
+
+	/*
+	 * Depth-first traversal with an explicit stack, so that long histories
+	 * do not overflow the call stack: a commit gets its generation once
+	 * all of its parents have theirs.
+	 */
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		if (packed_commit->generation != GIT_COMMIT_GRAPH_GENERATION_NONE)
+			continue;
+
+		index = git_array_alloc(index_stack);
+		GITERR_CHECK_ALLOC(index);
+		*index = i;
+
+		while (git_array_size(index_stack)) {
+			packed_commit = git_vector_get(
+				&w->commits, *git_array_last(index_stack));
+			max_parent_generation = 0;
+			parents_ready = true;
+
+			for (j = 0; j < git_array_size(packed_commit->parent_indices); ++j) {
+				parent_index = git_array_get(packed_commit->parent_indices, j);
+				parent = git_vector_get(&w->commits, *parent_index);
+
+				if (parent->generation == GIT_COMMIT_GRAPH_GENERATION_NONE) {
+					parents_ready = false;
+
+					index = git_array_alloc(index_stack);
+					if (!index) {
+						error = -1;
+						goto done;
+					}
+					*index = *parent_index;
+				} else if (parent->generation > max_parent_generation) {
+					max_parent_generation = parent->generation;
+				}
+			}
+
+			if (!parents_ready)
+				continue;
+
+			if (packed_commit->generation == GIT_COMMIT_GRAPH_GENERATION_NONE)
+				packed_commit->generation =
+					max_parent_generation < GIT_COMMIT_GRAPH_GENERATION_MAX ?
+					max_parent_generation + 1 : GIT_COMMIT_GRAPH_GENERATION_MAX;
+
+			git_array_pop(index_stack);
+		}
+	}
+
+done:
+	git_array_clear(index_stack);
+	return error;
+}
+
+static int write_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int write_chunk_header(git_buf *buf, uint32_t chunk_id, uint64_t offset)
+{
+	if (write_be32(buf, chunk_id) < 0 ||
+		write_be32(buf, (uint32_t)(offset >> 32)) < 0)
+		return -1;
+
+	return write_be32(buf, (uint32_t)offset);
+}
+
+int git_commit_graph_writer_dump(
+	git_buf *buffer,
+	git_commit_graph_writer *w)
+{
+	struct git_commit_graph_header hdr = {0};
+	struct packed_commit *packed_commit;
+	git_buf oid_fanout = GIT_BUF_INIT, oid_lookup = GIT_BUF_INIT,
+		commit_data = GIT_BUF_INIT, extra_edge_list = GIT_BUF_INIT;
+	uint32_t fanout[256] = {0}, num_extra_edges = 0, generation_and_time;
+	uint64_t offset;
+	size_t i, j, *parent_index;
+	git_oid cgraph_checksum;
+	int error = 0;
+
+	assert(buffer && w);
+
+	git_vector_sort(&w->commits);
+	git_vector_uniq(&w->commits, packed_commit_free_cb);
+
+	if ((error = compute_parent_indices(w)) < 0 ||
+		(error = compute_generation_numbers(w)) < 0)
+		goto cleanup;
+
+	git_vector_foreach(&w->commits, i, packed_commit) {
+		fanout[packed_commit->sha1.id[0]]++;
+
+		/* OID Lookup */
+		if ((error = git_buf_put(&oid_lookup,
+				(const char *)packed_commit->sha1.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+
+		/* Commit Data */
+		if ((error = git_buf_put(&commit_data,
+				(const char *)packed_commit->tree_oid.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+
+		if (git_array_size(packed_commit->parent_indices) == 0)
+			error = write_be32(&commit_data, GIT_COMMIT_GRAPH_MISSING_PARENT);
+		else
+			error = write_be32(&commit_data,
+				(uint32_t)*git_array_get(packed_commit->parent_indices, 0));
+		if (error < 0)
+			goto cleanup;
+
+		if (git_array_size(packed_commit->parent_indices) <= 1) {
+			error = write_be32(&commit_data, GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else if (git_array_size(packed_commit->parent_indices) == 2) {
+			error = write_be32(&commit_data,
+				(uint32_t)*git_array_get(packed_commit->parent_indices, 1));
+		} else {
+			error = write_be32(&commit_data,
+				GIT_COMMIT_GRAPH_MISSING_PARENT_MASK | num_extra_edges);
+
+			for (j = 1; !error && j < git_array_size(packed_commit->parent_indices); ++j) {
+				uint32_t edge;
+
+				parent_index = git_array_get(packed_commit->parent_indices, j);
+				edge = (uint32_t)*parent_index;
+				if (j + 1 == git_array_size(packed_commit->parent_indices))
+					edge |= GIT_COMMIT_GRAPH_MISSING_PARENT_MASK;
+
+				error = write_be32(&extra_edge_list, edge);
+				num_extra_edges++;
+			}
+		}
+		if (error < 0)
+			goto cleanup;
+
+		generation_and_time = (packed_commit->generation << 2) |
+			(uint32_t)((((uint64_t)packed_commit->commit_time) >> 32) & 0x3);
+		if ((error = write_be32(&commit_data, generation_and_time)) < 0 ||
+			(error = write_be32(&commit_data, (uint32_t)packed_commit->commit_time)) < 0)
+			goto cleanup;
+	}
+
+	/* OID Fanout */
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; ++i) {
+		if ((error = write_be32(&oid_fanout, fanout[i])) < 0)
+			goto cleanup;
+	}
+
+	/* Header */
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = (extra_edge_list.size > 0) ? 4 : 3;
+	hdr.base_graph_files = 0;
+
+	git_buf_clear(buffer);
+	if ((error = git_buf_put(buffer, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Chunk lookup table */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * COMMIT_GRAPH_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(buffer, COMMIT_GRAPH_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += oid_fanout.size;
+	if ((error = write_chunk_header(buffer, COMMIT_GRAPH_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += oid_lookup.size;
+	if ((error = write_chunk_header(buffer, COMMIT_GRAPH_COMMIT_DATA_ID, offset)) < 0)
+		goto cleanup;
+	offset += commit_data.size;
+	if (extra_edge_list.size > 0) {
+		if ((error = write_chunk_header(buffer, COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset)) < 0)
+			goto cleanup;
+		offset += extra_edge_list.size;
+	}
+	if ((error = write_chunk_header(buffer, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Chunks and trailer */
+	if ((error = git_buf_put(buffer, oid_fanout.ptr, oid_fanout.size)) < 0 ||
+		(error = git_buf_put(buffer, oid_lookup.ptr, oid_lookup.size)) < 0 ||
+		(error = git_buf_put(buffer, commit_data.ptr, commit_data.size)) < 0 ||
+		(error = git_buf_put(buffer, extra_edge_list.ptr, extra_edge_list.size)) < 0)
+		goto cleanup;
+
+	if ((error = git_hash_buf(&cgraph_checksum, buffer->ptr, buffer->size)) < 0)
+		goto cleanup;
+
+	error = git_buf_put(buffer, (const char *)cgraph_checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_buf_free(&oid_fanout);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&commit_data);
+	git_buf_free(&extra_edge_list);
+	return error;
+}
+
+int git_commit_graph_writer_commit(
+	git_commit_graph_writer *w)
+{
+	git_buf commit_graph_path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_joinpath(&commit_graph_path,
+			git_buf_cstr(&w->objects_info_dir), "commit-graph")) < 0 ||
+		(error = git_commit_graph_writer_dump(&contents, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_futils_mkdir(git_buf_cstr(&w->objects_info_dir),
+			GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, git_buf_cstr(&commit_graph_path),
+			0, GIT_OBJECT_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, contents.ptr, contents.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&contents);
+	git_buf_free(&commit_graph_path);
+	return error;
+}
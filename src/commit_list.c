@@ -19,6 +19,17 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return (commit_a->time < commit_b->time);
 }
 
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	uint32_t generation_a = git_commit_list_generation(a);
+	uint32_t generation_b = git_commit_list_generation(b);
+
+	if (generation_a != generation_b)
+		return (generation_a < generation_b) ? 1 : -1;
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -174,13 +185,38 @@ static int commit_quick_parse(
 	return 0;
 }
 
-int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
+static int commit_graph_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
-	git_odb_object *obj;
+	git_commit_graph_entry e, parent;
+	size_t i;
 	int error;
 
-	if (commit->parsed)
-		return 0;
+	if ((error = git_commit_graph_entry_find(&e, walk->cgraph, &commit->oid)) < 0)
+		return error;
+
+	commit->parents = alloc_parents(walk, commit, e.parent_count);
+	GITERR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e.parent_count; ++i) {
+		if ((error = git_commit_graph_entry_parent(&parent, walk->cgraph, &e, i)) < 0)
+			return error;
+
+		commit->parents[i] = git_revwalk__commit_lookup(walk, &parent.sha1);
+		if (commit->parents[i] == NULL)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)e.parent_count;
+	commit->time = e.commit_time;
+	commit->generation = e.generation;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_odb_parse(git_revwalk *walk, git_commit_list_node *commit)
+{
+	git_odb_object *obj;
+	int error;
 
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
@@ -198,3 +234,22 @@ int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 	return error;
 }
 
+int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
+{
+	int error;
+
+	if (commit->parsed)
+		return 0;
+
+	/* Commits in the commit-graph don't need to be read from the odb */
+	if (!walk->cgraph ||
+		(error = commit_graph_parse(walk, commit)) == GIT_ENOTFOUND)
+		error = commit_odb_parse(walk, commit);
+
+	/* The boundary commits of a shallow repository are roots */
+	if (!error && git_shallow__contains(walk->shallow, &commit->oid))
+		commit->out_degree = 0;
+
+	return error;
+}
+
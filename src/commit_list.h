@@ -7,6 +7,7 @@
 #ifndef INCLUDE_commit_list_h__
 #define INCLUDE_commit_list_h__
 
+#include "common.h"
 #include "git2/oid.h"
 
 #define PARENT1  (1 << 0)
@@ -21,9 +22,12 @@
 
 #define FLAG_BITS 4
 
+#define GENERATION_INFINITY 0xFFFFFFFF
+
 typedef struct git_commit_list_node {
 	git_oid oid;
 	int64_t time;
+	uint32_t generation;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
@@ -41,8 +45,19 @@ typedef struct git_commit_list {
 	struct git_commit_list *next;
 } git_commit_list;
 
+/*
+ * The generation number of a parsed commit.  Commits that are not in
+ * the commit-graph have no known generation and are treated as being
+ * above every commit that has one.
+ */
+GIT_INLINE(uint32_t) git_commit_list_generation(const git_commit_list_node *commit)
+{
+	return commit->generation ? commit->generation : GENERATION_INFINITY;
+}
+
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk);
 int git_commit_list_time_cmp(const void *a, const void *b);
+int git_commit_list_generation_cmp(const void *a, const void *b);
 void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
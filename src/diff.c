@@ -14,6 +14,7 @@
 #include "index.h"
 #include "odb.h"
 #include "submodule.h"
+#include "fsmonitor.h"
 
 #define DIFF_FLAG_IS_SET(DIFF,FLAG) (((DIFF)->opts.flags & (FLAG)) != 0)
 #define DIFF_FLAG_ISNT_SET(DIFF,FLAG) (((DIFF)->opts.flags & (FLAG)) == 0)
@@ -700,6 +701,8 @@ typedef struct {
 	git_iterator *new_iter;
 	const git_index_entry *oitem;
 	const git_index_entry *nitem;
+	git_untracked_cache *untracked;
+	git_vector fsmonitor_clean; /* paths to mark as fsmonitor valid */
 } diff_in_progress;
 
 #define MODE_BITS_MASK 0000777
@@ -855,6 +858,16 @@ static int maybe_modified(
 			modified_uncertain = true;
 		}
 
+		/* the fsmonitor will tell us when this changes */
+		else if ((info->new_iter->flags & GIT_ITERATOR_USE_FSMONITOR) &&
+			!(oitem->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID)) {
+			char *path = git_pool_strdup(&diff->pool, oitem->path);
+
+			if (!path ||
+				git_vector_insert(&info->fsmonitor_clean, path) < 0)
+				return -1;
+		}
+
 	/* if mode is GITLINK and submodules are ignored, then skip */
 	} else if (S_ISGITLINK(nmode) &&
 			 DIFF_FLAG_IS_SET(diff, GIT_DIFF_IGNORE_SUBMODULES)) {
@@ -983,12 +996,19 @@ static int iterator_advance_into(
 static int iterator_advance_over_with_status(
 	const git_index_entry **entry,
 	git_iterator_status_t *status,
-	git_iterator *iterator)
+	git_iterator *iterator,
+	git_untracked_cache *untracked)
 {
 	int error;
 
-	if ((error = git_iterator_advance_over_with_status(
-			entry, status, iterator)) == GIT_ITEROVER) {
+	if (untracked)
+		error = git_untracked_cache__advance_over(
+			entry, status, untracked, iterator);
+	else
+		error = git_iterator_advance_over_with_status(
+			entry, status, iterator);
+
+	if (error == GIT_ITEROVER) {
 		*entry = NULL;
 		error = 0;
 	}
@@ -1056,8 +1076,8 @@ static int handle_unmatched_new_item(
 				return iterator_advance(&info->nitem, info->new_iter);
 
 			/* iterate into dir looking for an actual untracked file */
-			if ((error = iterator_advance_over_with_status(
-					&info->nitem, &untracked_state, info->new_iter)) < 0)
+			if ((error = iterator_advance_over_with_status(&info->nitem,
+					&untracked_state, info->new_iter, info->untracked)) < 0)
 				return error;
 
 			/* if we found nothing that matched our pathlist filter, exclude */
@@ -1209,6 +1229,40 @@ static int handle_matched_item(
 	return error;
 }
 
+/* The untracked cache can answer for untracked directories as long as
+ * the diff is only interested in whether they contain untracked files,
+ * which is how `git status -unormal` looks at them.
+ */
+static int diff_untracked_cache(
+	git_untracked_cache **out, git_diff *diff, git_iterator *new_iter)
+{
+	git_index *index;
+	bool changed;
+	int error;
+
+	*out = NULL;
+
+	if (new_iter->type != GIT_ITERATOR_TYPE_WORKDIR ||
+		DIFF_FLAG_ISNT_SET(diff, GIT_DIFF_INCLUDE_UNTRACKED) ||
+		DIFF_FLAG_IS_SET(diff, GIT_DIFF_INCLUDE_IGNORED) ||
+		DIFF_FLAG_IS_SET(diff, GIT_DIFF_RECURSE_UNTRACKED_DIRS) ||
+		DIFF_FLAG_IS_SET(diff, GIT_DIFF_ENABLE_FAST_UNTRACKED_DIRS) ||
+		diff->pathspec.length > 0)
+		return 0;
+
+	if ((error = git_iterator_index(&index, new_iter)) < 0 || !index)
+		return error;
+
+	if ((error = git_untracked_cache__prepare(
+			out, &changed, diff->repo, index)) < 0)
+		return error;
+
+	if (changed)
+		diff->index_updated = true;
+
+	return 0;
+}
+
 int git_diff__from_iterators(
 	git_diff **diff_ptr,
 	git_repository *repo,
@@ -1228,6 +1282,8 @@ int git_diff__from_iterators(
 	info.repo = repo;
 	info.old_iter = old_iter;
 	info.new_iter = new_iter;
+	info.untracked = NULL;
+	git_vector_init(&info.fsmonitor_clean, 0, NULL);
 
 	/* make iterators have matching icase behavior */
 	if (DIFF_FLAG_IS_SET(diff, GIT_DIFF_IGNORE_CASE)) {
@@ -1237,7 +1293,8 @@ int git_diff__from_iterators(
 	}
 
 	/* finish initialization */
-	if ((error = diff_list_apply_options(diff, opts)) < 0)
+	if ((error = diff_list_apply_options(diff, opts)) < 0 ||
+		(error = diff_untracked_cache(&info.untracked, diff, new_iter)) < 0)
 		goto cleanup;
 
 	if ((error = iterator_current(&info.oitem, old_iter)) < 0 ||
@@ -1279,7 +1336,20 @@ int git_diff__from_iterators(
 
 	diff->perf.stat_calls += old_iter->stat_calls + new_iter->stat_calls;
 
+	if (info.untracked && info.untracked->changed)
+		diff->index_updated = true;
+
+	if (!error && info.fsmonitor_clean.length > 0) {
+		git_index *index;
+		git_iterator_index(&index, new_iter);
+
+		if (git_fsmonitor__mark_valid(index, &info.fsmonitor_clean) > 0)
+			diff->index_updated = true;
+	}
+
 cleanup:
+	git_vector_free(&info.fsmonitor_clean);
+
 	if (!error)
 		*diff_ptr = diff;
 	else
@@ -1381,6 +1451,11 @@ int git_diff_tree_to_index(
 	return error;
 }
 
+#define DIFF_WORKDIR_ITERATOR_FLAGS(opts) \
+	(GIT_ITERATOR_DONT_AUTOEXPAND | \
+	 ((opts) && ((opts)->flags & GIT_DIFF_PARALLEL_WORKDIR_SCAN) ? \
+		GIT_ITERATOR_PARALLEL_SCAN : 0))
+
 int git_diff_index_to_workdir(
 	git_diff **diff,
 	git_repository *repo,
@@ -1388,20 +1463,29 @@ int git_diff_index_to_workdir(
 	const git_diff_options *opts)
 {
 	int error = 0;
+	bool fsmonitor_valid, fsmonitor_changed;
 
 	assert(diff && repo);
 
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	if ((error = git_fsmonitor__refresh(
+			&fsmonitor_valid, &fsmonitor_changed, repo, index)) < 0)
+		return error;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index(&a, repo, index, &a_opts),
 		GIT_ITERATOR_INCLUDE_CONFLICTS,
 
 		git_iterator_for_workdir(&b, repo, index, NULL, &b_opts),
-		GIT_ITERATOR_DONT_AUTOEXPAND
+		DIFF_WORKDIR_ITERATOR_FLAGS(opts) |
+			(fsmonitor_valid ? GIT_ITERATOR_USE_FSMONITOR : 0)
 	);
 
+	if (!error && fsmonitor_changed)
+		(*diff)->index_updated = true;
+
 	if (!error && DIFF_FLAG_IS_SET(*diff, GIT_DIFF_UPDATE_INDEX) && (*diff)->index_updated)
 		error = git_index_write(index);
 
@@ -1424,7 +1508,8 @@ int git_diff_tree_to_workdir(
 
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_tree(&a, old_tree, &a_opts), 0,
-		git_iterator_for_workdir(&b, repo, index, old_tree, &b_opts), GIT_ITERATOR_DONT_AUTOEXPAND
+		git_iterator_for_workdir(&b, repo, index, old_tree, &b_opts),
+		DIFF_WORKDIR_ITERATOR_FLAGS(opts)
 	);
 
 	return error;
@@ -13,8 +13,6 @@
 #include "fileops.h"
 #include "filter.h"
 
-#define DIFF_MAX_FILESIZE 0x20000000
-
 static bool diff_file_content_binary_by_size(git_diff_file_content *fc)
 {
 	/* if we have diff opts, check max_size vs file size */
@@ -222,16 +220,22 @@ static int diff_file_content_load_blob(
 	git_diff_options *opts)
 {
 	int error = 0;
-	git_odb_object *odb_obj = NULL;
+	git_odb_object *odb_obj = fc->odb_obj;
+
+	fc->odb_obj = NULL;
 
 	if (git_oid_iszero(&fc->file->id))
-		return 0;
+		goto skip;
 
-	if (fc->file->mode == GIT_FILEMODE_COMMIT)
+	if (fc->file->mode == GIT_FILEMODE_COMMIT) {
+		git_odb_object_free(odb_obj);
 		return diff_file_content_commit_to_str(fc, false);
+	}
 
 	/* if we don't know size, try to peek at object header first */
-	if (!fc->file->size) {
+	if (odb_obj != NULL)
+		fc->file->size = (git_off_t)git_odb_object_size(odb_obj);
+	else if (!fc->file->size) {
 		if ((error = git_diff_file__resolve_zero_size(
 				fc->file, &odb_obj, fc->repo)) < 0)
 			return error;
@@ -239,7 +243,7 @@ static int diff_file_content_load_blob(
 
 	if ((opts->flags & GIT_DIFF_SHOW_BINARY) == 0 &&
 		diff_file_content_binary_by_size(fc))
-		return 0;
+		goto skip;
 
 	if (odb_obj != NULL) {
 		error = git_object__from_odb_object(
@@ -257,6 +261,10 @@ static int diff_file_content_load_blob(
 	}
 
 	return error;
+
+skip:
+	git_odb_object_free(odb_obj);
+	return 0;
 }
 
 static int diff_file_content_load_workdir_symlink_fake(
@@ -460,5 +468,6 @@ void git_diff_file_content__clear(git_diff_file_content *fc)
 {
 	git_diff_file_content__unload(fc);
 
-	/* for now, nothing else to do */
+	git_odb_object_free(fc->odb_obj);
+	fc->odb_obj = NULL;
 }
@@ -12,6 +12,8 @@
 #include "diff_driver.h"
 #include "map.h"
 
+#define DIFF_MAX_FILESIZE 0x20000000
+
 /* expanded information for one side of a delta */
 typedef struct {
 	git_repository *repo;
@@ -22,6 +24,7 @@ typedef struct {
 	git_off_t opts_max_size;
 	git_iterator_type_t src;
 	const git_blob *blob;
+	git_odb_object *odb_obj; /* blob read ahead of loading, if any */
 	git_map map;
 } git_diff_file_content;
 
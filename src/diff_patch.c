@@ -401,6 +401,151 @@ static int diff_required(git_diff *diff, const char *action)
 	return -1;
 }
 
+/* number of deltas whose blobs are read ahead together */
+#define DIFF_PREFETCH_WINDOW 64
+
+/* how many bytes of blobs may be read ahead, and how big one may be */
+#define DIFF_PREFETCH_MAX_BYTES (8 * 1024 * 1024)
+#define DIFF_PREFETCH_MAX_BLOB (512 * 1024)
+
+typedef struct {
+	size_t start, end;
+	size_t slots[DIFF_PREFETCH_WINDOW * 2];
+	git_odb_object *objects[DIFF_PREFETCH_WINDOW * 2];
+} diff_prefetch;
+
+/*
+ * Whether to read the blob of `file` ahead, and how big it is.  The size
+ * of a blob from a tree or the index is not known until it is loaded, so
+ * it is looked up in the object database; blobs whose size cannot be
+ * found out this way are left to be loaded as usual.
+ */
+static bool diff_prefetch_wanted(
+	size_t *size, git_diff *diff, git_odb *odb,
+	git_diff_file *file, git_iterator_type_t src)
+{
+	git_off_t max_size = diff->opts.max_size ?
+		diff->opts.max_size : DIFF_MAX_FILESIZE;
+	git_otype type;
+
+	if (src == GIT_ITERATOR_TYPE_WORKDIR ||
+		file->mode == GIT_FILEMODE_COMMIT ||
+		(file->flags & GIT_DIFF_FLAG_VALID_ID) == 0 ||
+		git_oid_iszero(&file->id))
+		return false;
+
+	if ((diff->opts.flags & GIT_DIFF_SHOW_BINARY) == 0 &&
+		((file->flags & GIT_DIFF_FLAG_BINARY) != 0 ||
+		 (max_size > 0 && file->size > max_size)))
+		return false;
+
+	if (file->size > 0) {
+		*size = (size_t)file->size;
+	} else if (git_odb_read_header(size, &type, odb, &file->id) < 0) {
+		giterr_clear();
+		return false;
+	}
+
+	return *size <= DIFF_PREFETCH_MAX_BLOB;
+}
+
+static int diff_prefetch_store(
+	git_odb_object *object, size_t position, void *payload)
+{
+	diff_prefetch *prefetch = payload;
+	size_t slot = prefetch->slots[position];
+
+	git_odb_object_free(prefetch->objects[slot]);
+	return git_odb_object_dup(&prefetch->objects[slot], object);
+}
+
+static void diff_prefetch_clear(diff_prefetch *prefetch)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(prefetch->objects); i++) {
+		git_odb_object_free(prefetch->objects[i]);
+		prefetch->objects[i] = NULL;
+	}
+}
+
+/* Read the blobs of the next deltas in the order they are stored in the
+ * packfiles, rather than one at a time in the order of their paths.
+ * The window ends early once its blobs take up DIFF_PREFETCH_MAX_BYTES.
+ * This is only a hint; anything that fails here is loaded as usual.
+ */
+static void diff_prefetch_window(
+	diff_prefetch *prefetch, git_diff *diff, size_t start)
+{
+	git_oid ids[DIFF_PREFETCH_WINDOW * 2];
+	git_diff_delta *delta;
+	git_odb *odb;
+	size_t i, count = 0, total = 0, old_size = 0, new_size = 0;
+	bool old_side, new_side;
+
+	diff_prefetch_clear(prefetch);
+	prefetch->start = start;
+	prefetch->end = start + DIFF_PREFETCH_WINDOW;
+
+	if (git_repository_odb__weakptr(&odb, diff->repo) < 0) {
+		giterr_clear();
+		return;
+	}
+
+	for (i = 0; i < DIFF_PREFETCH_WINDOW; i++) {
+		if ((delta = git_vector_get(&diff->deltas, start + i)) == NULL)
+			break;
+
+		if (git_diff_delta__should_skip(&diff->opts, delta))
+			continue;
+
+		switch (delta->status) {
+		case GIT_DELTA_ADDED:
+			old_side = false; new_side = true; break;
+		case GIT_DELTA_DELETED:
+			old_side = true; new_side = false; break;
+		case GIT_DELTA_MODIFIED:
+		case GIT_DELTA_COPIED:
+		case GIT_DELTA_RENAMED:
+			old_side = new_side = true; break;
+		default:
+			old_side = new_side = false; break;
+		}
+
+		old_side = old_side && diff_prefetch_wanted(&old_size,
+			diff, odb, &delta->old_file, diff->old_src);
+		new_side = new_side && diff_prefetch_wanted(&new_size,
+			diff, odb, &delta->new_file, diff->new_src);
+
+		if (old_side)
+			total += old_size;
+		if (new_side)
+			total += new_size;
+
+		/* leave this delta for the next window */
+		if (total > DIFF_PREFETCH_MAX_BYTES) {
+			prefetch->end = start + i;
+			break;
+		}
+
+		if (old_side) {
+			git_oid_cpy(&ids[count], &delta->old_file.id);
+			prefetch->slots[count++] = i * 2;
+		}
+
+		if (new_side) {
+			git_oid_cpy(&ids[count], &delta->new_file.id);
+			prefetch->slots[count++] = i * 2 + 1;
+		}
+	}
+
+	if (count < 2)
+		return;
+
+	if (git_odb_read_many(odb, ids, count, diff_prefetch_store, prefetch) < 0)
+		giterr_clear();
+}
+
 int git_diff_foreach(
 	git_diff *diff,
 	git_diff_file_cb file_cb,
@@ -411,12 +556,15 @@ int git_diff_foreach(
 {
 	int error = 0;
 	git_xdiff_output xo;
-	size_t idx;
+	size_t idx, slot;
 	git_patch patch;
+	diff_prefetch prefetch;
 
 	if ((error = diff_required(diff, "git_diff_foreach")) < 0)
 		return error;
 
+	memset(&prefetch, 0, sizeof(prefetch));
+
 	memset(&xo, 0, sizeof(xo));
 	memset(&patch, 0, sizeof(patch));
 	diff_output_init(
@@ -430,9 +578,21 @@ int git_diff_foreach(
 			continue;
 
 		if (binary_cb || hunk_cb || data_cb) {
-			if ((error = diff_patch_init_from_diff(&patch, diff, idx)) != 0 ||
-				(error = diff_patch_load(&patch, &xo.output)) != 0)
-				return error;
+			if (idx >= prefetch.end)
+				diff_prefetch_window(&prefetch, diff, idx);
+
+			if ((error = diff_patch_init_from_diff(&patch, diff, idx)) != 0)
+				break;
+
+			slot = (idx - prefetch.start) * 2;
+			patch.ofile.odb_obj = prefetch.objects[slot];
+			patch.nfile.odb_obj = prefetch.objects[slot + 1];
+			prefetch.objects[slot] = prefetch.objects[slot + 1] = NULL;
+
+			if ((error = diff_patch_load(&patch, &xo.output)) != 0) {
+				git_patch_free(&patch);
+				break;
+			}
 		}
 
 		if ((error = diff_patch_invoke_file_callback(&patch, &xo.output)) == 0) {
@@ -446,6 +606,8 @@ int git_diff_foreach(
 			break;
 	}
 
+	diff_prefetch_clear(&prefetch);
+
 	return error;
 }
 
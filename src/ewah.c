@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "ewah.h"
+
+/*
+ * An EWAH bitmap is a sequence of 64-bit words in which "running length
+ * words" (RLWs) alternate with literal words.  Every RLW describes a run
+ * of words that are all zeroes or all ones, followed by a number of
+ * literal words that are copied verbatim:
+ *
+ *   bit  0      the value of the words in the run
+ *   bits 1-32   the number of words in the run
+ *   bits 33-63  the number of literal words following the RLW
+ *
+ * On disk, the words are preceded by the size of the bitmap in bits and
+ * the number of words, and followed by the position of the last RLW, all
+ * of them in network byte order.
+ */
+
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT (((uint64_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT (((uint64_t)1 << RLW_LITERAL_BITS) - 1)
+
+#define rlw_running_bit(w) ((w) & 1)
+#define rlw_running_len(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define rlw_literal_words(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static int bitmap_grow(git_bitmap *bitmap, size_t word_alloc)
+{
+	uint64_t *words;
+
+	if (word_alloc <= bitmap->word_alloc)
+		return 0;
+
+	words = git__reallocarray(bitmap->words, word_alloc, sizeof(uint64_t));
+	GITERR_CHECK_ALLOC(words);
+
+	memset(words + bitmap->word_alloc, 0,
+		(word_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = words;
+	bitmap->word_alloc = word_alloc;
+	return 0;
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	if (block >= bitmap->word_alloc) {
+		size_t word_alloc = bitmap->word_alloc ? bitmap->word_alloc : 32;
+
+		while (word_alloc <= block)
+			GITERR_CHECK_ALLOC_MULTIPLY(&word_alloc, word_alloc, 2);
+
+		if (bitmap_grow(bitmap, word_alloc) < 0)
+			return -1;
+	}
+
+	bitmap->words[block] |= (uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS);
+	return 0;
+}
+
+int git_bitmap_or(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] |= src->words[i];
+
+	return 0;
+}
+
+int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i;
+
+	if (bitmap_grow(dst, src->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < src->word_alloc; i++)
+		dst->words[i] ^= src->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src)
+{
+	size_t i, count = min(dst->word_alloc, src->word_alloc);
+
+	for (i = 0; i < count; i++)
+		dst->words[i] &= ~src->words[i];
+}
+
+int git_bitmap_dup(git_bitmap *dst, const git_bitmap *src)
+{
+	dst->words = NULL;
+	dst->word_alloc = 0;
+
+	return git_bitmap_or(dst, src);
+}
+
+size_t git_bitmap_popcount(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		uint64_t word = bitmap->words[i];
+
+		while (word) {
+			word &= word - 1;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+void git_bitmap_clear(git_bitmap *bitmap)
+{
+	if (bitmap->words)
+		memset(bitmap->words, 0, bitmap->word_alloc * sizeof(uint64_t));
+}
+
+void git_bitmap_free(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+static int ewah_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid EWAH bitmap - %s", message);
+	return -1;
+}
+
+int git_ewah_parse(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len)
+{
+	const unsigned char *words;
+	uint32_t bit_size, buffer_size;
+	size_t i, j, pos = 0, max_words;
+
+	assert(out && consumed && data);
+
+	out->words = NULL;
+	out->word_alloc = 0;
+
+	if (len < 3 * sizeof(uint32_t))
+		return ewah_error("bitmap is too short");
+
+	bit_size = get_be32(data);
+	buffer_size = get_be32(data + 4);
+
+	if ((len - 3 * sizeof(uint32_t)) / sizeof(uint64_t) < buffer_size)
+		return ewah_error("bitmap is truncated");
+
+	words = data + 2 * sizeof(uint32_t);
+	max_words = (bit_size + GIT_BITMAP_WORD_BITS - 1) / GIT_BITMAP_WORD_BITS;
+
+	if (bitmap_grow(out, max_words) < 0)
+		return -1;
+
+	for (i = 0; i < buffer_size; ) {
+		uint64_t rlw = get_be64(words + i++ * sizeof(uint64_t));
+		uint64_t running_len = rlw_running_len(rlw);
+		uint64_t literal_words = rlw_literal_words(rlw);
+
+		if (running_len > max_words - pos ||
+			literal_words > max_words - pos - running_len ||
+			literal_words > buffer_size - i) {
+			git_bitmap_free(out);
+			return ewah_error("bitmap is larger than its declared size");
+		}
+
+		if (rlw_running_bit(rlw))
+			memset(out->words + pos, 0xff, (size_t)running_len * sizeof(uint64_t));
+		pos += (size_t)running_len;
+
+		for (j = 0; j < literal_words; j++)
+			out->words[pos++] = get_be64(words + i++ * sizeof(uint64_t));
+	}
+
+	*consumed = 3 * sizeof(uint32_t) + buffer_size * sizeof(uint64_t);
+	return 0;
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	unsigned char bytes[4];
+
+	bytes[0] = (unsigned char)(value >> 24);
+	bytes[1] = (unsigned char)(value >> 16);
+	bytes[2] = (unsigned char)(value >> 8);
+	bytes[3] = (unsigned char)value;
+
+	return git_buf_put(out, (const char *)bytes, sizeof(bytes));
+}
+
+static void set_be64(unsigned char *p, uint64_t value)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(uint64_t); i++)
+		p[i] = (unsigned char)(value >> (56 - 8 * i));
+}
+
+static int ewah_serialize(
+	git_buf *out, const git_bitmap *bitmap, bool exact_size)
+{
+	size_t nwords = bitmap->word_alloc, i = 0, buffer_size = 0;
+	size_t header_pos, rlw_pos = 0, bit_size;
+	unsigned char word[sizeof(uint64_t)];
+
+	assert(out && bitmap);
+
+	/* trailing empty words carry no information */
+	while (nwords && bitmap->words[nwords - 1] == 0)
+		nwords--;
+
+	if (!git__is_uint32(nwords * GIT_BITMAP_WORD_BITS)) {
+		giterr_set(GITERR_INVALID, "bitmap is too large to be serialized");
+		return -1;
+	}
+
+	bit_size = nwords * GIT_BITMAP_WORD_BITS;
+	if (exact_size && nwords) {
+		uint64_t last = bitmap->words[nwords - 1];
+
+		while (!(last & ((uint64_t)1 << 63))) {
+			last <<= 1;
+			bit_size--;
+		}
+	}
+
+	header_pos = out->size;
+	if (put_be32(out, (uint32_t)bit_size) < 0 ||
+		put_be32(out, 0) < 0)
+		return -1;
+
+	do {
+		uint64_t running_bit = 0, running_len = 0, literal_words = 0;
+		size_t literal_start;
+
+		if (i < nwords &&
+			(bitmap->words[i] == 0 || bitmap->words[i] == ~(uint64_t)0)) {
+			running_bit = (bitmap->words[i] != 0);
+
+			while (i < nwords && running_len < RLW_LARGEST_RUNNING_COUNT &&
+				bitmap->words[i] == (running_bit ? ~(uint64_t)0 : 0)) {
+				running_len++;
+				i++;
+			}
+		}
+
+		literal_start = i;
+		while (i < nwords && literal_words < RLW_LARGEST_LITERAL_COUNT &&
+			bitmap->words[i] != 0 && bitmap->words[i] != ~(uint64_t)0) {
+			literal_words++;
+			i++;
+		}
+
+		rlw_pos = buffer_size;
+		set_be64(word, running_bit | (running_len << 1) |
+			(literal_words << (1 + RLW_RUNNING_BITS)));
+		if (git_buf_put(out, (const char *)word, sizeof(word)) < 0)
+			return -1;
+		buffer_size++;
+
+		for (; literal_start < i; literal_start++) {
+			set_be64(word, bitmap->words[literal_start]);
+			if (git_buf_put(out, (const char *)word, sizeof(word)) < 0)
+				return -1;
+			buffer_size++;
+		}
+	} while (i < nwords);
+
+	if (!git__is_uint32(buffer_size)) {
+		giterr_set(GITERR_INVALID, "bitmap is too large to be serialized");
+		return -1;
+	}
+
+	/* now that we know it, fill in the number of words */
+	out->ptr[header_pos + 4] = (char)(buffer_size >> 24);
+	out->ptr[header_pos + 5] = (char)(buffer_size >> 16);
+	out->ptr[header_pos + 6] = (char)(buffer_size >> 8);
+	out->ptr[header_pos + 7] = (char)buffer_size;
+
+	return put_be32(out, (uint32_t)rlw_pos);
+}
+
+int git_ewah_serialize(git_buf *out, const git_bitmap *bitmap)
+{
+	return ewah_serialize(out, bitmap, false);
+}
+
+int git_ewah_serialize_bits(git_buf *out, const git_bitmap *bitmap)
+{
+	return ewah_serialize(out, bitmap, true);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_ewah_h__
+#define INCLUDE_ewah_h__
+
+#include "common.h"
+#include "buffer.h"
+
+/*
+ * An uncompressed, growable bitmap.  Bit `n` lives in bit `n % 64` of
+ * word `n / 64`, which is the layout git uses for its reachability
+ * bitmaps, so that converting from and to EWAH is a matter of
+ * (de)compressing runs of words.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT {NULL, 0}
+
+#define GIT_BITMAP_WORD_BITS 64
+
+extern int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+
+GIT_INLINE(bool) git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	size_t block = pos / GIT_BITMAP_WORD_BITS;
+
+	return block < bitmap->word_alloc &&
+		(bitmap->words[block] & ((uint64_t)1 << (pos % GIT_BITMAP_WORD_BITS))) != 0;
+}
+
+/* dst |= src */
+extern int git_bitmap_or(git_bitmap *dst, const git_bitmap *src);
+
+/* dst ^= src */
+extern int git_bitmap_xor(git_bitmap *dst, const git_bitmap *src);
+
+/* dst &= ~src */
+extern void git_bitmap_and_not(git_bitmap *dst, const git_bitmap *src);
+
+extern int git_bitmap_dup(git_bitmap *dst, const git_bitmap *src);
+
+extern size_t git_bitmap_popcount(const git_bitmap *bitmap);
+
+extern void git_bitmap_clear(git_bitmap *bitmap);
+
+extern void git_bitmap_free(git_bitmap *bitmap);
+
+/*
+ * Decompress the serialized EWAH bitmap at `data` into `out`, storing
+ * the number of bytes it occupies in `consumed`.
+ */
+extern int git_ewah_parse(
+	git_bitmap *out,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len);
+
+/* Append the EWAH-compressed serialization of `bitmap` to `out`. */
+extern int git_ewah_serialize(git_buf *out, const git_bitmap *bitmap);
+
+/*
+ * Like `git_ewah_serialize`, but declare the size of the bitmap as one
+ * past its highest set bit rather than in whole words, the way git
+ * records bitmaps that it builds one bit at a time (eg, in the index).
+ */
+extern int git_ewah_serialize_bits(git_buf *out, const git_bitmap *bitmap);
+
+#endif
@@ -18,8 +18,10 @@
 #include "netops.h"
 #include "repository.h"
 #include "refs.h"
+#include "shallow.h"
+#include "git2/config.h"
 
-static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, git_refspec *tagspec, git_remote_autotag_option_t tagopt)
+static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, git_refspec *tagspec, git_remote_autotag_option_t tagopt, bool deepen)
 {
 	int match = 0;
 
@@ -41,10 +43,13 @@ static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, g
 	if (!match)
 		return 0;
 
-	/* If we have the object, mark it so we don't ask for it */
-	if (git_odb_exists(odb, &head->oid)) {
+	/*
+	 * If we have the object, mark it so we don't ask for it; unless
+	 * we're deepening a shallow repository, whose history we may have
+	 * only part of.
+	 */
+	if (git_odb_exists(odb, &head->oid) && !deepen)
 		head->local = 1;
-	}
 	else
 		remote->need_pack = 1;
 
@@ -59,6 +64,7 @@ static int filter_wants(git_remote *remote, const git_fetch_options *opts)
 	git_odb *odb;
 	size_t i, heads_len;
 	git_remote_autotag_option_t tagopt = remote->download_tags;
+	bool deepen;
 
 	if (opts && opts->download_tags != GIT_REMOTE_DOWNLOAD_TAGS_UNSPECIFIED)
 		tagopt = opts->download_tags;
@@ -90,8 +96,15 @@ static int filter_wants(git_remote *remote, const git_fetch_options *opts)
 	if (git_remote_ls((const git_remote_head ***)&heads, &heads_len, remote) < 0)
 		goto cleanup;
 
+	if (git_remote__deepening(remote) &&
+	    (error = git_repository_is_shallow(remote->repo)) < 0)
+		goto cleanup;
+
+	deepen = (error > 0);
+	error = 0;
+
 	for (i = 0; i < heads_len; i++) {
-		if ((error = maybe_want(remote, heads[i], odb, &tagspec, tagopt)) < 0)
+		if ((error = maybe_want(remote, heads[i], odb, &tagspec, tagopt, deepen)) < 0)
 			break;
 	}
 
@@ -101,17 +114,91 @@ cleanup:
 	return error;
 }
 
+static git_cvar_map negotiation_algorithms[] = {
+	{GIT_CVAR_STRING, "consecutive", GIT_FETCH_NEGOTIATION_CONSECUTIVE},
+	{GIT_CVAR_STRING, "default", GIT_FETCH_NEGOTIATION_CONSECUTIVE},
+	{GIT_CVAR_STRING, "skipping", GIT_FETCH_NEGOTIATION_SKIPPING},
+	{GIT_CVAR_STRING, "noop", GIT_FETCH_NEGOTIATION_NOOP},
+};
+
+static int negotiation_algorithm(
+	git_fetch_negotiation_t *out, git_remote *remote, const git_fetch_options *opts)
+{
+	git_config *cfg;
+	int value, error;
+
+	*out = GIT_FETCH_NEGOTIATION_CONSECUTIVE;
+
+	if (opts && opts->version >= GIT_FETCH_OPTIONS_NEGOTIATION_VERSION &&
+	    opts->negotiation != GIT_FETCH_NEGOTIATION_UNSPECIFIED) {
+		*out = opts->negotiation;
+		return 0;
+	}
+
+	if ((error = git_repository_config__weakptr(&cfg, remote->repo)) < 0)
+		return error;
+
+	error = git_config_get_mapped(&value, cfg, "fetch.negotiationalgorithm",
+		negotiation_algorithms, ARRAY_SIZE(negotiation_algorithms));
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (!error)
+		*out = value;
+
+	return error;
+}
+
+/* Take how to move the shallow boundary from the options */
+static int set_deepen(git_remote *remote, const git_fetch_options *opts)
+{
+	remote->depth = 0;
+	remote->shallow_since = 0;
+	git_strarray_free(&remote->shallow_exclude);
+
+	git_array_clear(remote->shallow_ids);
+	git_array_clear(remote->unshallow_ids);
+
+	if (!opts || opts->version < GIT_FETCH_OPTIONS_DEEPEN_VERSION)
+		return 0;
+
+	if (opts->depth < 0) {
+		giterr_set(GITERR_INVALID, "invalid fetch depth %d", opts->depth);
+		return -1;
+	}
+
+	if (opts->depth && (opts->shallow_since || opts->shallow_exclude.count)) {
+		giterr_set(GITERR_INVALID,
+			"a fetch depth cannot be combined with shallow_since or shallow_exclude");
+		return -1;
+	}
+
+	remote->depth = opts->depth;
+	remote->shallow_since = opts->shallow_since;
+
+	return git_strarray_copy(&remote->shallow_exclude, &opts->shallow_exclude);
+}
+
 /*
- * In this first version, we push all our refs in and start sending
- * them out. When we get an ACK we hide that commit and continue
- * traversing until we're done
+ * Filter the wants and let the transport tell the server what we want
+ * and what we have; the smart transport asks the negotiator picked by
+ * `negotiation_algorithm()` which commits to send.
  */
 int git_fetch_negotiate(git_remote *remote, const git_fetch_options *opts)
 {
 	git_transport *t = remote->transport;
+	int error;
 
 	remote->need_pack = 0;
 
+	if ((error = negotiation_algorithm(&remote->negotiation, remote, opts)) < 0 ||
+	    (error = set_deepen(remote, opts)) < 0 ||
+	    (error = git_shallow__refresh(remote->repo)) < 0)
+		return error;
+
 	if (filter_wants(remote, opts) < 0) {
 		giterr_set(GITERR_NET, "Failed to filter the reference list for wants");
 		return -1;
@@ -136,6 +223,7 @@ int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *call
 	git_transport *t = remote->transport;
 	git_transfer_progress_cb progress = NULL;
 	void *payload = NULL;
+	int error;
 
 	if (!remote->need_pack)
 		return 0;
@@ -145,7 +233,11 @@ int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *call
 		payload  = callbacks->payload;
 	}
 
-	return t->download_pack(t, remote->repo, &remote->stats, progress, payload);
+	if ((error = t->download_pack(t, remote->repo, &remote->stats, progress, payload)) < 0)
+		return error;
+
+	/* Now that we have the commits, move the shallow boundary */
+	return git_shallow__update(remote->repo, &remote->shallow_ids, &remote->unshallow_ids);
 }
 
 int git_fetch_init_options(git_fetch_options *opts, unsigned int version)
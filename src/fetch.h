@@ -8,6 +8,11 @@
 #define INCLUDE_fetch_h__
 
 #include "netops.h"
+#include "buffer.h"
+
+/* The first version of `git_fetch_options` with each of these fields */
+#define GIT_FETCH_OPTIONS_NEGOTIATION_VERSION 2
+#define GIT_FETCH_OPTIONS_DEEPEN_VERSION 3
 
 int git_fetch_negotiate(git_remote *remote, const git_fetch_options *opts);
 
@@ -15,4 +20,10 @@ int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *call
 
 int git_fetch_setup_walk(git_revwalk **out, git_repository *repo);
 
+/*
+ * The host which `git_remote_fetch_batch` counts a fetch from `url`
+ * against, without the user name and port; empty for a local path.
+ */
+int git_fetch_batch__host(git_buf *out, const char *url);
+
 #endif
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "git2/remote.h"
+
+#include "common.h"
+#include "fetch.h"
+#include "remote.h"
+#include "thread-utils.h"
+
+#define FETCH_BATCH_DEFAULT_THREADS 4
+
+typedef enum {
+	JOB_PENDING = 0,
+	JOB_RUNNING,
+	JOB_DONE,
+} batch_job_state;
+
+struct fetch_batch;
+
+typedef struct {
+	struct fetch_batch *batch;
+	git_fetch_batch_job *job;
+	size_t index;
+	char *host; /* NULL for local repositories */
+	batch_job_state state;
+	git_error_state error_state;
+} batch_job;
+
+typedef struct fetch_batch {
+	batch_job *jobs;
+	size_t count;
+	size_t pending;
+	git_fetch_batch_options opts;
+
+	git_mutex lock;
+	git_cond done;
+
+	/* held while calling back, so that the callbacks see one job at a time */
+	git_mutex callback_lock;
+} fetch_batch;
+
+int git_fetch_batch__host(git_buf *out, const char *url)
+{
+	const char *host, *sep, *at;
+	size_t len;
+
+	git_buf_clear(out);
+
+	if ((sep = strstr(url, "://")) != NULL) {
+		host = sep + 3;
+		len = strcspn(host, "/");
+	} else if ((sep = strchr(url, ':')) != NULL && sep - url > 1 &&
+		memchr(url, '/', sep - url) == NULL) {
+		/* scp-like syntax: [user@]host:path */
+		host = url;
+		len = sep - url;
+	} else {
+		return 0;
+	}
+
+	/* leave out the user name and password */
+	for (at = host + len; at > host && at[-1] != '@'; at--)
+		/* nothing */;
+
+	len -= at - host;
+	host = at;
+
+	/* and the port */
+	if (len && host[0] == '[')
+		len = (sep = memchr(host, ']', len)) ? (size_t)(sep - host) + 1 : len;
+	else if ((sep = memchr(host, ':', len)) != NULL)
+		len = sep - host;
+
+	return git_buf_put(out, host, len);
+}
+
+/*
+ * Wrappers for the callbacks of the fetch options, which get the job
+ * as their payload.
+ */
+
+#define CALLBACK_BEGIN(payload) \
+	batch_job *job = payload; \
+	fetch_batch *batch = job->batch; \
+	const git_remote_callbacks *cbs = &batch->opts.fetch_opts.callbacks; \
+	int error; \
+	git_mutex_lock(&batch->callback_lock);
+
+#define CALLBACK_END \
+	git_mutex_unlock(&batch->callback_lock); \
+	return error;
+
+static int batch_sideband_progress(const char *str, int len, void *payload)
+{
+	CALLBACK_BEGIN(payload);
+	error = cbs->sideband_progress(str, len, cbs->payload);
+	CALLBACK_END;
+}
+
+static int batch_credentials(
+	git_cred **cred,
+	const char *url,
+	const char *username_from_url,
+	unsigned int allowed_types,
+	void *payload)
+{
+	CALLBACK_BEGIN(payload);
+	error = cbs->credentials(cred, url, username_from_url, allowed_types, cbs->payload);
+	CALLBACK_END;
+}
+
+static int batch_certificate_check(git_cert *cert, int valid, const char *host, void *payload)
+{
+	CALLBACK_BEGIN(payload);
+	error = cbs->certificate_check(cert, valid, host, cbs->payload);
+	CALLBACK_END;
+}
+
+static int batch_transfer_progress(const git_transfer_progress *stats, void *payload)
+{
+	CALLBACK_BEGIN(payload);
+
+	error = cbs->transfer_progress ?
+		cbs->transfer_progress(stats, cbs->payload) : 0;
+
+	if (!error && batch->opts.progress)
+		error = batch->opts.progress(job->index, stats, batch->opts.payload);
+
+	CALLBACK_END;
+}
+
+static int batch_update_tips(const char *refname, const git_oid *a, const git_oid *b, void *payload)
+{
+	CALLBACK_BEGIN(payload);
+	error = cbs->update_tips(refname, a, b, cbs->payload);
+	CALLBACK_END;
+}
+
+static int batch_transport(git_transport **out, git_remote *owner, void *payload)
+{
+	CALLBACK_BEGIN(payload);
+	error = cbs->transport(out, owner, cbs->payload);
+	CALLBACK_END;
+}
+
+static int run_job(batch_job *job)
+{
+	const git_remote_callbacks *cbs = &job->batch->opts.fetch_opts.callbacks;
+	git_fetch_options opts;
+	git_remote_callbacks *job_cbs = &opts.callbacks;
+
+	memcpy(&opts, &job->batch->opts.fetch_opts, sizeof(git_fetch_options));
+
+	memset(job_cbs, 0, sizeof(git_remote_callbacks));
+	job_cbs->version = GIT_REMOTE_CALLBACKS_VERSION;
+	job_cbs->payload = job;
+
+	if (cbs->sideband_progress)
+		job_cbs->sideband_progress = batch_sideband_progress;
+	if (cbs->credentials)
+		job_cbs->credentials = batch_credentials;
+	if (cbs->certificate_check)
+		job_cbs->certificate_check = batch_certificate_check;
+	if (cbs->transfer_progress || job->batch->opts.progress)
+		job_cbs->transfer_progress = batch_transfer_progress;
+	if (cbs->update_tips)
+		job_cbs->update_tips = batch_update_tips;
+	if (cbs->transport)
+		job_cbs->transport = batch_transport;
+
+	return git_remote_fetch(job->job->remote,
+		job->job->refspecs, &opts, job->job->reflog_message);
+}
+
+static void finish_job(batch_job *job, int error)
+{
+	job->job->error = error;
+
+	if (error < 0)
+		giterr_state_capture(&job->error_state, error);
+}
+
+/*
+ * Whether the job can start alongside the running ones: it may not use
+ * the same repository as any of them, nor go over the limit of its host.
+ */
+static bool can_start(fetch_batch *batch, batch_job *job)
+{
+	git_repository *repo = git_remote_owner(job->job->remote);
+	unsigned int same_host = 0;
+	size_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		batch_job *running = &batch->jobs[i];
+
+		if (running->state != JOB_RUNNING)
+			continue;
+
+		if (git_remote_owner(running->job->remote) == repo)
+			return false;
+
+		if (job->host && running->host && !strcmp(job->host, running->host))
+			same_host++;
+	}
+
+	return !job->host || !batch->opts.max_per_host ||
+		same_host < batch->opts.max_per_host;
+}
+
+#ifdef GIT_THREADS
+
+static void *fetch_worker(void *payload)
+{
+	fetch_batch *batch = payload;
+	batch_job *job;
+	size_t i;
+	int error;
+
+	git_mutex_lock(&batch->lock);
+
+	while (batch->pending) {
+		for (job = NULL, i = 0; i < batch->count; i++) {
+			if (batch->jobs[i].state == JOB_PENDING &&
+			    can_start(batch, &batch->jobs[i])) {
+				job = &batch->jobs[i];
+				break;
+			}
+		}
+
+		/* wait for a running job to make room */
+		if (!job) {
+			git_cond_wait(&batch->done, &batch->lock);
+			continue;
+		}
+
+		job->state = JOB_RUNNING;
+		batch->pending--;
+		git_mutex_unlock(&batch->lock);
+
+		error = run_job(job);
+		finish_job(job, error);
+
+		git_mutex_lock(&batch->lock);
+		job->state = JOB_DONE;
+		git_cond_broadcast(&batch->done);
+	}
+
+	git_mutex_unlock(&batch->lock);
+	return NULL;
+}
+
+/* Returns the number of threads which could be started */
+static unsigned int run_in_threads(fetch_batch *batch, unsigned int nthreads)
+{
+	git_thread *threads;
+	unsigned int started;
+
+	if ((threads = git__calloc(nthreads, sizeof(git_thread))) == NULL)
+		return 0;
+
+	if (git_cond_init(&batch->done) < 0) {
+		git__free(threads);
+		return 0;
+	}
+
+	for (started = 0; started < nthreads; started++) {
+		if (git_thread_create(&threads[started], NULL, fetch_worker, batch) != 0)
+			break;
+	}
+
+	/* the threads that did start run every job */
+	nthreads = started;
+
+	while (started)
+		git_thread_join(&threads[--started], NULL);
+
+	git_cond_free(&batch->done);
+	git__free(threads);
+	return nthreads;
+}
+
+#endif
+
+static void run_in_order(fetch_batch *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->count; i++) {
+		batch->jobs[i].state = JOB_RUNNING;
+		finish_job(&batch->jobs[i], run_job(&batch->jobs[i]));
+		batch->jobs[i].state = JOB_DONE;
+	}
+
+	batch->pending = 0;
+}
+
+int git_remote_fetch_batch(
+	git_fetch_batch_job *jobs,
+	size_t count,
+	const git_fetch_batch_options *given_opts)
+{
+	fetch_batch batch;
+	git_buf host = GIT_BUF_INIT;
+	unsigned int nthreads;
+	size_t i;
+	int error = 0;
+
+	assert(jobs || !count);
+
+	GITERR_CHECK_VERSION(given_opts, GIT_FETCH_BATCH_OPTIONS_VERSION, "git_fetch_batch_options");
+
+	memset(&batch, 0, sizeof(fetch_batch));
+
+	if (given_opts)
+		memcpy(&batch.opts, given_opts, sizeof(git_fetch_batch_options));
+	else
+		git_fetch_batch_init_options(&batch.opts, GIT_FETCH_BATCH_OPTIONS_VERSION);
+
+	GITERR_CHECK_VERSION(&batch.opts.fetch_opts.callbacks,
+		GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
+
+	if (!count)
+		return 0;
+
+	batch.jobs = git__calloc(count, sizeof(batch_job));
+	GITERR_CHECK_ALLOC(batch.jobs);
+
+	batch.count = batch.pending = count;
+
+	for (i = 0; i < count; i++) {
+		batch_job *job = &batch.jobs[i];
+
+		job->batch = &batch;
+		job->job = &jobs[i];
+		job->index = i;
+		jobs[i].error = 0;
+
+		if ((error = git_fetch_batch__host(&host, git_remote_url(jobs[i].remote))) < 0)
+			goto done;
+
+		if (host.size && (job->host = git_buf_detach(&host)) == NULL) {
+			error = -1;
+			goto done;
+		}
+	}
+
+	if ((nthreads = batch.opts.threads) == 0)
+		nthreads = FETCH_BATCH_DEFAULT_THREADS;
+
+	if (nthreads > count)
+		nthreads = (unsigned int)count;
+
+	if (git_mutex_init(&batch.lock) < 0 ||
+		git_mutex_init(&batch.callback_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize the fetch batch locks");
+		error = -1;
+		goto done;
+	}
+
+#ifdef GIT_THREADS
+	if (nthreads < 2 || !run_in_threads(&batch, nthreads))
+#endif
+		run_in_order(&batch);
+
+	git_mutex_free(&batch.callback_lock);
+	git_mutex_free(&batch.lock);
+
+	for (i = 0; i < count; i++) {
+		if (jobs[i].error) {
+			error = jobs[i].error;
+			giterr_state_restore(&batch.jobs[i].error_state);
+			break;
+		}
+	}
+
+done:
+	for (i = 0; i < count; i++) {
+		giterr_state_free(&batch.jobs[i].error_state);
+		git__free(batch.jobs[i].host);
+	}
+
+	git_buf_free(&host);
+	git__free(batch.jobs);
+	return error;
+}
+
+int git_fetch_batch_init_options(git_fetch_batch_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_fetch_batch_options, GIT_FETCH_BATCH_OPTIONS_INIT);
+	return 0;
+}
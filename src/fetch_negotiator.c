@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fetch_negotiator.h"
+
+#include "git2/refs.h"
+#include "git2/revwalk.h"
+
+#include "commit_list.h"
+#include "pqueue.h"
+#include "refs.h"
+#include "revwalk.h"
+
+/* Flags of the commits in the negotiator's own walk */
+#define COMMON (1 << 0)
+#define POPPED (1 << 1)
+
+typedef struct {
+	git_commit_list_node *commit;
+	uint32_t original_ttl;
+	uint32_t ttl;
+} negotiator_entry;
+
+struct git_fetch_negotiator {
+	git_fetch_negotiation_t algorithm;
+	git_revwalk *walk;
+
+	/* consecutive: the walk stops with the first ack */
+	bool acked;
+
+	/* the others: the commits left to look at, and how many of them aren't known to be common */
+	git_pqueue queue;
+	size_t non_common;
+};
+
+static int entry_time_cmp(const void *a, const void *b)
+{
+	const negotiator_entry *entry_a = a, *entry_b = b;
+
+	return git_commit_list_time_cmp(entry_a->commit, entry_b->commit);
+}
+
+static int entry_generation_cmp(const void *a, const void *b)
+{
+	const negotiator_entry *entry_a = a, *entry_b = b;
+
+	return git_commit_list_generation_cmp(entry_a->commit, entry_b->commit);
+}
+
+static int push_commit(
+	negotiator_entry **out,
+	git_fetch_negotiator *negotiator,
+	git_commit_list_node *commit)
+{
+	negotiator_entry *entry;
+	int error;
+
+	if ((error = git_commit_list_parse(negotiator->walk, commit)) < 0)
+		return error;
+
+	entry = git__calloc(1, sizeof(negotiator_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->commit = commit;
+	commit->seen = 1;
+
+	if (git_pqueue_insert(&negotiator->queue, entry) < 0) {
+		git__free(entry);
+		return -1;
+	}
+
+	if (!(commit->flags & COMMON))
+		negotiator->non_common++;
+
+	if (out)
+		*out = entry;
+
+	return 0;
+}
+
+/* Mark the commit and the ancestors we've seen so far as common */
+static int mark_common(git_fetch_negotiator *negotiator, git_commit_list_node *commit)
+{
+	git_vector stack = GIT_VECTOR_INIT;
+	unsigned short i;
+	int error = 0;
+
+	if (git_vector_insert(&stack, commit) < 0)
+		return -1;
+
+	while ((commit = git_vector_last(&stack)) != NULL) {
+		git_vector_pop(&stack);
+
+		if (commit->flags & COMMON)
+			continue;
+
+		commit->flags |= COMMON;
+
+		if (commit->seen && !(commit->flags & POPPED))
+			negotiator->non_common--;
+
+		if (!commit->parsed)
+			continue;
+
+		for (i = 0; i < commit->out_degree; i++) {
+			git_commit_list_node *parent = commit->parents[i];
+
+			if (parent->seen && !(parent->flags & COMMON) &&
+			    (error = git_vector_insert(&stack, parent)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_vector_free(&stack);
+	return error;
+}
+
+static int push_parent(
+	bool *pushed,
+	git_fetch_negotiator *negotiator,
+	negotiator_entry *entry,
+	git_commit_list_node *parent)
+{
+	negotiator_entry *parent_entry = NULL, *e;
+	uint32_t original_ttl, ttl;
+	size_t i;
+	int error;
+
+	*pushed = false;
+
+	if (parent->seen) {
+		/*
+		 * It was already popped, because of clock skew; pretend
+		 * that this parent doesn't exist.
+		 */
+		if (parent->flags & POPPED)
+			return 0;
+
+		git_vector_foreach(&negotiator->queue, i, e) {
+			if (e->commit == parent) {
+				parent_entry = e;
+				break;
+			}
+		}
+
+		assert(parent_entry);
+	} else if ((error = push_commit(&parent_entry, negotiator, parent)) < 0) {
+		return error;
+	}
+
+	*pushed = true;
+
+	if (entry->commit->flags & COMMON)
+		return mark_common(negotiator, parent);
+
+	if (negotiator->algorithm != GIT_FETCH_NEGOTIATION_SKIPPING)
+		return 0;
+
+	/* Each commit we send lets its parents skip half as many again */
+	original_ttl = entry->ttl ? entry->original_ttl :
+		min(entry->original_ttl * 3 / 2 + 1, UINT16_MAX);
+	ttl = entry->ttl ? entry->ttl - 1 : original_ttl;
+
+	if (parent_entry->original_ttl < original_ttl) {
+		parent_entry->original_ttl = original_ttl;
+		parent_entry->ttl = ttl;
+	}
+
+	return 0;
+}
+
+static int next_in_queue(git_oid *out, git_fetch_negotiator *negotiator)
+{
+	git_commit_list_node *commit, *to_send = NULL;
+	negotiator_entry *entry;
+	unsigned short i;
+	int error = 0;
+
+	while (!to_send) {
+		bool pushed, parent_pushed = false;
+
+		if (!negotiator->non_common ||
+		    (entry = git_pqueue_pop(&negotiator->queue)) == NULL)
+			return GIT_ITEROVER;
+
+		commit = entry->commit;
+		commit->flags |= POPPED;
+
+		if (!(commit->flags & COMMON)) {
+			negotiator->non_common--;
+
+			if (!entry->ttl)
+				to_send = commit;
+		}
+
+		for (i = 0; i < commit->out_degree; i++) {
+			if ((error = push_parent(&pushed, negotiator, entry, commit->parents[i])) < 0)
+				break;
+
+			parent_pushed |= pushed;
+		}
+
+		git__free(entry);
+
+		if (error < 0)
+			return error;
+
+		/* Send the roots, which we would otherwise skip past */
+		if (!(commit->flags & COMMON) && !parent_pushed)
+			to_send = commit;
+	}
+
+	git_oid_cpy(out, &to_send->oid);
+	return 0;
+}
+
+static int push_tip(git_fetch_negotiator *negotiator, const git_oid *id)
+{
+	git_commit_list_node *commit;
+
+	if (negotiator->algorithm == GIT_FETCH_NEGOTIATION_CONSECUTIVE)
+		return git_revwalk_push(negotiator->walk, id);
+
+	if ((commit = git_revwalk__commit_lookup(negotiator->walk, id)) == NULL)
+		return -1;
+
+	if (commit->seen)
+		return 0;
+
+	return push_commit(NULL, negotiator, commit);
+}
+
+static int push_tips(git_fetch_negotiator *negotiator, git_repository *repo)
+{
+	git_reference *ref = NULL;
+	git_strarray refs;
+	size_t i;
+	int error;
+
+	if ((error = git_reference_list(&refs, repo)) < 0)
+		return error;
+
+	for (i = 0; i < refs.count; ++i) {
+		/* No tags */
+		if (!git__prefixcmp(refs.strings[i], GIT_REFS_TAGS_DIR))
+			continue;
+
+		if ((error = git_reference_lookup(&ref, repo, refs.strings[i])) < 0)
+			break;
+
+		if (git_reference_type(ref) != GIT_REF_SYMBOLIC &&
+		    (error = push_tip(negotiator, git_reference_target(ref))) < 0)
+			break;
+
+		git_reference_free(ref);
+		ref = NULL;
+	}
+
+	git_reference_free(ref);
+	git_strarray_free(&refs);
+	return error;
+}
+
+int git_fetch_negotiator_new(
+	git_fetch_negotiator **out,
+	git_repository *repo,
+	git_fetch_negotiation_t algorithm)
+{
+	git_fetch_negotiator *negotiator;
+	git_vector_cmp cmp = entry_time_cmp;
+	int error;
+
+	if (algorithm == GIT_FETCH_NEGOTIATION_UNSPECIFIED)
+		algorithm = GIT_FETCH_NEGOTIATION_CONSECUTIVE;
+
+	if (algorithm == GIT_FETCH_NEGOTIATION_CONSECUTIVE_GENERATION)
+		cmp = entry_generation_cmp;
+	else if (algorithm != GIT_FETCH_NEGOTIATION_CONSECUTIVE &&
+		algorithm != GIT_FETCH_NEGOTIATION_SKIPPING &&
+		algorithm != GIT_FETCH_NEGOTIATION_NOOP) {
+		giterr_set(GITERR_INVALID, "invalid fetch negotiation algorithm %d", (int)algorithm);
+		return -1;
+	}
+
+	negotiator = git__calloc(1, sizeof(git_fetch_negotiator));
+	GITERR_CHECK_ALLOC(negotiator);
+
+	negotiator->algorithm = algorithm;
+
+	if ((error = git_pqueue_init(&negotiator->queue, 0, 8, cmp)) < 0 ||
+	    (error = git_revwalk_new(&negotiator->walk, repo)) < 0)
+		goto on_error;
+
+	if (algorithm == GIT_FETCH_NEGOTIATION_NOOP)
+		goto done;
+
+	git_revwalk_sorting(negotiator->walk, GIT_SORT_TIME);
+
+	if ((error = push_tips(negotiator, repo)) < 0)
+		goto on_error;
+
+done:
+	*out = negotiator;
+	return 0;
+
+on_error:
+	git_fetch_negotiator_free(negotiator);
+	return error;
+}
+
+int git_fetch_negotiator_next(git_oid *out, git_fetch_negotiator *negotiator)
+{
+	switch (negotiator->algorithm) {
+	case GIT_FETCH_NEGOTIATION_CONSECUTIVE:
+		if (negotiator->acked)
+			return GIT_ITEROVER;
+
+		return git_revwalk_next(out, negotiator->walk);
+
+	case GIT_FETCH_NEGOTIATION_NOOP:
+		return GIT_ITEROVER;
+
+	default:
+		return next_in_queue(out, negotiator);
+	}
+}
+
+int git_fetch_negotiator_ack(git_fetch_negotiator *negotiator, const git_oid *id)
+{
+	git_commit_list_node *commit;
+
+	if (negotiator->algorithm == GIT_FETCH_NEGOTIATION_CONSECUTIVE) {
+		negotiator->acked = true;
+		return 0;
+	}
+
+	if ((commit = git_revwalk__commit_lookup(negotiator->walk, id)) == NULL)
+		return -1;
+
+	return mark_common(negotiator, commit);
+}
+
+void git_fetch_negotiator_free(git_fetch_negotiator *negotiator)
+{
+	negotiator_entry *entry;
+	size_t i;
+
+	if (!negotiator)
+		return;
+
+	git_vector_foreach(&negotiator->queue, i, entry)
+		git__free(entry);
+
+	git_pqueue_free(&negotiator->queue);
+	git_revwalk_free(negotiator->walk);
+	git__free(negotiator);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fetch_negotiator_h__
+#define INCLUDE_fetch_negotiator_h__
+
+#include "common.h"
+#include "git2/remote.h"
+
+/*
+ * Picks the local commits to send as "have" lines while negotiating a
+ * fetch, and learns from the ones the server says it has.
+ */
+typedef struct git_fetch_negotiator git_fetch_negotiator;
+
+/*
+ * Start from the tips of the local branches (but not of the tags), as
+ * the negotiation always did.
+ */
+int git_fetch_negotiator_new(
+	git_fetch_negotiator **out,
+	git_repository *repo,
+	git_fetch_negotiation_t algorithm);
+
+/*
+ * The next commit to send, or GIT_ITEROVER once there's nothing left
+ * which is worth sending.
+ */
+int git_fetch_negotiator_next(git_oid *out, git_fetch_negotiator *negotiator);
+
+/* The server has this commit, and so all of its history */
+int git_fetch_negotiator_ack(git_fetch_negotiator *negotiator, const git_oid *id);
+
+void git_fetch_negotiator_free(git_fetch_negotiator *negotiator);
+
+#endif
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "fsmonitor.h"
+#include "index.h"
+#include "repository.h"
+#include "config.h"
+#include "ewah.h"
+
+#ifndef GIT_WIN32
+# include <sys/time.h>
+# include <sys/wait.h>
+# include <signal.h>
+#endif
+
+/*
+ * The FSMN extension holds the token of the last query of the monitor
+ * and a bitmap of the entries that were not known to be unchanged when
+ * the index was written.  Version 1, from the first versions of core
+ * git's hook protocol, has a timestamp in nanoseconds instead of a
+ * token; we read it but always write version 2.
+ */
+
+#define FSMONITOR_EXT_VERSION1 1
+#define FSMONITOR_EXT_VERSION2 2
+
+/* the token core git gives the hook when it has none */
+#define FSMONITOR_FAKE_TOKEN "builtin:fake"
+
+int git_fsmonitor_init(git_fsmonitor *monitor, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		monitor, version, git_fsmonitor, GIT_FSMONITOR_INIT);
+	return 0;
+}
+
+int git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor *monitor)
+{
+	assert(repo);
+
+	if (monitor)
+		GITERR_CHECK_VERSION(monitor, GIT_FSMONITOR_VERSION, "git_fsmonitor");
+
+	if ((monitor = git__swap(repo->_fsmonitor, monitor)) != NULL &&
+		monitor->free)
+		monitor->free(monitor);
+
+	return 0;
+}
+
+static int fsmonitor_error_invalid(const char *message)
+{
+	giterr_set(GITERR_INDEX, "Invalid fsmonitor data in index - %s", message);
+	return -1;
+}
+
+static void fsmonitor_set_all(git_index *index, bool valid)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (valid)
+			entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+		else
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
+}
+
+int git_fsmonitor__read_extension(
+	git_index *index, const char *buffer, size_t buffer_size)
+{
+	const char *end = buffer + buffer_size;
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_buf token = GIT_BUF_INIT;
+	uint32_t version, ewah_size;
+	size_t consumed, i, len;
+	int error = -1;
+
+	if (buffer_size < sizeof(uint32_t))
+		return fsmonitor_error_invalid("insufficient buffer space");
+
+	memcpy(&version, buffer, sizeof(uint32_t));
+	version = ntohl(version);
+	buffer += sizeof(uint32_t);
+
+	if (version == FSMONITOR_EXT_VERSION1) {
+		uint32_t timestamp[2];
+
+		if ((size_t)(end - buffer) < sizeof(timestamp)) {
+			fsmonitor_error_invalid("truncated timestamp");
+			goto done;
+		}
+
+		memcpy(timestamp, buffer, sizeof(timestamp));
+		buffer += sizeof(timestamp);
+
+		if (git_buf_printf(&token, "%"PRIu64,
+				((uint64_t)ntohl(timestamp[0]) << 32) | ntohl(timestamp[1])) < 0)
+			goto done;
+	} else if (version == FSMONITOR_EXT_VERSION2) {
+		if ((len = p_strnlen(buffer, end - buffer)) == (size_t)(end - buffer)) {
+			fsmonitor_error_invalid("unterminated token");
+			goto done;
+		}
+
+		if (git_buf_put(&token, buffer, len) < 0)
+			goto done;
+		buffer += len + 1;
+	} else {
+		fsmonitor_error_invalid("unknown version");
+		goto done;
+	}
+
+	if ((size_t)(end - buffer) < sizeof(uint32_t)) {
+		fsmonitor_error_invalid("truncated bitmap");
+		goto done;
+	}
+
+	memcpy(&ewah_size, buffer, sizeof(uint32_t));
+	ewah_size = ntohl(ewah_size);
+	buffer += sizeof(uint32_t);
+
+	if (ewah_size != (size_t)(end - buffer) ||
+		git_ewah_parse(&dirty, &consumed,
+			(const unsigned char *)buffer, ewah_size) < 0 ||
+		consumed != ewah_size) {
+		fsmonitor_error_invalid("invalid bitmap");
+		goto done;
+	}
+
+	/* the bitmap has a bit for each entry, in the order of the file */
+	for (i = index->entries.length; i < dirty.word_alloc * GIT_BITMAP_WORD_BITS; i++) {
+		if (git_bitmap_get(&dirty, i)) {
+			fsmonitor_error_invalid("bitmap is larger than the index");
+			goto done;
+		}
+	}
+
+	for (i = 0; i < index->entries.length; i++) {
+		git_index_entry *entry = git_vector_get(&index->entries, i);
+
+		if (git_bitmap_get(&dirty, i))
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+		else
+			entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+	}
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = git_buf_detach(&token);
+	error = 0;
+
+done:
+	git_bitmap_free(&dirty);
+	git_buf_free(&token);
+	return error;
+}
+
+int git_fsmonitor__write_extension(git_buf *out, git_index *index)
+{
+	git_bitmap dirty = GIT_BITMAP_INIT;
+	git_vector case_sorted = GIT_VECTOR_INIT, *entries = &index->entries;
+	git_index_entry *entry;
+	uint32_t version = htonl(FSMONITOR_EXT_VERSION2), ewah_size = 0;
+	size_t i, size_offset;
+	int error = -1;
+
+	assert(index->fsmonitor_token);
+
+	/* the bits follow the order of the entries on disk */
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp) < 0)
+			return -1;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	}
+
+	git_vector_foreach(entries, i, entry) {
+		if (!(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) &&
+			git_bitmap_set(&dirty, i) < 0)
+			goto done;
+	}
+
+	if (git_buf_put(out, (const char *)&version, sizeof(version)) < 0 ||
+		git_buf_put(out, index->fsmonitor_token,
+			strlen(index->fsmonitor_token) + 1) < 0)
+		goto done;
+
+	size_offset = out->size;
+
+	/* the size of the bitmap goes first, filled in once we know it */
+	if (git_buf_put(out, (const char *)&ewah_size, sizeof(ewah_size)) < 0 ||
+		git_ewah_serialize_bits(out, &dirty) < 0)
+		goto done;
+
+	ewah_size = htonl((uint32_t)(out->size - size_offset - sizeof(ewah_size)));
+	memcpy(out->ptr + size_offset, &ewah_size, sizeof(ewah_size));
+	error = 0;
+
+done:
+	git_vector_free(&case_sorted);
+	git_bitmap_free(&dirty);
+	return error;
+}
+
+size_t git_fsmonitor__mark_valid(git_index *index, const git_vector *paths)
+{
+	git_index_entry *entry;
+	const char *path;
+	size_t i, pos, marked = 0;
+
+	git_vector_foreach(paths, i, path) {
+		if (git_index__find_pos(&pos, index, path, 0, 0) < 0)
+			continue;
+
+		entry = git_vector_get(&index->entries, pos);
+
+		if (!(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID)) {
+			entry->flags_extended |= GIT_IDXENTRY_FSMONITOR_VALID;
+			marked++;
+		}
+	}
+
+	return marked;
+}
+
+#ifndef GIT_WIN32
+
+/* The `core.fsmonitor` hook, run with the version of the protocol and
+ * the token as arguments.  Version 2 prints the new token followed by
+ * the changed paths, each one NUL terminated.  Version 1 takes and
+ * hands out timestamps in nanoseconds and prints only the paths.
+ */
+typedef struct {
+	git_fsmonitor parent;
+	char *command;
+	char *workdir;
+	int version; /* 0 to try version 2, then version 1 */
+} fsmonitor_hook;
+
+static int fsmonitor_hook_run(
+	git_buf *out,
+	fsmonitor_hook *hook,
+	const char *version,
+	const char *token)
+{
+	git_buf script = GIT_BUF_INIT;
+	char buf[4096];
+	ssize_t read_len;
+	int fds[2], status, error = 0;
+	pid_t pid;
+
+	/* like core git, give the arguments to the command through the shell */
+	if (git_buf_printf(&script, "%s \"$@\"", hook->command) < 0)
+		return -1;
+
+	if (pipe(fds) < 0) {
+		giterr_set(GITERR_OS, "Failed to create a pipe for the fsmonitor hook");
+		git_buf_free(&script);
+		return -1;
+	}
+
+	if ((pid = fork()) < 0) {
+		giterr_set(GITERR_OS, "Failed to run the fsmonitor hook");
+		close(fds[0]);
+		close(fds[1]);
+		git_buf_free(&script);
+		return -1;
+	}
+
+	if (pid == 0) {
+		int null_fd = open("/dev/null", O_RDONLY);
+
+		if (null_fd >= 0)
+			dup2(null_fd, STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+
+		if (chdir(hook->workdir) == 0)
+			execl("/bin/sh", "sh", "-c", script.ptr,
+				hook->command, version, token, (char *)NULL);
+
+		_exit(127);
+	}
+
+	close(fds[1]);
+
+	while ((read_len = read(fds[0], buf, sizeof(buf))) != 0) {
+		if (read_len < 0 && errno == EINTR)
+			continue;
+
+		if (read_len < 0) {
+			giterr_set(GITERR_OS, "Failed to read from the fsmonitor hook");
+			error = -1;
+		} else {
+			error = git_buf_put(out, buf, read_len);
+		}
+
+		if (error < 0) {
+			kill(pid, SIGKILL);
+			break;
+		}
+	}
+
+	close(fds[0]);
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			giterr_set(GITERR_OS, "Failed to wait for the fsmonitor hook");
+			error = -1;
+			goto done;
+		}
+	}
+
+	if (!error && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+		giterr_set(GITERR_INVALID,
+			"The fsmonitor hook '%s' failed", hook->command);
+		error = -1;
+	}
+
+done:
+	git_buf_free(&script);
+	return error;
+}
+
+static int fsmonitor_hook_report(
+	const char *paths,
+	size_t len,
+	git_fsmonitor_path_cb path_cb,
+	void *payload)
+{
+	const char *end = paths + len, *path_end;
+	int error = 0;
+
+	for (; paths < end && !error; paths = path_end + 1) {
+		if ((path_end = memchr(paths, '\0', end - paths)) == NULL)
+			path_end = end;
+
+		if (path_end > paths) {
+			char *path = git__substrdup(paths, path_end - paths);
+			GITERR_CHECK_ALLOC(path);
+
+			error = giterr_set_after_callback_function(
+				path_cb(path, payload), "git_fsmonitor_path_cb");
+			git__free(path);
+		}
+	}
+
+	return error;
+}
+
+static int fsmonitor_hook_query(
+	git_fsmonitor *monitor,
+	git_buf *token_out,
+	const char *token,
+	git_fsmonitor_path_cb path_cb,
+	void *payload)
+{
+	fsmonitor_hook *hook = (fsmonitor_hook *)monitor;
+	git_buf output = GIT_BUF_INIT;
+	struct timeval now;
+	size_t token_len;
+	int error = -1;
+
+	if (hook->version != 1) {
+		error = fsmonitor_hook_run(&output, hook, "2",
+			token ? token : FSMONITOR_FAKE_TOKEN);
+
+		if (!error) {
+			token_len = p_strnlen(output.ptr, output.size);
+
+			if (!token_len) {
+				giterr_set(GITERR_INVALID,
+					"The fsmonitor hook '%s' gave no token", hook->command);
+				error = -1;
+			} else if ((error = git_buf_put(token_out, output.ptr, token_len)) == 0 &&
+				token_len < output.size)
+				error = fsmonitor_hook_report(
+					output.ptr + token_len + 1, output.size - token_len - 1,
+					path_cb, payload);
+		}
+
+		if (!error || hook->version == 2)
+			goto done;
+
+		giterr_clear();
+		git_buf_clear(&output);
+		git_buf_clear(token_out);
+	}
+
+	/* the new timestamp must be taken before asking what changed */
+	gettimeofday(&now, NULL);
+	if ((error = git_buf_printf(token_out, "%"PRIu64,
+			(uint64_t)now.tv_sec * 1000000000 + now.tv_usec * 1000)) < 0)
+		goto done;
+
+	/* a token from a version 2 hook means nothing to a version 1 one */
+	if (!token || token[strspn(token, "0123456789")] != '\0') {
+		error = token ? path_cb("/", payload) : 0;
+		goto done;
+	}
+
+	if ((error = fsmonitor_hook_run(&output, hook, "1", token)) == 0)
+		error = fsmonitor_hook_report(
+			output.ptr, output.size, path_cb, payload);
+
+done:
+	git_buf_free(&output);
+	return error;
+}
+
+static void fsmonitor_hook_free(git_fsmonitor *monitor)
+{
+	fsmonitor_hook *hook = (fsmonitor_hook *)monitor;
+
+	git__free(hook->command);
+	git__free(hook->workdir);
+	git__free(hook);
+}
+
+static int fsmonitor_hook_new(
+	git_fsmonitor **out,
+	const char *workdir,
+	const char *command,
+	int version)
+{
+	fsmonitor_hook *hook = git__calloc(1, sizeof(fsmonitor_hook));
+	GITERR_CHECK_ALLOC(hook);
+
+	hook->parent.version = GIT_FSMONITOR_VERSION;
+	hook->parent.query = fsmonitor_hook_query;
+	hook->parent.free = fsmonitor_hook_free;
+	hook->command = git__strdup(command);
+	hook->workdir = git__strdup(workdir);
+	hook->version = version;
+
+	if (!hook->command || !hook->workdir) {
+		fsmonitor_hook_free(&hook->parent);
+		return -1;
+	}
+
+	*out = &hook->parent;
+	return 0;
+}
+
+#else
+
+static int fsmonitor_hook_new(
+	git_fsmonitor **out,
+	const char *workdir,
+	const char *command,
+	int version)
+{
+	GIT_UNUSED(workdir);
+	GIT_UNUSED(version);
+
+	*out = NULL;
+	giterr_set(GITERR_INVALID,
+		"Running the fsmonitor hook '%s' is not supported on Windows", command);
+	return -1;
+}
+
+#endif
+
+/* The monitor set on the repository, or one for the `core.fsmonitor`
+ * hook that the caller must free.
+ */
+static int fsmonitor_lookup(
+	git_fsmonitor **out, bool *owned, git_repository *repo)
+{
+	git_config *cfg;
+	git_config_entry *entry = NULL;
+	int is_bool, version, error;
+
+	*out = NULL;
+	*owned = false;
+
+	if (repo->_fsmonitor) {
+		*out = repo->_fsmonitor;
+		return 0;
+	}
+
+	if (repo->is_bare)
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0 ||
+		(error = git_config__lookup_entry(
+			&entry, cfg, "core.fsmonitor", false)) < 0)
+		return error;
+
+	/* a boolean asks for core git's own daemon, which we can't talk to */
+	if (!entry || !entry->value || !*entry->value ||
+		git_config_parse_bool(&is_bool, entry->value) == 0)
+		goto done;
+
+	giterr_clear();
+
+	version = git_config__get_int_force(cfg, "core.fsmonitorhookversion", 0);
+
+	if ((error = fsmonitor_hook_new(
+			out, repo->workdir, entry->value, version)) == 0)
+		*owned = true;
+
+done:
+	git_config_entry_free(entry);
+	return error;
+}
+
+typedef struct {
+	git_index *index;
+	int (*strncomp)(const char *a, const char *b, size_t len);
+	bool all_changed;
+} fsmonitor_refresh;
+
+static int fsmonitor_refresh_path(const char *path, void *payload)
+{
+	fsmonitor_refresh *refresh = payload;
+	git_index_entry *entry;
+	size_t pos, len = strlen(path);
+
+	if (!strcmp(path, "/")) {
+		refresh->all_changed = true;
+		return 0;
+	}
+
+	if (len && path[len - 1] == '/')
+		len--;
+
+	/* the path itself, and everything beneath it if it is a directory */
+	git_index__find_pos(&pos, refresh->index, path, len, GIT_INDEX_STAGE_ANY);
+
+	while ((entry = git_vector_get(&refresh->index->entries, pos++)) != NULL &&
+		refresh->strncomp(entry->path, path, len) == 0) {
+		if (entry->path[len] == '\0' || entry->path[len] == '/')
+			entry->flags_extended &= ~GIT_IDXENTRY_FSMONITOR_VALID;
+	}
+
+	giterr_clear();
+	return 0;
+}
+
+int git_fsmonitor__refresh(
+	bool *valid, bool *changed, git_repository *repo, git_index *index)
+{
+	git_fsmonitor *monitor;
+	git_buf token = GIT_BUF_INIT;
+	fsmonitor_refresh refresh;
+	bool owned;
+	int error;
+
+	*valid = *changed = false;
+
+	if ((error = fsmonitor_lookup(&monitor, &owned, repo)) < 0)
+		return error;
+
+	/* like core git, forget what the monitor told us once it is gone */
+	if (!monitor) {
+		if (index->fsmonitor_token) {
+			git__free(index->fsmonitor_token);
+			index->fsmonitor_token = NULL;
+			fsmonitor_set_all(index, false);
+			*changed = true;
+		}
+		return 0;
+	}
+
+	/* without a token, whatever flags we have could be stale */
+	if (!index->fsmonitor_token)
+		fsmonitor_set_all(index, false);
+
+	memset(&refresh, 0, sizeof(refresh));
+	refresh.index = index;
+	refresh.strncomp = index->ignore_case ? git__strncasecmp : git__strncmp;
+
+	error = monitor->query(monitor, &token, index->fsmonitor_token,
+		fsmonitor_refresh_path, &refresh);
+
+	/* when the monitor can't tell, everything may have changed, and
+	 * nothing it said before can be trusted
+	 */
+	if (error < 0 || !token.size) {
+		giterr_clear();
+		error = 0;
+
+		fsmonitor_set_all(index, false);
+
+		if (index->fsmonitor_token) {
+			git__free(index->fsmonitor_token);
+			index->fsmonitor_token = NULL;
+			*changed = true;
+		}
+
+		goto done;
+	}
+
+	if (refresh.all_changed)
+		fsmonitor_set_all(index, false);
+
+	if (!index->fsmonitor_token ||
+		strcmp(index->fsmonitor_token, token.ptr) != 0) {
+		git__free(index->fsmonitor_token);
+		index->fsmonitor_token = git_buf_detach(&token);
+		*changed = true;
+	}
+
+	*valid = true;
+
+done:
+	if (owned)
+		monitor->free(monitor);
+
+	git_buf_free(&token);
+	return error;
+}
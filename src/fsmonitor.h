@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_fsmonitor_h__
+#define INCLUDE_fsmonitor_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "vector.h"
+#include "git2/sys/fsmonitor.h"
+
+/* Ask the filesystem monitor of the repository (the one set with
+ * `git_repository_set_fsmonitor`, or else the `core.fsmonitor` hook)
+ * what changed since the token stored in `index`, and clear the
+ * `GIT_IDXENTRY_FSMONITOR_VALID` flag of the entries it reports.
+ *
+ * `valid` tells whether the flags of the other entries can be trusted,
+ * and `changed` whether the index now needs to be written.
+ */
+extern int git_fsmonitor__refresh(
+	bool *valid, bool *changed, git_repository *repo, git_index *index);
+
+/* Set the `GIT_IDXENTRY_FSMONITOR_VALID` flag of the stage 0 entries
+ * of `index` at `paths`, returning how many were not set already.
+ */
+extern size_t git_fsmonitor__mark_valid(
+	git_index *index, const git_vector *paths);
+
+/* Parse the data of an FSMN index extension into `index` */
+extern int git_fsmonitor__read_extension(
+	git_index *index, const char *buffer, size_t buffer_size);
+
+/* Serialize the token and flags of `index` as the data of an FSMN
+ * index extension
+ */
+extern int git_fsmonitor__write_extension(git_buf *out, git_index *index);
+
+#endif
@@ -10,6 +10,7 @@
 #include "sysdir.h"
 #include "filter.h"
 #include "openssl_stream.h"
+#include "stream_pool.h"
 #include "thread-utils.h"
 #include "git2/global.h"
 #include "transports/ssh.h"
@@ -41,7 +42,8 @@ static void git__global_state_cleanup(git_global_st *st)
 	if (!st)
 		return;
 
-	git__free(st->error_t.message);
+	/* the message of the last error is the error buffer's */
+	git_buf_free(&st->error_buf);
 	st->error_t.message = NULL;
 }
 
@@ -59,8 +61,9 @@ static int init_common(void)
 	if ((ret = git_hash_global_init()) == 0 &&
 		(ret = git_sysdir_global_init()) == 0 &&
 		(ret = git_filter_global_init()) == 0 &&
-		(ret = git_transport_ssh_global_init()) == 0)
-		ret = git_openssl_stream_global_init();
+		(ret = git_transport_ssh_global_init()) == 0 &&
+		(ret = git_openssl_stream_global_init()) == 0)
+		ret = git_stream_pool_global_init();
 
 	GIT_MEMORY_BARRIER;
 
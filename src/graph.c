@@ -41,7 +41,7 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 		return 0;
 	}
 
-	if (git_pqueue_init(&list, 0, 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if (git_commit_list_parse(walk, one) < 0)
@@ -172,21 +172,114 @@ on_error:
 	return -1;
 }
 
+/*
+ * Whether `ancestor` can be reached from `commit`.  Since a commit's
+ * generation is larger than those of all its parents, the walk never
+ * needs to go below the generation of `ancestor`.
+ */
+static int reachable_by_generation(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_list_node *ancestor)
+{
+	git_pqueue list;
+	uint32_t min_generation = git_commit_list_generation(ancestor);
+	int error = 0, found = 0;
+	unsigned int i;
+
+	if (git_pqueue_init(&list, 0, 8, git_commit_list_generation_cmp) < 0)
+		return -1;
+
+	commit->flags |= PARENT1;
+	if ((error = git_pqueue_insert(&list, commit)) < 0)
+		goto done;
+
+	while (!found && (commit = git_pqueue_pop(&list)) != NULL) {
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
+			goto done;
+
+		for (i = 0; i < commit->out_degree; i++) {
+			git_commit_list_node *p = commit->parents[i];
+
+			if (p == ancestor) {
+				found = 1;
+				break;
+			}
+
+			if (p->flags & PARENT1)
+				continue;
+
+			if ((error = git_commit_list_parse(walk, p)) < 0)
+				goto done;
+
+			if (git_commit_list_generation(p) <= min_generation)
+				continue;
+
+			p->flags |= PARENT1;
+			if ((error = git_pqueue_insert(&list, p)) < 0)
+				goto done;
+		}
+	}
+
+	error = found;
+
+done:
+	git_pqueue_free(&list);
+	return error;
+}
+
 int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
 {
-	git_oid merge_base;
+	git_revwalk *walk;
+	git_commit_list_node *commit_node, *ancestor_node;
+	git_commit_list *merge_bases = NULL;
+	git_vector list;
+	void *contents[1];
 	int error;
 
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
-	error = git_merge_base(&merge_base, repo, commit, ancestor);
-	/* No merge-base found, it's not a descendant */
-	if (error == GIT_ENOTFOUND)
-		return 0;
+	if (git_revwalk_new(&walk, repo) < 0)
+		return -1;
+
+	if ((commit_node = git_revwalk__commit_lookup(walk, commit)) == NULL ||
+		(ancestor_node = git_revwalk__commit_lookup(walk, ancestor)) == NULL) {
+		error = -1;
+		goto done;
+	}
 
-	if (error < 0)
-		return error;
+	if ((error = git_commit_list_parse(walk, commit_node)) < 0 ||
+		(error = git_commit_list_parse(walk, ancestor_node)) < 0)
+		goto done;
+
+	/*
+	 * With a known generation for the ancestor we can skip everything
+	 * below it; otherwise fall back to computing the merge-base.
+	 */
+	if (git_commit_list_generation(ancestor_node) != GENERATION_INFINITY) {
+		if (git_commit_list_generation(commit_node) <= git_commit_list_generation(ancestor_node))
+			error = 0;
+		else
+			error = reachable_by_generation(walk, commit_node, ancestor_node);
 
-	return git_oid_equal(&merge_base, ancestor);
+		goto done;
+	}
+
+	/* This is just one value, so we can do it on the stack */
+	memset(&list, 0x0, sizeof(git_vector));
+	contents[0] = ancestor_node;
+	list.length = 1;
+	list.contents = contents;
+
+	if ((error = git_merge__bases_many(&merge_bases, walk, commit_node, &list)) < 0)
+		goto done;
+
+	/* No merge-base found, it's not a descendant */
+	error = (merge_bases != NULL && merge_bases->item == ancestor_node);
+
+done:
+	git_commit_list_free(&merge_bases);
+	git_revwalk_free(walk);
+	return error;
 }
@@ -9,6 +9,7 @@
 #define GIT_IGNORE_INTERNAL		"[internal]exclude"
 
 #define GIT_IGNORE_DEFAULT_RULES ".\n..\n.git\n"
+#define GIT_IGNORE_DEFAULT_RULES_COUNT 3
 
 /**
  * A negative ignore pattern can match a positive one without
@@ -438,6 +439,20 @@ int git_ignore_add_rule(git_repository *repo, const char *rules)
 	return error;
 }
 
+int git_ignore__has_internal_rules(bool *out, git_repository *repo)
+{
+	int error;
+	git_attr_file *ign_internal;
+
+	if ((error = get_internal_ignores(&ign_internal, repo)) < 0)
+		return error;
+
+	*out = (ign_internal->rules.length != GIT_IGNORE_DEFAULT_RULES_COUNT);
+
+	git_attr_file__free(ign_internal);
+	return 0;
+}
+
 int git_ignore_clear_internal_rules(git_repository *repo)
 {
 	int error;
@@ -51,6 +51,9 @@ enum {
 
 extern int git_ignore__lookup(int *out, git_ignores *ign, const char *path, git_dir_flag dir_flag);
 
+/* Whether rules beyond the defaults were added with `git_ignore_add_rule` */
+extern int git_ignore__has_internal_rules(bool *out, git_repository *repo);
+
 /* command line Git sometimes generates an error message if given a
  * pathspec that contains an exact match to an ignored file (provided
  * --force isn't also given).  This makes it easy to check it that has
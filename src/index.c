@@ -19,6 +19,10 @@
 #include "blob.h"
 #include "idxmap.h"
 #include "diff.h"
+#include "fsmonitor.h"
+#include "ewah.h"
+#include "config.h"
+#include "varint.h"
 
 #include "git2/odb.h"
 #include "git2/oid.h"
@@ -29,6 +33,8 @@
 GIT__USE_IDXMAP
 GIT__USE_IDXMAP_ICASE
 
+bool git_index__lazy_map = false;
+
 #define INSERT_IN_MAP_EX(idx, map, e, err) do {				\
 		if ((idx)->ignore_case)					\
 			git_idxmap_icase_insert((khash_t(idxicase) *) (map), (e), (e), (err)); \
@@ -36,7 +42,13 @@ GIT__USE_IDXMAP_ICASE
 			git_idxmap_insert((map), (e), (e), (err));	\
 	} while (0)
 
-#define INSERT_IN_MAP(idx, e, err) INSERT_IN_MAP_EX(idx, (idx)->entries_map, e, err)
+/* while the map is pending, it is built from the entries when needed */
+#define INSERT_IN_MAP(idx, e, err) do {					\
+		if ((idx)->entries_map_pending)				\
+			(err) = 0;					\
+		else							\
+			INSERT_IN_MAP_EX(idx, (idx)->entries_map, e, err); \
+	} while (0)
 
 #define LOOKUP_IN_MAP(p, idx, k) do {					\
 		if ((idx)->ignore_case)					\
@@ -46,6 +58,8 @@ GIT__USE_IDXMAP_ICASE
 	} while (0)
 
 #define DELETE_IN_MAP(idx, e) do {					\
+		if ((idx)->entries_map_pending)				\
+			break;						\
 		if ((idx)->ignore_case)					\
 			git_idxmap_icase_delete((khash_t(idxicase) *) (idx)->entries_map, (e)); \
 		else							\
@@ -65,13 +79,45 @@ static int index_apply_to_wd_diff(git_index *index, int action, const git_strarr
 static const size_t INDEX_FOOTER_SIZE = GIT_OID_RAWSZ;
 static const size_t INDEX_HEADER_SIZE = 12;
 
-static const unsigned int INDEX_VERSION_NUMBER = 2;
+static const unsigned int INDEX_VERSION_NUMBER_DEFAULT = 2;
+static const unsigned int INDEX_VERSION_NUMBER_LB = 2;
 static const unsigned int INDEX_VERSION_NUMBER_EXT = 3;
+static const unsigned int INDEX_VERSION_NUMBER_COMP = 4;
+static const unsigned int INDEX_VERSION_NUMBER_UB = 4;
 
 static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+static const char INDEX_EXT_LINK_SIG[] = {'l', 'i', 'n', 'k'};
+static const char INDEX_EXT_OFFSET_TABLE_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_END_OF_ENTRIES_SIG[] = {'E', 'O', 'I', 'E'};
+
+static const uint32_t INDEX_OFFSET_TABLE_VERSION = 1;
+
+/* the offset of the extensions, then the hash of their headers */
+#define INDEX_END_OF_ENTRIES_SIZE (4 + GIT_OID_RAWSZ)
+
+/* The `IEOT` extension records where blocks of entries start, so that
+ * they can be parsed from several threads.  Like core git, it is only
+ * written when `index.threads` or `index.recordOffsetTable` asks for it,
+ * along with the `EOIE` extension that tells where the entries end.  An
+ * index is only read from several threads when it has at least
+ * INDEX_THREAD_COST entries per thread.
+ */
+#define INDEX_THREAD_COST 10000
+
+/* A split index is written next to a `sharedindex.<checksum>` file with
+ * most of its entries, which is rewritten once the split index holds
+ * more than `splitIndex.maxPercentChange` percent of the entries.
+ * Shared indexes no longer in use are removed once they are older than
+ * `splitIndex.sharedIndexExpire`.
+ */
+#define SHARED_INDEX_PREFIX "sharedindex."
+#define SPLIT_INDEX_MAX_PERCENT_CHANGE 20
+#define SHARED_INDEX_EXPIRE "2.weeks.ago"
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -129,6 +175,7 @@ struct entry_srch_key {
 struct entry_internal {
 	git_index_entry entry;
 	size_t pathlen;
+	bool pooled; /* freed with the entry pool of the index */
 	char path[GIT_FLEX_ARRAY];
 };
 
@@ -139,11 +186,21 @@ struct reuc_entry_internal {
 };
 
 /* local declarations */
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size);
+/* Extensions that apply to the entries are only read once they all are */
+typedef struct {
+	const char *link;
+	size_t link_size;
+	const char *fsmonitor;
+	size_t fsmonitor_size;
+} entry_extensions;
+
+static size_t read_extension(
+	git_index *index, entry_extensions *ext, const char *buffer, size_t buffer_size);
 static int read_header(struct index_header *dest, const void *buffer);
 
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size);
 static bool is_index_extended(git_index *index);
+static int index_map_build(git_index *index);
 static int write_index(git_oid *checksum, git_index *index, git_filebuf *file);
 
 static void index_entry_free(git_index_entry *entry);
@@ -324,13 +381,29 @@ static void index_entry_reuc_free(git_index_reuc_entry *reuc)
 
 static void index_entry_free(git_index_entry *entry)
 {
-	if (!entry)
+	if (!entry || ((struct entry_internal *)entry)->pooled)
 		return;
 
 	memset(&entry->id, 0, sizeof(entry->id));
 	git__free(entry);
 }
 
+static void index_shared_free(git_index_shared *shared)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	if (!shared)
+		return;
+
+	git_vector_foreach(&shared->entries, i, entry)
+		index_entry_free(entry);
+
+	git_vector_free(&shared->entries);
+	git_pool_clear(&shared->entry_pool);
+	git__free(shared);
+}
+
 unsigned int git_index__create_mode(unsigned int mode)
 {
 	if (S_ISLNK(mode))
@@ -412,6 +485,7 @@ int git_index_open(git_index **index_out, const char *index_path)
 	GITERR_CHECK_ALLOC(index);
 
 	git_pool_init(&index->tree_pool, 1);
+	git_pool_init(&index->entry_pool, 1);
 
 	if (index_path != NULL) {
 		index->index_file_path = git__strdup(index_path);
@@ -430,6 +504,7 @@ int git_index_open(git_index **index_out, const char *index_path)
 		git_vector_init(&index->deleted, 8, git_index_entry_cmp) < 0)
 		goto fail;
 
+	index->version = INDEX_VERSION_NUMBER_DEFAULT;
 	index->entries_cmp_path = git__strcmp_cb;
 	index->entries_search = git_index_entry_srch;
 	index->entries_search_path = index_entry_srch_path;
@@ -462,11 +537,14 @@ static void index_free(git_index *index)
 	assert(!git_atomic_get(&index->readers));
 
 	git_index_clear(index);
+	index_shared_free(index->shared);
 	git_idxmap_free(index->entries_map);
 	git_vector_free(&index->entries);
 	git_vector_free(&index->names);
 	git_vector_free(&index->reuc);
 	git_vector_free(&index->deleted);
+	git_vector_free(&index->deleted_pools);
+	git_pool_clear(&index->entry_pool);
 
 	git__free(index->index_file_path);
 
@@ -486,9 +564,10 @@ void git_index_free(git_index *index)
 static void index_free_deleted(git_index *index)
 {
 	int readers = (int)git_atomic_get(&index->readers);
+	git_pool *pool;
 	size_t i;
 
-	if (readers > 0 || !index->deleted.length)
+	if (readers > 0)
 		return;
 
 	for (i = 0; i < index->deleted.length; ++i) {
@@ -497,6 +576,40 @@ static void index_free_deleted(git_index *index)
 	}
 
 	git_vector_clear(&index->deleted);
+
+	git_vector_foreach(&index->deleted_pools, i, pool) {
+		git_pool_clear(pool);
+		git__free(pool);
+	}
+
+	git_vector_clear(&index->deleted_pools);
+}
+
+/* Free the entries read from disk, or keep them with the deleted
+ * entries while there are readers.  Call with locked index.
+ */
+static int index_clear_entry_pool(git_index *index)
+{
+	git_pool *pool;
+
+	if (git_atomic_get(&index->readers) == 0) {
+		git_pool_clear(&index->entry_pool);
+		return 0;
+	}
+
+	pool = git__malloc(sizeof(git_pool));
+	GITERR_CHECK_ALLOC(pool);
+
+	git_pool_init(pool, 1);
+	git_pool_swap(pool, &index->entry_pool);
+
+	if (git_vector_insert(&index->deleted_pools, pool) < 0) {
+		git_pool_swap(pool, &index->entry_pool);
+		git__free(pool);
+		return -1;
+	}
+
+	return 0;
 }
 
 /* call with locked index */
@@ -505,8 +618,10 @@ static int index_remove_entry(git_index *index, size_t pos)
 	int error = 0;
 	git_index_entry *entry = git_vector_get(&index->entries, pos);
 
-	if (entry != NULL)
+	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
+	}
 
 	DELETE_IN_MAP(index, entry);
 	error = git_vector_remove(&index->entries, pos);
@@ -531,11 +646,22 @@ int git_index_clear(git_index *index)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+
 	git_idxmap_clear(index->entries_map);
+	index->entries_map_pending = 0;
+
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
 	index_free_deleted(index);
 
+	if (!error)
+		error = index_clear_entry_pool(index);
+
 	git_index_reuc_clear(index);
 	git_index_name_clear(index);
 
@@ -593,6 +719,28 @@ int git_index_caps(const git_index *index)
 			(index->no_symlinks ? GIT_INDEXCAP_NO_SYMLINKS : 0));
 }
 
+unsigned int git_index_version(git_index *index)
+{
+	assert(index);
+
+	return index->version;
+}
+
+int git_index_set_version(git_index *index, unsigned int version)
+{
+	assert(index);
+
+	if (version < INDEX_VERSION_NUMBER_LB ||
+		version > INDEX_VERSION_NUMBER_UB) {
+		giterr_set(GITERR_INDEX, "Invalid version number");
+		return -1;
+	}
+
+	index->version = version;
+
+	return 0;
+}
+
 const git_oid *git_index_checksum(git_index *index)
 {
 	return &index->checksum;
@@ -814,6 +962,9 @@ const git_index_entry *git_index_get_bypath(
 	key.path = path;
 	GIT_IDXENTRY_STAGE_SET(&key, stage);
 
+	if (index->entries_map_pending && index_map_build(index) < 0)
+		return NULL;
+
 	LOOKUP_IN_MAP(pos, index, &key);
 
 	if (git_idxmap_valid_index(index->entries_map, pos))
@@ -841,6 +992,24 @@ void git_index_entry__init_from_stat(
 	entry->file_size = (uint32_t)st->st_size;
 }
 
+void git_index_entry__to_stat(struct stat *st, const git_index_entry *entry)
+{
+	memset(st, 0, sizeof(*st));
+
+	st->st_ctime = entry->ctime.seconds;
+	st->st_mtime = entry->mtime.seconds;
+#if defined(GIT_USE_NSEC)
+	st->st_mtime_nsec = entry->mtime.nanoseconds;
+	st->st_ctime_nsec = entry->ctime.nanoseconds;
+#endif
+	st->st_rdev = entry->dev;
+	st->st_ino  = entry->ino;
+	st->st_mode = entry->mode;
+	st->st_uid  = entry->uid;
+	st->st_gid  = entry->gid;
+	st->st_size = entry->file_size;
+}
+
 static void index_entry_adjust_namemask(
 		git_index_entry *entry,
 		size_t path_length)
@@ -853,6 +1022,43 @@ static void index_entry_adjust_namemask(
 		entry->flags |= GIT_IDXENTRY_NAMEMASK;
 }
 
+/* Allocate an entry with room for a path of `pathlen` bytes, copied from
+ * `path` unless it is NULL.  Entries allocated from a `pool` are not freed
+ * by `index_entry_free`, but with the pool.
+ */
+static struct entry_internal *index_entry_alloc(
+	git_pool *pool, const char *path, size_t pathlen)
+{
+	struct entry_internal *entry;
+	size_t alloclen;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(struct entry_internal), pathlen) ||
+		GIT_ADD_SIZET_OVERFLOW(&alloclen, alloclen, 1))
+		return NULL;
+
+	if (pool) {
+		/* keep the next entry of the pool aligned */
+		alloclen = (alloclen + 7) & ~(size_t)7;
+
+		if (alloclen > UINT32_MAX ||
+			(entry = git_pool_mallocz(pool, (uint32_t)alloclen)) == NULL) {
+			giterr_set_oom();
+			return NULL;
+		}
+
+		entry->pooled = true;
+	} else if ((entry = git__calloc(1, alloclen)) == NULL) {
+		return NULL;
+	}
+
+	entry->pathlen = pathlen;
+	if (path)
+		memcpy(entry->path, path, pathlen);
+	entry->entry.path = entry->path;
+
+	return entry;
+}
+
 /* When `from_workdir` is true, we will validate the paths to avoid placing
  * paths that are invalid for the working directory on the current filesystem
  * (eg, on Windows, we will disallow `GIT~1`, `AUX`, `COM1`, etc).  This
@@ -865,7 +1071,6 @@ static int index_entry_create(
 	const char *path,
 	bool from_workdir)
 {
-	size_t pathlen = strlen(path), alloclen;
 	struct entry_internal *entry;
 	unsigned int path_valid_flags = GIT_PATH_REJECT_INDEX_DEFAULTS;
 
@@ -881,15 +1086,9 @@ static int index_entry_create(
 		return -1;
 	}
 
-	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(struct entry_internal), pathlen);
-	GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
-	entry = git__calloc(1, alloclen);
+	entry = index_entry_alloc(NULL, path, strlen(path));
 	GITERR_CHECK_ALLOC(entry);
 
-	entry->pathlen = pathlen;
-	memcpy(entry->path, path, pathlen);
-	entry->entry.path = entry->path;
-
 	*out = (git_index_entry *)entry;
 	return 0;
 }
@@ -1002,6 +1201,23 @@ static int index_entry_dup(
 	return 0;
 }
 
+/* Copy an entry that is already known to have a valid path into `pool` */
+static int index_entry_dup_pooled(
+	git_index_entry **out,
+	git_pool *pool,
+	const git_index_entry *src)
+{
+	struct entry_internal *entry;
+
+	if ((entry = index_entry_alloc(pool, src->path, strlen(src->path))) == NULL)
+		return -1;
+
+	index_entry_cpy(&entry->entry, src);
+
+	*out = &entry->entry;
+	return 0;
+}
+
 static void index_entry_cpy_nocache(
 	git_index_entry *tgt,
 	const git_index_entry *src)
@@ -1423,6 +1639,7 @@ int git_index_add_frombuffer(
 		return error;
 
 	git_tree_cache_invalidate_path(index->tree, entry->path);
+	git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	return 0;
 }
 
@@ -1516,6 +1733,7 @@ int git_index_add_bypath(git_index *index, const char *path)
 		return ret;
 
 	git_tree_cache_invalidate_path(index->tree, entry->path);
+	git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	return 0;
 }
 
@@ -1593,6 +1811,7 @@ int git_index_add(git_index *index, const git_index_entry *source_entry)
 		return ret;
 
 	git_tree_cache_invalidate_path(index->tree, entry->path);
+	git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	return 0;
 }
 
@@ -2257,77 +2476,137 @@ out_err:
 	return 0;
 }
 
+/* Read the entry at `buffer` into one allocated from `pool`.  Version 4
+ * indexes store each path as the number of bytes to remove from the end
+ * of the path of the `last` entry, followed by the bytes to append.
+ * This is thread-safe, as long as each thread has its own pool.
+ */
 static size_t read_entry(
 	git_index_entry **out,
 	git_index *index,
+	git_pool *pool,
+	unsigned int version,
+	const git_index_entry *last,
 	const void *buffer,
 	size_t buffer_size)
 {
-	size_t path_length, entry_size;
+	size_t path_length, prefix_length = 0, entry_size;
 	const char *path_ptr;
 	struct entry_short source;
-	git_index_entry entry = {{0}};
+	struct entry_internal *entry;
+	uint16_t flags;
 
 	if (INDEX_FOOTER_SIZE + minimal_entry_size > buffer_size)
 		return 0;
 
 	/* buffer is not guaranteed to be aligned */
 	memcpy(&source, buffer, sizeof(struct entry_short));
+	flags = ntohs(source.flags);
 
-	entry.ctime.seconds = (git_time_t)ntohl(source.ctime.seconds);
-	entry.ctime.nanoseconds = ntohl(source.ctime.nanoseconds);
-	entry.mtime.seconds = (git_time_t)ntohl(source.mtime.seconds);
-	entry.mtime.nanoseconds = ntohl(source.mtime.nanoseconds);
-	entry.dev = ntohl(source.dev);
-	entry.ino = ntohl(source.ino);
-	entry.mode = ntohl(source.mode);
-	entry.uid = ntohl(source.uid);
-	entry.gid = ntohl(source.gid);
-	entry.file_size = ntohl(source.file_size);
-	git_oid_cpy(&entry.id, &source.oid);
-	entry.flags = ntohs(source.flags);
-
-	if (entry.flags & GIT_IDXENTRY_EXTENDED) {
-		uint16_t flags_raw;
-		size_t flags_offset;
-
-		flags_offset = offsetof(struct entry_long, flags_extended);
-		memcpy(&flags_raw, (const char *) buffer + flags_offset,
-			sizeof(flags_raw));
-		flags_raw = ntohs(flags_raw);
-
-		memcpy(&entry.flags_extended, &flags_raw, sizeof(flags_raw));
+	if (flags & GIT_IDXENTRY_EXTENDED)
 		path_ptr = (const char *) buffer + offsetof(struct entry_long, path);
-	} else
+	else
 		path_ptr = (const char *) buffer + offsetof(struct entry_short, path);
 
-	path_length = entry.flags & GIT_IDXENTRY_NAMEMASK;
+	if (version < INDEX_VERSION_NUMBER_COMP) {
+		path_length = flags & GIT_IDXENTRY_NAMEMASK;
+
+		/* if this is a very long string, we must find its
+		 * real length without overflowing */
+		if (path_length == 0xFFF) {
+			const char *path_end;
+
+			path_end = memchr(path_ptr, '\0', buffer_size);
+			if (path_end == NULL)
+				return 0;
+
+			path_length = path_end - path_ptr;
+		}
+
+		if (flags & GIT_IDXENTRY_EXTENDED)
+			entry_size = long_entry_size(path_length);
+		else
+			entry_size = short_entry_size(path_length);
 
-	/* if this is a very long string, we must find its
-	 * real length without overflowing */
-	if (path_length == 0xFFF) {
-		const char *path_end;
+		if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
+			return 0;
+	} else {
+		size_t varint_len, last_length, suffix_length, offset;
+		uintmax_t strip_length;
+		const char *suffix_end;
 
-		path_end = memchr(path_ptr, '\0', buffer_size);
-		if (path_end == NULL)
+		offset = path_ptr - (const char *) buffer;
+		if (INDEX_FOOTER_SIZE + offset >= buffer_size)
 			return 0;
 
-		path_length = path_end - path_ptr;
-	}
+		strip_length = git_decode_varint((const unsigned char *)path_ptr, &varint_len);
+		last_length = last ? ((struct entry_internal *)last)->pathlen : 0;
 
-	if (entry.flags & GIT_IDXENTRY_EXTENDED)
-		entry_size = long_entry_size(path_length);
-	else
-		entry_size = short_entry_size(path_length);
+		/* the first entry of a block of the offset table has no
+		 * previous path, whatever it says to remove from it
+		 */
+		if (varint_len == 0 || (last && strip_length > last_length))
+			return 0;
+
+		offset += varint_len;
+		path_ptr += varint_len;
+
+		suffix_end = memchr(path_ptr, '\0', buffer_size - offset);
+		if (suffix_end == NULL)
+			return 0;
+
+		suffix_length = suffix_end - path_ptr;
+		prefix_length = last ? last_length - (size_t)strip_length : 0;
+		path_length = prefix_length + suffix_length;
+
+		/* there is no padding after the path in version 4 */
+		entry_size = offset + suffix_length + 1;
+		if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
+			return 0;
+	}
 
-	if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
+	if ((entry = index_entry_alloc(pool, NULL, path_length)) == NULL)
 		return 0;
 
-	entry.path = (char *)path_ptr;
+	memcpy(entry->path, last ? last->path : "", prefix_length);
+	memcpy(entry->path + prefix_length, path_ptr, path_length - prefix_length);
 
-	if (index_entry_dup(out, index, &entry) < 0)
+	/* an entry of a split index that replaces one of the shared index
+	 * has no path of its own; it takes the path of the one it replaces
+	 */
+	if (path_length && !git_path_isvalid(INDEX_OWNER(index),
+			entry->path, GIT_PATH_REJECT_INDEX_DEFAULTS)) {
+		giterr_set(GITERR_INDEX, "invalid path: '%s'", entry->path);
+		index_entry_free(&entry->entry);
 		return 0;
+	}
+
+	entry->entry.ctime.seconds = (git_time_t)ntohl(source.ctime.seconds);
+	entry->entry.ctime.nanoseconds = ntohl(source.ctime.nanoseconds);
+	entry->entry.mtime.seconds = (git_time_t)ntohl(source.mtime.seconds);
+	entry->entry.mtime.nanoseconds = ntohl(source.mtime.nanoseconds);
+	entry->entry.dev = ntohl(source.dev);
+	entry->entry.ino = ntohl(source.ino);
+	entry->entry.mode = ntohl(source.mode);
+	entry->entry.uid = ntohl(source.uid);
+	entry->entry.gid = ntohl(source.gid);
+	entry->entry.file_size = ntohl(source.file_size);
+	git_oid_cpy(&entry->entry.id, &source.oid);
+	entry->entry.flags = flags;
+
+	if (flags & GIT_IDXENTRY_EXTENDED) {
+		uint16_t flags_raw;
+		size_t flags_offset;
+
+		flags_offset = offsetof(struct entry_long, flags_extended);
+		memcpy(&flags_raw, (const char *) buffer + flags_offset,
+			sizeof(flags_raw));
+		flags_raw = ntohs(flags_raw);
+
+		memcpy(&entry->entry.flags_extended, &flags_raw, sizeof(flags_raw));
+	}
 
+	*out = &entry->entry;
 	return entry_size;
 }
 
@@ -2340,146 +2619,840 @@ static int read_header(struct index_header *dest, const void *buffer)
 		return index_error_invalid("incorrect header signature");
 
 	dest->version = ntohl(source->version);
-	if (dest->version != INDEX_VERSION_NUMBER_EXT &&
-		dest->version != INDEX_VERSION_NUMBER)
+	if (dest->version < INDEX_VERSION_NUMBER_LB ||
+		dest->version > INDEX_VERSION_NUMBER_UB)
 		return index_error_invalid("incorrect header version");
 
 	dest->entry_count = ntohl(source->entry_count);
 	return 0;
 }
 
-static size_t read_extension(git_index *index, const char *buffer, size_t buffer_size)
+static int shared_index_path(
+	git_buf *out, git_index *index, const git_oid *checksum)
 {
-	struct index_extension dest;
-	size_t total_size;
-
-	/* buffer is not guaranteed to be aligned */
-	memcpy(&dest, buffer, sizeof(struct index_extension));
-	dest.extension_size = ntohl(dest.extension_size);
+	char hex[GIT_OID_HEXSZ + 1];
 
-	total_size = dest.extension_size + sizeof(struct index_extension);
+	/* shared indexes live next to the split indexes that use them */
+	if (git_path_dirname_r(out, index->index_file_path) < 0)
+		return -1;
 
-	if (dest.extension_size > total_size ||
-		buffer_size < total_size ||
-		buffer_size - total_size < INDEX_FOOTER_SIZE)
-		return 0;
+	git_oid_tostr(hex, sizeof(hex), checksum);
 
-	/* optional extension */
-	if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
-		/* tree cache */
-		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
-			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, &index->tree_pool) < 0)
-				return 0;
-		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
-			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
-				return 0;
-		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
-			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
-				return 0;
-		}
-		/* else, unsupported extension. We cannot parse this, but we can skip
-		 * it by returning `total_size */
-	} else {
-		/* we cannot handle non-ignorable extensions;
-		 * in fact they aren't even defined in the standard */
-		return 0;
-	}
+	git_buf_joinpath(out, out->ptr, SHARED_INDEX_PREFIX);
+	git_buf_puts(out, hex);
 
-	return total_size;
+	return git_buf_oom(out) ? -1 : 0;
 }
 
-static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+static int read_shared_index(
+	git_index_shared **out, git_index *index, const git_oid *checksum)
 {
-	int error = 0;
+	git_index_shared *shared = NULL;
+	git_buf path = GIT_BUF_INIT, buffer = GIT_BUF_INIT;
+	struct index_header header;
+	git_oid checksum_calculated;
+	git_index_entry *entry = NULL;
+	const char *data;
+	size_t size;
 	unsigned int i;
-	struct index_header header = { 0 };
-	git_oid checksum_calculated, checksum_expected;
+	int error;
 
-#define seek_forward(_increase) { \
-	if (_increase >= buffer_size) { \
-		error = index_error_invalid("ran out of data while parsing"); \
-		goto done; } \
-	buffer += _increase; \
-	buffer_size -= _increase;\
-}
+	if ((error = shared_index_path(&path, index, checksum)) < 0 ||
+		(error = git_futils_readbuffer(&buffer, path.ptr)) < 0)
+		goto done;
 
-	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
-		return index_error_invalid("insufficient buffer space");
+	data = buffer.ptr;
+	size = buffer.size;
 
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+	if (size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE) {
+		error = index_error_invalid("insufficient buffer space in shared index");
+		goto done;
+	}
 
-	/* Parse header */
-	if ((error = read_header(&header, buffer)) < 0)
-		return error;
+	git_hash_buf(&checksum_calculated, data, size - INDEX_FOOTER_SIZE);
+
+	if (git_oid__cmp(&checksum_calculated, checksum) != 0 ||
+		memcmp(data + size - INDEX_FOOTER_SIZE, checksum->id, GIT_OID_RAWSZ) != 0) {
+		error = index_error_invalid("shared index does not match its checksum");
+		goto done;
+	}
 
-	seek_forward(INDEX_HEADER_SIZE);
+	if ((error = read_header(&header, data)) < 0)
+		goto done;
 
-	assert(!index->entries.length);
+	data += INDEX_HEADER_SIZE;
+	size -= INDEX_HEADER_SIZE;
 
-	if (index->ignore_case)
-		kh_resize(idxicase, (khash_t(idxicase) *) index->entries_map, header.entry_count);
-	else
-		kh_resize(idx, index->entries_map, header.entry_count);
+	if ((shared = git__calloc(1, sizeof(git_index_shared))) == NULL) {
+		error = -1;
+		goto done;
+	}
 
-	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
-		git_index_entry *entry;
-		size_t entry_size = read_entry(&entry, index, buffer, buffer_size);
+	git_oid_cpy(&shared->checksum, checksum);
+	git_pool_init(&shared->entry_pool, 1);
+
+	if ((error = git_vector_init(
+			&shared->entries, header.entry_count, git_index_entry_cmp)) < 0)
+		goto done;
+
+	/* the extensions of a shared index, if any, are of no use */
+	for (i = 0; i < header.entry_count; i++) {
+		size_t entry_size = read_entry(&entry, index, &shared->entry_pool,
+			header.version, entry, data, size);
 
-		/* 0 bytes read means an object corruption */
 		if (entry_size == 0) {
-			error = index_error_invalid("invalid entry");
+			error = index_error_invalid("invalid entry in shared index");
 			goto done;
 		}
 
-		if ((error = git_vector_insert(&index->entries, entry)) < 0) {
+		if ((error = git_vector_insert(&shared->entries, entry)) < 0) {
 			index_entry_free(entry);
 			goto done;
 		}
 
-		INSERT_IN_MAP(index, entry, error);
-
-		if (error < 0) {
-			index_entry_free(entry);
+		if (!*entry->path) {
+			error = index_error_invalid("entry without a path in shared index");
 			goto done;
 		}
-		error = 0;
 
-		seek_forward(entry_size);
+		data += entry_size;
+		size -= entry_size;
 	}
 
-	if (i != header.entry_count) {
-		error = index_error_invalid("header entries changed while parsing");
-		goto done;
+	git_vector_set_sorted(&shared->entries, true);
+
+	*out = shared;
+	shared = NULL;
+
+done:
+	index_shared_free(shared);
+	git_buf_free(&buffer);
+	git_buf_free(&path);
+	return error;
+}
+
+static bool bitmap_fits(const git_bitmap *bitmap, size_t length)
+{
+	size_t i;
+
+	for (i = length; i < bitmap->word_alloc * GIT_BITMAP_WORD_BITS; i++) {
+		if (git_bitmap_get(bitmap, i))
+			return false;
 	}
 
-	/* There's still space for some extensions! */
-	while (buffer_size > INDEX_FOOTER_SIZE) {
-		size_t extension_size;
+	return true;
+}
+
+/* Merge the entries read from a split index into those of the shared
+ * index it links to.  The `link` extension has the checksum of the
+ * shared index, a bitmap of the shared entries that were deleted and
+ * one of those that were replaced; the replacements come first in the
+ * split index, without a path, and are followed by the new entries.
+ */
+static int read_link(git_index *index, const char *buffer, size_t size)
+{
+	git_oid checksum;
+	git_bitmap deleted = GIT_BITMAP_INIT, replaced = GIT_BITMAP_INIT;
+	git_vector merged = GIT_VECTOR_INIT, *split = &index->entries;
+	git_index_entry *entry, *shared_entry, *split_entry;
+	size_t shared_count, replacements, consumed, replaced_pos = 0, split_pos, i;
+	int error = -1;
 
-		extension_size = read_extension(index, buffer, buffer_size);
+	if (size < GIT_OID_RAWSZ)
+		return index_error_invalid("truncated link extension");
 
-		/* see if we have read any bytes from the extension */
-		if (extension_size == 0) {
-			error = index_error_invalid("extension is truncated");
+	git_oid_fromraw(&checksum, (const unsigned char *)buffer);
+	buffer += GIT_OID_RAWSZ;
+	size -= GIT_OID_RAWSZ;
+
+	if (size > 0) {
+		if (git_ewah_parse(&deleted, &consumed,
+				(const unsigned char *)buffer, size) < 0)
+			goto done;
+
+		buffer += consumed;
+		size -= consumed;
+
+		if (git_ewah_parse(&replaced, &consumed,
+				(const unsigned char *)buffer, size) < 0)
+			goto done;
+
+		if (consumed != size) {
+			index_error_invalid("garbage at the end of the link extension");
 			goto done;
 		}
+	}
 
-		seek_forward(extension_size);
+	/* an index that is read again usually links to the same shared index */
+	if (git_oid_iszero(&checksum)) {
+		index_shared_free(index->shared);
+		index->shared = NULL;
+	} else if (!index->shared ||
+		!git_oid_equal(&index->shared->checksum, &checksum)) {
+		git_index_shared *shared;
+
+		if (read_shared_index(&shared, index, &checksum) < 0)
+			goto done;
+
+		index_shared_free(index->shared);
+		index->shared = shared;
 	}
 
-	if (buffer_size != INDEX_FOOTER_SIZE) {
-		error = index_error_invalid(
-			"buffer size does not match index footer size");
+	shared_count = index->shared ? index->shared->entries.length : 0;
+
+	if (!bitmap_fits(&deleted, shared_count) ||
+		!bitmap_fits(&replaced, shared_count)) {
+		index_error_invalid("link extension is larger than the shared index");
 		goto done;
 	}
 
-	/* 160-bit SHA-1 over the content of the index file before this checksum. */
-	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
+	for (replacements = 0; replacements < split->length; replacements++) {
+		entry = git_vector_get(split, replacements);
 
-	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
+		if (*entry->path)
+			break;
+	}
+
+	if (git_vector_init(&merged,
+			shared_count + split->length, git_index_entry_cmp) < 0)
+		goto done;
+
+	split_pos = replacements;
+
+	for (i = 0; i < shared_count; i++) {
+		shared_entry = git_vector_get(&index->shared->entries, i);
+
+		/* new entries are sorted among the shared ones */
+		while ((split_entry = git_vector_get(split, split_pos)) != NULL &&
+			git_index_entry_cmp(split_entry, shared_entry) <= 0) {
+			if (!*split_entry->path) {
+				index_error_invalid("entry without a path in split index");
+				goto done;
+			}
+
+			if (git_vector_insert(&merged, split_entry) < 0)
+				goto done;
+
+			split->contents[split_pos++] = NULL;
+		}
+
+		if (git_bitmap_get(&replaced, i)) {
+			git_index_entry replacement;
+
+			if (git_bitmap_get(&deleted, i)) {
+				index_error_invalid("shared entry is both replaced and deleted");
+				goto done;
+			}
+
+			if (replaced_pos == replacements) {
+				index_error_invalid("too many replaced entries in split index");
+				goto done;
+			}
+
+			memcpy(&replacement, git_vector_get(split, replaced_pos++),
+				sizeof(git_index_entry));
+			replacement.path = shared_entry->path;
+			index_entry_adjust_namemask(&replacement,
+				((struct entry_internal *)shared_entry)->pathlen);
+
+			if (index_entry_dup_pooled(&entry,
+					&index->entry_pool, &replacement) < 0)
+				goto done;
+		} else if (git_bitmap_get(&deleted, i)) {
+			continue;
+		} else if (index_entry_dup_pooled(&entry,
+				&index->entry_pool, shared_entry) < 0) {
+			goto done;
+		}
+
+		/* a new entry takes the place of a shared one at the same path */
+		if (merged.length > 0 &&
+			!git_index_entry_cmp(git_vector_last(&merged), entry)) {
+			index_entry_free(entry);
+			continue;
+		}
+
+		if (git_vector_insert(&merged, entry) < 0) {
+			index_entry_free(entry);
+			goto done;
+		}
+	}
+
+	if (replaced_pos != replacements) {
+		index_error_invalid("too few replaced entries in split index");
+		goto done;
+	}
+
+	for (; split_pos < split->length; split_pos++) {
+		split_entry = git_vector_get(split, split_pos);
+
+		if (!*split_entry->path) {
+			index_error_invalid("entry without a path in split index");
+			goto done;
+		}
+
+		if (git_vector_insert(&merged, split_entry) < 0)
+			goto done;
+
+		split->contents[split_pos] = NULL;
+	}
+
+	git_vector_swap(&merged, split);
+	index->split = 1;
+	error = 0;
+
+done:
+	/* the entries moved out of the split index were set to NULL, so
+	 * this leaves the replacements on success and nothing on failure
+	 */
+	git_vector_foreach(&merged, i, entry)
+		index_entry_free(entry);
+	git_vector_free(&merged);
+
+	if (error < 0) {
+		git_vector_foreach(split, i, entry)
+			index_entry_free(entry);
+		git_vector_clear(split);
+	}
+
+	git_bitmap_free(&deleted);
+	git_bitmap_free(&replaced);
+	return error;
+}
+
+static size_t read_extension(
+	git_index *index, entry_extensions *ext, const char *buffer, size_t buffer_size)
+{
+	struct index_extension dest;
+	size_t total_size;
+
+	/* buffer is not guaranteed to be aligned */
+	memcpy(&dest, buffer, sizeof(struct index_extension));
+	dest.extension_size = ntohl(dest.extension_size);
+
+	total_size = dest.extension_size + sizeof(struct index_extension);
+
+	if (dest.extension_size > total_size ||
+		buffer_size < total_size ||
+		buffer_size - total_size < INDEX_FOOTER_SIZE)
+		return 0;
+
+	/* optional extension */
+	if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
+		/* tree cache */
+		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
+			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, &index->tree_pool) < 0)
+				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
+			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
+				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
+			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
+				return 0;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			/* like core git, drop an untracked cache we cannot parse */
+			git_untracked_cache_free(index->untracked);
+			if (git_untracked_cache_read(&index->untracked, buffer + 8, dest.extension_size) < 0)
+				giterr_clear();
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			ext->fsmonitor = buffer + 8;
+			ext->fsmonitor_size = dest.extension_size;
+		}
+		/* else, unsupported extension. We cannot parse this, but we can skip
+		 * it by returning `total_size */
+	} else if (memcmp(dest.signature, INDEX_EXT_LINK_SIG, 4) == 0) {
+		ext->link = buffer + 8;
+		ext->link_size = dest.extension_size;
+	} else {
+		/* we cannot handle non-ignorable extensions;
+		 * in fact they aren't even defined in the standard */
+		return 0;
+	}
+
+	return total_size;
+}
+
+/* The number of threads that `index.threads` asks for: 0 for one per
+ * core, 1 for none but the calling one.  Like core git, `true` means
+ * one per core and `false` means none.
+ */
+static int index_threads_config(bool *configured, git_index *index)
+{
+	git_config *cfg;
+	char *value = NULL;
+	int32_t threads = 0;
+	int enabled;
+
+	if (INDEX_OWNER(index) &&
+		git_repository_config__weakptr(&cfg, INDEX_OWNER(index)) == 0)
+		value = git_config__get_string_force(cfg, "index.threads", NULL);
+
+	*configured = (value != NULL);
+
+	if (value && git_config_parse_int32(&threads, value) < 0)
+		threads = (git_config_parse_bool(&enabled, value) == 0 && !enabled);
+
+	giterr_clear();
+	git__free(value);
+
+	return threads < 0 ? 0 : threads;
+}
+
+static size_t index_read_threads(git_index *index, size_t entry_count)
+{
+#ifdef GIT_THREADS
+	bool configured;
+	size_t threads = (size_t)index_threads_config(&configured, index);
+
+	if (threads == 0) {
+		threads = (size_t)git_online_cpus();
+
+		if (threads > entry_count / INDEX_THREAD_COST)
+			threads = entry_count / INDEX_THREAD_COST;
+	}
+
+	return threads;
+#else
+	GIT_UNUSED(index);
+	GIT_UNUSED(entry_count);
+	return 1;
+#endif
+}
+
+/* The offset of the extensions that the `EOIE` extension at the end of
+ * the index records, or 0 when there is none or it does not match the
+ * headers of the extensions.
+ */
+static size_t read_end_of_entries(const char *buffer, size_t buffer_size)
+{
+	struct index_extension dest;
+	const char *eoie, *ext;
+	git_hash_ctx ctx;
+	git_oid expected, actual;
+	uint32_t offset;
+	size_t size;
+
+	size = INDEX_HEADER_SIZE + sizeof(struct index_extension) +
+		INDEX_END_OF_ENTRIES_SIZE + INDEX_FOOTER_SIZE;
+
+	if (buffer_size < size)
+		return 0;
+
+	eoie = buffer + buffer_size - INDEX_FOOTER_SIZE -
+		INDEX_END_OF_ENTRIES_SIZE - sizeof(struct index_extension);
+
+	memcpy(&dest, eoie, sizeof(struct index_extension));
+
+	if (memcmp(dest.signature, INDEX_EXT_END_OF_ENTRIES_SIG, 4) != 0 ||
+		ntohl(dest.extension_size) != INDEX_END_OF_ENTRIES_SIZE)
+		return 0;
+
+	memcpy(&offset, eoie + sizeof(struct index_extension), sizeof(uint32_t));
+	offset = ntohl(offset);
+
+	if (offset < INDEX_HEADER_SIZE || offset > (size_t)(eoie - buffer))
+		return 0;
+
+	git_oid_fromraw(&expected, (const unsigned char *)eoie +
+		sizeof(struct index_extension) + sizeof(uint32_t));
+
+	if (git_hash_ctx_init(&ctx) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	/* the hash is over the headers of the extensions before it */
+	for (ext = buffer + offset;
+		(size_t)(eoie - ext) >= sizeof(struct index_extension);
+		ext += sizeof(struct index_extension) + size) {
+		memcpy(&dest, ext, sizeof(struct index_extension));
+		git_hash_update(&ctx, ext, sizeof(struct index_extension));
+
+		size = ntohl(dest.extension_size);
+		if (size > (size_t)(eoie - ext) - sizeof(struct index_extension))
+			break;
+	}
+
+	git_hash_final(&actual, &ctx);
+	git_hash_ctx_cleanup(&ctx);
+
+	if (ext != eoie || !git_oid_equal(&expected, &actual))
+		return 0;
+
+	return offset;
+}
+
+typedef struct {
+	size_t offset; /* of the first entry in the index file */
+	size_t end;    /* of the last one */
+	size_t count;
+} index_entry_block;
+
+/* Read the blocks of the `IEOT` extension, which core git writes first,
+ * at `offset`; they must cover all the `entry_count` entries before it.
+ * An offset table that does not is ignored, and the entries are then
+ * read one after the other.
+ */
+static int read_offset_table(
+	index_entry_block **out,
+	size_t *out_count,
+	const char *buffer,
+	size_t offset,
+	size_t entry_count)
+{
+	struct index_extension dest;
+	index_entry_block *blocks;
+	const char *data;
+	uint32_t values[2];
+	size_t count, total = 0, i;
+
+	*out = NULL;
+	*out_count = 0;
+
+	/* `read_end_of_entries` made sure the extension fits */
+	memcpy(&dest, buffer + offset, sizeof(struct index_extension));
+	dest.extension_size = ntohl(dest.extension_size);
+
+	if (memcmp(dest.signature, INDEX_EXT_OFFSET_TABLE_SIG, 4) != 0 ||
+		dest.extension_size < sizeof(uint32_t) ||
+		(dest.extension_size - sizeof(uint32_t)) % sizeof(values) != 0)
+		return 0;
+
+	data = buffer + offset + sizeof(struct index_extension);
+	memcpy(values, data, sizeof(uint32_t));
+
+	if (ntohl(values[0]) != INDEX_OFFSET_TABLE_VERSION)
+		return 0;
+
+	data += sizeof(uint32_t);
+
+	if ((count = (dest.extension_size - sizeof(uint32_t)) / sizeof(values)) == 0)
+		return 0;
+
+	blocks = git__calloc(count, sizeof(index_entry_block));
+	GITERR_CHECK_ALLOC(blocks);
+
+	for (i = 0; i < count; i++, data += sizeof(values)) {
+		memcpy(values, data, sizeof(values));
+		blocks[i].offset = ntohl(values[0]);
+		blocks[i].count = ntohl(values[1]);
+
+		if (i > 0)
+			blocks[i - 1].end = blocks[i].offset;
+
+		if (blocks[i].offset < (i ? blocks[i - 1].offset + 1 : INDEX_HEADER_SIZE) ||
+			blocks[i].offset >= offset || !blocks[i].count ||
+			blocks[i].count > entry_count - total) {
+			git__free(blocks);
+			return 0;
+		}
+
+		total += blocks[i].count;
+	}
+
+	blocks[count - 1].end = offset;
+
+	if (blocks[0].offset != INDEX_HEADER_SIZE || total != entry_count) {
+		git__free(blocks);
+		return 0;
+	}
+
+	*out = blocks;
+	*out_count = count;
+	return 0;
+}
+
+typedef struct {
+	git_index *index;
+	const char *buffer; /* of the whole index file */
+	unsigned int version;
+	const index_entry_block *blocks;
+	size_t block_count;
+	git_index_entry **entries; /* where the entry of the first block goes */
+	git_pool pool;
+	git_error_state error;
+#ifdef GIT_THREADS
+	git_thread thread;
+#endif
+} index_entry_loader;
+
+static void *read_entry_blocks(void *payload)
+{
+	index_entry_loader *loader = payload;
+	git_index_entry *entry, *last;
+	const char *pos, *end;
+	size_t i, j, n = 0, entry_size;
+
+	for (i = 0; i < loader->block_count; i++) {
+		pos = loader->buffer + loader->blocks[i].offset;
+		end = loader->buffer + loader->blocks[i].end;
+
+		/* paths are compressed from the start of each block */
+		last = NULL;
+
+		for (j = 0; j < loader->blocks[i].count; j++) {
+			entry_size = read_entry(&entry, loader->index, &loader->pool,
+				loader->version, last, pos, (end - pos) + INDEX_FOOTER_SIZE);
+
+			if (entry_size == 0) {
+				if (!giterr_last())
+					index_error_invalid("invalid entry");
+				goto on_error;
+			}
+
+			loader->entries[n++] = last = entry;
+			pos += entry_size;
+		}
+
+		if (pos != end) {
+			index_error_invalid("entries do not match the offset table");
+			goto on_error;
+		}
+	}
+
+	return NULL;
+
+on_error:
+	giterr_state_capture(&loader->error, -1);
+	return NULL;
+}
+
+/* Start reading the blocks of entries on `thread_count` threads, each
+ * with its own pool, into `entries`.
+ */
+static int start_entry_loaders(
+	index_entry_loader **out,
+	size_t *out_count,
+	git_index *index,
+	const char *buffer,
+	unsigned int version,
+	const index_entry_block *blocks,
+	size_t block_count,
+	size_t thread_count,
+	git_index_entry **entries)
+{
+#ifdef GIT_THREADS
+	index_entry_loader *loaders;
+	size_t per_thread, count, i, n = 0, first = 0;
+	int val;
+
+	if (thread_count > block_count)
+		thread_count = block_count;
+
+	per_thread = (block_count + thread_count - 1) / thread_count;
+	count = (block_count + per_thread - 1) / per_thread;
+
+	loaders = git__calloc(count, sizeof(index_entry_loader));
+	GITERR_CHECK_ALLOC(loaders);
+
+	/* the threads check paths, which looks these up in the config */
+	if (INDEX_OWNER(index)) {
+		git_repository__cvar(&val, INDEX_OWNER(index), GIT_CVAR_PROTECTHFS);
+		git_repository__cvar(&val, INDEX_OWNER(index), GIT_CVAR_PROTECTNTFS);
+		giterr_clear();
+	}
+
+	for (i = 0; i < count; i++) {
+		index_entry_loader *loader = &loaders[i];
+		size_t b;
+
+		loader->index = index;
+		loader->buffer = buffer;
+		loader->version = version;
+		loader->blocks = &blocks[i * per_thread];
+		loader->block_count = min(per_thread, block_count - i * per_thread);
+		loader->entries = &entries[first];
+		git_pool_init(&loader->pool, 1);
+
+		for (b = 0; b < loader->block_count; b++)
+			first += loader->blocks[b].count;
+
+		if (git_thread_create(&loader->thread, NULL,
+				read_entry_blocks, loader) != 0) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			break;
+		}
+
+		n++;
+	}
+
+	*out = loaders;
+	*out_count = n;
+
+	return (n == count) ? 0 : -1;
+#else
+	GIT_UNUSED(index);
+	GIT_UNUSED(buffer);
+	GIT_UNUSED(version);
+	GIT_UNUSED(blocks);
+	GIT_UNUSED(block_count);
+	GIT_UNUSED(thread_count);
+	GIT_UNUSED(entries);
+
+	*out = NULL;
+	*out_count = 0;
+	return 0;
+#endif
+}
+
+/* Wait for the threads reading the entries and take over their pools */
+static int finish_entry_loaders(
+	git_index *index, index_entry_loader *loaders, size_t count)
+{
+	git_error_state error = { 0 };
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+#ifdef GIT_THREADS
+		git_thread_join(&loaders[i].thread, NULL);
+#endif
+
+		if (loaders[i].error.error_code && !error.error_code)
+			memcpy(&error, &loaders[i].error, sizeof(git_error_state));
+		else
+			giterr_state_free(&loaders[i].error);
+
+		if (git_pool_merge(&index->entry_pool, &loaders[i].pool) < 0 &&
+			!error.error_code)
+			error.error_code = -1;
+
+		git_pool_clear(&loaders[i].pool);
+	}
+
+	git__free(loaders);
+
+	if (error.error_code && error.error_msg.message)
+		return giterr_state_restore(&error);
+
+	return error.error_code;
+}
+
+static int read_entry_extensions(git_index *index, entry_extensions *ext)
+{
+	if (ext->link && read_link(index, ext->link, ext->link_size) < 0)
+		return -1;
+
+	/* without it every entry is checked, so it can be dropped */
+	if (ext->fsmonitor && git_fsmonitor__read_extension(
+			index, ext->fsmonitor, ext->fsmonitor_size) < 0)
+		giterr_clear();
+
+	return 0;
+}
+
+static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+{
+	int error = 0;
+	unsigned int i, stripped = 0;
+	struct index_header header = { 0 };
+	git_oid checksum_calculated, checksum_expected;
+	git_index_entry *entry = NULL;
+	entry_extensions ext = { 0 };
+	index_entry_block *blocks = NULL;
+	index_entry_loader *loaders = NULL;
+	size_t block_count = 0, loader_count = 0, extensions_offset = 0, threads;
+
+#define seek_forward(_increase) { \
+	if (_increase >= buffer_size) { \
+		error = index_error_invalid("ran out of data while parsing"); \
+		goto done; } \
+	buffer += _increase; \
+	buffer_size -= _increase;\
+}
+
+	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
+		return index_error_invalid("insufficient buffer space");
+
+	/* Parse header */
+	if ((error = read_header(&header, buffer)) < 0)
+		return error;
+
+	assert(!index->entries.length);
+
+	index->version = header.version;
+	index->split = 0;
+
+	/* a corrupt header could ask for more entries than fit */
+	if (header.entry_count > buffer_size / minimal_entry_size)
+		return index_error_invalid("too many entries for the index size");
+
+	if ((error = git_vector_size_hint(&index->entries, header.entry_count)) < 0)
+		return error;
+
+	/* Read blocks of entries on other threads when the index tells
+	 * where they are, while this one does the rest
+	 */
+	if ((threads = index_read_threads(index, header.entry_count)) > 1 &&
+		(extensions_offset = read_end_of_entries(buffer, buffer_size)) > 0 &&
+		(error = read_offset_table(&blocks, &block_count, buffer,
+			extensions_offset, header.entry_count)) < 0)
+		return error;
+
+	if (block_count > 1 &&
+		(error = start_entry_loaders(&loaders, &loader_count, index, buffer,
+			header.version, blocks, block_count, threads,
+			(git_index_entry **)index->entries.contents)) < 0)
+		goto done;
+
+	/* Precalculate the SHA1 of the files's contents -- we'll match it to
+	 * the provided SHA1 in the footer */
+	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+
+	if (loaders) {
+		seek_forward(extensions_offset);
+	} else {
+		seek_forward(INDEX_HEADER_SIZE);
+
+		/* Parse all the entries */
+		for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
+			size_t entry_size = read_entry(&entry, index, &index->entry_pool,
+				header.version, entry, buffer, buffer_size);
+
+			/* 0 bytes read means an object corruption */
+			if (entry_size == 0) {
+				error = index_error_invalid("invalid entry");
+				goto done;
+			}
+
+			if ((error = git_vector_insert(&index->entries, entry)) < 0) {
+				index_entry_free(entry);
+				goto done;
+			}
+
+			seek_forward(entry_size);
+		}
+
+		if (i != header.entry_count) {
+			error = index_error_invalid("header entries changed while parsing");
+			goto done;
+		}
+	}
+
+	/* There's still space for some extensions! */
+	while (buffer_size > INDEX_FOOTER_SIZE) {
+		size_t extension_size;
+
+		extension_size = read_extension(index, &ext, buffer, buffer_size);
+
+		/* see if we have read any bytes from the extension */
+		if (extension_size == 0) {
+			error = index_error_invalid("extension is truncated");
+			goto done;
+		}
+
+		seek_forward(extension_size);
+	}
+
+	if (buffer_size != INDEX_FOOTER_SIZE) {
+		error = index_error_invalid(
+			"buffer size does not match index footer size");
+		goto done;
+	}
+
+	/* 160-bit SHA-1 over the content of the index file before this checksum. */
+	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
+
+	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
 		error = index_error_invalid(
 			"calculated checksum does not match expected");
 		goto done;
@@ -2489,6 +3462,42 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 #undef seek_forward
 
+	if (loaders) {
+		error = finish_entry_loaders(index, loaders, loader_count);
+		loaders = NULL;
+
+		if (error < 0)
+			goto done;
+
+		index->entries.length = header.entry_count;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (!*entry->path)
+			stripped++;
+	}
+
+	if ((error = read_entry_extensions(index, &ext)) < 0)
+		goto done;
+
+	/* replacements are only valid with the shared index they replace
+	 * entries of, which is merged in with the `link` extension
+	 */
+	if (stripped && !index->split) {
+		error = index_error_invalid("entry without a path");
+		goto done;
+	}
+
+	if (!index->split) {
+		index_shared_free(index->shared);
+		index->shared = NULL;
+	}
+
+	if (git_index__lazy_map)
+		index->entries_map_pending = 1;
+	else if ((error = index_map_build(index)) < 0)
+		goto done;
+
 	/* Entries are stored case-sensitively on disk, so re-sort now if
 	 * in-memory index is supposed to be case-insensitive
 	 */
@@ -2496,9 +3505,50 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 	git_vector_sort(&index->entries);
 
 done:
+	if (loaders) {
+		/* keep the error of this thread over that of the loaders */
+		git_error_state state;
+
+		giterr_state_capture(&state, error);
+		finish_entry_loaders(index, loaders, loader_count);
+		giterr_state_restore(&state);
+	}
+
+	git__free(blocks);
 	return error;
 }
 
+/* Build the map of the entries by path, which is put off when the
+ * index is read with `git_index__lazy_map` set.
+ */
+static int index_map_build(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+	int error = 0;
+
+	index->entries_map_pending = 0;
+	git_idxmap_clear(index->entries_map);
+
+	if (index->ignore_case)
+		kh_resize(idxicase, (khash_t(idxicase) *) index->entries_map, index->entries.length);
+	else
+		kh_resize(idx, index->entries_map, index->entries.length);
+
+	git_vector_foreach(&index->entries, i, entry) {
+		INSERT_IN_MAP(index, entry, error);
+
+		if (error < 0) {
+			/* try again on the next lookup */
+			git_idxmap_clear(index->entries_map);
+			index->entries_map_pending = 1;
+			return error;
+		}
+	}
+
+	return 0;
+}
+
 static bool is_index_extended(git_index *index)
 {
 	size_t i, extended;
@@ -2517,16 +3567,46 @@ static bool is_index_extended(git_index *index)
 	return (extended > 0);
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
+/* Write `entry`, compressing its path against the `last` path written
+ * when `version` is 4 or more.
+ */
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	bool strip_path,
+	uint32_t version,
+	git_buf *last)
 {
 	void *mem = NULL;
 	struct entry_short *ondisk;
-	size_t path_len, disk_size;
+	size_t path_len, disk_size, same_len = 0, strip_len = 0;
+	int varint_len = 0;
+	uint16_t flags = entry->flags;
 	char *path;
 
 	path_len = ((struct entry_internal *)entry)->pathlen;
 
-	if (entry->flags & GIT_IDXENTRY_EXTENDED)
+	/* replacements in a split index take the path of a shared entry */
+	if (strip_path) {
+		path_len = 0;
+		flags &= ~GIT_IDXENTRY_NAMEMASK;
+	}
+
+	if (version >= INDEX_VERSION_NUMBER_COMP) {
+		while (same_len < path_len && same_len < last->size &&
+			entry->path[same_len] == last->ptr[same_len])
+			same_len++;
+
+		strip_len = last->size - same_len;
+		varint_len = git_encode_varint(NULL, 0, strip_len);
+
+		/* the path is not padded in version 4 */
+		disk_size = (entry->flags & GIT_IDXENTRY_EXTENDED) ?
+			offsetof(struct entry_long, path) :
+			offsetof(struct entry_short, path);
+		disk_size += varint_len + (path_len - same_len) + 1;
+	} else if (entry->flags & GIT_IDXENTRY_EXTENDED)
 		disk_size = long_entry_size(path_len);
 	else
 		disk_size = short_entry_size(path_len);
@@ -2534,6 +3614,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 	if (git_filebuf_reserve(file, &mem, disk_size) < 0)
 		return -1;
 
+	*out_size = disk_size;
 	ondisk = (struct entry_short *)mem;
 
 	memset(ondisk, 0x0, disk_size);
@@ -2559,232 +3640,793 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry)
 	ondisk->gid = htonl(entry->gid);
 	ondisk->file_size = htonl((uint32_t)entry->file_size);
 
-	git_oid_cpy(&ondisk->oid, &entry->id);
+	git_oid_cpy(&ondisk->oid, &entry->id);
+
+	ondisk->flags = htons(flags);
+
+	if (entry->flags & GIT_IDXENTRY_EXTENDED) {
+		struct entry_long *ondisk_ext;
+		ondisk_ext = (struct entry_long *)ondisk;
+		ondisk_ext->flags_extended = htons(entry->flags_extended &
+			GIT_IDXENTRY_EXTENDED_FLAGS);
+		path = ondisk_ext->path;
+	}
+	else
+		path = ondisk->path;
+
+	if (version >= INDEX_VERSION_NUMBER_COMP) {
+		git_encode_varint((unsigned char *)path, varint_len, strip_len);
+		memcpy(path + varint_len, entry->path + same_len, path_len - same_len);
+
+		git_buf_truncate(last, same_len);
+		return git_buf_put(last, entry->path + same_len, path_len - same_len);
+	}
+
+	memcpy(path, entry->path, path_len);
+
+	return 0;
+}
+
+/* Write the entries from `offset` in the file, moving it past them.
+ * When `block_size` is set, the entries are split in blocks of that
+ * many, whose offsets and sizes are added to `offset_table`; paths are
+ * compressed from the start of each block.
+ */
+static int write_entries(
+	size_t *offset,
+	git_filebuf *file,
+	git_vector *entries,
+	size_t stripped,
+	uint32_t version,
+	size_t block_size,
+	git_buf *offset_table)
+{
+	git_buf last = GIT_BUF_INIT;
+	size_t i, entry_size, block_start = *offset, in_block = 0;
+	git_index_entry *entry;
+	uint32_t values[2];
+	int error = 0;
+
+	git_vector_foreach(entries, i, entry) {
+		if ((error = write_disk_entry(&entry_size,
+				file, entry, i < stripped, version, &last)) < 0)
+			break;
+
+		*offset += entry_size;
+
+		if (block_size && (++in_block == block_size || i == entries->length - 1)) {
+			values[0] = htonl((uint32_t)block_start);
+			values[1] = htonl((uint32_t)in_block);
+
+			if ((error = git_buf_put(offset_table,
+					(const char *)values, sizeof(values))) < 0)
+				break;
+
+			/* like core git, make the next path share nothing with
+			 * the last one, so that a reader that starts at the block
+			 * and one that reads all the entries agree
+			 */
+			if (last.size > 0)
+				last.ptr[0] = '\0';
+
+			block_start = *offset;
+			in_block = 0;
+		}
+	}
+
+	git_buf_free(&last);
+	return error;
+}
+
+/* The headers of the extensions are added to `eoie`, if set, for the
+ * end of index entries extension that follows them.
+ */
+static int write_extension(
+	git_filebuf *file,
+	git_hash_ctx *eoie,
+	struct index_extension *header,
+	git_buf *data)
+{
+	struct index_extension ondisk;
+
+	memset(&ondisk, 0x0, sizeof(struct index_extension));
+	memcpy(&ondisk, header, 4);
+	ondisk.extension_size = htonl(header->extension_size);
+
+	if (eoie && git_hash_update(eoie, &ondisk, sizeof(struct index_extension)) < 0)
+		return -1;
+
+	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
+	return git_filebuf_write(file, data->ptr, data->size);
+}
+
+static int create_name_extension_data(git_buf *name_buf, git_index_name_entry *conflict_name)
+{
+	int error = 0;
+
+	if (conflict_name->ancestor == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->ancestor, strlen(conflict_name->ancestor) + 1);
+
+	if (error != 0)
+		goto on_error;
+
+	if (conflict_name->ours == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->ours, strlen(conflict_name->ours) + 1);
+
+	if (error != 0)
+		goto on_error;
+
+	if (conflict_name->theirs == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->theirs, strlen(conflict_name->theirs) + 1);
+
+on_error:
+	return error;
+}
+
+static int write_name_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	git_buf name_buf = GIT_BUF_INIT;
+	git_vector *out = &index->names;
+	git_index_name_entry *conflict_name;
+	struct index_extension extension;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(out, i, conflict_name) {
+		if ((error = create_name_extension_data(&name_buf, conflict_name)) < 0)
+			goto done;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
+	extension.extension_size = (uint32_t)name_buf.size;
+
+	error = write_extension(file, eoie, &extension, &name_buf);
+
+	git_buf_free(&name_buf);
+
+done:
+	return error;
+}
+
+static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *reuc)
+{
+	int i;
+	int error = 0;
+
+	if ((error = git_buf_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
+		return error;
+
+	for (i = 0; i < 3; i++) {
+		if ((error = git_buf_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
+			(error = git_buf_put(reuc_buf, "\0", 1)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (reuc->mode[i] && (error = git_buf_put(reuc_buf, (char *)&reuc->oid[i].id, GIT_OID_RAWSZ)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int write_reuc_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	git_buf reuc_buf = GIT_BUF_INIT;
+	git_vector *out = &index->reuc;
+	git_index_reuc_entry *reuc;
+	struct index_extension extension;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(out, i, reuc) {
+		if ((error = create_reuc_extension_data(&reuc_buf, reuc)) < 0)
+			goto done;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
+	extension.extension_size = (uint32_t)reuc_buf.size;
+
+	error = write_extension(file, eoie, &extension, &reuc_buf);
+
+	git_buf_free(&reuc_buf);
+
+done:
+	return error;
+}
+
+static int write_tree_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if (index->tree == NULL)
+		return 0;
+
+	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_free(&buf);
+
+	return error;
+}
+
+static int write_untracked_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&buf, index->untracked)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_free(&buf);
+
+	return error;
+}
+
+static int write_fsmonitor_extension(
+	git_index *index, git_filebuf *file, git_hash_ctx *eoie)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_fsmonitor__write_extension(&buf, index)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, eoie, &extension, &buf);
+
+	git_buf_free(&buf);
+
+	return error;
+}
+
+typedef struct {
+	git_vector entries; /* the replacements, then the new entries */
+	size_t replacements;
+	git_bitmap deleted;  /* entries of the shared index */
+	git_bitmap replaced;
+} split_index;
 
-	ondisk->flags = htons(entry->flags);
+#define SPLIT_INDEX_INIT { GIT_VECTOR_INIT, 0, GIT_BITMAP_INIT, GIT_BITMAP_INIT }
 
-	if (entry->flags & GIT_IDXENTRY_EXTENDED) {
-		struct entry_long *ondisk_ext;
-		ondisk_ext = (struct entry_long *)ondisk;
-		ondisk_ext->flags_extended = htons(entry->flags_extended &
-			GIT_IDXENTRY_EXTENDED_FLAGS);
-		path = ondisk_ext->path;
-	}
-	else
-		path = ondisk->path;
+static void split_index_free(split_index *split)
+{
+	git_vector_free(&split->entries);
+	split->replacements = 0;
+	git_bitmap_free(&split->deleted);
+	git_bitmap_free(&split->replaced);
+}
 
-	memcpy(path, entry->path, path_len);
+/* `core.splitIndex` turns split indexes on or off; when it is not set,
+ * the index is written the way it was read.
+ */
+static void index_update_split(git_index *index)
+{
+	git_config *cfg;
+	int split;
 
-	return 0;
+	if (!INDEX_OWNER(index) ||
+		git_repository_config__weakptr(&cfg, INDEX_OWNER(index)) < 0) {
+		giterr_clear();
+		return;
+	}
+
+	if ((split = git_config__get_bool_force(cfg, "core.splitindex", -1)) >= 0)
+		index->split = split;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/* Whether two entries are the same on disk, other than their path */
+static bool index_entry_same_on_disk(
+	const git_index_entry *a, const git_index_entry *b)
 {
-	int error = 0;
-	size_t i;
-	git_vector case_sorted, *entries;
-	git_index_entry *entry;
+	return a->ctime.seconds == b->ctime.seconds &&
+		a->ctime.nanoseconds == b->ctime.nanoseconds &&
+		a->mtime.seconds == b->mtime.seconds &&
+		a->mtime.nanoseconds == b->mtime.nanoseconds &&
+		a->dev == b->dev &&
+		a->ino == b->ino &&
+		a->mode == b->mode &&
+		a->uid == b->uid &&
+		a->gid == b->gid &&
+		a->file_size == b->file_size &&
+		git_oid_equal(&a->id, &b->id) &&
+		!((a->flags ^ b->flags) & ~GIT_IDXENTRY_EXTENDED) &&
+		!((a->flags_extended ^ b->flags_extended) & GIT_IDXENTRY_EXTENDED_FLAGS);
+}
 
-	/* If index->entries is sorted case-insensitively, then we need
-	 * to re-sort it case-sensitively before writing */
-	if (index->ignore_case) {
-		git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp);
-		git_vector_sort(&case_sorted);
-		entries = &case_sorted;
-	} else {
-		entries = &index->entries;
+/* Find the entries that differ from those of the shared index, both
+ * of them being sorted case-sensitively.
+ */
+static int split_index_compute(
+	split_index *split, git_index_shared *shared, git_vector *entries)
+{
+	git_vector added = GIT_VECTOR_INIT;
+	git_index_entry *entry, *shared_entry;
+	size_t i = 0, j = 0;
+	int cmp, error = 0;
+
+	while (!error && (i < entries->length || j < shared->entries.length)) {
+		entry = git_vector_get(entries, i);
+		shared_entry = git_vector_get(&shared->entries, j);
+
+		if (!shared_entry)
+			cmp = -1;
+		else if (!entry)
+			cmp = 1;
+		else
+			cmp = git_index_entry_cmp(entry, shared_entry);
+
+		if (cmp < 0) {
+			error = git_vector_insert(&added, entry);
+			i++;
+		} else if (cmp > 0) {
+			error = git_bitmap_set(&split->deleted, j);
+			j++;
+		} else {
+			if (!index_entry_same_on_disk(entry, shared_entry) &&
+				(error = git_bitmap_set(&split->replaced, j)) == 0)
+				error = git_vector_insert(&split->entries, entry);
+			i++;
+			j++;
+		}
 	}
 
-	git_vector_foreach(entries, i, entry)
-		if ((error = write_disk_entry(file, entry)) < 0)
-			break;
+	split->replacements = split->entries.length;
 
-	if (index->ignore_case)
-		git_vector_free(&case_sorted);
+	for (i = 0; !error && i < added.length; i++)
+		error = git_vector_insert(&split->entries, git_vector_get(&added, i));
 
+	git_vector_free(&added);
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_buf *data)
+/* Whether the split index holds too many of the entries to keep
+ * writing it relative to the shared index, rather than a new one.
+ */
+static bool split_index_too_large(
+	git_index *index, split_index *split, size_t entry_count)
 {
-	struct index_extension ondisk;
+	git_config *cfg;
+	int max_change = SPLIT_INDEX_MAX_PERCENT_CHANGE;
 
-	memset(&ondisk, 0x0, sizeof(struct index_extension));
-	memcpy(&ondisk, header, 4);
-	ondisk.extension_size = htonl(header->extension_size);
+	if (INDEX_OWNER(index) &&
+		git_repository_config__weakptr(&cfg, INDEX_OWNER(index)) == 0)
+		max_change = git_config__get_int_force(
+			cfg, "splitindex.maxpercentchange", max_change);
 
-	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
-	return git_filebuf_write(file, data->ptr, data->size);
+	giterr_clear();
+
+	if (max_change < 0 || max_change > 100)
+		max_change = SPLIT_INDEX_MAX_PERCENT_CHANGE;
+
+	if (max_change == 0)
+		return true;
+
+	return (uint64_t)split->entries.length * 100 >
+		(uint64_t)entry_count * (uint64_t)max_change;
 }
 
-static int create_name_extension_data(git_buf *name_buf, git_index_name_entry *conflict_name)
+typedef struct {
+	const char *keep;
+	git_time_t expire;
+} shared_index_cleanup;
+
+static int remove_expired_shared_index(void *payload, git_buf *path)
 {
-	int error = 0;
+	shared_index_cleanup *cleanup = payload;
+	const char *name = strrchr(path->ptr, '/');
+	struct stat st;
 
-	if (conflict_name->ancestor == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
-	else
-		error = git_buf_put(name_buf, conflict_name->ancestor, strlen(conflict_name->ancestor) + 1);
+	name = name ? name + 1 : path->ptr;
 
-	if (error != 0)
-		goto on_error;
+	if (git__prefixcmp(name, SHARED_INDEX_PREFIX) != 0 ||
+		!strcmp(name + strlen(SHARED_INDEX_PREFIX), cleanup->keep))
+		return 0;
 
-	if (conflict_name->ours == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
-	else
-		error = git_buf_put(name_buf, conflict_name->ours, strlen(conflict_name->ours) + 1);
+	/* shared indexes in use are freshened each time they are linked to */
+	if (p_stat(path->ptr, &st) == 0 && st.st_mtime <= cleanup->expire)
+		p_unlink(path->ptr);
 
-	if (error != 0)
-		goto on_error;
+	return 0;
+}
 
-	if (conflict_name->theirs == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
+static void remove_expired_shared_indexes(git_index *index, const git_oid *keep)
+{
+	shared_index_cleanup cleanup;
+	char hex[GIT_OID_HEXSZ + 1];
+	git_buf path = GIT_BUF_INIT;
+	git_config *cfg;
+	char *expire = NULL;
+
+	if (INDEX_OWNER(index) &&
+		git_repository_config__weakptr(&cfg, INDEX_OWNER(index)) == 0)
+		expire = git_config__get_string_force(
+			cfg, "splitindex.sharedindexexpire", SHARED_INDEX_EXPIRE);
 	else
-		error = git_buf_put(name_buf, conflict_name->theirs, strlen(conflict_name->theirs) + 1);
+		expire = git__strdup(SHARED_INDEX_EXPIRE);
 
-on_error:
-	return error;
+	if (!expire || !strcmp(expire, "never") ||
+		git__date_parse(&cleanup.expire, expire) < 0)
+		goto done;
+
+	git_oid_tostr(hex, sizeof(hex), keep);
+	cleanup.keep = hex;
+
+	if (git_path_dirname_r(&path, index->index_file_path) >= 0)
+		git_path_direach(&path, 0, remove_expired_shared_index, &cleanup);
+
+done:
+	/* like core git, failing to clean up is not an error */
+	giterr_clear();
+	git__free(expire);
+	git_buf_free(&path);
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+static int write_shared_index(
+	git_index *index, git_vector *entries, uint32_t version)
 {
-	git_buf name_buf = GIT_BUF_INIT;
-	git_vector *out = &index->names;
-	git_index_name_entry *conflict_name;
-	struct index_extension extension;
-	size_t i;
-	int error = 0;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_index_shared *shared = NULL;
+	git_index_entry *entry, *dup;
+	struct index_header header;
+	git_oid checksum;
+	size_t i, offset = INDEX_HEADER_SIZE;
+	int error;
 
-	git_vector_foreach(out, i, conflict_name) {
-		if ((error = create_name_extension_data(&name_buf, conflict_name)) < 0)
+	header.signature = htonl(INDEX_HEADER_SIG);
+	header.version = htonl(version);
+	header.entry_count = htonl((uint32_t)entries->length);
+
+	if ((error = git_path_dirname_r(&path, index->index_file_path)) < 0 ||
+		(error = git_buf_joinpath(&path, path.ptr, "sharedindex")) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS | GIT_FILEBUF_TEMPORARY,
+			GIT_INDEX_FILE_MODE)) < 0)
+		goto done;
+
+	git_buf_clear(&path);
+
+	if ((error = git_filebuf_write(&file, &header, sizeof(struct index_header))) < 0 ||
+		(error = write_entries(&offset, &file, entries, 0, version, 0, NULL)) < 0 ||
+		(error = git_filebuf_hash(&checksum, &file)) < 0 ||
+		(error = git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ)) < 0 ||
+		(error = shared_index_path(&path, index, &checksum)) < 0 ||
+		(error = git_filebuf_commit_at(&file, path.ptr)) < 0)
+		goto done;
+
+	if ((shared = git__calloc(1, sizeof(git_index_shared))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	git_oid_cpy(&shared->checksum, &checksum);
+	git_pool_init(&shared->entry_pool, 1);
+
+	if ((error = git_vector_init(
+			&shared->entries, entries->length, git_index_entry_cmp)) < 0)
+		goto done;
+
+	git_vector_foreach(entries, i, entry) {
+		if ((error = index_entry_dup_pooled(
+				&dup, &shared->entry_pool, entry)) < 0)
 			goto done;
+
+		dup->flags_extended &= GIT_IDXENTRY_EXTENDED_FLAGS;
+
+		if ((error = git_vector_insert(&shared->entries, dup)) < 0) {
+			index_entry_free(dup);
+			goto done;
+		}
 	}
 
-	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
-	extension.extension_size = (uint32_t)name_buf.size;
+	git_vector_set_sorted(&shared->entries, true);
 
-	error = write_extension(file, &extension, &name_buf);
+	index_shared_free(index->shared);
+	index->shared = shared;
+	shared = NULL;
 
-	git_buf_free(&name_buf);
+	remove_expired_shared_indexes(index, &checksum);
 
 done:
+	git_filebuf_cleanup(&file);
+	index_shared_free(shared);
+	git_buf_free(&path);
 	return error;
 }
 
-static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *reuc)
+/* Find what goes in the split index, writing a new shared index first
+ * when there is none or the split index would be too large.
+ */
+static int prepare_split_index(
+	split_index *split, git_index *index, git_vector *entries, uint32_t version)
 {
-	int i;
-	int error = 0;
+	git_buf path = GIT_BUF_INIT;
+	int error;
 
-	if ((error = git_buf_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
+	if (index->shared &&
+		(error = split_index_compute(split, index->shared, entries)) < 0)
 		return error;
 
-	for (i = 0; i < 3; i++) {
-		if ((error = git_buf_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
-			(error = git_buf_put(reuc_buf, "\0", 1)) < 0)
-			return error;
+	if (!index->shared ||
+		split_index_too_large(index, split, entries->length)) {
+		split_index_free(split);
+		return write_shared_index(index, entries, version);
 	}
 
-	for (i = 0; i < 3; i++) {
-		if (reuc->mode[i] && (error = git_buf_put(reuc_buf, (char *)&reuc->oid[i].id, GIT_OID_RAWSZ)) < 0)
-			return error;
-	}
+	/* keep the shared index from expiring while it is in use */
+	if (shared_index_path(&path, index, &index->shared->checksum) < 0)
+		return -1;
+
+	p_utimes(path.ptr, NULL);
 
+	git_buf_free(&path);
 	return 0;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+static int write_link_extension(
+	git_index *index, split_index *split, git_filebuf *file, git_hash_ctx *eoie)
 {
-	git_buf reuc_buf = GIT_BUF_INIT;
-	git_vector *out = &index->reuc;
-	git_index_reuc_entry *reuc;
 	struct index_extension extension;
-	size_t i;
-	int error = 0;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
 
-	git_vector_foreach(out, i, reuc) {
-		if ((error = create_reuc_extension_data(&reuc_buf, reuc)) < 0)
-			goto done;
-	}
+	git_buf_put(&buf, (const char *)index->shared->checksum.id, GIT_OID_RAWSZ);
 
-	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
-	extension.extension_size = (uint32_t)reuc_buf.size;
+	if ((error = git_ewah_serialize_bits(&buf, &split->deleted)) < 0 ||
+		(error = git_ewah_serialize_bits(&buf, &split->replaced)) < 0)
+		goto done;
 
-	error = write_extension(file, &extension, &reuc_buf);
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_LINK_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
 
-	git_buf_free(&reuc_buf);
+	error = write_extension(file, eoie, &extension, &buf);
 
 done:
+	git_buf_free(&buf);
 	return error;
 }
 
-static int write_tree_extension(git_index *index, git_filebuf *file)
+static void clear_uptodate(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_IDXENTRY_UPTODATE;
+}
+
+/* Whether to write the `IEOT` extension, with blocks of `block_size`
+ * entries, and the `EOIE` one, which core git does when `index.threads`
+ * is set to more than one thread, or as asked by
+ * `index.recordOffsetTable` and `index.recordEndOfIndexEntries`.
+ */
+static void index_offset_table_config(
+	size_t *block_size, bool *end_of_entries, git_index *index, size_t entry_count)
+{
+	git_config *cfg;
+	bool configured;
+	int threads, offset_table = -1, eoie = -1;
+	size_t blocks;
+
+	*block_size = 0;
+
+	threads = index_threads_config(&configured, index);
+
+	if (INDEX_OWNER(index) &&
+		git_repository_config__weakptr(&cfg, INDEX_OWNER(index)) == 0) {
+		offset_table = git_config__get_bool_force(
+			cfg, "index.recordoffsettable", -1);
+		eoie = git_config__get_bool_force(
+			cfg, "index.recordendofindexentries", -1);
+	}
+
+	giterr_clear();
+
+	if (offset_table < 0)
+		offset_table = (configured && threads != 1);
+
+	if (eoie < 0)
+		eoie = (configured && threads != 1);
+
+	*end_of_entries = (eoie > 0);
+
+	if (!offset_table)
+		return;
+
+	if (threads > 0) {
+		blocks = (size_t)threads;
+	} else {
+		blocks = entry_count / INDEX_THREAD_COST;
+
+		if (blocks > (size_t)git_online_cpus() - 1)
+			blocks = (size_t)git_online_cpus() - 1;
+	}
+
+	if (blocks > 1)
+		*block_size = (entry_count + blocks - 1) / blocks;
+}
+
+static int write_offset_table_extension(
+	git_filebuf *file, git_hash_ctx *eoie, git_buf *offset_table)
 {
 	struct index_extension extension;
 	git_buf buf = GIT_BUF_INIT;
+	uint32_t version = htonl(INDEX_OFFSET_TABLE_VERSION);
 	int error;
 
-	if (index->tree == NULL)
-		return 0;
-
-	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
-		return error;
+	if ((error = git_buf_put(&buf, (const char *)&version, sizeof(uint32_t))) < 0 ||
+		(error = git_buf_put(&buf, offset_table->ptr, offset_table->size)) < 0)
+		goto done;
 
 	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
+	memcpy(&extension.signature, INDEX_EXT_OFFSET_TABLE_SIG, 4);
 	extension.extension_size = (uint32_t)buf.size;
 
-	error = write_extension(file, &extension, &buf);
+	error = write_extension(file, eoie, &extension, &buf);
 
+done:
 	git_buf_free(&buf);
-
 	return error;
 }
 
-static void clear_uptodate(git_index *index)
+static int write_end_of_entries_extension(
+	git_filebuf *file, git_hash_ctx *eoie, size_t offset)
 {
-	git_index_entry *entry;
-	size_t i;
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	uint32_t offset_raw = htonl((uint32_t)offset);
+	git_oid hash;
+	int error;
 
-	git_vector_foreach(&index->entries, i, entry)
-		entry->flags_extended &= ~GIT_IDXENTRY_UPTODATE;
+	if ((error = git_hash_final(&hash, eoie)) < 0 ||
+		(error = git_buf_put(&buf, (const char *)&offset_raw, sizeof(uint32_t))) < 0 ||
+		(error = git_buf_put(&buf, (const char *)hash.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_END_OF_ENTRIES_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, NULL, &extension, &buf);
+
+done:
+	git_buf_free(&buf);
+	return error;
 }
 
 static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 {
 	git_oid hash_final;
 	struct index_header header;
-	bool is_extended;
+	bool is_extended, end_of_entries;
 	uint32_t index_version_number;
+	git_vector case_sorted = GIT_VECTOR_INIT, *entries = &index->entries;
+	split_index split = SPLIT_INDEX_INIT;
+	git_buf offset_table = GIT_BUF_INIT;
+	git_hash_ctx eoie_ctx, *eoie = NULL;
+	size_t offset = INDEX_HEADER_SIZE, block_size;
+	int error = -1;
 
 	assert(index && file);
 
 	is_extended = is_index_extended(index);
-	index_version_number = is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER;
+
+	/* version 4 has extended flags as well; version 3 is only needed
+	 * over version 2 when there are entries that use them
+	 */
+	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+		index_version_number = INDEX_VERSION_NUMBER_COMP;
+	else
+		index_version_number = is_extended ?
+			INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER_LB;
+
+	/* If index->entries is sorted case-insensitively, then we need
+	 * to re-sort it case-sensitively before writing */
+	if (index->ignore_case) {
+		if (git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp) < 0)
+			goto done;
+
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	}
+
+	index_update_split(index);
+
+	if (index->split) {
+		if (prepare_split_index(&split, index, entries, index_version_number) < 0)
+			goto done;
+
+		entries = &split.entries;
+	} else {
+		index_shared_free(index->shared);
+		index->shared = NULL;
+	}
 
 	header.signature = htonl(INDEX_HEADER_SIG);
 	header.version = htonl(index_version_number);
-	header.entry_count = htonl((uint32_t)index->entries.length);
+	header.entry_count = htonl((uint32_t)entries->length);
 
 	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
-		return -1;
+		goto done;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	index_offset_table_config(&block_size, &end_of_entries, index, entries->length);
+
+	if (end_of_entries) {
+		if (git_hash_ctx_init(&eoie_ctx) < 0)
+			goto done;
+
+		eoie = &eoie_ctx;
+	}
+
+	if (write_entries(&offset, file, entries, split.replacements,
+			index_version_number, block_size, &offset_table) < 0)
+		goto done;
+
+	/* write the offset table first, as core git does */
+	if (offset_table.size > 0 &&
+		write_offset_table_extension(file, eoie, &offset_table) < 0)
+		goto done;
+
+	/* then the link to the shared index */
+	if (index->split && write_link_extension(index, &split, file, eoie) < 0)
+		goto done;
 
 	/* write the tree cache extension */
-	if (index->tree != NULL && write_tree_extension(index, file) < 0)
-		return -1;
+	if (index->tree != NULL && write_tree_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, eoie) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked != NULL && write_untracked_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (index->fsmonitor_token != NULL && write_fsmonitor_extension(index, file, eoie) < 0)
+		goto done;
+
+	/* the end of the entries goes last, after the extensions it hashes */
+	if (eoie && write_end_of_entries_extension(file, eoie, offset) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
@@ -2792,12 +4434,21 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 
 	/* write it at the end of the file */
 	if (git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ) < 0)
-		return -1;
+		goto done;
 
 	/* file entries are no longer up to date */
 	clear_uptodate(index);
+	error = 0;
 
-	return 0;
+done:
+	if (eoie) {
+		git_hash_ctx_cleanup(eoie);
+	}
+
+	git_buf_free(&offset_table);
+	split_index_free(&split);
+	git_vector_free(&case_sorted);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -2836,7 +4487,7 @@ static int read_tree_cb(
 		return -1;
 
 	entry->mode = tentry->attr;
-	entry->id = tentry->oid;
+	git_oid_cpy(&entry->id, tentry->oid);
 
 	/* look for corresponding old entry and copy data to new entry */
 	if (data->old_entries != NULL &&
@@ -2981,6 +4632,7 @@ int git_index_read_index(
 			remove_entry = (git_index_entry *)old_entry;
 		} else if (diff > 0) {
 			dup_entry = (git_index_entry *)new_entry;
+			git_untracked_cache_invalidate_path(index->untracked, dup_entry->path);
 		} else {
 			/* Path and stage are equal, if the OID is equal, keep it to
 			 * keep the stat cache data.
@@ -3029,10 +4681,12 @@ int git_index_read_index(
 
 	git_vector_swap(&new_entries, &index->entries);
 	new_entries_map = git__swap(index->entries_map, new_entries_map);
+	index->entries_map_pending = 0;
 
 	git_vector_foreach(&remove_entries, i, entry) {
 		if (index->tree)
 			git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 
 		index_entry_free(entry);
 	}
@@ -10,14 +10,25 @@
 #include "fileops.h"
 #include "filebuf.h"
 #include "vector.h"
+#include "pool.h"
 #include "idxmap.h"
 #include "tree-cache.h"
+#include "untracked_cache.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
 #define GIT_INDEX_FILE "index"
 #define GIT_INDEX_FILE_MODE 0666
 
+/* The entries of a shared index, which those of a split index are
+ * written relative to.
+ */
+typedef struct {
+	git_oid checksum;   /* of the file, which is named after it */
+	git_vector entries; /* sorted case-sensitively, as in the file */
+	git_pool entry_pool; /* the entries read or written */
+} git_index_shared;
+
 struct git_index {
 	git_refcount rc;
 
@@ -27,18 +38,28 @@ struct git_index {
 
 	git_vector entries;
 	git_idxmap *entries_map;
+	git_pool entry_pool; /* the entries read from disk */
 
 	git_vector deleted; /* deleted entries if readers > 0 */
+	git_vector deleted_pools; /* cleared entry pools if readers > 0 */
 	git_atomic readers; /* number of active iterators */
 
+	unsigned int version;
+
 	unsigned int on_disk:1;
 	unsigned int ignore_case:1;
 	unsigned int distrust_filemode:1;
 	unsigned int no_symlinks:1;
+	unsigned int split:1; /* written as a split index */
+	unsigned int entries_map_pending:1; /* built on the first lookup */
 
 	git_tree_cache *tree;
 	git_pool tree_pool;
 
+	git_untracked_cache *untracked;
+	char *fsmonitor_token; /* of the last query of the fsmonitor */
+	git_index_shared *shared; /* the base of the split index */
+
 	git_vector names;
 	git_vector reuc;
 
@@ -53,9 +74,16 @@ struct git_index_conflict_iterator {
 	size_t cur;
 };
 
+/* Whether `entries_map` is only built on the first lookup by path */
+extern bool git_index__lazy_map;
+
 extern void git_index_entry__init_from_stat(
 	git_index_entry *entry, struct stat *st, bool trust_mode);
 
+/* The stat data that `git_index_entry__init_from_stat` made `entry` from */
+extern void git_index_entry__to_stat(
+	struct stat *st, const git_index_entry *entry);
+
 /* Index entry comparison functions for array sorting */
 extern int git_index_entry_cmp(const void *a, const void *b);
 extern int git_index_entry_icmp(const void *a, const void *b);
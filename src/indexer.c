@@ -16,9 +16,14 @@
 #include "filebuf.h"
 #include "oid.h"
 #include "oidmap.h"
+#include "offmap.h"
 #include "zstream.h"
+#include "delta-apply.h"
+#include "array.h"
+#include "thread-utils.h"
 
 GIT__USE_OIDMAP
+GIT__USE_OFFMAP
 
 extern git_mutex git__mwindow_mutex;
 
@@ -35,12 +40,14 @@ struct git_indexer {
 	unsigned int parsed_header :1,
 		opened_pack :1,
 		have_stream :1,
-		have_delta :1;
+		have_delta :1,
+		stream_deltas :1;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	unsigned int mode;
 	git_off_t off;
 	git_off_t entry_start;
+	git_off_t entry_base; /* base of the current entry, if an OFS_DELTA */
 	git_packfile_stream stream;
 	size_t nr_objects;
 	git_vector objects;
@@ -52,6 +59,11 @@ struct git_indexer {
 	void *progress_payload;
 	char objbuf[8*1024];
 
+	unsigned int nr_threads; /* nr of threads resolving deltas */
+
+	/* Resolves deltas while we receive the pack, if streaming */
+	struct delta_stream *delta_stream;
+
 	/* Needed to look up objects which we want to inject to fix a thin pack */
 	git_odb *odb;
 
@@ -62,7 +74,21 @@ struct git_indexer {
 };
 
 struct delta_info {
-	git_off_t delta_off;
+	git_off_t delta_off; /* where the entry starts */
+	git_off_t end_off; /* where the entry ends */
+
+	/* filled in when resolving the deltas */
+	git_otype type;
+	size_t size; /* size of the inflated delta */
+	git_off_t data_off; /* where the compressed delta starts */
+	git_off_t base_off; /* base of an OFS_DELTA */
+	git_oid base_id; /* base of a REF_DELTA */
+
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+	git_atomic claimed; /* taken by the worker which resolves it */
+
+	unsigned int streamed :1; /* queued to be resolved while receiving */
 };
 
 const git_oid *git_indexer_hash(const git_indexer *idx)
@@ -103,6 +129,12 @@ static int objects_cmp(const void *a, const void *b)
 	return git_oid__cmp(&entrya->oid, &entryb->oid);
 }
 
+GIT_INLINE(git_off_t) entry_offset(const struct entry *entry)
+{
+	return entry->offset == UINT32_MAX ?
+		(git_off_t)entry->offset_long : (git_off_t)entry->offset;
+}
+
 int git_indexer_new(
 		git_indexer **out,
 		const char *prefix,
@@ -122,6 +154,7 @@ int git_indexer_new(
 	idx->progress_cb = progress_cb;
 	idx->progress_payload = progress_payload;
 	idx->mode = mode ? mode : GIT_PACK_FILE_MODE;
+	idx->nr_threads = 0;
 	git_hash_ctx_init(&idx->hash_ctx);
 	git_hash_ctx_init(&idx->trailer);
 
@@ -157,6 +190,35 @@ cleanup:
 	return -1;
 }
 
+unsigned int git_indexer_set_threads(git_indexer *idx, unsigned int n)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	idx->nr_threads = n;
+#else
+	GIT_UNUSED(n);
+	idx->nr_threads = 1;
+#endif
+
+	return idx->nr_threads;
+}
+
+int git_indexer_set_streaming(git_indexer *idx, int enabled)
+{
+	assert(idx);
+
+#ifdef GIT_THREADS
+	/* the thread is started when we parse the header */
+	if (!idx->parsed_header)
+		idx->stream_deltas = !!enabled;
+#else
+	GIT_UNUSED(enabled);
+#endif
+
+	return idx->stream_deltas;
+}
+
 /* Try to store the delta so we can try to resolve it later */
 static int store_delta(git_indexer *idx)
 {
@@ -165,6 +227,7 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GITERR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->end_off = idx->off;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
 		return -1;
@@ -209,11 +272,14 @@ static int advance_delta_offset(git_indexer *idx, git_otype type)
 
 	if (type == GIT_OBJ_REF_DELTA) {
 		idx->off += GIT_OID_RAWSZ;
+		idx->entry_base = 0;
 	} else {
 		git_off_t base_off = get_delta_base(idx->pack, &w, &idx->off, type, idx->entry_start);
 		git_mwindow_close(&w);
 		if (base_off < 0)
 			return (int)base_off;
+
+		idx->entry_base = base_off;
 	}
 
 	return 0;
@@ -260,6 +326,30 @@ static int crc_object(uint32_t *crc_out, git_mwindow_file *mwf, git_off_t start,
 	return 0;
 }
 
+/* Create the index entries of a delta which resolved to `obj` */
+static int delta_entries(struct delta_info *delta, git_mwindow_file *mwf, git_rawobj *obj)
+{
+	struct entry *entry;
+	struct git_pack_entry *pentry;
+
+	entry = git__calloc(1, sizeof(*entry));
+	pentry = git__calloc(1, sizeof(*pentry));
+
+	if (!entry || !pentry || git_odb__hashobj(&entry->oid, obj) < 0 ||
+		crc_object(&entry->crc, mwf,
+			delta->delta_off, delta->end_off - delta->delta_off) < 0) {
+		git__free(entry);
+		git__free(pentry);
+		return -1;
+	}
+
+	git_oid_cpy(&pentry->sha1, &entry->oid);
+	delta->entry = entry;
+	delta->pentry = pentry;
+
+	return 0;
+}
+
 static int store_object(git_indexer *idx)
 {
 	int i, error;
@@ -365,39 +455,34 @@ static int save_entry(git_indexer *idx, struct entry *entry, struct git_pack_ent
 	return 0;
 }
 
-static int hash_and_save(git_indexer *idx, git_rawobj *obj, git_off_t entry_start)
+/* Add the deltas which have been resolved to the index */
+static int save_resolved(git_indexer *idx, size_t *saved)
 {
-	git_oid oid;
-	size_t entry_size;
-	struct entry *entry;
-	struct git_pack_entry *pentry = NULL;
-
-	entry = git__calloc(1, sizeof(*entry));
-	GITERR_CHECK_ALLOC(entry);
+	struct delta_info *delta;
+	size_t i;
+	int error = 0;
 
-	if (git_odb__hashobj(&oid, obj) < 0) {
-		giterr_set(GITERR_INDEXER, "Failed to hash object");
-		goto on_error;
-	}
+	*saved = 0;
 
-	pentry = git__calloc(1, sizeof(struct git_pack_entry));
-	GITERR_CHECK_ALLOC(pentry);
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (!delta || !delta->entry)
+			continue;
 
-	git_oid_cpy(&pentry->sha1, &oid);
-	git_oid_cpy(&entry->oid, &oid);
-	entry->crc = crc32(0L, Z_NULL, 0);
+		if (!error)
+			error = save_entry(idx, delta->entry, delta->pentry, delta->delta_off);
 
-	entry_size = (size_t)(idx->off - entry_start);
-	if (crc_object(&entry->crc, &idx->pack->mwf, entry_start, entry_size) < 0)
-		goto on_error;
+		if (error < 0) {
+			git__free(delta->entry);
+			git__free(delta->pentry);
+		}
 
-	return save_entry(idx, entry, pentry, entry_start);
+		/* remove from the list */
+		git_vector_set(NULL, &idx->deltas, i, NULL);
+		git__free(delta);
+		(*saved)++;
+	}
 
-on_error:
-	git__free(pentry);
-	git__free(entry);
-	git__free(obj->data);
-	return -1;
+	return error;
 }
 
 static int do_progress_callback(git_indexer *idx, git_transfer_progress *stats)
@@ -492,6 +577,409 @@ static int append_to_pack(git_indexer *idx, const void *data, size_t size)
 	return write_at(idx, data, idx->pack->mwf.size, size);
 }
 
+/* Inflate `size` bytes of data stored at `offset` in the pack */
+static int inflate_entry(git_rawobj *out, struct git_pack_file *pack, git_off_t offset, size_t size)
+{
+	git_packfile_stream stream;
+	size_t alloc_size, len = 0;
+	ssize_t read;
+	char *data;
+	int error = 0;
+
+	GITERR_CHECK_ALLOC_ADD(&alloc_size, size, 1);
+	data = git__malloc(alloc_size);
+	GITERR_CHECK_ALLOC(data);
+
+	if (git_packfile_stream_open(&stream, pack, offset) < 0) {
+		git__free(data);
+		return -1;
+	}
+
+	while (!stream.done) {
+		if ((read = git_packfile_stream_read(&stream, data + len, alloc_size - len)) < 0) {
+			error = (int)read;
+			break;
+		}
+
+		len += read;
+	}
+
+	git_packfile_stream_free(&stream);
+
+	if (!error && len != size) {
+		giterr_set(GITERR_INDEXER, "object size mismatch");
+		error = -1;
+	}
+
+	if (error < 0) {
+		git__free(data);
+		return error;
+	}
+
+	data[size] = '\0';
+	out->data = data;
+	out->len = size;
+	return 0;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * When streaming, the OFS_DELTAs whose base is already in the pack
+ * (stored whole, or through other such deltas) are handed to a thread
+ * as they arrive, so that they get resolved while we keep receiving
+ * the rest of the pack.  The thread reads the pack through its own
+ * handle, as we throw away our windows every time the pack grows, and
+ * only fills in the entries of the deltas; they are added to the index
+ * by git_indexer_commit(), which resolves whatever is left.
+ */
+struct delta_stream {
+	git_thread thread;
+	git_mutex lock;
+	git_cond cond;
+
+	struct git_pack_file *pack; /* the thread's own handle on the pack */
+	git_off_t size; /* how much of the pack has been written out */
+
+	git_array_t(struct delta_info *) queue;
+	size_t queue_pos;
+
+	/* recently resolved objects, which later deltas are likely to use */
+	git_offmap *cache;
+	git_array_t(git_off_t) cache_order;
+	size_t cache_pos;
+	size_t cache_used;
+
+	unsigned int done :1, /* nothing else will be queued */
+		stop :1; /* give up on what is left in the queue */
+};
+
+static void stream_cache_evict(struct delta_stream *ds, size_t needed)
+{
+	git_rawobj *obj;
+	git_off_t offset;
+	khiter_t pos;
+
+	while (ds->cache_used + needed > GIT_PACK_CACHE_MEMORY_LIMIT &&
+		ds->cache_pos < git_array_size(ds->cache_order)) {
+		offset = *git_array_get(ds->cache_order, ds->cache_pos);
+		ds->cache_pos++;
+
+		/* it may have been evicted already, or never made it in */
+		pos = git_offmap_lookup_index(ds->cache, offset);
+		if (!git_offmap_valid_index(ds->cache, pos))
+			continue;
+
+		obj = git_offmap_value_at(ds->cache, pos);
+		git_offmap_delete_at(ds->cache, pos);
+
+		ds->cache_used -= obj->len;
+		git__free(obj->data);
+		git__free(obj);
+	}
+}
+
+/* Keep `obj` around as a base; it is freed if we cannot */
+static void stream_cache_add(struct delta_stream *ds, git_off_t offset, git_rawobj *obj)
+{
+	git_rawobj *cached = NULL;
+	git_off_t *order = NULL;
+	int error = -1;
+
+	if (obj->len < GIT_PACK_CACHE_MEMORY_LIMIT) {
+		stream_cache_evict(ds, obj->len);
+
+		if ((cached = git__malloc(sizeof(git_rawobj))) != NULL &&
+			(order = git_array_alloc(ds->cache_order)) != NULL) {
+			*order = offset;
+			memcpy(cached, obj, sizeof(git_rawobj));
+			git_offmap_insert(ds->cache, offset, cached, error);
+		}
+	}
+
+	if (error < 0) {
+		git__free(cached);
+		git__free(obj->data);
+		return;
+	}
+
+	ds->cache_used += obj->len;
+}
+
+static int stream_base(git_rawobj **out, struct delta_stream *ds, git_off_t offset)
+{
+	git_rawobj obj;
+	git_off_t curpos = offset;
+	khiter_t pos;
+
+	pos = git_offmap_lookup_index(ds->cache, offset);
+	if (!git_offmap_valid_index(ds->cache, pos)) {
+		if (git_packfile_unpack(&obj, ds->pack, &curpos) < 0)
+			return -1;
+
+		stream_cache_add(ds, offset, &obj);
+
+		pos = git_offmap_lookup_index(ds->cache, offset);
+		if (!git_offmap_valid_index(ds->cache, pos))
+			return -1;
+	}
+
+	*out = git_offmap_value_at(ds->cache, pos);
+	return 0;
+}
+
+static void stream_resolve(struct delta_stream *ds, struct delta_info *delta)
+{
+	git_mwindow *w = NULL;
+	git_rawobj *base, delta_obj, obj;
+	git_off_t curpos = delta->delta_off, base_off;
+	git_otype type;
+	size_t size;
+
+	/* Failures are reported when git_indexer_commit() tries again */
+	if (git_packfile_unpack_header(&size, &type, &ds->pack->mwf, &w, &curpos) < 0)
+		goto done;
+
+	git_mwindow_close(&w);
+	base_off = get_delta_base(ds->pack, &w, &curpos, type, delta->delta_off);
+	git_mwindow_close(&w);
+
+	if (base_off <= 0 || stream_base(&base, ds, base_off) < 0 ||
+		inflate_entry(&delta_obj, ds->pack, curpos, size) < 0)
+		goto done;
+
+	if (git__delta_apply(&obj, base->data, base->len, delta_obj.data, delta_obj.len) == 0) {
+		obj.type = base->type;
+
+		if (delta_entries(delta, &ds->pack->mwf, &obj) == 0)
+			stream_cache_add(ds, delta->delta_off, &obj);
+		else
+			git__free(obj.data);
+	}
+
+	git__free(delta_obj.data);
+
+done:
+	git_mwindow_close(&w);
+	giterr_clear();
+}
+
+static void *stream_thread(void *payload)
+{
+	struct delta_stream *ds = payload;
+	struct delta_info *delta;
+	bool grown;
+
+	while (true) {
+		git_mutex_lock(&ds->lock);
+
+		while (!ds->done && !ds->stop &&
+			ds->queue_pos == git_array_size(ds->queue))
+			git_cond_wait(&ds->cond, &ds->lock);
+
+		if (ds->stop || ds->queue_pos == git_array_size(ds->queue)) {
+			git_mutex_unlock(&ds->lock);
+			break;
+		}
+
+		delta = *git_array_get(ds->queue, ds->queue_pos);
+		ds->queue_pos++;
+		grown = ds->pack->mwf.size != ds->size;
+		ds->pack->mwf.size = ds->size;
+
+		git_mutex_unlock(&ds->lock);
+
+		/* As the file grows any windows we try to use will be out of date */
+		if (grown)
+			git_mwindow_free_all(&ds->pack->mwf);
+
+		stream_resolve(ds, delta);
+	}
+
+	return NULL;
+}
+
+static void stream_free_pack(struct delta_stream *ds)
+{
+	if (!git_mutex_lock(&git__mwindow_mutex)) {
+		git_packfile_free(ds->pack);
+		git_mutex_unlock(&git__mwindow_mutex);
+	}
+}
+
+static int stream_start(git_indexer *idx)
+{
+	struct delta_stream *ds;
+
+	ds = git__calloc(1, sizeof(struct delta_stream));
+	GITERR_CHECK_ALLOC(ds);
+
+	if (git_packfile_alloc(&ds->pack, idx->pack->pack_name) < 0) {
+		git__free(ds);
+		return -1;
+	}
+
+	ds->pack->mwf.size = 0;
+	if ((ds->cache = git_offmap_alloc()) == NULL ||
+		(ds->pack->mwf.fd = git_futils_open_ro(idx->pack->pack_name)) < 0 ||
+		git_mwindow_file_register(&ds->pack->mwf) < 0)
+		goto on_error;
+
+	if (git_mutex_init(&ds->lock) < 0 || git_cond_init(&ds->cond) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize indexer mutex");
+		goto on_error;
+	}
+
+	if (git_thread_create(&ds->thread, NULL, stream_thread, ds) != 0) {
+		giterr_set(GITERR_THREAD, "unable to create thread");
+		git_cond_free(&ds->cond);
+		git_mutex_free(&ds->lock);
+		goto on_error;
+	}
+
+	idx->delta_stream = ds;
+	return 0;
+
+on_error:
+	if (ds->cache)
+		git_offmap_free(ds->cache);
+	stream_free_pack(ds);
+	git__free(ds);
+	return -1;
+}
+
+/* Whether the object at `offset` is stored whole or is being streamed */
+static bool stream_has_base(git_indexer *idx, git_off_t offset)
+{
+	struct delta_info *delta;
+	size_t lo, hi, mid;
+	git_off_t cur;
+
+	/* both lists are still in pack order */
+	lo = 0;
+	hi = git_vector_length(&idx->objects);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cur = entry_offset(git_vector_get(&idx->objects, mid));
+
+		if (cur == offset)
+			return true;
+		else if (cur < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	lo = 0;
+	hi = git_vector_length(&idx->deltas);
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		delta = git_vector_get(&idx->deltas, mid);
+
+		if (delta->delta_off == offset)
+			return delta->streamed;
+		else if (delta->delta_off < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return false;
+}
+
+/* Queue the delta we just stored, if the thread can resolve it */
+static int stream_delta(git_indexer *idx)
+{
+	struct delta_stream *ds = idx->delta_stream;
+	struct delta_info *delta, **slot;
+
+	if (!idx->entry_base || !stream_has_base(idx, idx->entry_base))
+		return 0;
+
+	delta = git_vector_last(&idx->deltas);
+
+	if (git_mutex_lock(&ds->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock indexer mutex");
+		return -1;
+	}
+
+	if ((slot = git_array_alloc(ds->queue)) != NULL) {
+		*slot = delta;
+		delta->streamed = 1;
+
+		/* everything up to here is on disk */
+		ds->size = idx->pack->mwf.size;
+		git_cond_signal(&ds->cond);
+	}
+
+	git_mutex_unlock(&ds->lock);
+
+	GITERR_CHECK_ALLOC(slot);
+	return 0;
+}
+
+/* Let the thread finish the queue (or give up on it) and free it */
+static void stream_finish(git_indexer *idx, bool stop)
+{
+	struct delta_stream *ds = idx->delta_stream;
+	git_rawobj *obj;
+
+	if (!ds)
+		return;
+
+	git_mutex_lock(&ds->lock);
+	ds->done = 1;
+	ds->stop = stop;
+	git_cond_signal(&ds->cond);
+	git_mutex_unlock(&ds->lock);
+
+	git_thread_join(&ds->thread, NULL);
+
+	git_offmap_foreach_value(ds->cache, obj, {
+		git__free(obj->data);
+		git__free(obj);
+	});
+	git_offmap_free(ds->cache);
+	git_array_clear(ds->cache_order);
+
+	stream_free_pack(ds);
+	git_array_clear(ds->queue);
+	git_cond_free(&ds->cond);
+	git_mutex_free(&ds->lock);
+	git__free(ds);
+
+	idx->delta_stream = NULL;
+}
+
+#else
+
+#define stream_start(idx) 0
+#define stream_delta(idx) 0
+#define stream_finish(idx, stop) /* nothing to do */
+
+#endif
+
+/* Add the deltas which were resolved while we were receiving the pack */
+static int save_streamed(git_indexer *idx, git_transfer_progress *stats)
+{
+	size_t saved;
+	int error;
+
+	if (!idx->delta_stream)
+		return 0;
+
+	stream_finish(idx, false);
+
+	error = save_resolved(idx, &saved);
+	stats->indexed_objects += (unsigned int)saved;
+	stats->indexed_deltas += (unsigned int)saved;
+
+	if (!error && saved)
+		error = do_progress_callback(idx, stats);
+
+	return error;
+}
+
 int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_transfer_progress *stats)
 {
 	int error = -1;
@@ -548,6 +1036,9 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 		processed = stats->indexed_objects = 0;
 		stats->total_objects = total_objects;
 
+		if (idx->stream_deltas && (error = stream_start(idx)) < 0)
+			return error;
+
 		if ((error = do_progress_callback(idx, stats)) != 0)
 			return error;
 	}
@@ -621,6 +1112,9 @@ int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_tran
 
 		if (idx->have_delta) {
 			error = store_delta(idx);
+
+			if (!error && idx->delta_stream)
+				error = stream_delta(idx);
 		} else {
 			error = store_object(idx);
 		}
@@ -813,48 +1307,455 @@ static int fix_thin_pack(git_indexer *idx, git_transfer_progress *stats)
 	return 0;
 }
 
-static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
+/*
+ * Deltas are resolved by walking down from every object that is stored
+ * whole to the deltas that use it as their base, and from there to
+ * their own children.  Each base is thus inflated a single time and the
+ * chains hanging from different bases are independent, so we can hand
+ * them out to several threads.  The threads only fill in the entries of
+ * the deltas they resolve; adding them to the index happens afterwards.
+ */
+
+struct resolve_base {
+	git_off_t offset;
+	git_oid id;
+};
+
+struct resolve_frame {
+	git_rawobj obj;
+	git_off_t offset;
+	git_oid id;
+	size_t ofs_pos, ofs_end; /* OFS_DELTA children left to resolve */
+	size_t ref_pos, ref_end; /* REF_DELTA children left to resolve */
+};
+
+struct resolve_ctx {
+	git_indexer *idx;
+	git_transfer_progress *stats;
+
+	git_vector ofs_deltas; /* sorted by base offset */
+	git_vector ref_deltas; /* sorted by base id */
+	git_array_t(struct resolve_base) bases;
+
+	git_atomic next_base;
+	git_atomic stop;
+	git_mutex progress_mutex;
+	int progress_error; /* what the progress callback returned */
+	int error;
+};
+
+static int delta_base_off_cmp(const void *a, const void *b)
 {
-	unsigned int i;
+	const struct delta_info *delta_a = a, *delta_b = b;
+
+	if (delta_a->base_off < delta_b->base_off)
+		return -1;
+	return delta_a->base_off > delta_b->base_off;
+}
+
+static int delta_base_id_cmp(const void *a, const void *b)
+{
+	const struct delta_info *delta_a = a, *delta_b = b;
+	return git_oid__cmp(&delta_a->base_id, &delta_b->base_id);
+}
+
+static int parse_delta(git_indexer *idx, struct delta_info *delta)
+{
+	git_mwindow *w = NULL;
+	git_off_t curpos = delta->delta_off;
+	unsigned char *base_info;
+	unsigned int left;
+	int error;
+
+	error = git_packfile_unpack_header(
+		&delta->size, &delta->type, &idx->pack->mwf, &w, &curpos);
+	git_mwindow_close(&w);
+	if (error < 0)
+		return error;
+
+	if (delta->type == GIT_OBJ_OFS_DELTA) {
+		delta->base_off = get_delta_base(
+			idx->pack, &w, &curpos, delta->type, delta->delta_off);
+		git_mwindow_close(&w);
+
+		if (delta->base_off <= 0) {
+			giterr_set(GITERR_INDEXER, "invalid delta base offset");
+			return -1;
+		}
+	} else if (delta->type == GIT_OBJ_REF_DELTA) {
+		base_info = git_mwindow_open(&idx->pack->mwf, &w, curpos, GIT_OID_RAWSZ, &left);
+		if (base_info == NULL) {
+			giterr_set(GITERR_INDEXER, "failed to map delta information");
+			return -1;
+		}
+
+		git_oid_fromraw(&delta->base_id, base_info);
+		git_mwindow_close(&w);
+		curpos += GIT_OID_RAWSZ;
+	} else {
+		giterr_set(GITERR_INDEXER, "object is not a delta");
+		return -1;
+	}
+
+	delta->data_off = curpos;
+	return 0;
+}
+
+static int load_base(git_rawobj *out, git_indexer *idx, git_off_t offset)
+{
+	git_mwindow *w = NULL;
+	git_off_t curpos = offset;
+	size_t size;
+	int error;
+
+	error = git_packfile_unpack_header(&size, &out->type, &idx->pack->mwf, &w, &curpos);
+	git_mwindow_close(&w);
+
+	if (error < 0)
+		return error;
+
+	return inflate_entry(out, idx->pack, curpos, size);
+}
+
+static void find_children(struct resolve_ctx *ctx, struct resolve_frame *frame)
+{
+	struct delta_info key;
+	size_t pos;
+
+	key.base_off = frame->offset;
+	git_oid_cpy(&key.base_id, &frame->id);
+
+	frame->ofs_pos = frame->ofs_end = 0;
+	if (git_vector_bsearch(&pos, &ctx->ofs_deltas, &key) == 0) {
+		/* there may be several; find the first one */
+		while (pos > 0 &&
+			delta_base_off_cmp(git_vector_get(&ctx->ofs_deltas, pos - 1), &key) == 0)
+			pos--;
+
+		frame->ofs_pos = frame->ofs_end = pos;
+		while (frame->ofs_end < ctx->ofs_deltas.length &&
+			delta_base_off_cmp(git_vector_get(&ctx->ofs_deltas, frame->ofs_end), &key) == 0)
+			frame->ofs_end++;
+	}
+
+	frame->ref_pos = frame->ref_end = 0;
+	if (git_vector_bsearch(&pos, &ctx->ref_deltas, &key) == 0) {
+		while (pos > 0 &&
+			delta_base_id_cmp(git_vector_get(&ctx->ref_deltas, pos - 1), &key) == 0)
+			pos--;
+
+		frame->ref_pos = frame->ref_end = pos;
+		while (frame->ref_end < ctx->ref_deltas.length &&
+			delta_base_id_cmp(git_vector_get(&ctx->ref_deltas, frame->ref_end), &key) == 0)
+			frame->ref_end++;
+	}
+}
+
+GIT_INLINE(bool) has_children(struct resolve_frame *frame)
+{
+	return frame->ofs_pos < frame->ofs_end || frame->ref_pos < frame->ref_end;
+}
+
+static int report_resolved(struct resolve_ctx *ctx)
+{
+	git_transfer_progress *stats = ctx->stats;
+	int error = 0;
+
+	if (git_mutex_lock(&ctx->progress_mutex) < 0)
+		return -1;
+
+	stats->indexed_objects++;
+	stats->indexed_deltas++;
+
+	if (ctx->idx->progress_cb && !ctx->progress_error &&
+		(error = ctx->idx->progress_cb(stats, ctx->idx->progress_payload)) != 0) {
+		ctx->progress_error = error;
+		git_atomic_set(&ctx->stop, 1);
+	}
+
+	git_mutex_unlock(&ctx->progress_mutex);
+	return error;
+}
+
+/*
+ * Resolve a delta against its (inflated) base.  Failures leave the
+ * delta unresolved, and they are reported as such once we are done.
+ */
+static int resolve_delta(
+	git_rawobj *out,
+	git_oid *id,
+	struct resolve_ctx *ctx,
+	struct delta_info *delta,
+	const git_rawobj *base)
+{
+	git_rawobj delta_obj;
+
+	if (inflate_entry(&delta_obj, ctx->idx->pack, delta->data_off, delta->size) < 0)
+		return -1;
+
+	if (git__delta_apply(out, base->data, base->len, delta_obj.data, delta_obj.len) < 0) {
+		git__free(delta_obj.data);
+		return -1;
+	}
+
+	git__free(delta_obj.data);
+	out->type = base->type;
+
+	if (delta_entries(delta, &ctx->idx->pack->mwf, out) < 0) {
+		git__free(out->data);
+		return -1;
+	}
+
+	git_oid_cpy(id, &delta->entry->oid);
+	return 0;
+}
+
+static void resolve_from_base(struct resolve_ctx *ctx, struct resolve_base *base)
+{
+	git_array_t(struct resolve_frame) stack = GIT_ARRAY_INIT;
+	struct resolve_frame *frame;
+
+	frame = git_array_alloc(stack);
+	if (!frame) {
+		ctx->error = -1;
+		git_atomic_set(&ctx->stop, 1);
+		return;
+	}
+
+	frame->offset = base->offset;
+	git_oid_cpy(&frame->id, &base->id);
+	find_children(ctx, frame);
+
+	if (load_base(&frame->obj, ctx->idx, frame->offset) < 0) {
+		git_array_clear(stack);
+		return;
+	}
+
+	while ((frame = git_array_last(stack)) != NULL) {
+		struct delta_info *delta;
+		struct resolve_frame child;
+
+		if (git_atomic_get(&ctx->stop) || !has_children(frame)) {
+			git__free(frame->obj.data);
+			git_array_pop(stack);
+			continue;
+		}
+
+		if (frame->ofs_pos < frame->ofs_end)
+			delta = git_vector_get(&ctx->ofs_deltas, frame->ofs_pos++);
+		else
+			delta = git_vector_get(&ctx->ref_deltas, frame->ref_pos++);
+
+		/*
+		 * A REF_DELTA may be reached through several copies of its
+		 * base, from different workers; the first to claim it resolves
+		 * it, unless it was resolved while receiving the pack.
+		 */
+		if (git_atomic_inc(&delta->claimed) != 1 || delta->entry)
+			continue;
+
+		if (resolve_delta(&child.obj, &child.id, ctx, delta, &frame->obj) < 0)
+			continue;
+
+		if (report_resolved(ctx) != 0) {
+			git__free(child.obj.data);
+			continue;
+		}
+
+		child.offset = delta->delta_off;
+		find_children(ctx, &child);
+
+		if (!has_children(&child)) {
+			git__free(child.obj.data);
+			continue;
+		}
+
+		if ((frame = git_array_alloc(stack)) == NULL) {
+			git__free(child.obj.data);
+			ctx->error = -1;
+			git_atomic_set(&ctx->stop, 1);
+			continue;
+		}
+
+		memcpy(frame, &child, sizeof(child));
+	}
+
+	git_array_clear(stack);
+}
+
+static void *resolve_thread(void *payload)
+{
+	struct resolve_ctx *ctx = payload;
+	size_t i;
+
+	while (!git_atomic_get(&ctx->stop)) {
+		i = (size_t)git_atomic_inc(&ctx->next_base) - 1;
+		if (i >= git_array_size(ctx->bases))
+			break;
+
+		resolve_from_base(ctx, git_array_get(ctx->bases, i));
+	}
+
+	return NULL;
+}
+
+static int run_resolve_threads(git_indexer *idx, struct resolve_ctx *ctx)
+{
+#ifdef GIT_THREADS
+	git_thread *threads;
+	size_t nr_threads, i;
+	int error = 0;
+
+	if (!idx->nr_threads)
+		idx->nr_threads = git_online_cpus();
+
+	nr_threads = min(idx->nr_threads, git_array_size(ctx->bases));
+
+	if (nr_threads <= 1) {
+		resolve_thread(ctx);
+		return 0;
+	}
+
+	threads = git__calloc(nr_threads, sizeof(git_thread));
+	GITERR_CHECK_ALLOC(threads);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (git_thread_create(&threads[i], NULL, resolve_thread, ctx) != 0) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			git_atomic_set(&ctx->stop, 1);
+			error = -1;
+			break;
+		}
+	}
+
+	while (i > 0)
+		git_thread_join(&threads[--i], NULL);
+
+	git__free(threads);
+	return error;
+#else
+	GIT_UNUSED(idx);
+	resolve_thread(ctx);
+	return 0;
+#endif
+}
+
+static int add_bases(struct resolve_ctx *ctx)
+{
+	struct entry *entry;
+	struct resolve_frame frame;
+	struct resolve_base *base;
+	size_t i;
+
+	git_vector_foreach(&ctx->idx->objects, i, entry) {
+		frame.offset = entry_offset(entry);
+		git_oid_cpy(&frame.id, &entry->oid);
+
+		find_children(ctx, &frame);
+		if (!has_children(&frame))
+			continue;
+
+		base = git_array_alloc(ctx->bases);
+		GITERR_CHECK_ALLOC(base);
+
+		base->offset = frame.offset;
+		git_oid_cpy(&base->id, &frame.id);
+	}
+
+	return 0;
+}
+
+/* Resolve every delta that we can with the objects we have */
+static int resolve_pass(git_indexer *idx, git_transfer_progress *stats, bool *progressed)
+{
+	struct resolve_ctx ctx;
 	struct delta_info *delta;
-	int progressed = 0, non_null = 0, progress_cb_result;
+	size_t i, saved;
+	int error;
 
-	while (idx->deltas.length > 0) {
-		progressed = 0;
-		non_null = 0;
-		git_vector_foreach(&idx->deltas, i, delta) {
-			git_rawobj obj = {NULL};
+	*progressed = false;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.idx = idx;
+	ctx.stats = stats;
 
-			if (!delta)
-				continue;
+	if ((error = git_vector_init(&ctx.ofs_deltas, 0, delta_base_off_cmp)) < 0 ||
+		(error = git_vector_init(&ctx.ref_deltas, 0, delta_base_id_cmp)) < 0 ||
+		(error = git_mutex_init(&ctx.progress_mutex)) < 0)
+		goto cleanup;
 
-			non_null = 1;
-			idx->off = delta->delta_off;
-			if (git_packfile_unpack(&obj, idx->pack, &idx->off) < 0)
-				continue;
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (!delta)
+			continue;
 
-			if (hash_and_save(idx, &obj, delta->delta_off) < 0)
-				continue;
+		if ((error = parse_delta(idx, delta)) < 0)
+			goto cleanup;
 
-			git__free(obj.data);
-			stats->indexed_objects++;
-			stats->indexed_deltas++;
-			progressed = 1;
-			if ((progress_cb_result = do_progress_callback(idx, stats)) < 0)
-				return progress_cb_result;
-
-			/* remove from the list */
-			git_vector_set(NULL, &idx->deltas, i, NULL);
-			git__free(delta);
+		/* one the last pass could not resolve may be resolved now */
+		git_atomic_set(&delta->claimed, 0);
+
+		if ((error = git_vector_insert(delta->type == GIT_OBJ_OFS_DELTA ?
+				&ctx.ofs_deltas : &ctx.ref_deltas, delta)) < 0)
+			goto cleanup;
+	}
+
+	git_vector_sort(&ctx.ofs_deltas);
+	git_vector_sort(&ctx.ref_deltas);
+
+	if ((error = add_bases(&ctx)) < 0 ||
+		(error = run_resolve_threads(idx, &ctx)) < 0)
+		goto cleanup;
+
+	/* Now add what the threads resolved to the index */
+	error = save_resolved(idx, &saved);
+	*progressed = (saved > 0);
+
+	if (!error && ctx.error < 0) {
+		giterr_set_oom();
+		error = -1;
+	}
+
+	if (!error && ctx.progress_error)
+		error = giterr_set_after_callback_function(
+			ctx.progress_error, "indexer progress");
+
+cleanup:
+	git_vector_free(&ctx.ofs_deltas);
+	git_vector_free(&ctx.ref_deltas);
+	git_array_clear(ctx.bases);
+	git_mutex_free(&ctx.progress_mutex);
+	return error;
+}
+
+static int resolve_deltas(git_indexer *idx, git_transfer_progress *stats)
+{
+	struct delta_info *delta;
+	unsigned int local_objects;
+	size_t i;
+	bool progressed;
+	int error;
+
+	while (true) {
+		if ((error = resolve_pass(idx, stats, &progressed)) < 0)
+			return error;
+
+		git_vector_foreach(&idx->deltas, i, delta) {
+			if (delta)
+				break;
 		}
 
-		/* if none were actually set, we're done */
-		if (!non_null)
+		/* if none are left, we're done */
+		if (i == idx->deltas.length)
 			break;
 
-		if (!progressed && (fix_thin_pack(idx, stats) < 0)) {
+		/* Otherwise some bases must be missing from a thin pack */
+		local_objects = stats->local_objects;
+		if (fix_thin_pack(idx, stats) < 0)
 			return -1;
-		}
+
+		/* we cannot make any more progress; this is reported by the caller */
+		if (!progressed && stats->local_objects == local_objects)
+			break;
 	}
 
 	return 0;
@@ -942,6 +1843,9 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 	/* Freeze the number of deltas */
 	stats->total_deltas = stats->total_objects - stats->indexed_objects;
 
+	if ((error = save_streamed(idx, stats)) < 0)
+		return error;
+
 	if ((error = resolve_deltas(idx, stats)) < 0)
 		return error;
 
@@ -1065,9 +1969,18 @@ on_error:
 
 void git_indexer_free(git_indexer *idx)
 {
+	struct delta_info *delta;
+	size_t i;
+
 	if (idx == NULL)
 		return;
 
+	stream_finish(idx, true);
+
+	/* we may have been given only part of the last object */
+	if (idx->have_stream)
+		git_packfile_stream_free(&idx->stream);
+
 	git_vector_free_deep(&idx->objects);
 
 	if (idx->pack && idx->pack->idx_cache) {
@@ -1078,6 +1991,14 @@ void git_indexer_free(git_indexer *idx)
 		git_oidmap_free(idx->pack->idx_cache);
 	}
 
+	/* the entries of the deltas resolved while streaming are not indexed yet */
+	git_vector_foreach(&idx->deltas, i, delta) {
+		if (delta) {
+			git__free(delta->entry);
+			git__free(delta->pentry);
+		}
+	}
+
 	git_vector_free_deep(&idx->deltas);
 
 	if (!git_mutex_lock(&git__mwindow_mutex)) {
@@ -458,7 +458,7 @@ static int tree_iterator__set_next(tree_iterator *ti, tree_iterator_frame *tf)
 		/* try to load trees for items in [current,next) range */
 		if (!error && git_tree_entry__is_tree(te))
 			error = git_tree_lookup(
-				&tf->entries[tf->next]->tree, ti->base.repo, &te->oid);
+				&tf->entries[tf->next]->tree, ti->base.repo, te->oid);
 	}
 
 	if (tf->next > tf->current + 1)
@@ -603,7 +603,7 @@ static int tree_iterator__update_entry(tree_iterator *ti)
     te = tf->entries[tf->current]->te;
 
 	ti->entry.mode = te->attr;
-	git_oid_cpy(&ti->entry.id, &te->oid);
+	git_oid_cpy(&ti->entry.id, te->oid);
 
 	ti->entry.path = tree_iterator__current_filename(ti, te);
 	GITERR_CHECK_ALLOC(ti->entry.path);
@@ -1130,6 +1130,7 @@ struct fs_iterator_frame {
 	git_vector entries;
 	size_t index;
 	int is_ignored;
+	struct fs_dirload **loads; /* prefetched subdirectories, by entry */
 };
 
 typedef struct fs_iterator fs_iterator;
@@ -1143,10 +1144,13 @@ struct fs_iterator {
 	uint32_t dirload_flags;
 	int depth;
 	iterator_pathlist__match_t pathlist_match;
+	struct fs_prefetch *prefetch;
 
 	int (*enter_dir_cb)(fs_iterator *self);
 	int (*leave_dir_cb)(fs_iterator *self);
 	int (*update_entry_cb)(fs_iterator *self);
+	bool (*unchanged_stat_cb)(
+		struct stat *st, fs_iterator *self, const char *path, size_t path_len);
 };
 
 #define FS_MAX_DEPTH 100
@@ -1154,6 +1158,7 @@ struct fs_iterator {
 typedef struct {
 	struct stat st;
 	iterator_pathlist__match_t pathlist_match;
+	bool        st_unchanged; /* st was not read from the filesystem */
 	size_t      path_len;
 	char        path[GIT_FLEX_ARRAY];
 } fs_iterator_path_with_stat;
@@ -1189,12 +1194,17 @@ static fs_iterator_frame *fs_iterator__alloc_frame(fs_iterator *fi)
 static void fs_iterator__free_frame(fs_iterator_frame *ff)
 {
 	git_vector_free_deep(&ff->entries);
+	git__free(ff->loads);
 	git__free(ff);
 }
 
+static void fs_iterator__prefetch_drop(fs_iterator *fi, fs_iterator_frame *ff);
+
 static void fs_iterator__pop_frame(
 	fs_iterator *fi, fs_iterator_frame *ff, bool pop_last)
 {
+	fs_iterator__prefetch_drop(fi, ff);
+
 	if (fi && fi->stack == ff) {
 		if (!ff->next && !pop_last) {
 			memset(&fi->entry, 0, sizeof(fi->entry));
@@ -1235,7 +1245,11 @@ static void fs_iterator__seek_frame_start(
 		ff->index = 0;
 }
 
-static int dirload_with_stat(git_vector *contents, fs_iterator *fi)
+static int dirload_with_stat(
+	git_vector *contents,
+	fs_iterator *fi,
+	const char *dir_path,
+	iterator_pathlist__match_t dir_match)
 {
 	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
 	const char *path;
@@ -1248,7 +1262,7 @@ static int dirload_with_stat(git_vector *contents, fs_iterator *fi)
 
 	/* Any error here is equivalent to the dir not existing, skip over it */
 	if ((error = git_path_diriter_init(
-			&diriter, fi->path.ptr, fi->dirload_flags)) < 0) {
+			&diriter, dir_path, fi->dirload_flags)) < 0) {
 		error = GIT_ENOTFOUND;
 		goto done;
 	}
@@ -1279,8 +1293,8 @@ static int dirload_with_stat(git_vector *contents, fs_iterator *fi)
 		 * this path or children of this path.
 		 */
 		if (fi->base.pathlist.length &&
-			fi->pathlist_match != ITERATOR_PATHLIST_MATCH &&
-			fi->pathlist_match != ITERATOR_PATHLIST_MATCH_DIRECTORY &&
+			dir_match != ITERATOR_PATHLIST_MATCH &&
+			dir_match != ITERATOR_PATHLIST_MATCH_DIRECTORY &&
 			!(pathlist_match = iterator_pathlist__match(&fi->base, path, path_len)))
 			continue;
 
@@ -1295,9 +1309,11 @@ static int dirload_with_stat(git_vector *contents, fs_iterator *fi)
 
 		memcpy(ps->path, path, path_len);
 
-		/* TODO: don't stat if assume unchanged for this path */
-
-		if ((error = git_path_diriter_stat(&ps->st, &diriter)) < 0) {
+		/* don't stat the paths that are known not to have changed */
+		if (fi->unchanged_stat_cb &&
+			fi->unchanged_stat_cb(&ps->st, fi, ps->path, ps->path_len)) {
+			ps->st_unchanged = true;
+		} else if ((error = git_path_diriter_stat(&ps->st, &diriter)) < 0) {
 			if (error == GIT_ENOTFOUND) {
 				/* file was removed between readdir and lstat */
 				git__free(ps);
@@ -1346,10 +1362,348 @@ done:
 }
 
 
+/*
+ * With GIT_ITERATOR_PARALLEL_SCAN, the subdirectories of every directory
+ * we enter are loaded ahead of time by a pool of threads, so that the
+ * readdir and lstat calls overlap with each other and with the work done
+ * by the caller on the entries.  Entries are still returned in order: a
+ * directory is expanded with what the threads have loaded for it, or is
+ * loaded right away if no thread got to it yet.
+ */
+
+#define FS_PREFETCH_MAX_THREADS 8
+#define FS_PREFETCH_MAX_LOADS 1024
+
+#ifdef GIT_THREADS
+
+typedef enum {
+	FS_DIRLOAD_QUEUED = 0,
+	FS_DIRLOAD_LOADING,
+	FS_DIRLOAD_DONE,
+	FS_DIRLOAD_DROPPED,
+} fs_dirload_state;
+
+struct fs_dirload {
+	fs_dirload_state state;
+	iterator_pathlist__match_t pathlist_match;
+	int error;
+	git_vector entries;
+	char path[GIT_FLEX_ARRAY];
+};
+
+struct fs_prefetch {
+	fs_iterator *fi;
+	git_mutex lock;
+	git_cond work; /* signalled when loads are queued */
+	git_cond done; /* signalled when a load is done */
+	git_vector queue; /* loads not started yet, the next one last */
+	size_t pending; /* loads that have not been consumed or dropped */
+	size_t loading;
+	git_thread *threads;
+	size_t nthreads;
+	bool stop;
+};
+
+static void fs_dirload_free(struct fs_dirload *load)
+{
+	git_vector_free_deep(&load->entries);
+	git__free(load);
+}
+
+static void *fs_prefetch__thread(void *payload)
+{
+	struct fs_prefetch *pf = payload;
+	struct fs_dirload *load;
+	int error;
+
+	git_mutex_lock(&pf->lock);
+
+	while (!pf->stop) {
+		if ((load = git_vector_last(&pf->queue)) == NULL) {
+			git_cond_wait(&pf->work, &pf->lock);
+			continue;
+		}
+
+		git_vector_pop(&pf->queue);
+
+		/* the iterator no longer wants it, or took it over */
+		if (load->state == FS_DIRLOAD_DROPPED) {
+			fs_dirload_free(load);
+			continue;
+		}
+
+		load->state = FS_DIRLOAD_LOADING;
+		pf->loading++;
+		git_mutex_unlock(&pf->lock);
+
+		error = dirload_with_stat(
+			&load->entries, pf->fi, load->path, load->pathlist_match);
+
+		git_mutex_lock(&pf->lock);
+		pf->loading--;
+
+		if (load->state == FS_DIRLOAD_DROPPED)
+			fs_dirload_free(load);
+		else {
+			load->error = error;
+			load->state = FS_DIRLOAD_DONE;
+		}
+
+		git_cond_broadcast(&pf->done);
+	}
+
+	git_mutex_unlock(&pf->lock);
+	return NULL;
+}
+
+static void fs_prefetch__stop(struct fs_prefetch *pf)
+{
+	struct fs_dirload *load;
+	size_t i;
+
+	git_mutex_lock(&pf->lock);
+	pf->stop = true;
+	git_cond_broadcast(&pf->work);
+	git_mutex_unlock(&pf->lock);
+
+	for (i = 0; i < pf->nthreads; i++)
+		git_thread_join(&pf->threads[i], NULL);
+
+	/* everything left has been dropped along with its frame */
+	git_vector_foreach(&pf->queue, i, load)
+		fs_dirload_free(load);
+
+	git_vector_free(&pf->queue);
+	git_cond_free(&pf->done);
+	git_cond_free(&pf->work);
+	git_mutex_free(&pf->lock);
+	git__free(pf->threads);
+	git__free(pf);
+}
+
+static int fs_iterator__prefetch_init(fs_iterator *fi)
+{
+	struct fs_prefetch *pf;
+	size_t nthreads = (size_t)git_online_cpus();
+
+	if (nthreads < 2)
+		nthreads = 2;
+	if (nthreads > FS_PREFETCH_MAX_THREADS)
+		nthreads = FS_PREFETCH_MAX_THREADS;
+
+	pf = git__calloc(1, sizeof(struct fs_prefetch));
+	GITERR_CHECK_ALLOC(pf);
+
+	pf->fi = fi;
+	pf->threads = git__calloc(nthreads, sizeof(git_thread));
+
+	if (!pf->threads || git_vector_init(&pf->queue, 0, NULL) < 0) {
+		git__free(pf->threads);
+		git__free(pf);
+		return -1;
+	}
+
+	if (git_mutex_init(&pf->lock) < 0 ||
+		git_cond_init(&pf->work) < 0 || git_cond_init(&pf->done) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize iterator mutex");
+		git_vector_free(&pf->queue);
+		git__free(pf->threads);
+		git__free(pf);
+		return -1;
+	}
+
+	for (; pf->nthreads < nthreads; pf->nthreads++) {
+		if (git_thread_create(&pf->threads[pf->nthreads],
+				NULL, fs_prefetch__thread, pf) != 0) {
+			giterr_set(GITERR_THREAD, "unable to create thread");
+			fs_prefetch__stop(pf);
+			return -1;
+		}
+	}
+
+	fi->prefetch = pf;
+	return 0;
+}
+
+/* Queue the subdirectories of a frame we have just entered */
+static void fs_iterator__prefetch_frame(fs_iterator *fi, fs_iterator_frame *ff)
+{
+	struct fs_prefetch *pf = fi->prefetch;
+	fs_iterator_path_with_stat *ps;
+	struct fs_dirload *load;
+	size_t i, alloclen, queued = 0;
+
+	if (!pf || !ff || ff->loads)
+		return;
+
+	if ((ff->loads = git__calloc(
+			ff->entries.length, sizeof(struct fs_dirload *))) == NULL) {
+		giterr_clear();
+		return;
+	}
+
+	git_mutex_lock(&pf->lock);
+
+	/* queue them backwards, so that the first one is loaded first */
+	for (i = ff->entries.length; i > ff->index; i--) {
+		ps = git_vector_get(&ff->entries, i - 1);
+
+		if (!S_ISDIR(ps->st.st_mode))
+			continue;
+
+		if (pf->pending >= FS_PREFETCH_MAX_LOADS)
+			break;
+
+		if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(struct fs_dirload), fi->root_len) ||
+			GIT_ADD_SIZET_OVERFLOW(&alloclen, alloclen, ps->path_len + 1) ||
+			(load = git__calloc(1, alloclen)) == NULL)
+			break;
+
+		memcpy(load->path, fi->path.ptr, fi->root_len);
+		memcpy(load->path + fi->root_len, ps->path, ps->path_len);
+		load->pathlist_match = ps->pathlist_match;
+
+		if (git_vector_init(&load->entries, 0, ff->entries._cmp) < 0 ||
+			git_vector_insert(&pf->queue, load) < 0) {
+			git_vector_free(&load->entries);
+			git__free(load);
+			break;
+		}
+
+		ff->loads[i - 1] = load;
+		pf->pending++;
+		queued++;
+	}
+
+	if (queued)
+		git_cond_broadcast(&pf->work);
+
+	git_mutex_unlock(&pf->lock);
+	giterr_clear();
+}
+
+/*
+ * Take the entries that were loaded ahead of time for the directory at
+ * the current entry of the top frame; returns GIT_ENOTFOUND when the
+ * directory has to be loaded now.
+ */
+static int fs_iterator__prefetch_take(git_vector *entries, fs_iterator *fi)
+{
+	struct fs_prefetch *pf = fi->prefetch;
+	fs_iterator_frame *parent = fi->stack;
+	struct fs_dirload *load;
+	int error = GIT_ENOTFOUND;
+
+	if (!pf || !parent || !parent->loads ||
+		(load = parent->loads[parent->index]) == NULL)
+		return GIT_ENOTFOUND;
+
+	parent->loads[parent->index] = NULL;
+
+	git_mutex_lock(&pf->lock);
+
+	pf->pending--;
+
+	if (load->state == FS_DIRLOAD_QUEUED) {
+		/* no thread got to it; the thread popping it will free it */
+		load->state = FS_DIRLOAD_DROPPED;
+		git_mutex_unlock(&pf->lock);
+		return GIT_ENOTFOUND;
+	}
+
+	while (load->state == FS_DIRLOAD_LOADING)
+		git_cond_wait(&pf->done, &pf->lock);
+
+	git_mutex_unlock(&pf->lock);
+
+	/* errors are reported by loading the directory again */
+	if (!load->error) {
+		git_vector_swap(entries, &load->entries);
+		error = 0;
+	}
+
+	fs_dirload_free(load);
+	return error;
+}
+
+static void fs_iterator__prefetch_drop(fs_iterator *fi, fs_iterator_frame *ff)
+{
+	struct fs_prefetch *pf = fi ? fi->prefetch : NULL;
+	struct fs_dirload *load;
+	size_t i;
+
+	if (!pf || !ff->loads)
+		return;
+
+	git_mutex_lock(&pf->lock);
+
+	for (i = 0; i < ff->entries.length; i++) {
+		if ((load = ff->loads[i]) == NULL)
+			continue;
+
+		ff->loads[i] = NULL;
+		pf->pending--;
+
+		if (load->state == FS_DIRLOAD_DONE)
+			fs_dirload_free(load);
+		else
+			load->state = FS_DIRLOAD_DROPPED;
+	}
+
+	git_mutex_unlock(&pf->lock);
+}
+
+/* Wait for the threads to be done with the loads that were dropped */
+static void fs_iterator__prefetch_quiesce(fs_iterator *fi)
+{
+	struct fs_prefetch *pf = fi->prefetch;
+	fs_iterator_frame *ff;
+
+	if (!pf)
+		return;
+
+	for (ff = fi->stack; ff != NULL; ff = ff->next) {
+		fs_iterator__prefetch_drop(fi, ff);
+		git__free(ff->loads);
+		ff->loads = NULL;
+	}
+
+	git_mutex_lock(&pf->lock);
+	while (pf->loading)
+		git_cond_wait(&pf->done, &pf->lock);
+	git_mutex_unlock(&pf->lock);
+}
+
+static void fs_iterator__prefetch_free(fs_iterator *fi)
+{
+	if (fi->prefetch) {
+		fs_prefetch__stop(fi->prefetch);
+		fi->prefetch = NULL;
+	}
+}
+
+#else
+
+#define fs_iterator__prefetch_init(fi) 0
+#define fs_iterator__prefetch_frame(fi, ff) /* nothing to do */
+#define fs_iterator__prefetch_take(entries, fi) GIT_ENOTFOUND
+#define fs_iterator__prefetch_quiesce(fi) /* nothing to do */
+#define fs_iterator__prefetch_free(fi) /* nothing to do */
+
+static void fs_iterator__prefetch_drop(fs_iterator *fi, fs_iterator_frame *ff)
+{
+	GIT_UNUSED(fi);
+	GIT_UNUSED(ff);
+}
+
+#endif
+
 static int fs_iterator__expand_dir(fs_iterator *fi)
 {
 	int error;
 	fs_iterator_frame *ff;
+	fs_iterator_path_with_stat *ps;
+	size_t i;
 
 	if (fi->depth > FS_MAX_DEPTH) {
 		giterr_set(GITERR_REPOSITORY,
@@ -1360,7 +1714,9 @@ static int fs_iterator__expand_dir(fs_iterator *fi)
 	ff = fs_iterator__alloc_frame(fi);
 	GITERR_CHECK_ALLOC(ff);
 
-	error = dirload_with_stat(&ff->entries, fi);
+	if ((error = fs_iterator__prefetch_take(&ff->entries, fi)) == GIT_ENOTFOUND)
+		error = dirload_with_stat(
+			&ff->entries, fi, fi->path.ptr, fi->pathlist_match);
 
 	if (error < 0) {
 		git_error_state last_error = { 0 };
@@ -1379,9 +1735,14 @@ static int fs_iterator__expand_dir(fs_iterator *fi)
 		fs_iterator__free_frame(ff);
 		return GIT_ENOTFOUND;
 	}
-	fi->base.stat_calls += ff->entries.length;
+
+	git_vector_foreach(&ff->entries, i, ps) {
+		if (!ps->st_unchanged)
+			fi->base.stat_calls++;
+	}
 
 	fs_iterator__seek_frame_start(fi, ff);
+	fs_iterator__prefetch_frame(fi, ff);
 
 	ff->next  = fi->stack;
 	fi->stack = ff;
@@ -1518,10 +1879,14 @@ static int fs_iterator__reset(
 		fs_iterator__pop_frame(fi, fi->stack, false);
 	fi->depth = 0;
 
+	/* the threads look at the range while loading */
+	fs_iterator__prefetch_quiesce(fi);
+
 	if ((error = iterator__reset_range(self, start, end)) < 0)
 		return error;
 
 	fs_iterator__seek_frame_start(fi, fi->stack);
+	fs_iterator__prefetch_frame(fi, fi->stack);
 
 	error = fs_iterator__update_entry(fi);
 	if (error == GIT_ITEROVER)
@@ -1537,6 +1902,7 @@ static void fs_iterator__free(git_iterator *self)
 	while (fi->stack != NULL)
 		fs_iterator__pop_frame(fi, fi->stack, true);
 
+	fs_iterator__prefetch_free(fi);
 	git_buf_free(&fi->path);
 }
 
@@ -1610,6 +1976,13 @@ static int fs_iterator__initialize(
 		(iterator__flag(fi, PRECOMPOSE_UNICODE) ?
 			GIT_PATH_DIR_PRECOMPOSE_UNICODE : 0);
 
+	if (iterator__flag(fi, PARALLEL_SCAN) &&
+		(error = fs_iterator__prefetch_init(fi)) < 0) {
+		git_iterator_free((git_iterator *)fi);
+		*out = NULL;
+		return error;
+	}
+
 	if ((error = fs_iterator__expand_dir(fi)) < 0) {
 		if (error == GIT_ENOTFOUND || error == GIT_ITEROVER) {
 			giterr_clear();
@@ -1788,6 +2161,30 @@ static int workdir_iterator__leave_dir(fs_iterator *fi)
 	return 0;
 }
 
+/* Files the fsmonitor has not seen change since they last matched the
+ * index have the stat data recorded in their index entry.
+ */
+static bool workdir_iterator__unchanged_stat(
+	struct stat *st, fs_iterator *fi, const char *path, size_t path_len)
+{
+	workdir_iterator *wi = (workdir_iterator *)fi;
+	const git_index_entry *entry;
+	size_t pos;
+
+	if (git_index_snapshot_find(&pos, &wi->index_snapshot,
+			wi->entry_srch, path, path_len, 0) < 0)
+		return false;
+
+	entry = git_vector_get(&wi->index_snapshot, pos);
+
+	if (!(entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) ||
+		(!S_ISREG(entry->mode) && !S_ISLNK(entry->mode)))
+		return false;
+
+	git_index_entry__to_stat(st, entry);
+	return true;
+}
+
 static int workdir_iterator__update_entry(fs_iterator *fi)
 {
 	workdir_iterator *wi = (workdir_iterator *)fi;
@@ -1858,6 +2255,8 @@ int git_iterator_for_workdir_ext(
 	wi->entry_srch = iterator__ignore_case(wi) ?
 		git_index_entry_isrch : git_index_entry_srch;
 
+	if (index && iterator__flag(wi, USE_FSMONITOR))
+		wi->fi.unchanged_stat_cb = workdir_iterator__unchanged_stat;
 
 	/* try to look up precompose and set flag if appropriate */
 	if (git_repository__cvar(&precompose, repo, GIT_CVAR_PRECOMPOSE) < 0)
@@ -2039,6 +2438,17 @@ int git_iterator_advance_over_with_status(
 	const git_index_entry **entryptr,
 	git_iterator_status_t *status,
 	git_iterator *iter)
+{
+	return git_iterator_advance_over_with_status_cb(
+		entryptr, status, iter, NULL, NULL);
+}
+
+int git_iterator_advance_over_with_status_cb(
+	const git_index_entry **entryptr,
+	git_iterator_status_t *status,
+	git_iterator *iter,
+	git_iterator_scan_cb cb,
+	void *payload)
 {
 	int error = 0;
 	workdir_iterator *wi = (workdir_iterator *)iter;
@@ -2074,6 +2484,9 @@ int git_iterator_advance_over_with_status(
 		if (wi->is_ignored == GIT_IGNORE_TRUE)
 			*status = GIT_ITERATOR_STATUS_IGNORED;
 		else if (S_ISDIR(entry->mode)) {
+			if (cb && (error = cb(entry, GIT_ITERATOR_STATUS_EMPTY, payload)) < 0)
+				goto done;
+
 			error = git_iterator_advance_into(&entry, iter);
 
 			if (!error)
@@ -2095,6 +2508,9 @@ int git_iterator_advance_over_with_status(
 		} else {
 			/* we found a non-ignored item, treat parent as untracked */
 			*status = GIT_ITERATOR_STATUS_NORMAL;
+
+			if (cb && (error = cb(entry, GIT_ITERATOR_STATUS_NORMAL, payload)) < 0)
+				goto done;
 			break;
 		}
 
@@ -2107,6 +2523,7 @@ int git_iterator_advance_over_with_status(
 		if ((error = git_iterator_advance(&entry, iter)) < 0)
 			break;
 
+done:
 	*entryptr = entry;
 	git__free(base);
 
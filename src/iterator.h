@@ -36,6 +36,11 @@ typedef enum {
 	GIT_ITERATOR_PRECOMPOSE_UNICODE = (1u << 4),
 	/** include conflicts */
 	GIT_ITERATOR_INCLUDE_CONFLICTS = (1u << 5),
+	/** load directories ahead of the iteration from several threads */
+	GIT_ITERATOR_PARALLEL_SCAN = (1u << 6),
+	/** take the stat data of index entries that the fsmonitor reports as
+	 * unchanged from the index instead of calling lstat */
+	GIT_ITERATOR_USE_FSMONITOR = (1u << 7),
 } git_iterator_flag_t;
 
 typedef struct {
@@ -296,6 +301,24 @@ typedef enum {
 extern int git_iterator_advance_over_with_status(
 	const git_index_entry **entry, git_iterator_status_t *status, git_iterator *iter);
 
+/* Called by `git_iterator_advance_over_with_status_cb` for every
+ * directory the scan looks into (with GIT_ITERATOR_STATUS_EMPTY, before
+ * its contents) and for the item that makes the directory untracked
+ * (with GIT_ITERATOR_STATUS_NORMAL).  A negative return aborts the scan.
+ */
+typedef int (*git_iterator_scan_cb)(
+	const git_index_entry *entry, git_iterator_status_t status, void *payload);
+
+/* Advance over a directory like `git_iterator_advance_over_with_status`,
+ * reporting what the scan finds to `cb`.
+ */
+extern int git_iterator_advance_over_with_status_cb(
+	const git_index_entry **entry,
+	git_iterator_status_t *status,
+	git_iterator *iter,
+	git_iterator_scan_cb cb,
+	void *payload);
+
 /**
  * Retrieve the index stored in the iterator.
  *
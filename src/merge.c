@@ -359,8 +359,22 @@ static void clear_commit_marks(git_commit_list_node *commit, unsigned int mark)
 		clear_commit_marks_1(&list, git_commit_list_pop(&list), mark);
 }
 
+/*
+ * Paint the history of `one` and `twos` until all the paths that are
+ * left are stale.  Commits are visited in generation order (falling back
+ * to commit time when generations are unknown), so that every commit is
+ * seen after all of its descendants.
+ *
+ * When `min_generation` is a known generation, painting stops as soon as
+ * the walk goes below it: callers that only care about the reachability
+ * of commits at or above that generation don't need the rest.
+ */
 static int paint_down_to_common(
-	git_commit_list **out, git_revwalk *walk, git_commit_list_node *one, git_vector *twos)
+	git_commit_list **out,
+	git_revwalk *walk,
+	git_commit_list_node *one,
+	git_vector *twos,
+	uint32_t min_generation)
 {
 	git_pqueue list;
 	git_commit_list *result = NULL;
@@ -369,7 +383,7 @@ static int paint_down_to_common(
 	int error;
 	unsigned int i;
 
-	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	one->flags |= PARENT1;
@@ -394,6 +408,10 @@ static int paint_down_to_common(
 		if (commit == NULL)
 			break;
 
+		if (min_generation != GENERATION_INFINITY &&
+			git_commit_list_generation(commit) < min_generation)
+			break;
+
 		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->flags & RESULT)) {
@@ -430,6 +448,7 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 	unsigned char *redundant;
 	unsigned int *filled_index;
 	unsigned int i, j;
+	uint32_t min_generation;
 	int error = 0;
 
 	redundant = git__calloc(commits->length, 1);
@@ -450,17 +469,27 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 			continue;
 
 		git_vector_clear(&work);
+		min_generation = GENERATION_INFINITY;
 
 		for (j = 0; j < commits->length; j++) {
+			git_commit_list_node *other = commits->contents[j];
+
 			if (i == j || redundant[j])
 				continue;
 
 			filled_index[work.length] = j;
-			if ((error = git_vector_insert(&work, commits->contents[j])) < 0)
+			if ((error = git_vector_insert(&work, other)) < 0)
 				goto done;
+
+			if (git_commit_list_generation(other) < min_generation)
+				min_generation = git_commit_list_generation(other);
 		}
 
-		error = paint_down_to_common(&common, walk, commit, &work);
+		/*
+		 * We only need to know whether the other commits are reachable
+		 * from this one, so the walk can stop below the lowest of them.
+		 */
+		error = paint_down_to_common(&common, walk, commit, &work, min_generation);
 		if (error < 0)
 			goto done;
 
@@ -513,7 +542,7 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 	if (git_commit_list_parse(walk, one) < 0)
 		return -1;
 
-	error = paint_down_to_common(&result, walk, one, twos);
+	error = paint_down_to_common(&result, walk, one, twos, GENERATION_INFINITY);
 	if (error < 0)
 		return error;
 
@@ -0,0 +1,839 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "midx.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "path.h"
+#include "sha1_lookup.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_OBJECT_ID_VERSION 1
+
+struct git_midx_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_midx_files;
+	uint32_t packfiles;
+};
+
+#define MIDX_PACKFILE_NAMES_ID 0x504e414d /* "PNAM" */
+#define MIDX_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define MIDX_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define MIDX_OBJECT_OFFSETS_ID 0x4f4f4646 /* "OOFF" */
+#define MIDX_OBJECT_LARGE_OFFSETS_ID 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_CHUNK_ENTRY_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+#define MIDX_OBJECT_OFFSET_SIZE (2 * sizeof(uint32_t))
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000u
+
+typedef struct {
+	size_t offset;
+	size_t length;
+} midx_chunk;
+
+static int midx_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid multi-pack-index file - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ntohl(*((const uint32_t *)p));
+}
+
+static int midx_parse_packfile_names(
+	git_midx_file *idx,
+	const unsigned char *data,
+	uint32_t packfiles,
+	midx_chunk *chunk)
+{
+	const char *name, *end, *prev_name = NULL;
+	uint32_t i;
+
+	if (chunk->offset == 0)
+		return midx_error("missing Packfile Names chunk");
+	if (chunk->length == 0)
+		return midx_error("empty Packfile Names chunk");
+
+	name = (const char *)(data + chunk->offset);
+	end = name + chunk->length;
+
+	for (i = 0; i < packfiles; ++i) {
+		const char *nul = memchr(name, '\0', end - name);
+
+		if (!nul)
+			return midx_error("unterminated packfile name");
+		if (nul == name || git__suffixcmp(name, ".idx") != 0)
+			return midx_error("non-.idx packfile name");
+		if (strchr(name, '/') != NULL || strchr(name, '\\') != NULL)
+			return midx_error("non-local packfile");
+		if (prev_name && strcmp(prev_name, name) >= 0)
+			return midx_error("packfile names are not sorted");
+
+		if (git_vector_insert(&idx->packfile_names, (char *)name) < 0)
+			return -1;
+
+		prev_name = name;
+		name = nul + 1;
+	}
+
+	return 0;
+}
+
+static int midx_parse_oid_fanout(
+	git_midx_file *idx,
+	const unsigned char *data,
+	midx_chunk *chunk)
+{
+	uint32_t i, nr;
+
+	if (chunk->offset == 0)
+		return midx_error("missing OID Fanout chunk");
+	if (chunk->length == 0)
+		return midx_error("empty OID Fanout chunk");
+	if (chunk->length != 256 * 4)
+		return midx_error("OID Fanout chunk has wrong length");
+
+	idx->oid_fanout = (const uint32_t *)(data + chunk->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(idx->oid_fanout[i]);
+		if (n < nr)
+			return midx_error("index is non-monotonic");
+		nr = n;
+	}
+	idx->num_objects = nr;
+	return 0;
+}
+
+static int midx_parse_oid_lookup(
+	git_midx_file *idx,
+	const unsigned char *data,
+	midx_chunk *chunk)
+{
+	uint32_t i;
+	git_oid *oid, *prev_oid;
+
+	if (chunk->offset == 0)
+		return midx_error("missing OID Lookup chunk");
+	if (chunk->length != (size_t)idx->num_objects * GIT_OID_RAWSZ)
+		return midx_error("OID Lookup chunk has wrong length");
+
+	idx->oid_lookup = oid = (git_oid *)(data + chunk->offset);
+	prev_oid = NULL;
+	for (i = 0; i < idx->num_objects; ++i, ++oid) {
+		if (prev_oid && git_oid__cmp(prev_oid, oid) >= 0)
+			return midx_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int midx_parse_object_offsets(
+	git_midx_file *idx,
+	const unsigned char *data,
+	midx_chunk *chunk)
+{
+	if (chunk->offset == 0)
+		return midx_error("missing Object Offsets chunk");
+	if (chunk->length != (size_t)idx->num_objects * MIDX_OBJECT_OFFSET_SIZE)
+		return midx_error("Object Offsets chunk has wrong length");
+
+	idx->object_offsets = data + chunk->offset;
+
+	return 0;
+}
+
+static int midx_parse_object_large_offsets(
+	git_midx_file *idx,
+	const unsigned char *data,
+	midx_chunk *chunk)
+{
+	if (chunk->length == 0)
+		return 0;
+	if (chunk->length % 8 != 0)
+		return midx_error("malformed Object Large Offsets chunk");
+
+	idx->object_large_offsets = data + chunk->offset;
+	idx->num_object_large_offsets = chunk->length / 8;
+
+	return 0;
+}
+
+int git_midx_parse(
+	git_midx_file *idx,
+	const unsigned char *data,
+	size_t size)
+{
+	struct git_midx_header *hdr;
+	const unsigned char *chunk_hdr;
+	midx_chunk *last_chunk;
+	uint32_t i;
+	uint64_t last_chunk_offset, chunk_offset, trailer_offset;
+	midx_chunk chunk_packfile_names = {0}, chunk_oid_fanout = {0},
+		chunk_oid_lookup = {0}, chunk_object_offsets = {0},
+		chunk_object_large_offsets = {0}, chunk_unsupported = {0};
+
+	assert(idx);
+
+	if (size < sizeof(struct git_midx_header) + GIT_OID_RAWSZ)
+		return midx_error("multi-pack index is too short");
+
+	hdr = ((struct git_midx_header *)data);
+
+	if (hdr->signature != htonl(MIDX_SIGNATURE) ||
+		hdr->version != MIDX_VERSION ||
+		hdr->object_id_version != MIDX_OBJECT_ID_VERSION)
+		return midx_error("unsupported multi-pack index version");
+	if (hdr->chunks == 0)
+		return midx_error("no chunks in multi-pack index");
+	if (hdr->base_midx_files != 0)
+		return midx_error("chained multi-pack indexes are not supported");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_midx_header) +
+		(1 + hdr->chunks) * MIDX_CHUNK_ENTRY_SIZE;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return midx_error("wrong index size");
+	git_oid_fromraw(&idx->checksum, data + trailer_offset);
+
+	chunk_hdr = data + sizeof(struct git_midx_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += MIDX_CHUNK_ENTRY_SIZE) {
+		chunk_offset = ((uint64_t)get_be32(chunk_hdr + 4)) << 32 |
+			get_be32(chunk_hdr + 8);
+
+		if (chunk_offset < last_chunk_offset)
+			return midx_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return midx_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (get_be32(chunk_hdr)) {
+		case MIDX_PACKFILE_NAMES_ID:
+			chunk_packfile_names.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_packfile_names;
+			break;
+
+		case MIDX_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case MIDX_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case MIDX_OBJECT_OFFSETS_ID:
+			chunk_object_offsets.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_object_offsets;
+			break;
+
+		case MIDX_OBJECT_LARGE_OFFSETS_ID:
+			chunk_object_large_offsets.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_object_large_offsets;
+			break;
+
+		default:
+			/* reverse indexes and future chunks are skipped */
+			chunk_unsupported.offset = (size_t)last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	if (midx_parse_packfile_names(
+			idx, data, ntohl(hdr->packfiles), &chunk_packfile_names) < 0 ||
+		midx_parse_oid_fanout(idx, data, &chunk_oid_fanout) < 0 ||
+		midx_parse_oid_lookup(idx, data, &chunk_oid_lookup) < 0 ||
+		midx_parse_object_offsets(idx, data, &chunk_object_offsets) < 0 ||
+		midx_parse_object_large_offsets(idx, data, &chunk_object_large_offsets) < 0)
+		return -1;
+
+	return 0;
+}
+
+int git_midx_open(git_midx_file **idx_out, const char *path)
+{
+	git_midx_file *idx;
+	git_file fd = -1;
+	size_t idx_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "Unable to stat multi-pack-index '%s'", path);
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		giterr_set(GITERR_ODB, "Invalid multi-pack-index file '%s'", path);
+		return -1;
+	}
+	idx_size = (size_t)st.st_size;
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	GITERR_CHECK_ALLOC(idx);
+
+	idx->filename = git__strdup(path);
+	GITERR_CHECK_ALLOC(idx->filename);
+
+	error = git_futils_mmap_ro(&idx->index_map, fd, 0, idx_size);
+	p_close(fd);
+	if (error < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	if ((error = git_midx_parse(idx, idx->index_map.data, idx_size)) < 0) {
+		git_midx_free(idx);
+		return error;
+	}
+
+	*idx_out = idx;
+	return 0;
+}
+
+bool git_midx_needs_refresh(
+	const git_midx_file *idx,
+	const char *path)
+{
+	git_file fd = -1;
+	struct stat st;
+	ssize_t bytes_read;
+	git_oid idx_checksum = {{0}};
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return true;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		return true;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size) ||
+		(size_t)st.st_size != idx->index_map.len) {
+		p_close(fd);
+		return true;
+	}
+
+	if (p_lseek(fd, -GIT_OID_RAWSZ, SEEK_END) < 0) {
+		p_close(fd);
+		return true;
+	}
+
+	bytes_read = p_read(fd, idx_checksum.id, GIT_OID_RAWSZ);
+	p_close(fd);
+	if (bytes_read != GIT_OID_RAWSZ)
+		return true;
+
+	return !git_oid_equal(&idx_checksum, &idx->checksum);
+}
+
+static int midx_entry_get_byindex(
+	git_midx_entry *e,
+	const git_midx_file *idx,
+	size_t pos)
+{
+	const unsigned char *object_offset;
+	uint32_t offset;
+
+	object_offset = idx->object_offsets + pos * MIDX_OBJECT_OFFSET_SIZE;
+	e->pack_index = get_be32(object_offset);
+	offset = get_be32(object_offset + sizeof(uint32_t));
+
+	if (e->pack_index >= git_vector_length(&idx->packfile_names))
+		return midx_error("invalid index into the packfile names table");
+
+	if (offset & MIDX_LARGE_OFFSET_NEEDED) {
+		const unsigned char *large_offset;
+		uint32_t large_offset_pos = offset & ~MIDX_LARGE_OFFSET_NEEDED;
+
+		/* Make sure we're not being sent out of bounds */
+		if (large_offset_pos >= idx->num_object_large_offsets)
+			return midx_error("invalid index into the object large offsets table");
+
+		large_offset = idx->object_large_offsets + 8 * large_offset_pos;
+		e->offset = ((git_off_t)get_be32(large_offset)) << 32 |
+			get_be32(large_offset + sizeof(uint32_t));
+	} else {
+		e->offset = offset;
+	}
+
+	git_oid_cpy(&e->sha1, &idx->oid_lookup[pos]);
+	return 0;
+}
+
+int git_midx_entry_find(
+	git_midx_entry *e,
+	git_midx_file *idx,
+	const git_oid *short_oid,
+	size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+
+	assert(e && idx && short_oid);
+
+	hi = ntohl(idx->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(idx->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	if (lo < hi)
+		pos = sha1_position(idx->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+	else
+		pos = -1 - (int)lo;
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = idx->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)idx->num_objects) {
+			current = idx->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)idx->num_objects) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len)) {
+			found = 2;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound("failed to find offset for multi-pack index entry", short_oid, len);
+	if (found > 1)
+		return git_odb__error_ambiguous("found multiple offsets for multi-pack index entry");
+
+	return midx_entry_get_byindex(e, idx, (size_t)pos);
+}
+
+int git_midx_foreach_entry(
+	git_midx_file *idx,
+	git_odb_foreach_cb cb,
+	void *data)
+{
+	size_t i;
+	int error;
+
+	assert(idx && cb);
+
+	for (i = 0; i < idx->num_objects; ++i) {
+		if ((error = cb(&idx->oid_lookup[i], data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return 0;
+}
+
+void git_midx_free(git_midx_file *idx)
+{
+	if (!idx)
+		return;
+
+	git__free(idx->filename);
+
+	if (idx->index_map.data)
+		git_futils_mmap_free(&idx->index_map);
+	git_vector_free(&idx->packfile_names);
+	git__free(idx);
+}
+
+/*
+ * multi-pack-index writer
+ */
+
+struct git_midx_writer {
+	/* The path of the directory holding the packfiles. */
+	git_buf pack_dir;
+
+	/* The packfiles that will be indexed, sorted by name. */
+	git_vector packs;
+};
+
+struct midx_object {
+	git_oid id;
+	uint32_t pack_index;
+	git_off_t offset;
+	git_time_t pack_mtime;
+};
+
+typedef git_array_t(struct midx_object) midx_object_array;
+
+struct midx_collect {
+	midx_object_array *objects;
+	struct git_pack_file *pack;
+	uint32_t pack_index;
+};
+
+static const char *pack_basename(const struct git_pack_file *p)
+{
+	const char *name = strrchr(p->pack_name, '/');
+	return name ? name + 1 : p->pack_name;
+}
+
+static int packfile__cmp(const void *a_, const void *b_)
+{
+	const struct git_pack_file *a = a_;
+	const struct git_pack_file *b = b_;
+
+	return strcmp(a->pack_name, b->pack_name);
+}
+
+static void packfile_put_cb(void *p)
+{
+	git_mwindow_put_pack(p);
+}
+
+static int midx_object__cmp(const void *a_, const void *b_, void *payload)
+{
+	const struct midx_object *a = a_;
+	const struct midx_object *b = b_;
+	int cmp;
+
+	GIT_UNUSED(payload);
+
+	if ((cmp = git_oid__cmp(&a->id, &b->id)) != 0)
+		return cmp;
+
+	/* when an object is in several packs, prefer the most recent pack */
+	if (a->pack_mtime != b->pack_mtime)
+		return (a->pack_mtime > b->pack_mtime) ? -1 : 1;
+
+	return (a->pack_index < b->pack_index) ? -1 :
+		(a->pack_index > b->pack_index);
+}
+
+int git_midx_writer_new(
+	git_midx_writer **out,
+	const char *pack_dir)
+{
+	git_midx_writer *w;
+
+	assert(out && pack_dir);
+
+	if (git_mwindow_files_init() < 0)
+		return -1;
+
+	w = git__calloc(1, sizeof(git_midx_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->pack_dir, pack_dir) < 0 ||
+		git_path_to_dir(&w->pack_dir) < 0) {
+		git_buf_free(&w->pack_dir);
+		git__free(w);
+		return -1;
+	}
+
+	if (git_vector_init(&w->packs, 0, packfile__cmp) < 0) {
+		git_buf_free(&w->pack_dir);
+		git__free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_midx_writer_free(git_midx_writer *w)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach(&w->packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&w->packs);
+	git_buf_free(&w->pack_dir);
+	git__free(w);
+}
+
+int git_midx_writer_add(
+	git_midx_writer *w,
+	const char *idx_path)
+{
+	git_buf idx_path_buf = GIT_BUF_INIT, dir = GIT_BUF_INIT;
+	struct git_pack_file *p;
+	int error;
+
+	assert(w && idx_path);
+
+	if ((error = git_path_join_unrooted(&idx_path_buf,
+			idx_path, git_buf_cstr(&w->pack_dir), NULL)) < 0 ||
+		(error = git_path_dirname_r(&dir, git_buf_cstr(&idx_path_buf))) < 0)
+		goto cleanup;
+
+	if ((error = git_path_to_dir(&dir)) < 0)
+		goto cleanup;
+
+	if (git__suffixcmp(git_buf_cstr(&idx_path_buf), ".idx") != 0 ||
+		strcmp(git_buf_cstr(&dir), git_buf_cstr(&w->pack_dir)) != 0) {
+		giterr_set(GITERR_INVALID,
+			"'%s' is not an index in the pack directory", idx_path);
+		error = -1;
+		goto cleanup;
+	}
+
+	if ((error = git_mwindow_get_pack(&p, git_buf_cstr(&idx_path_buf))) < 0)
+		goto cleanup;
+
+	if ((error = git_vector_insert(&w->packs, p)) < 0)
+		git_mwindow_put_pack(p);
+
+cleanup:
+	git_buf_free(&dir);
+	git_buf_free(&idx_path_buf);
+	return error;
+}
+
+static int midx_collect_cb(const git_oid *id, git_off_t offset, void *payload)
+{
+	struct midx_collect *collect = payload;
+	struct midx_object *object;
+
+	object = git_array_alloc(*collect->objects);
+	GITERR_CHECK_ALLOC(object);
+
+	git_oid_cpy(&object->id, id);
+	object->pack_index = collect->pack_index;
+	object->offset = offset;
+	object->pack_mtime = collect->pack->mtime;
+
+	return 0;
+}
+
+static int write_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int write_chunk_header(git_buf *buf, uint32_t chunk_id, uint64_t offset)
+{
+	if (write_be32(buf, chunk_id) < 0 ||
+		write_be32(buf, (uint32_t)(offset >> 32)) < 0)
+		return -1;
+
+	return write_be32(buf, (uint32_t)offset);
+}
+
+int git_midx_writer_dump(
+	git_buf *midx,
+	git_midx_writer *w)
+{
+	struct git_midx_header hdr = {0};
+	struct git_pack_file *p;
+	midx_object_array objects = GIT_ARRAY_INIT;
+	struct midx_object *object;
+	git_buf packfile_names = GIT_BUF_INIT, oid_fanout = GIT_BUF_INIT,
+		oid_lookup = GIT_BUF_INIT, object_offsets = GIT_BUF_INIT,
+		object_large_offsets = GIT_BUF_INIT, idx_name = GIT_BUF_INIT;
+	const git_oid *prev_id = NULL;
+	uint32_t fanout[256] = {0}, num_large_offsets = 0;
+	uint64_t offset;
+	git_oid idx_checksum;
+	size_t i;
+	int error = 0;
+
+	assert(midx && w);
+
+	git_vector_sort(&w->packs);
+	git_vector_uniq(&w->packs, packfile_put_cb);
+
+	git_vector_foreach(&w->packs, i, p) {
+		struct midx_collect collect;
+		const char *name = pack_basename(p);
+
+		/* Packfile Names, stored as the name of the .idx */
+		git_buf_clear(&idx_name);
+		if ((error = git_buf_put(&idx_name,
+				name, strlen(name) - strlen(".pack"))) < 0 ||
+			(error = git_buf_puts(&idx_name, ".idx")) < 0 ||
+			(error = git_buf_put(&packfile_names,
+				idx_name.ptr, idx_name.size + 1)) < 0)
+			goto cleanup;
+
+		collect.objects = &objects;
+		collect.pack = p;
+		collect.pack_index = (uint32_t)i;
+
+		if ((error = git_pack_foreach_entry_offset(p, midx_collect_cb, &collect)) < 0)
+			goto cleanup;
+	}
+
+	while (packfile_names.size % 4 != 0) {
+		if ((error = git_buf_putc(&packfile_names, '\0')) < 0)
+			goto cleanup;
+	}
+
+	git__qsort_r(objects.ptr, objects.size, sizeof(struct midx_object),
+		midx_object__cmp, NULL);
+
+	for (i = 0; i < git_array_size(objects); ++i) {
+		object = git_array_get(objects, i);
+
+		/* objects present in several packs are only indexed once */
+		if (prev_id && git_oid_equal(prev_id, &object->id))
+			continue;
+		prev_id = &object->id;
+
+		fanout[object->id.id[0]]++;
+
+		/* OID Lookup */
+		if ((error = git_buf_put(&oid_lookup,
+				(const char *)object->id.id, GIT_OID_RAWSZ)) < 0)
+			goto cleanup;
+
+		/* Object Offsets and Object Large Offsets */
+		if ((error = write_be32(&object_offsets, object->pack_index)) < 0)
+			goto cleanup;
+
+		if ((uint64_t)object->offset >= MIDX_LARGE_OFFSET_NEEDED) {
+			if ((error = write_be32(&object_offsets,
+					MIDX_LARGE_OFFSET_NEEDED | num_large_offsets++)) < 0 ||
+				(error = write_be32(&object_large_offsets,
+					(uint32_t)((uint64_t)object->offset >> 32))) < 0 ||
+				(error = write_be32(&object_large_offsets,
+					(uint32_t)object->offset)) < 0)
+				goto cleanup;
+		} else if ((error = write_be32(&object_offsets,
+				(uint32_t)object->offset)) < 0) {
+			goto cleanup;
+		}
+	}
+
+	/* OID Fanout */
+	for (i = 1; i < 256; ++i)
+		fanout[i] += fanout[i - 1];
+	for (i = 0; i < 256; ++i) {
+		if ((error = write_be32(&oid_fanout, fanout[i])) < 0)
+			goto cleanup;
+	}
+
+	/* Header */
+	hdr.signature = htonl(MIDX_SIGNATURE);
+	hdr.version = MIDX_VERSION;
+	hdr.object_id_version = MIDX_OBJECT_ID_VERSION;
+	hdr.chunks = (object_large_offsets.size > 0) ? 5 : 4;
+	hdr.base_midx_files = 0;
+	hdr.packfiles = htonl((uint32_t)git_vector_length(&w->packs));
+
+	git_buf_clear(midx);
+	if ((error = git_buf_put(midx, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Chunk lookup table */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * MIDX_CHUNK_ENTRY_SIZE;
+	if ((error = write_chunk_header(midx, MIDX_PACKFILE_NAMES_ID, offset)) < 0)
+		goto cleanup;
+	offset += packfile_names.size;
+	if ((error = write_chunk_header(midx, MIDX_OID_FANOUT_ID, offset)) < 0)
+		goto cleanup;
+	offset += oid_fanout.size;
+	if ((error = write_chunk_header(midx, MIDX_OID_LOOKUP_ID, offset)) < 0)
+		goto cleanup;
+	offset += oid_lookup.size;
+	if ((error = write_chunk_header(midx, MIDX_OBJECT_OFFSETS_ID, offset)) < 0)
+		goto cleanup;
+	offset += object_offsets.size;
+	if (object_large_offsets.size > 0) {
+		if ((error = write_chunk_header(midx, MIDX_OBJECT_LARGE_OFFSETS_ID, offset)) < 0)
+			goto cleanup;
+		offset += object_large_offsets.size;
+	}
+	if ((error = write_chunk_header(midx, 0, offset)) < 0)
+		goto cleanup;
+
+	/* Chunks and trailer */
+	if ((error = git_buf_put(midx, packfile_names.ptr, packfile_names.size)) < 0 ||
+		(error = git_buf_put(midx, oid_fanout.ptr, oid_fanout.size)) < 0 ||
+		(error = git_buf_put(midx, oid_lookup.ptr, oid_lookup.size)) < 0 ||
+		(error = git_buf_put(midx, object_offsets.ptr, object_offsets.size)) < 0 ||
+		(error = git_buf_put(midx, object_large_offsets.ptr, object_large_offsets.size)) < 0)
+		goto cleanup;
+
+	if ((error = git_hash_buf(&idx_checksum, midx->ptr, midx->size)) < 0)
+		goto cleanup;
+
+	error = git_buf_put(midx, (const char *)idx_checksum.id, GIT_OID_RAWSZ);
+
+cleanup:
+	git_array_clear(objects);
+	git_buf_free(&packfile_names);
+	git_buf_free(&oid_fanout);
+	git_buf_free(&oid_lookup);
+	git_buf_free(&object_offsets);
+	git_buf_free(&object_large_offsets);
+	git_buf_free(&idx_name);
+	return error;
+}
+
+int git_midx_writer_commit(
+	git_midx_writer *w)
+{
+	git_buf midx_path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_joinpath(&midx_path,
+			git_buf_cstr(&w->pack_dir), GIT_MIDX_FILE)) < 0 ||
+		(error = git_midx_writer_dump(&contents, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, git_buf_cstr(&midx_path),
+			0, GIT_OBJECT_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, contents.ptr, contents.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&contents);
+	git_buf_free(&midx_path);
+	return error;
+}
@@ -15,6 +15,7 @@
 #include "delta-apply.h"
 #include "filter.h"
 #include "repository.h"
+#include "pack.h"
 
 #include "git2/odb_backend.h"
 #include "git2/oid.h"
@@ -36,6 +37,7 @@ typedef struct
 	git_odb_backend *backend;
 	int priority;
 	bool is_alternate;
+	bool is_pack; /* created by git_odb_backend_pack() */
 	ino_t disk_inode;
 } backend_internal;
 
@@ -425,6 +427,14 @@ int git_odb_new(git_odb **out)
 		return -1;
 	}
 
+	if (git_mutex_init(&db->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize object database mutex");
+		git_cache_free(&db->own_cache);
+		git_vector_free(&db->backends);
+		git__free(db);
+		return -1;
+	}
+
 	*out = db;
 	GIT_REFCOUNT_INC(db);
 	return 0;
@@ -432,7 +442,7 @@ int git_odb_new(git_odb **out)
 
 static int add_backend_internal(
 	git_odb *odb, git_odb_backend *backend,
-	int priority, bool is_alternate, ino_t disk_inode)
+	int priority, bool is_alternate, bool is_pack, ino_t disk_inode)
 {
 	backend_internal *internal;
 
@@ -449,6 +459,7 @@ static int add_backend_internal(
 	internal->backend = backend;
 	internal->priority = priority;
 	internal->is_alternate = is_alternate;
+	internal->is_pack = is_pack;
 	internal->disk_inode = disk_inode;
 
 	if (git_vector_insert(&odb->backends, internal) < 0) {
@@ -463,12 +474,12 @@ static int add_backend_internal(
 
 int git_odb_add_backend(git_odb *odb, git_odb_backend *backend, int priority)
 {
-	return add_backend_internal(odb, backend, priority, false, 0);
+	return add_backend_internal(odb, backend, priority, false, false, 0);
 }
 
 int git_odb_add_alternate(git_odb *odb, git_odb_backend *backend, int priority)
 {
-	return add_backend_internal(odb, backend, priority, true, 0);
+	return add_backend_internal(odb, backend, priority, true, false, 0);
 }
 
 size_t git_odb_num_backends(git_odb *odb)
@@ -537,12 +548,14 @@ static int add_default_backends(
 
 	/* add the loose object backend */
 	if (git_odb_backend_loose(&loose, objects_dir, -1, 0, 0, 0) < 0 ||
-		add_backend_internal(db, loose, GIT_LOOSE_PRIORITY, as_alternates, inode) < 0)
+		add_backend_internal(db, loose, GIT_LOOSE_PRIORITY,
+			as_alternates, false, inode) < 0)
 		return -1;
 
 	/* add the packed file backend */
 	if (git_odb_backend_pack(&packed, objects_dir) < 0 ||
-		add_backend_internal(db, packed, GIT_PACKED_PRIORITY, as_alternates, inode) < 0)
+		add_backend_internal(db, packed, GIT_PACKED_PRIORITY,
+			as_alternates, true, inode) < 0)
 		return -1;
 
 	return load_alternates(db, objects_dir, alternate_depth);
@@ -617,7 +630,9 @@ int git_odb_open(git_odb **out, const char *objects_dir)
 	if (git_odb_new(&db) < 0)
 		return -1;
 
-	if (add_default_backends(db, objects_dir, 0, 0) < 0) {
+	db->objects_dir = git__strdup(objects_dir);
+	if (db->objects_dir == NULL ||
+		add_default_backends(db, objects_dir, 0, 0) < 0) {
 		git_odb_free(db);
 		return -1;
 	}
@@ -641,6 +656,9 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_free(&db->own_cache);
+	git_commit_graph_file_free(db->commit_graph);
+	git__free(db->objects_dir);
+	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -1000,6 +1018,119 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return error;
 }
 
+typedef struct {
+	size_t position;
+	struct git_pack_file *pack; /* NULL when cached or not packed */
+	git_off_t offset;
+} odb_read_request;
+
+static int odb_read_request_cmp(const void *a_, const void *b_, void *payload)
+{
+	const odb_read_request *a = a_, *b = b_;
+
+	GIT_UNUSED(payload);
+
+	if (a->pack != b->pack)
+		return ((uintptr_t)a->pack < (uintptr_t)b->pack) ? -1 : 1;
+
+	if (a->offset != b->offset)
+		return (a->offset < b->offset) ? -1 : 1;
+
+	return (a->position < b->position) ? -1 : (a->position > b->position);
+}
+
+static int odb_read_packed(
+	git_odb_object **out, git_odb *db, const git_oid *id,
+	struct git_pack_file *pack, git_off_t offset)
+{
+	git_rawobj raw = { NULL };
+	git_odb_object *object;
+	int error;
+
+	if ((*out = git_cache_get_raw(odb_cache(db), id)) != NULL)
+		return 0;
+
+	/* the pack may have gone away since it was looked up */
+	if ((error = git_packfile_unpack(&raw, pack, &offset)) < 0) {
+		giterr_clear();
+		return git_odb_read(out, db, id);
+	}
+
+	if ((object = odb_object__alloc(id, &raw)) == NULL) {
+		git__free(raw.data);
+		return -1;
+	}
+
+	*out = git_cache_store_raw(odb_cache(db), object);
+	return 0;
+}
+
+int git_odb_read_many(
+	git_odb *db,
+	const git_oid *ids,
+	size_t count,
+	git_odb_read_many_cb cb,
+	void *payload)
+{
+	odb_read_request *requests, *req;
+	struct git_pack_entry e;
+	git_odb_object *object;
+	git_cached_obj *cached;
+	size_t i;
+	int error = 0;
+
+	assert(db && (ids || !count) && cb);
+
+	if (!count)
+		return 0;
+
+	requests = git__calloc(count, sizeof(odb_read_request));
+	GITERR_CHECK_ALLOC(requests);
+
+	for (i = 0; i < count; i++) {
+		requests[i].position = i;
+
+		if ((cached = git_cache_get_any(odb_cache(db), &ids[i])) != NULL) {
+			git_cached_obj_decref(cached);
+			continue;
+		}
+
+		if (git_odb__pack_entry_find(&e, db, &ids[i]) == 0) {
+			requests[i].pack = e.p;
+			requests[i].offset = e.offset;
+		}
+	}
+
+	giterr_clear();
+
+	git__qsort_r(requests, count, sizeof(odb_read_request),
+		odb_read_request_cmp, NULL);
+
+	for (i = 0; i < count; i++) {
+		req = &requests[i];
+
+		if (req->pack)
+			error = odb_read_packed(&object, db,
+				&ids[req->position], req->pack, req->offset);
+		else
+			error = git_odb_read(&object, db, &ids[req->position]);
+
+		if (error < 0)
+			break;
+
+		error = cb(object, req->position, payload);
+		git_odb_object_free(object);
+
+		if (error) {
+			giterr_set_after_callback(error);
+			break;
+		}
+	}
+
+	git__free(requests);
+	return error;
+}
+
 static int odb_otype_fast(git_otype *type_p, git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
@@ -1273,34 +1404,108 @@ void git_odb_stream_free(git_odb_stream *stream)
 	if (stream == NULL)
 		return;
 
-	git_hash_ctx_cleanup(stream->hash_ctx);
-	git__free(stream->hash_ctx);
+	/* read streams have no hash context */
+	if (stream->hash_ctx != NULL) {
+		git_hash_ctx_cleanup(stream->hash_ctx);
+		git__free(stream->hash_ctx);
+	}
+
 	stream->free(stream);
 }
 
-int git_odb_open_rstream(git_odb_stream **stream, git_odb *db, const git_oid *oid)
+typedef struct {
+	git_odb_stream parent;
+	git_odb_object *object;
+} odb_object_stream;
+
+static int odb_object_stream__read(
+	git_odb_stream *_stream, char *buffer, size_t len)
 {
-	size_t i, reads = 0;
-	int error = GIT_ERROR;
+	odb_object_stream *stream = (odb_object_stream *)_stream;
+	size_t left = stream->object->cached.size -
+		(size_t)stream->parent.received_bytes;
 
-	assert(stream && db);
+	if (len > left)
+		len = left;
+	if (len > INT_MAX)
+		len = INT_MAX;
 
-	for (i = 0; i < db->backends.length && error < 0; ++i) {
-		backend_internal *internal = git_vector_get(&db->backends, i);
-		git_odb_backend *b = internal->backend;
+	memcpy(buffer, (char *)stream->object->buffer +
+		stream->parent.received_bytes, len);
+	stream->parent.received_bytes += len;
+
+	return (int)len;
+}
+
+static void odb_object_stream__free(git_odb_stream *_stream)
+{
+	odb_object_stream *stream = (odb_object_stream *)_stream;
+
+	git_odb_object_free(stream->object);
+	git__free(stream);
+}
+
+int git_odb__object_rstream(git_odb_stream **out, git_odb_object *object)
+{
+	odb_object_stream *stream;
+
+	if ((stream = git__calloc(1, sizeof(odb_object_stream))) == NULL) {
+		git_odb_object_free(object);
+		return -1;
+	}
+
+	stream->object = object;
+	stream->parent.mode = GIT_STREAM_RDONLY;
+	stream->parent.declared_size = object->cached.size;
+	stream->parent.read = &odb_object_stream__read;
+	stream->parent.free = &odb_object_stream__free;
 
-		if (b->readstream != NULL) {
-			++reads;
-			error = b->readstream(stream, b, oid);
+	*out = (git_odb_stream *)stream;
+	return 0;
+}
+
+int git_odb_open_rstream(
+	git_odb_stream **stream,
+	size_t *len,
+	git_otype *type,
+	git_odb *db,
+	const git_oid *oid)
+{
+	git_odb_object *object;
+	size_t i;
+	int error = GIT_ENOTFOUND;
+
+	assert(stream && len && type && db && oid);
+
+	*stream = NULL;
+
+	if ((object = git_cache_get_raw(odb_cache(db), oid)) == NULL) {
+		for (i = 0; i < db->backends.length; ++i) {
+			backend_internal *internal = git_vector_get(&db->backends, i);
+			git_odb_backend *b = internal->backend;
+
+			if (b->version < GIT_ODB_BACKEND_READSTREAM_VERSION ||
+				b->readstream == NULL)
+				continue;
+
+			error = b->readstream(stream, len, type, b, oid);
+			if (error != GIT_ENOTFOUND && error != GIT_PASSTHROUGH)
+				return error;
 		}
+
+		/*
+		 * Objects that no backend can stream (deltas, or objects in
+		 * backends without `readstream`) are read whole.
+		 */
+		giterr_clear();
+		if ((error = git_odb_read(&object, db, oid)) < 0)
+			return error;
 	}
 
-	if (error == GIT_PASSTHROUGH)
-		error = 0;
-	if (error < 0 && !reads)
-		error = git_odb__error_unsupported_in_backend("read object streamed");
+	*len = object->cached.size;
+	*type = object->cached.type;
 
-	return error;
+	return git_odb__object_rstream(stream, object);
 }
 
 int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer_progress_cb progress_cb, void *progress_payload)
@@ -1338,11 +1543,96 @@ void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 	return git__malloc(len);
 }
 
+static int commit_graph_path(git_buf *out, git_odb *odb)
+{
+	return git_buf_joinpath(out, odb->objects_dir, GIT_COMMIT_GRAPH_FILE);
+}
+
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error = 0;
+
+	assert(out && odb);
+
+	*out = NULL;
+
+	if (!odb->objects_dir)
+		return 0;
+
+	if (git_mutex_lock(&odb->lock) < 0) {
+		giterr_set(GITERR_ODB, "Failed to acquire the odb lock");
+		return -1;
+	}
+
+	if (!odb->commit_graph_checked) {
+		odb->commit_graph_checked = 1;
+
+		if ((error = commit_graph_path(&path, odb)) < 0)
+			goto done;
+
+		/*
+		 * The commit-graph is only a cache of data that is also in the
+		 * object database: when it is missing or cannot be parsed we
+		 * simply read the commits themselves.
+		 */
+		if (git_path_isfile(path.ptr) &&
+			git_commit_graph_open(&odb->commit_graph, path.ptr) < 0) {
+			odb->commit_graph = NULL;
+			giterr_clear();
+		}
+	}
+
+	if (odb->commit_graph) {
+		GIT_REFCOUNT_INC(odb->commit_graph);
+		*out = odb->commit_graph;
+	}
+
+done:
+	git_mutex_unlock(&odb->lock);
+	git_buf_free(&path);
+	return error;
+}
+
+static int odb_refresh_commit_graph(git_odb *db)
+{
+	git_buf path = GIT_BUF_INIT;
+	int error = 0;
+
+	if (!db->objects_dir)
+		return 0;
+
+	if (git_mutex_lock(&db->lock) < 0) {
+		giterr_set(GITERR_ODB, "Failed to acquire the odb lock");
+		return -1;
+	}
+
+	if ((error = commit_graph_path(&path, db)) < 0)
+		goto done;
+
+	if (db->commit_graph &&
+		git_commit_graph_needs_refresh(db->commit_graph, path.ptr)) {
+		git_commit_graph_file_free(db->commit_graph);
+		db->commit_graph = NULL;
+	}
+
+	if (!db->commit_graph)
+		db->commit_graph_checked = 0;
+
+done:
+	git_mutex_unlock(&db->lock);
+	git_buf_free(&path);
+	return error;
+}
+
 int git_odb_refresh(struct git_odb *db)
 {
 	size_t i;
 	assert(db);
 
+	if (odb_refresh_commit_graph(db) < 0)
+		return -1;
+
 	for (i = 0; i < db->backends.length; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
 		git_odb_backend *b = internal->backend;
@@ -1357,6 +1647,31 @@ int git_odb_refresh(struct git_odb *db)
 	return 0;
 }
 
+int git_odb__pack_entry_find(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id)
+{
+	size_t i;
+	int error;
+
+	assert(e && db && id);
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		if (!internal->is_pack)
+			continue;
+
+		error = git_odb_backend__pack_entry_find(e, internal->backend, id);
+		if (error == GIT_ENOTFOUND)
+			continue;
+
+		return error;
+	}
+
+	return git_odb__error_notfound("no packfile contains the object",
+		id, GIT_OID_HEXSZ);
+}
+
 int git_odb__error_notfound(
 	const char *message, const git_oid *oid, size_t oid_len)
 {
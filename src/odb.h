@@ -15,11 +15,15 @@
 #include "cache.h"
 #include "posix.h"
 #include "filter.h"
+#include "commit_graph.h"
 
 #define GIT_OBJECTS_DIR "objects/"
 #define GIT_OBJECT_DIR_MODE 0777
 #define GIT_OBJECT_FILE_MODE 0444
 
+/* The first version of `git_odb_backend` with the current `readstream` */
+#define GIT_ODB_BACKEND_READSTREAM_VERSION 2
+
 /* DO NOT EXPORT */
 typedef struct {
 	void *data;			/**< Raw, decompressed object data. */
@@ -38,6 +42,11 @@ struct git_odb {
 	git_refcount rc;
 	git_vector backends;
 	git_cache own_cache;
+
+	char *objects_dir;
+	git_mutex lock; /* protects the commit-graph */
+	git_commit_graph_file *commit_graph;
+	unsigned int commit_graph_checked:1;
 };
 
 /*
@@ -98,6 +107,37 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_otype *type_p,
 	git_odb *db, const git_oid *id);
 
+/*
+ * Open a read stream on the contents of an object which has already
+ * been read.  The stream takes over the caller's reference.
+ */
+int git_odb__object_rstream(git_odb_stream **out, git_odb_object *object);
+
+/*
+ * Get the commit-graph file of the object database, loading it if
+ * necessary.  `*out` is set to NULL when the repository has no
+ * (usable) commit-graph; otherwise the caller owns a reference and
+ * must release it with `git_commit_graph_file_free`.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
+struct git_pack_entry;
+
+/*
+ * Find the packfile entry of an object in the packfile backends the
+ * object database set up for itself, for callers that want to use the
+ * packed data as is.
+ */
+int git_odb__pack_entry_find(
+	struct git_pack_entry *e, git_odb *db, const git_oid *id);
+
+/*
+ * Find the packfile entry of an object in a backend created by
+ * `git_odb_backend_pack()`.
+ */
+int git_odb_backend__pack_entry_find(
+	struct git_pack_entry *e, git_odb_backend *backend, const git_oid *id);
+
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
@@ -28,6 +28,16 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+typedef struct {
+	git_odb_stream stream;
+	git_file fd;
+	z_stream zstream;
+	int done;
+	size_t head_pos, head_len;
+	unsigned char head[64]; /* the header and the data inflated with it */
+	unsigned char in[FILEIO_BUFSIZE];
+} loose_readstream;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
@@ -838,6 +848,164 @@ static void loose_backend__stream_free(git_odb_stream *_stream)
 	git__free(stream);
 }
 
+static int loose_readstream_fill(loose_readstream *stream)
+{
+	ssize_t read_bytes;
+
+	if (stream->zstream.avail_in)
+		return 0;
+
+	if ((read_bytes = p_read(stream->fd, stream->in, sizeof(stream->in))) < 0) {
+		giterr_set(GITERR_OS, "failed to read loose object");
+		return -1;
+	}
+
+	set_stream_input(&stream->zstream, stream->in, read_bytes);
+	return 0;
+}
+
+static int loose_backend__readstream_read(
+	git_odb_stream *_stream, char *buffer, size_t len)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+	size_t written;
+	int status = Z_OK;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+
+	/* hand out the data that was inflated along with the header first */
+	if (stream->head_pos < stream->head_len) {
+		written = min(len, stream->head_len - stream->head_pos);
+		memcpy(buffer, stream->head + stream->head_pos, written);
+		stream->head_pos += written;
+		stream->stream.received_bytes += written;
+		return (int)written;
+	}
+
+	if (len == 0 || stream->done)
+		return 0;
+
+	set_stream_output(&stream->zstream, buffer, len);
+
+	while (stream->zstream.avail_out == len) {
+		if (loose_readstream_fill(stream) < 0)
+			return -1;
+
+		if ((status = inflate(&stream->zstream, Z_NO_FLUSH)) == Z_STREAM_END) {
+			stream->done = 1;
+			break;
+		} else if (status != Z_OK) {
+			giterr_set(GITERR_ZLIB, "failed to inflate loose object");
+			return -1;
+		}
+	}
+
+	written = len - stream->zstream.avail_out;
+	stream->stream.received_bytes += written;
+
+	if (stream->stream.received_bytes > stream->stream.declared_size ||
+		(stream->done &&
+		 stream->stream.received_bytes != stream->stream.declared_size)) {
+		giterr_set(GITERR_ODB, "loose object does not match its size");
+		return -1;
+	}
+
+	return (int)written;
+}
+
+static void loose_backend__readstream_free(git_odb_stream *_stream)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+
+	inflateEnd(&stream->zstream);
+	if (stream->fd >= 0)
+		p_close(stream->fd);
+	git__free(stream);
+}
+
+static int loose_backend__readstream(
+	git_odb_stream **stream_out, size_t *len_out, git_otype *type_out,
+	git_odb_backend *backend, const git_oid *oid)
+{
+	git_buf object_path = GIT_BUF_INIT;
+	loose_readstream *stream;
+	obj_hdr hdr;
+	size_t used;
+	int status = Z_OK, error = 0;
+
+	assert(stream_out && len_out && type_out && backend && oid);
+
+	if (locate_object(&object_path, (loose_backend *)backend, oid) < 0) {
+		git_buf_free(&object_path);
+		return git_odb__error_notfound("no matching loose object",
+			oid, GIT_OID_HEXSZ);
+	}
+
+	stream = git__calloc(1, sizeof(loose_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if ((stream->fd = git_futils_open_ro(object_path.ptr)) < 0) {
+		error = stream->fd;
+		goto done;
+	}
+
+	init_stream(&stream->zstream, stream->head, sizeof(stream->head) - 1);
+
+	if ((error = loose_readstream_fill(stream)) < 0)
+		goto done;
+
+	/* objects in the old pack-like format are left to `read` */
+	if (stream->zstream.avail_in < 2 ||
+		!is_zlib_compressed_data(stream->in)) {
+		error = GIT_PASSTHROUGH;
+		goto done;
+	}
+
+	if (inflateInit(&stream->zstream) < Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to init loose object stream");
+		error = -1;
+		goto done;
+	}
+
+	while (status == Z_OK && stream->zstream.avail_out) {
+		if ((error = loose_readstream_fill(stream)) < 0)
+			goto done;
+		status = inflate(&stream->zstream, Z_NO_FLUSH);
+	}
+
+	if ((status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) ||
+		(used = get_object_header(&hdr, stream->head)) == 0 ||
+		!git_object_typeisloose(hdr.type) ||
+		stream->zstream.total_out - used > hdr.size ||
+		(status == Z_STREAM_END && stream->zstream.total_out - used != hdr.size)) {
+		giterr_set(GITERR_ODB, "failed to read loose object header");
+		error = -1;
+		goto done;
+	}
+
+	stream->done = (status == Z_STREAM_END);
+	stream->head_pos = used;
+	stream->head_len = stream->zstream.total_out;
+
+	stream->stream.backend = backend;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+	stream->stream.declared_size = hdr.size;
+	stream->stream.read = &loose_backend__readstream_read;
+	stream->stream.free = &loose_backend__readstream_free;
+
+	*stream_out = (git_odb_stream *)stream;
+	*len_out = hdr.size;
+	*type_out = hdr.type;
+
+done:
+	if (error < 0)
+		loose_backend__readstream_free((git_odb_stream *)stream);
+
+	git_buf_free(&object_path);
+	return error;
+}
+
 static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_backend, git_off_t length, git_otype type)
 {
 	loose_backend *backend;
@@ -972,6 +1140,7 @@ int git_odb_backend_loose(
 	backend->parent.read_prefix = &loose_backend__read_prefix;
 	backend->parent.read_header = &loose_backend__read_header;
 	backend->parent.writestream = &loose_backend__stream;
+	backend->parent.readstream = &loose_backend__readstream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.exists_prefix = &loose_backend__exists_prefix;
 	backend->parent.foreach = &loose_backend__foreach;
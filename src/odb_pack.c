@@ -15,6 +15,7 @@
 #include "odb.h"
 #include "delta-apply.h"
 #include "sha1_lookup.h"
+#include "midx.h"
 #include "mwindow.h"
 #include "pack.h"
 
@@ -22,6 +23,8 @@
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
@@ -32,6 +35,11 @@ struct pack_writepack {
 	git_indexer *indexer;
 };
 
+struct pack_readstream {
+	git_odb_stream parent;
+	git_packfile_stream stream;
+};
+
 /**
  * The wonderful tale of a Packed Object lookup query
  * ===================================================
@@ -210,6 +218,13 @@ static int packfile_load__cb(void *data, git_buf *path)
 			return 0;
 	}
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (memcmp(p->pack_name, path_str, cmp_len) == 0)
+			return 0;
+	}
+
 	error = git_mwindow_get_pack(&pack, path->ptr);
 
 	/* ignore missing .pack file as git does */
@@ -253,6 +268,33 @@ static int pack_entry_find_inner(
 	return -1;
 }
 
+static int midx_entry_find(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *short_oid,
+	size_t len)
+{
+	git_midx_entry midx_entry;
+	struct git_pack_file *p;
+	int error;
+
+	if ((error = git_midx_entry_find(
+			&midx_entry, backend->midx, short_oid, len)) < 0)
+		return error;
+
+	p = git_vector_get(&backend->midx_packs, midx_entry.pack_index);
+	if (!p)
+		return git_odb__error_notfound(
+			"multi-pack index refers to a missing packfile", short_oid, len);
+
+	if ((error = git_pack_entry_from_offset(
+			e, p, &midx_entry.sha1, midx_entry.offset)) < 0)
+		return error;
+
+	backend->last_found = p;
+	return 0;
+}
+
 static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
 {
 	struct git_pack_file *last_found = backend->last_found;
@@ -261,6 +303,9 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
+	if (backend->midx && !midx_entry_find(e, backend, oid, GIT_OID_HEXSZ))
+		return 0;
+
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
@@ -280,11 +325,23 @@ static int pack_entry_find_prefix(
 	bool found = false;
 	struct git_pack_file *last_found = backend->last_found;
 
+	if (backend->midx) {
+		error = midx_entry_find(e, backend, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error) {
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+		}
+	}
+
 	if (last_found) {
 		error = git_pack_entry_find(e, last_found, short_oid, len);
 		if (error == GIT_EAMBIGUOUS)
 			return error;
 		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
 			git_oid_cpy(&found_full_oid, &e->sha1);
 			found = true;
 		}
@@ -324,6 +381,108 @@ static int pack_entry_find_prefix(
  * Implement the git_odb_backend API calls
  *
  ***********************************************************/
+
+/*
+ * Give the packs covered by the multi-pack-index back to the list of
+ * packs that are searched one by one, and forget about the index.
+ */
+static int remove_multi_pack_index(struct pack_backend *backend)
+{
+	struct git_pack_file *p;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (error < 0 || (error = git_vector_insert(&backend->packs, p)) < 0)
+			git_mwindow_put_pack(p);
+	}
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+
+	return error;
+}
+
+static int load_multi_pack_index_packs(struct pack_backend *backend)
+{
+	git_buf idx_path = GIT_BUF_INIT;
+	struct git_pack_file *p;
+	const char *name;
+	size_t i, j;
+	int error = 0;
+
+	git_vector_foreach(&backend->midx->packfile_names, i, name) {
+		size_t root_len;
+
+		git_buf_clear(&idx_path);
+		if ((error = git_buf_joinpath(&idx_path, backend->pack_folder, name)) < 0)
+			break;
+		root_len = idx_path.size - strlen(".idx");
+
+		/* reuse the pack if we already have it open */
+		git_vector_foreach(&backend->packs, j, p) {
+			if (memcmp(p->pack_name, idx_path.ptr, root_len) == 0 &&
+				strcmp(p->pack_name + root_len, ".pack") == 0)
+				break;
+		}
+
+		if (j < backend->packs.length) {
+			git_vector_remove(&backend->packs, j);
+		} else if ((error = git_mwindow_get_pack(&p, idx_path.ptr)) < 0) {
+			break;
+		}
+
+		if ((error = git_vector_insert(&backend->midx_packs, p)) < 0) {
+			git_mwindow_put_pack(p);
+			break;
+		}
+	}
+
+	git_buf_free(&idx_path);
+	return error;
+}
+
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	git_buf midx_path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_buf_joinpath(&midx_path,
+			backend->pack_folder, GIT_MIDX_FILE)) < 0)
+		return error;
+
+	if (backend->midx) {
+		if (!git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path)))
+			goto done;
+
+		if ((error = remove_multi_pack_index(backend)) < 0)
+			goto done;
+	}
+
+	if (!git_path_isfile(git_buf_cstr(&midx_path)))
+		goto done;
+
+	/*
+	 * A multi-pack-index is only an accelerator; when it cannot be used
+	 * the packs it covers are simply looked up one by one.
+	 */
+	if (git_midx_open(&backend->midx, git_buf_cstr(&midx_path)) < 0) {
+		giterr_clear();
+		backend->midx = NULL;
+		goto done;
+	}
+
+	if (load_multi_pack_index_packs(backend) < 0) {
+		giterr_clear();
+		error = remove_multi_pack_index(backend);
+	}
+
+done:
+	git_buf_free(&midx_path);
+	return error;
+}
+
 static int pack_backend__refresh(git_odb_backend *backend_)
 {
 	int error;
@@ -337,6 +496,9 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL, 0);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -382,6 +544,98 @@ static int pack_backend__read(
 	return 0;
 }
 
+static int pack_backend__readstream_read(
+	git_odb_stream *_stream, char *buffer, size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+	git_off_t curpos;
+	ssize_t read;
+
+	if (len > INT_MAX)
+		len = INT_MAX;
+	if (len == 0 || stream->stream.done)
+		return 0;
+
+	/* the end of a window may not yield any output */
+	do {
+		curpos = stream->stream.curpos;
+		read = git_packfile_stream_read(&stream->stream, buffer, len);
+	} while (read == GIT_EBUFS && stream->stream.curpos > curpos);
+
+	if (read == GIT_EBUFS) {
+		giterr_set(GITERR_ODB, "truncated packfile entry");
+		return -1;
+	} else if (read < 0)
+		return -1;
+
+	stream->parent.received_bytes += read;
+
+	if (stream->parent.received_bytes > stream->parent.declared_size ||
+		(stream->stream.done &&
+		 stream->parent.received_bytes != stream->parent.declared_size)) {
+		giterr_set(GITERR_ODB, "packfile entry does not match its size");
+		return -1;
+	}
+
+	return (int)read;
+}
+
+static void pack_backend__readstream_free(git_odb_stream *_stream)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_stream_free(&stream->stream);
+	git__free(stream);
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **stream_out, size_t *len_p, git_otype *type_p,
+	git_odb_backend *backend, const git_oid *oid)
+{
+	struct pack_readstream *stream;
+	struct git_pack_entry e;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos;
+	size_t size;
+	git_otype type;
+	int error;
+
+	assert(stream_out && len_p && type_p && backend && oid);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	curpos = e.offset;
+	error = git_packfile_unpack_header(&size, &type, &e.p->mwf, &w_curs, &curpos);
+	git_mwindow_close(&w_curs);
+	if (error < 0)
+		return error;
+
+	/* deltas need their base in memory; let them be read whole */
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA)
+		return GIT_PASSTHROUGH;
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	if (git_packfile_stream_open(&stream->stream, e.p, curpos) < 0) {
+		git__free(stream);
+		return -1;
+	}
+
+	stream->parent.backend = backend;
+	stream->parent.mode = GIT_STREAM_RDONLY;
+	stream->parent.declared_size = size;
+	stream->parent.read = &pack_backend__readstream_read;
+	stream->parent.free = &pack_backend__readstream_free;
+
+	*stream_out = (git_odb_stream *)stream;
+	*len_p = size;
+	*type_p = type;
+
+	return 0;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -451,6 +705,10 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	if (backend->midx &&
+		(error = git_midx_foreach_entry(backend->midx, cb, data)) < 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) < 0)
 			return error;
@@ -511,6 +769,9 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 		return -1;
 	}
 
+	/* Most of the pack can be indexed while it is being received */
+	git_indexer_set_streaming(writepack->indexer, 1);
+
 	writepack->parent.backend = _backend;
 	writepack->parent.append = pack_backend__writepack_append;
 	writepack->parent.commit = pack_backend__writepack_commit;
@@ -530,11 +791,18 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+		git_mwindow_put_pack(p);
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
 	}
 
+	git_midx_free(backend->midx);
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
@@ -545,7 +813,9 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GITERR_CHECK_ALLOC(backend);
 
-	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0 ||
+		git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
@@ -555,6 +825,7 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
@@ -566,6 +837,12 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	return 0;
 }
 
+int git_odb_backend__pack_entry_find(
+	struct git_pack_entry *e, git_odb_backend *_backend, const git_oid *id)
+{
+	return pack_entry_find(e, (struct pack_backend *)_backend, id);
+}
+
 int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 {
 	struct pack_backend *backend = NULL;
@@ -14,6 +14,8 @@
 #include "stream.h"
 #include "socket_stream.h"
 #include "netops.h"
+#include "buffer.h"
+#include "vector.h"
 #include "git2/transport.h"
 #include "git2/sys/openssl.h"
 
@@ -34,6 +36,23 @@
 
 SSL_CTX *git__ssl_ctx;
 
+/*
+ * The last TLS session of each server we talked to, so that the next
+ * connection to it can resume the session instead of going through the
+ * whole handshake again.
+ */
+typedef struct {
+	char *server;
+	SSL_SESSION *session;
+} ssl_cached_session;
+
+#define SSL_SESSIONS_MAX 32
+
+static git_vector ssl_sessions = GIT_VECTOR_INIT;
+static git_mutex ssl_sessions_lock;
+
+static int ssl_session_new(SSL *ssl, SSL_SESSION *session);
+
 #define GIT_SSL_DEFAULT_CIPHERS "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:DHE-RSA-AES128-GCM-SHA256:DHE-DSS-AES128-GCM-SHA256:DHE-RSA-AES256-GCM-SHA384:DHE-DSS-AES256-GCM-SHA384:ECDHE-ECDSA-AES128-SHA256:ECDHE-RSA-AES128-SHA256:ECDHE-ECDSA-AES128-SHA:ECDHE-RSA-AES128-SHA:ECDHE-ECDSA-AES256-SHA384:ECDHE-RSA-AES256-SHA384:ECDHE-ECDSA-AES256-SHA:ECDHE-RSA-AES256-SHA:DHE-RSA-AES128-SHA256:DHE-RSA-AES256-SHA256:DHE-RSA-AES128-SHA:DHE-RSA-AES256-SHA:DHE-DSS-AES128-SHA256:DHE-DSS-AES256-SHA256:DHE-DSS-AES128-SHA:DHE-DSS-AES256-SHA:AES128-GCM-SHA256:AES256-GCM-SHA384:AES128-SHA256:AES256-SHA256:AES128-SHA:AES256-SHA"
 
 #ifdef GIT_THREADS
@@ -77,6 +96,18 @@ static void shutdown_ssl_locking(void)
  */
 static void shutdown_ssl(void)
 {
+	ssl_cached_session *cached;
+	size_t i;
+
+	git_vector_foreach(&ssl_sessions, i, cached) {
+		SSL_SESSION_free(cached->session);
+		git__free(cached->server);
+		git__free(cached);
+	}
+
+	git_vector_free(&ssl_sessions);
+	git_mutex_free(&ssl_sessions_lock);
+
 	if (git__ssl_ctx) {
 		SSL_CTX_free(git__ssl_ctx);
 		git__ssl_ctx = NULL;
@@ -106,7 +137,20 @@ int git_openssl_stream_global_init(void)
 	SSL_CTX_set_options(git__ssl_ctx, ssl_opts);
 	SSL_CTX_set_mode(git__ssl_ctx, SSL_MODE_AUTO_RETRY);
 	SSL_CTX_set_verify(git__ssl_ctx, SSL_VERIFY_NONE, NULL);
+
+	/* We keep the sessions ourselves, by server rather than by id */
+	SSL_CTX_set_session_cache_mode(git__ssl_ctx,
+		SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(git__ssl_ctx, ssl_session_new);
+
+	if (git_mutex_init(&ssl_sessions_lock) < 0) {
+		SSL_CTX_free(git__ssl_ctx);
+		git__ssl_ctx = NULL;
+		return -1;
+	}
+
 	if (!SSL_CTX_set_default_verify_paths(git__ssl_ctx)) {
+		git_mutex_free(&ssl_sessions_lock);
 		SSL_CTX_free(git__ssl_ctx);
 		git__ssl_ctx = NULL;
 		return -1;
@@ -117,6 +161,7 @@ int git_openssl_stream_global_init(void)
 	}
 
 	if(!SSL_CTX_set_cipher_list(git__ssl_ctx, ciphers)) {
+		git_mutex_free(&ssl_sessions_lock);
 		SSL_CTX_free(git__ssl_ctx);
 		git__ssl_ctx = NULL;
 		return -1;
@@ -428,10 +473,94 @@ typedef struct {
 	git_stream *io;
 	bool connected;
 	char *host;
+	char *server;
 	SSL *ssl;
 	git_cert_x509 cert_info;
 } openssl_stream;
 
+/*
+ * Called by OpenSSL when the server gives us a session which can be
+ * resumed, which for TLS 1.3 may only be once the handshake is over.
+ * Returning 1 keeps the reference to the session.
+ */
+static int ssl_session_new(SSL *ssl, SSL_SESSION *session)
+{
+	openssl_stream *st = SSL_get_app_data(ssl);
+	ssl_cached_session *cached = NULL, *c;
+	SSL_SESSION *old = NULL;
+	size_t i;
+
+	if (!st || git_mutex_lock(&ssl_sessions_lock) < 0)
+		return 0;
+
+	git_vector_foreach(&ssl_sessions, i, c) {
+		if (!strcmp(c->server, st->server)) {
+			cached = c;
+			old = c->session;
+			break;
+		}
+	}
+
+	/*
+	 * We already keep this very session; let OpenSSL drop the reference
+	 * it gave us, rather than freeing the one we keep.
+	 */
+	if (old == session) {
+		git_mutex_unlock(&ssl_sessions_lock);
+		return 0;
+	}
+
+	if (!cached && ssl_sessions.length >= SSL_SESSIONS_MAX) {
+		/* forget the server which was added first */
+		cached = git_vector_get(&ssl_sessions, 0);
+		git_vector_remove(&ssl_sessions, 0);
+
+		SSL_SESSION_free(cached->session);
+		git__free(cached->server);
+		git__free(cached);
+		cached = NULL;
+	}
+
+	if (!cached) {
+		if ((cached = git__calloc(1, sizeof(ssl_cached_session))) == NULL ||
+		    (cached->server = git__strdup(st->server)) == NULL ||
+		    git_vector_insert(&ssl_sessions, cached) < 0) {
+			if (cached)
+				git__free(cached->server);
+			git__free(cached);
+			git_mutex_unlock(&ssl_sessions_lock);
+			return 0;
+		}
+	}
+
+	cached->session = session;
+	git_mutex_unlock(&ssl_sessions_lock);
+
+	if (old)
+		SSL_SESSION_free(old);
+
+	return 1;
+}
+
+static void ssl_session_resume(openssl_stream *st)
+{
+	ssl_cached_session *cached;
+	size_t i;
+
+	if (git_mutex_lock(&ssl_sessions_lock) < 0)
+		return;
+
+	/* SSL_set_session() takes its own reference to the session */
+	git_vector_foreach(&ssl_sessions, i, cached) {
+		if (!strcmp(cached->server, st->server)) {
+			SSL_set_session(st->ssl, cached->session);
+			break;
+		}
+	}
+
+	git_mutex_unlock(&ssl_sessions_lock);
+}
+
 int openssl_close(git_stream *stream);
 
 int openssl_connect(git_stream *stream)
@@ -455,6 +584,8 @@ int openssl_connect(git_stream *stream)
 	SSL_set_tlsext_host_name(st->ssl, st->host);
 #endif
 
+	ssl_session_resume(st);
+
 	if ((ret = SSL_connect(st->ssl)) <= 0)
 		return ssl_set_error(st->ssl, ret);
 
@@ -547,6 +678,7 @@ void openssl_free(git_stream *stream)
 
 	SSL_free(st->ssl);
 	git__free(st->host);
+	git__free(st->server);
 	git__free(st->cert_info.data);
 	git_stream_free(st->io);
 	git__free(st);
@@ -556,6 +688,7 @@ int git_openssl_stream_new(git_stream **out, const char *host, const char *port)
 {
 	int error;
 	openssl_stream *st;
+	git_buf server = GIT_BUF_INIT;
 
 	st = git__calloc(1, sizeof(openssl_stream));
 	GITERR_CHECK_ALLOC(st);
@@ -580,6 +713,12 @@ int git_openssl_stream_new(git_stream **out, const char *host, const char *port)
 	st->host = git__strdup(host);
 	GITERR_CHECK_ALLOC(st->host);
 
+	git_buf_printf(&server, "%s:%s", host, port);
+	GITERR_CHECK_ALLOC_BUF(&server);
+	st->server = git_buf_detach(&server);
+
+	SSL_set_app_data(st->ssl, st);
+
 	st->parent.version = GIT_STREAM_VERSION;
 	st->parent.encrypted = 1;
 	st->parent.proxy_support = git_stream_supports_proxy(st->io);
@@ -0,0 +1,1109 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "map.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "path.h"
+#include "pool.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+#include "vector.h"
+
+#include "git2/commit.h"
+#include "git2/revwalk.h"
+#include "git2/tree.h"
+
+GIT__USE_OIDMAP
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+
+#define BITMAP_OPT_FULL_DAG 0x1
+#define BITMAP_OPT_HASH_CACHE 0x4
+
+/* How far back a stored bitmap may refer to the bitmap it is XORed with */
+#define BITMAP_MAX_XOR_OFFSET 160
+
+/* How many previous bitmaps the writer tries to XOR a new one with */
+#define BITMAP_XOR_WINDOW 10
+
+struct bitmap_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t options;
+	uint32_t entry_count;
+	unsigned char checksum[GIT_OID_RAWSZ];
+};
+
+#define BITMAP_ENTRY_HEADER_SIZE (sizeof(uint32_t) + 2)
+
+enum {
+	BITMAP_TYPE_COMMITS = 0,
+	BITMAP_TYPE_TREES,
+	BITMAP_TYPE_BLOBS,
+	BITMAP_TYPE_TAGS,
+	BITMAP_TYPE__COUNT
+};
+
+static const git_otype bitmap_types[BITMAP_TYPE__COUNT] = {
+	GIT_OBJ_COMMIT, GIT_OBJ_TREE, GIT_OBJ_BLOB, GIT_OBJ_TAG
+};
+
+/*
+ * A bitmap stored in the index.  It is only decompressed (and XORed
+ * with the bitmap it is based on) the first time it is needed.
+ */
+struct stored_bitmap {
+	const git_oid *commit;
+	const unsigned char *data;
+	size_t len;
+	struct stored_bitmap *xor;
+	git_bitmap bitmap;
+	unsigned int loaded:1;
+};
+
+/* An object which is not in the pack but reachable from a commit that is. */
+struct extended_object {
+	git_oid id;
+	git_otype type;
+	uint32_t pos;
+};
+
+struct git_bitmap_index {
+	git_repository *repo;
+	struct git_pack_file *pack;
+
+	/* the mapped `.bitmap` file, if there is one */
+	git_map map;
+
+	/* the objects in the order of the pack index, sorted by id */
+	uint32_t num_objects;
+	git_oid *oids;
+
+	/* bit positions follow the order of the objects in the pack */
+	uint32_t *idx_to_pack;
+	uint32_t *pack_to_idx;
+
+	git_bitmap types[BITMAP_TYPE__COUNT];
+
+	/* the name hash of every object, in the order of the pack index */
+	const unsigned char *name_hashes;
+	uint32_t *computed_hashes;
+
+	struct stored_bitmap *entries;
+	size_t num_entries;
+	git_oidmap *bitmaps;
+
+	git_pool extended_pool;
+	git_vector extended;
+	git_oidmap *extended_positions;
+	unsigned int allow_extended:1;
+};
+
+static int bitmap_error(const char *message)
+{
+	giterr_set(GITERR_ODB, "Invalid bitmap index - %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+struct pack_objects {
+	git_array_t(git_oid) oids;
+	git_array_t(git_off_t) offsets;
+};
+
+static int collect_pack_object(const git_oid *id, git_off_t offset, void *payload)
+{
+	struct pack_objects *objects = payload;
+	git_oid *oid = git_array_alloc(objects->oids);
+	git_off_t *off = git_array_alloc(objects->offsets);
+
+	GITERR_CHECK_ALLOC(oid);
+	GITERR_CHECK_ALLOC(off);
+
+	git_oid_cpy(oid, id);
+	*off = offset;
+	return 0;
+}
+
+static int pack_offset_cmp(const void *a, const void *b, void *payload)
+{
+	const git_off_t *offsets = payload;
+	git_off_t off_a = offsets[*(const uint32_t *)a];
+	git_off_t off_b = offsets[*(const uint32_t *)b];
+
+	return (off_a < off_b) ? -1 : (off_a > off_b);
+}
+
+static void bitmap_index_free_tables(git_bitmap_index *idx)
+{
+	size_t i;
+
+	for (i = 0; i < idx->num_entries; i++)
+		git_bitmap_free(&idx->entries[i].bitmap);
+	git__free(idx->entries);
+	idx->entries = NULL;
+	idx->num_entries = 0;
+
+	for (i = 0; i < BITMAP_TYPE__COUNT; i++)
+		git_bitmap_free(&idx->types[i]);
+
+	if (idx->bitmaps)
+		git_oidmap_free(idx->bitmaps);
+}
+
+void git_bitmap_index_free(git_bitmap_index *idx)
+{
+	if (!idx)
+		return;
+
+	bitmap_index_free_tables(idx);
+
+	if (idx->extended_positions)
+		git_oidmap_free(idx->extended_positions);
+	git_vector_free(&idx->extended);
+	git_pool_clear(&idx->extended_pool);
+
+	git__free(idx->computed_hashes);
+	git__free(idx->pack_to_idx);
+	git__free(idx->idx_to_pack);
+	git__free(idx->oids);
+
+	if (idx->map.data)
+		git_futils_mmap_free(&idx->map);
+
+	if (idx->pack)
+		git_mwindow_put_pack(idx->pack);
+
+	git__free(idx);
+}
+
+/*
+ * Open the pack behind `idx_path` and compute the position of every
+ * object in the pack order.
+ */
+static int bitmap_index_new(
+	git_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_bitmap_index *idx;
+	struct pack_objects objects = { GIT_ARRAY_INIT, GIT_ARRAY_INIT };
+	uint32_t i;
+	int error;
+
+	idx = git__calloc(1, sizeof(git_bitmap_index));
+	GITERR_CHECK_ALLOC(idx);
+
+	idx->repo = repo;
+	git_pool_init(&idx->extended_pool, sizeof(struct extended_object));
+
+	if ((error = git_vector_init(&idx->extended, 0, NULL)) < 0)
+		goto on_error;
+
+	idx->bitmaps = git_oidmap_alloc();
+	idx->extended_positions = git_oidmap_alloc();
+	if (!idx->bitmaps || !idx->extended_positions) {
+		giterr_set_oom();
+		error = -1;
+		goto on_error;
+	}
+
+	if ((error = git_mwindow_get_pack(&idx->pack, idx_path)) < 0 ||
+		(error = git_pack_foreach_entry_offset(
+			idx->pack, collect_pack_object, &objects)) < 0)
+		goto on_error;
+
+	if (!git__is_uint32(git_array_size(objects.oids))) {
+		error = bitmap_error("too many objects in the pack");
+		goto on_error;
+	}
+
+	idx->num_objects = (uint32_t)git_array_size(objects.oids);
+	idx->oids = objects.oids.ptr;
+	objects.oids.ptr = NULL;
+
+	idx->idx_to_pack = git__calloc(idx->num_objects + 1, sizeof(uint32_t));
+	idx->pack_to_idx = git__calloc(idx->num_objects + 1, sizeof(uint32_t));
+	if (!idx->idx_to_pack || !idx->pack_to_idx) {
+		error = -1;
+		goto on_error;
+	}
+
+	for (i = 0; i < idx->num_objects; i++)
+		idx->pack_to_idx[i] = i;
+
+	git__qsort_r(idx->pack_to_idx, idx->num_objects, sizeof(uint32_t),
+		pack_offset_cmp, objects.offsets.ptr);
+
+	for (i = 0; i < idx->num_objects; i++)
+		idx->idx_to_pack[idx->pack_to_idx[i]] = i;
+
+	git_array_clear(objects.offsets);
+	*out = idx;
+	return 0;
+
+on_error:
+	git_array_clear(objects.oids);
+	git_array_clear(objects.offsets);
+	git_bitmap_index_free(idx);
+	return error;
+}
+
+static int bitmap_index_parse(git_bitmap_index *idx)
+{
+	const unsigned char *data = idx->map.data, *pack_checksum, *end;
+	const struct bitmap_header *hdr;
+	uint32_t entry_count, i;
+	uint16_t options;
+	size_t consumed;
+	int error;
+
+	if (idx->map.len < sizeof(struct bitmap_header) + GIT_OID_RAWSZ)
+		return bitmap_error("bitmap is too short");
+
+	hdr = (const struct bitmap_header *)data;
+	end = data + idx->map.len - GIT_OID_RAWSZ;
+
+	if (memcmp(hdr->magic, BITMAP_SIGNATURE, sizeof(hdr->magic)) != 0 ||
+		ntohs(hdr->version) != BITMAP_VERSION)
+		return bitmap_error("unsupported bitmap version");
+
+	options = ntohs(hdr->options);
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmap does not cover the full history");
+
+	/* the pack index ends with the checksum of the pack, then its own */
+	pack_checksum = (const unsigned char *)idx->pack->index_map.data +
+		idx->pack->index_map.len - 2 * GIT_OID_RAWSZ;
+	if (memcmp(hdr->checksum, pack_checksum, GIT_OID_RAWSZ) != 0)
+		return bitmap_error("bitmap does not belong to the pack");
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		size_t cache_size = (size_t)idx->num_objects * sizeof(uint32_t);
+
+		if ((size_t)(end - data) - sizeof(struct bitmap_header) < cache_size)
+			return bitmap_error("bitmap is too short for the name hash cache");
+
+		end -= cache_size;
+		idx->name_hashes = end;
+	}
+
+	data += sizeof(struct bitmap_header);
+
+	for (i = 0; i < BITMAP_TYPE__COUNT; i++) {
+		if ((error = git_ewah_parse(&idx->types[i], &consumed,
+				data, end - data)) < 0)
+			return error;
+		data += consumed;
+	}
+
+	entry_count = ntohl(hdr->entry_count);
+	idx->entries = git__calloc(entry_count ? entry_count : 1,
+		sizeof(struct stored_bitmap));
+	GITERR_CHECK_ALLOC(idx->entries);
+
+	for (i = 0; i < entry_count; i++) {
+		struct stored_bitmap *entry = &idx->entries[i];
+		uint32_t commit_idx_pos, buffer_size;
+		uint8_t xor_offset;
+
+		if ((size_t)(end - data) < BITMAP_ENTRY_HEADER_SIZE + 3 * sizeof(uint32_t))
+			return bitmap_error("truncated bitmap entry");
+
+		commit_idx_pos = get_be32(data);
+		xor_offset = data[4];
+		data += BITMAP_ENTRY_HEADER_SIZE;
+
+		if (commit_idx_pos >= idx->num_objects)
+			return bitmap_error("bitmap entry for a commit outside of the pack");
+		if (xor_offset > BITMAP_MAX_XOR_OFFSET || xor_offset > i)
+			return bitmap_error("invalid XOR offset in bitmap entry");
+
+		buffer_size = get_be32(data + sizeof(uint32_t));
+		if (((size_t)(end - data) - 3 * sizeof(uint32_t)) / sizeof(uint64_t) < buffer_size)
+			return bitmap_error("truncated bitmap entry");
+
+		entry->commit = &idx->oids[commit_idx_pos];
+		entry->data = data;
+		entry->len = 3 * sizeof(uint32_t) + (size_t)buffer_size * sizeof(uint64_t);
+		entry->xor = xor_offset ? &idx->entries[i - xor_offset] : NULL;
+		idx->num_entries++;
+
+		git_oidmap_insert(idx->bitmaps, entry->commit, entry, error);
+		if (error < 0) {
+			giterr_set_oom();
+			return -1;
+		}
+
+		data += entry->len;
+	}
+
+	return 0;
+}
+
+int git_bitmap_index_open(
+	git_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_bitmap_index *idx;
+	git_buf bitmap_path = GIT_BUF_INIT;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	assert(out && repo && idx_path);
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not a pack index", idx_path);
+		return -1;
+	}
+
+	if ((error = git_buf_put(&bitmap_path, idx_path,
+			strlen(idx_path) - strlen(".idx"))) < 0 ||
+		(error = git_buf_puts(&bitmap_path, GIT_BITMAP_FILE_EXTENSION)) < 0)
+		goto done;
+
+	if ((fd = git_futils_open_ro(bitmap_path.ptr)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+		!git__is_sizet(st.st_size)) {
+		giterr_set(GITERR_ODB, "Invalid bitmap index '%s'", bitmap_path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = bitmap_index_new(&idx, repo, idx_path)) < 0)
+		goto done;
+
+	if ((error = git_futils_mmap_ro(&idx->map, fd, 0, (size_t)st.st_size)) < 0 ||
+		(error = bitmap_index_parse(idx)) < 0) {
+		git_bitmap_index_free(idx);
+		goto done;
+	}
+
+	idx->allow_extended = 1;
+	*out = idx;
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+	git_buf_free(&bitmap_path);
+	return error;
+}
+
+static int find_bitmap_cb(void *payload, git_buf *path)
+{
+	git_buf *idx_path = payload;
+
+	if (git__suffixcmp(path->ptr, GIT_BITMAP_FILE_EXTENSION) != 0)
+		return 0;
+
+	if (git_buf_put(idx_path, path->ptr,
+			path->size - strlen(GIT_BITMAP_FILE_EXTENSION)) < 0 ||
+		git_buf_puts(idx_path, ".idx") < 0)
+		return -1;
+
+	/* git only ever uses a single bitmap; so do we */
+	return GIT_ITEROVER;
+}
+
+int git_bitmap_index_load(git_bitmap_index **out, git_repository *repo)
+{
+	git_buf pack_dir = GIT_BUF_INIT, idx_path = GIT_BUF_INIT;
+	git_odb *odb;
+	int error;
+
+	assert(out && repo);
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0)
+		return error;
+
+	if (!odb->objects_dir) {
+		giterr_set(GITERR_ODB, "the object database has no bitmap index");
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = git_buf_joinpath(&pack_dir, odb->objects_dir, "pack")) < 0)
+		goto done;
+
+	if (!git_path_isdir(pack_dir.ptr)) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	error = git_path_direach(&pack_dir, 0, find_bitmap_cb, &idx_path);
+	if (error == GIT_ITEROVER) {
+		giterr_clear();
+		error = git_bitmap_index_open(out, repo, idx_path.ptr);
+	} else if (!error) {
+		giterr_set(GITERR_ODB, "the object database has no bitmap index");
+		error = GIT_ENOTFOUND;
+	}
+
+done:
+	git_buf_free(&pack_dir);
+	git_buf_free(&idx_path);
+	return error;
+}
+
+static int stored_bitmap_load(git_bitmap **out, struct stored_bitmap *entry)
+{
+	git_vector chain = GIT_VECTOR_INIT;
+	struct stored_bitmap *e;
+	size_t i, consumed;
+	int error = 0;
+
+	/* resolve the chain of XORed bitmaps from its base up */
+	for (e = entry; e && !e->loaded; e = e->xor) {
+		if ((error = git_vector_insert(&chain, e)) < 0)
+			goto done;
+	}
+
+	for (i = git_vector_length(&chain); i > 0; i--) {
+		e = git_vector_get(&chain, i - 1);
+
+		if ((error = git_ewah_parse(&e->bitmap, &consumed, e->data, e->len)) < 0 ||
+			(e->xor && (error = git_bitmap_xor(&e->bitmap, &e->xor->bitmap)) < 0))
+			goto done;
+
+		e->loaded = 1;
+	}
+
+	*out = &entry->bitmap;
+
+done:
+	git_vector_free(&chain);
+	return error;
+}
+
+static int bitmap_position(
+	uint32_t *out,
+	git_bitmap_index *idx,
+	const git_oid *id,
+	git_otype type)
+{
+	struct extended_object *ext;
+	khiter_t pos;
+	int idx_pos, error;
+
+	if (idx->num_objects &&
+		(idx_pos = sha1_position(idx->oids, GIT_OID_RAWSZ,
+			0, idx->num_objects, id->id)) >= 0) {
+		*out = idx->idx_to_pack[idx_pos];
+		return 0;
+	}
+
+	pos = git_oidmap_lookup_index(idx->extended_positions, id);
+	if (git_oidmap_valid_index(idx->extended_positions, pos)) {
+		ext = git_oidmap_value_at(idx->extended_positions, pos);
+		*out = ext->pos;
+		return 0;
+	}
+
+	if (!idx->allow_extended) {
+		char hex[GIT_OID_HEXSZ + 1];
+		git_oid_tostr(hex, sizeof(hex), id);
+		giterr_set(GITERR_ODB,
+			"object %s is not in the packfile; bitmaps can only be "
+			"written for packs that contain all of the reachable objects", hex);
+		return -1;
+	}
+
+	ext = git_pool_mallocz(&idx->extended_pool, 1);
+	GITERR_CHECK_ALLOC(ext);
+
+	git_oid_cpy(&ext->id, id);
+	ext->type = type;
+	ext->pos = idx->num_objects + (uint32_t)git_vector_length(&idx->extended);
+
+	if ((error = git_vector_insert(&idx->extended, ext)) < 0)
+		return error;
+
+	git_oidmap_insert(idx->extended_positions, &ext->id, ext, error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	*out = ext->pos;
+	return 0;
+}
+
+static void record_name_hash(
+	git_bitmap_index *idx, uint32_t pos, const char *name)
+{
+	if (!idx->computed_hashes || pos >= idx->num_objects)
+		return;
+
+	idx->computed_hashes[idx->pack_to_idx[pos]] =
+		git_packbuilder__name_hash(name);
+}
+
+static int add_tree(
+	git_bitmap *out,
+	git_bitmap_index *idx,
+	const git_oid *tree_id,
+	const char *name)
+{
+	git_tree *tree;
+	uint32_t pos;
+	size_t i;
+	int error;
+
+	if ((error = bitmap_position(&pos, idx, tree_id, GIT_OBJ_TREE)) < 0)
+		return error;
+
+	/* a tree that is already in the bitmap brings all of its contents */
+	if (git_bitmap_get(out, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(out, pos)) < 0)
+		return error;
+	record_name_hash(idx, pos, name);
+
+	if ((error = git_tree_lookup(&tree, idx->repo, tree_id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const git_oid *entry_id = git_tree_entry_id(entry);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJ_TREE:
+			error = add_tree(out, idx, entry_id, git_tree_entry_name(entry));
+			break;
+		case GIT_OBJ_BLOB:
+			if ((error = bitmap_position(&pos, idx, entry_id, GIT_OBJ_BLOB)) < 0 ||
+				(error = git_bitmap_set(out, pos)) < 0)
+				break;
+			record_name_hash(idx, pos, git_tree_entry_name(entry));
+			break;
+		default:
+			/* it's a submodule or something unknown, we don't want it */
+			;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+int git_bitmap_index_reachable(
+	git_bitmap *out,
+	git_bitmap_index *idx,
+	const git_oid *tip)
+{
+	git_array_t(git_oid) stack = GIT_ARRAY_INIT, commits = GIT_ARRAY_INIT;
+	git_oid *id, commit_id;
+	git_commit *commit;
+	git_bitmap *stored;
+	khiter_t entry;
+	uint32_t pos;
+	size_t i;
+	int error = 0;
+
+	assert(out && idx && tip);
+
+	if ((id = git_array_alloc(stack)) == NULL) {
+		error = -1;
+		goto done;
+	}
+	git_oid_cpy(id, tip);
+
+	/*
+	 * First walk the commits down to the closest ones that have a
+	 * bitmap, and only then add the trees of the commits that were
+	 * walked, so that the trees already covered by the bitmaps are not
+	 * walked again.
+	 */
+	while ((id = git_array_pop(stack)) != NULL) {
+		git_oid_cpy(&commit_id, id);
+
+		if ((error = bitmap_position(&pos, idx, &commit_id, GIT_OBJ_COMMIT)) < 0)
+			goto done;
+
+		if (git_bitmap_get(out, pos))
+			continue;
+
+		entry = git_oidmap_lookup_index(idx->bitmaps, &commit_id);
+		if (git_oidmap_valid_index(idx->bitmaps, entry)) {
+			if ((error = stored_bitmap_load(&stored,
+					git_oidmap_value_at(idx->bitmaps, entry))) < 0 ||
+				(error = git_bitmap_or(out, stored)) < 0)
+				goto done;
+			continue;
+		}
+
+		if ((error = git_bitmap_set(out, pos)) < 0)
+			goto done;
+
+		if ((id = git_array_alloc(commits)) == NULL) {
+			error = -1;
+			goto done;
+		}
+		git_oid_cpy(id, &commit_id);
+
+		if ((error = git_commit_lookup(&commit, idx->repo, &commit_id)) < 0)
+			goto done;
+
+		for (i = 0; i < git_commit_parentcount(commit); i++) {
+			if ((id = git_array_alloc(stack)) == NULL) {
+				error = -1;
+				break;
+			}
+			git_oid_cpy(id, git_commit_parent_id(commit, (unsigned int)i));
+		}
+
+		git_commit_free(commit);
+		if (error < 0)
+			goto done;
+	}
+
+	for (i = 0; i < git_array_size(commits); i++) {
+		id = git_array_get(commits, i);
+
+		if ((error = git_commit_lookup(&commit, idx->repo, id)) < 0)
+			goto done;
+
+		error = add_tree(out, idx, git_commit_tree_id(commit), NULL);
+		git_commit_free(commit);
+
+		if (error < 0)
+			goto done;
+	}
+
+done:
+	git_array_clear(stack);
+	git_array_clear(commits);
+	return error;
+}
+
+static uint32_t bitmap_name_hash(git_bitmap_index *idx, uint32_t pos)
+{
+	uint32_t idx_pos;
+
+	if (pos >= idx->num_objects)
+		return 0;
+
+	idx_pos = idx->pack_to_idx[pos];
+
+	if (idx->computed_hashes)
+		return idx->computed_hashes[idx_pos];
+	if (idx->name_hashes)
+		return get_be32(idx->name_hashes + idx_pos * sizeof(uint32_t));
+
+	return 0;
+}
+
+static git_otype bitmap_type(git_bitmap_index *idx, uint32_t pos)
+{
+	struct extended_object *ext;
+	size_t i;
+
+	if (pos >= idx->num_objects) {
+		ext = git_vector_get(&idx->extended, pos - idx->num_objects);
+		return ext ? ext->type : GIT_OBJ_BAD;
+	}
+
+	for (i = 0; i < BITMAP_TYPE__COUNT; i++) {
+		if (git_bitmap_get(&idx->types[i], pos))
+			return bitmap_types[i];
+	}
+
+	return GIT_OBJ_BAD;
+}
+
+int git_bitmap_index_foreach(
+	git_bitmap_index *idx,
+	const git_bitmap *bitmap,
+	git_bitmap_index_foreach_cb cb,
+	void *payload)
+{
+	size_t i, bit;
+	int error;
+
+	assert(idx && bitmap && cb);
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		uint64_t word = bitmap->words[i];
+
+		for (bit = 0; word; bit++, word >>= 1) {
+			uint32_t pos = (uint32_t)(i * GIT_BITMAP_WORD_BITS + bit);
+			const git_oid *id;
+			struct extended_object *ext;
+
+			if (!(word & 1))
+				continue;
+
+			if (pos < idx->num_objects) {
+				id = &idx->oids[idx->pack_to_idx[pos]];
+			} else if ((ext = git_vector_get(&idx->extended,
+					pos - idx->num_objects)) != NULL) {
+				id = &ext->id;
+			} else {
+				return bitmap_error("bit set for an unknown object");
+			}
+
+			if ((error = cb(id, bitmap_type(idx, pos),
+					bitmap_name_hash(idx, pos), payload)) != 0)
+				return giterr_set_after_callback(error);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * reachability bitmap writer
+ */
+
+struct git_bitmap_writer {
+	git_buf idx_path;
+	git_bitmap_index *index;
+	git_array_t(git_oid) commits;
+};
+
+int git_bitmap_writer_new(
+	git_bitmap_writer **out,
+	git_repository *repo,
+	const char *idx_path)
+{
+	git_bitmap_writer *w;
+
+	assert(out && repo && idx_path);
+
+	if (git__suffixcmp(idx_path, ".idx") != 0) {
+		giterr_set(GITERR_INVALID, "'%s' is not a pack index", idx_path);
+		return -1;
+	}
+
+	if (git_mwindow_files_init() < 0)
+		return -1;
+
+	w = git__calloc(1, sizeof(git_bitmap_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->idx_path, idx_path) < 0 ||
+		bitmap_index_new(&w->index, repo, idx_path) < 0) {
+		git_bitmap_writer_free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_bitmap_writer_free(git_bitmap_writer *w)
+{
+	if (!w)
+		return;
+
+	git_bitmap_index_free(w->index);
+	git_array_clear(w->commits);
+	git_buf_free(&w->idx_path);
+	git__free(w);
+}
+
+int git_bitmap_writer_add_commit(
+	git_bitmap_writer *w,
+	const git_oid *commit_id)
+{
+	git_oid *id;
+
+	assert(w && commit_id);
+
+	id = git_array_alloc(w->commits);
+	GITERR_CHECK_ALLOC(id);
+
+	git_oid_cpy(id, commit_id);
+	return 0;
+}
+
+static int compute_type_bitmaps(git_bitmap_index *idx)
+{
+	struct git_pack_entry e;
+	git_otype type;
+	size_t size;
+	uint32_t pos, i;
+	int error;
+
+	for (pos = 0; pos < idx->num_objects; pos++) {
+		const git_oid *id = &idx->oids[idx->pack_to_idx[pos]];
+
+		if ((error = git_pack_entry_find(&e, idx->pack, id, GIT_OID_HEXSZ)) < 0 ||
+			(error = git_packfile_resolve_header(&size, &type, idx->pack, e.offset)) < 0)
+			return error;
+
+		for (i = 0; i < BITMAP_TYPE__COUNT; i++) {
+			if (bitmap_types[i] == type)
+				break;
+		}
+
+		if (i == BITMAP_TYPE__COUNT)
+			return bitmap_error("unknown object type in the pack");
+
+		if ((error = git_bitmap_set(&idx->types[i], pos)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int write_be32(git_buf *buf, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(buf, (const char *)&value, sizeof(value));
+}
+
+static int write_entry(
+	git_buf *out,
+	git_bitmap_index *idx,
+	size_t n)
+{
+	git_buf best = GIT_BUF_INIT, xored = GIT_BUF_INIT;
+	git_bitmap xor = GIT_BITMAP_INIT;
+	struct stored_bitmap *entry = &idx->entries[n];
+	size_t i, best_offset = 0;
+	int error;
+
+	if ((error = git_ewah_serialize(&best, &entry->bitmap)) < 0)
+		goto done;
+
+	/* store the bitmap as a difference to a recent one if that is smaller */
+	for (i = 1; i <= BITMAP_XOR_WINDOW && i <= n; i++) {
+		git_bitmap_free(&xor);
+		git_buf_clear(&xored);
+
+		if ((error = git_bitmap_dup(&xor, &entry->bitmap)) < 0 ||
+			(error = git_bitmap_xor(&xor, &idx->entries[n - i].bitmap)) < 0 ||
+			(error = git_ewah_serialize(&xored, &xor)) < 0)
+			goto done;
+
+		if (xored.size < best.size) {
+			git_buf_swap(&best, &xored);
+			best_offset = i;
+		}
+	}
+
+	if ((error = write_be32(out, (uint32_t)(entry->commit - idx->oids))) < 0 ||
+		(error = git_buf_putc(out, (char)best_offset)) < 0 ||
+		(error = git_buf_putc(out, 0)) < 0)
+		goto done;
+
+	error = git_buf_put(out, best.ptr, best.size);
+
+done:
+	git_bitmap_free(&xor);
+	git_buf_free(&best);
+	git_buf_free(&xored);
+	return error;
+}
+
+static int oid_cmp(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid__cmp(a, b);
+}
+
+/*
+ * Compute the bitmaps of the selected commits, parents first, so that
+ * the walk for every commit stops at the closest selected ancestors.
+ */
+static int compute_bitmaps(git_bitmap_writer *w)
+{
+	git_bitmap_index *idx = w->index;
+	git_revwalk *walk = NULL;
+	git_oid id;
+	size_t i, selected;
+	int idx_pos, error;
+
+	git__qsort_r(w->commits.ptr, git_array_size(w->commits), sizeof(git_oid),
+		oid_cmp, NULL);
+
+	idx->entries = git__calloc(git_array_size(w->commits) + 1,
+		sizeof(struct stored_bitmap));
+	GITERR_CHECK_ALLOC(idx->entries);
+
+	if ((error = git_revwalk_new(&walk, idx->repo)) < 0)
+		return error;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	for (i = 0; i < git_array_size(w->commits); i++) {
+		if ((error = git_revwalk_push(walk, git_array_get(w->commits, i))) < 0)
+			goto done;
+	}
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		struct stored_bitmap *entry;
+
+		if (!git_array_size(w->commits) ||
+			sha1_position(w->commits.ptr, GIT_OID_RAWSZ, 0,
+				(unsigned)git_array_size(w->commits), id.id) < 0)
+			continue;
+
+		if (!idx->num_objects ||
+			(idx_pos = sha1_position(idx->oids, GIT_OID_RAWSZ,
+				0, idx->num_objects, id.id)) < 0) {
+			char hex[GIT_OID_HEXSZ + 1];
+			git_oid_tostr(hex, sizeof(hex), &id);
+			giterr_set(GITERR_ODB, "commit %s is not in the packfile", hex);
+			error = -1;
+			goto done;
+		}
+
+		entry = &idx->entries[idx->num_entries];
+		if ((error = git_bitmap_index_reachable(&entry->bitmap, idx, &id)) < 0)
+			goto done;
+
+		entry->commit = &idx->oids[idx_pos];
+		entry->loaded = 1;
+		idx->num_entries++;
+
+		git_oidmap_insert(idx->bitmaps, entry->commit, entry, error);
+		if (error < 0) {
+			giterr_set_oom();
+			goto done;
+		}
+	}
+
+	if (error == GIT_ITEROVER) {
+		giterr_clear();
+		error = 0;
+	}
+
+	/* a selected commit the walk did not return is not a commit */
+	for (selected = 0, i = 0; i < git_array_size(w->commits); i++) {
+		if (i == 0 || !git_oid_equal(git_array_get(w->commits, i),
+				git_array_get(w->commits, i - 1)))
+			selected++;
+	}
+
+	if (!error && selected != idx->num_entries) {
+		giterr_set(GITERR_INVALID, "only commits can have a bitmap");
+		error = -1;
+	}
+
+done:
+	git_revwalk_free(walk);
+	return error;
+}
+
+int git_bitmap_writer_dump(
+	git_buf *bitmap,
+	git_bitmap_writer *w)
+{
+	git_bitmap_index *idx;
+	struct bitmap_header hdr;
+	const unsigned char *pack_checksum;
+	git_oid checksum;
+	size_t i;
+	int error;
+
+	assert(bitmap && w);
+
+	idx = w->index;
+
+	bitmap_index_free_tables(idx);
+	idx->bitmaps = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(idx->bitmaps);
+
+	git__free(idx->computed_hashes);
+	idx->computed_hashes = git__calloc(idx->num_objects + 1, sizeof(uint32_t));
+	GITERR_CHECK_ALLOC(idx->computed_hashes);
+
+	if ((error = compute_type_bitmaps(idx)) < 0 ||
+		(error = compute_bitmaps(w)) < 0)
+		return error;
+
+	/* the pack index ends with the checksum of the pack, then its own */
+	pack_checksum = (const unsigned char *)idx->pack->index_map.data +
+		idx->pack->index_map.len - 2 * GIT_OID_RAWSZ;
+
+	memcpy(hdr.magic, BITMAP_SIGNATURE, sizeof(hdr.magic));
+	hdr.version = htons(BITMAP_VERSION);
+	hdr.options = htons(BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE);
+	hdr.entry_count = htonl((uint32_t)idx->num_entries);
+	memcpy(hdr.checksum, pack_checksum, GIT_OID_RAWSZ);
+
+	git_buf_clear(bitmap);
+	if ((error = git_buf_put(bitmap, (const char *)&hdr, sizeof(hdr))) < 0)
+		return error;
+
+	for (i = 0; i < BITMAP_TYPE__COUNT; i++) {
+		if ((error = git_ewah_serialize(bitmap, &idx->types[i])) < 0)
+			return error;
+	}
+
+	for (i = 0; i < idx->num_entries; i++) {
+		if ((error = write_entry(bitmap, idx, i)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < idx->num_objects; i++) {
+		if ((error = write_be32(bitmap, idx->computed_hashes[i])) < 0)
+			return error;
+	}
+
+	if ((error = git_hash_buf(&checksum, bitmap->ptr, bitmap->size)) < 0)
+		return error;
+
+	return git_buf_put(bitmap, (const char *)checksum.id, GIT_OID_RAWSZ);
+}
+
+int git_bitmap_writer_commit(
+	git_bitmap_writer *w)
+{
+	git_buf bitmap_path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	int error;
+
+	assert(w);
+
+	if ((error = git_buf_put(&bitmap_path, w->idx_path.ptr,
+			w->idx_path.size - strlen(".idx"))) < 0 ||
+		(error = git_buf_puts(&bitmap_path, GIT_BITMAP_FILE_EXTENSION)) < 0 ||
+		(error = git_bitmap_writer_dump(&contents, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, git_buf_cstr(&bitmap_path),
+			0, GIT_PACK_FILE_MODE)) < 0 ||
+		(error = git_filebuf_write(&output, contents.ptr, contents.size)) < 0)
+		goto cleanup;
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_filebuf_cleanup(&output);
+	git_buf_free(&contents);
+	git_buf_free(&bitmap_path);
+	return error;
+}
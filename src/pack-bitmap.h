@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+#include "git2/sys/pack_bitmap.h"
+
+#include "ewah.h"
+
+#define GIT_BITMAP_FILE_EXTENSION ".bitmap"
+
+/*
+ * A reachability bitmap index (`pack-*.bitmap`).
+ *
+ * Every object of the pack is given a bit, in the order in which the
+ * objects appear in the pack; the index stores, for a selection of
+ * commits, the set of objects reachable from them.  The set of objects
+ * reachable from any commit can then be computed by walking only down
+ * to the closest commits that have a bitmap, and objects which are not
+ * in the pack are given extra bits past the end of the pack.
+ */
+typedef struct git_bitmap_index git_bitmap_index;
+
+/*
+ * Open the reachability bitmap of a pack in the object database of
+ * `repo`.  Returns GIT_ENOTFOUND when no pack has one.
+ */
+int git_bitmap_index_load(git_bitmap_index **out, git_repository *repo);
+
+/* Open the `.bitmap` file belonging to the `.idx` file at `idx_path`. */
+int git_bitmap_index_open(
+	git_bitmap_index **out,
+	git_repository *repo,
+	const char *idx_path);
+
+void git_bitmap_index_free(git_bitmap_index *idx);
+
+/* Add every object reachable from the commit `tip` to `out`. */
+int git_bitmap_index_reachable(
+	git_bitmap *out,
+	git_bitmap_index *idx,
+	const git_oid *tip);
+
+typedef int (*git_bitmap_index_foreach_cb)(
+	const git_oid *id,
+	git_otype type,
+	uint32_t name_hash,
+	void *payload);
+
+/*
+ * Call `cb` for every object in `bitmap`, with the name hash recorded
+ * for it in the index (or zero when there is none).
+ */
+int git_bitmap_index_foreach(
+	git_bitmap_index *idx,
+	const git_bitmap *bitmap,
+	git_bitmap_index_foreach_cb cb,
+	void *payload);
+
+#endif
@@ -7,11 +7,15 @@
 
 #include "pack-objects.h"
 
+#include "array.h"
 #include "zstream.h"
 #include "delta.h"
 #include "iterator.h"
+#include "mwindow.h"
 #include "netops.h"
+#include "odb.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
@@ -68,7 +72,7 @@ GIT__USE_OIDMAP
 /* Size of the buffer to feed to zlib */
 #define COMPRESS_BUFLEN (1024 * 1024)
 
-static unsigned name_hash(const char *name)
+unsigned int git_packbuilder__name_hash(const char *name)
 {
 	unsigned c, hash = 0;
 
@@ -142,6 +146,7 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
+	pb->max_delta_depth = GIT_PACK_DEPTH;
 
 	if (git_hash_ctx_init(&pb->ctx) < 0 ||
 		git_zstream_init(&pb->zstream) < 0 ||
@@ -197,16 +202,75 @@ static void rehash(git_packbuilder *pb)
 	}
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+/*
+ * Take a reference to a pack we copy data from, so that it stays around
+ * when the object database lets go of it, e.g. on refresh.
+ */
+static int packbuilder_use_pack(
+	struct git_pack_file **out, git_packbuilder *pb, struct git_pack_file *p)
+{
+	struct git_pack_file *used;
+	git_buf idx_path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&pb->packs, i, used) {
+		if (used == p) {
+			*out = used;
+			return 0;
+		}
+	}
+
+	/* packs are shared by the name of their index */
+	if ((error = git_buf_set(&idx_path, p->pack_name,
+			strlen(p->pack_name) - strlen(".pack"))) < 0 ||
+		(error = git_buf_puts(&idx_path, ".idx")) < 0 ||
+		(error = git_mwindow_get_pack(&used, idx_path.ptr)) < 0)
+		goto done;
+
+	if ((error = git_vector_insert(&pb->packs, used)) < 0) {
+		git_mwindow_put_pack(used);
+		goto done;
+	}
+
+	*out = used;
+
+done:
+	git_buf_free(&idx_path);
+	return error;
+}
+
+/*
+ * Read the type and size of an object, remembering where it is stored
+ * when it is in a packfile so that its data can be copied as is when
+ * writing the pack.  Only packs with a version 2 index are considered,
+ * as they let us check the data against the CRC32 recorded for it.
+ */
+static int read_object_header(git_packbuilder *pb, git_pobject *po,
+			      const git_oid *oid)
+{
+	struct git_pack_entry e;
+
+	if (git_odb__pack_entry_find(&e, pb->odb, oid) == 0 &&
+	    e.p->index_version > 1 &&
+	    git_packfile_resolve_header(&po->size, &po->type, e.p, e.offset) == 0 &&
+	    packbuilder_use_pack(&po->in_pack, pb, e.p) == 0) {
+		po->in_pack_offset = e.offset;
+		return 0;
+	}
+
+	giterr_clear();
+	return git_odb_read_header(&po->size, &po->type, pb->odb, oid);
+}
+
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      unsigned int hash)
 {
 	git_pobject *po;
 	khiter_t pos;
 	size_t newsize;
 	int ret;
 
-	assert(pb && oid);
-
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
 	pos = kh_get(oid, pb->object_ix, oid);
@@ -233,12 +297,12 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	po = pb->object_list + pb->nr_objects;
 	memset(po, 0x0, sizeof(*po));
 
-	if ((ret = git_odb_read_header(&po->size, &po->type, pb->odb, oid)) < 0)
+	if ((ret = read_object_header(pb, po, oid)) < 0)
 		return ret;
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	pos = kh_put(oid, pb->object_ix, &po->id, &ret);
 	if (ret < 0) {
@@ -269,6 +333,14 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	assert(pb && oid);
+
+	return packbuilder_insert(pb, oid, git_packbuilder__name_hash(name));
+}
+
 static int get_delta(void **out, git_odb *odb, git_pobject *po)
 {
 	git_odb_object *src = NULL, *trg = NULL;
@@ -303,6 +375,150 @@ on_error:
 	return -1;
 }
 
+static int check_pack_crc(
+	struct git_pack_file *p, git_off_t offset, git_off_t len, uint32_t expected)
+{
+	git_mwindow *w_curs = NULL;
+	git_off_t start = offset;
+	unsigned char *data;
+	unsigned int left;
+	uLong crc = crc32(0L, Z_NULL, 0);
+
+	while (len > 0) {
+		if ((data = git_mwindow_open(&p->mwf, &w_curs, offset, 1, &left)) == NULL) {
+			git_mwindow_close(&w_curs);
+			return -1;
+		}
+
+		if ((git_off_t)left > len)
+			left = (unsigned int)len;
+
+		crc = crc32(crc, data, left);
+		offset += left;
+		len -= left;
+	}
+
+	git_mwindow_close(&w_curs);
+
+	if ((uint32_t)crc != expected) {
+		giterr_set(GITERR_ODB, "Packed object at offset %"PRId64" is corrupt",
+			(int64_t)start);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int copy_pack_data(
+	git_packbuilder *pb,
+	struct git_pack_file *p,
+	git_off_t offset,
+	git_off_t len,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	git_mwindow *w_curs = NULL;
+	unsigned char *data;
+	unsigned int left;
+	int error = 0;
+
+	while (len > 0) {
+		if ((data = git_mwindow_open(&p->mwf, &w_curs, offset, 1, &left)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		if ((git_off_t)left > len)
+			left = (unsigned int)len;
+
+		if ((error = write_cb(data, left, cb_data)) < 0 ||
+			(error = git_hash_update(&pb->ctx, data, left)) < 0)
+			break;
+
+		offset += left;
+		len -= left;
+	}
+
+	git_mwindow_close(&w_curs);
+	return error;
+}
+
+/*
+ * Copy the compressed data of an object straight from the packfile it
+ * is stored in, when it is stored whole or as a delta against the base
+ * we send it against.  The data is checked against the CRC32 recorded
+ * in the pack index before anything is written.  Returns GIT_PASSTHROUGH
+ * when the object has to be written from its inflated data instead.
+ */
+static int write_reused_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct git_pack_file *p = po->in_pack;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos = po->in_pack_offset, raw_size, data_len;
+	git_otype type;
+	unsigned char hdr[10];
+	size_t size, hdr_len;
+	uint32_t crc;
+	int error;
+
+	/* we found a better delta than the one in the pack */
+	if (po->delta && !po->reuse_delta)
+		return GIT_PASSTHROUGH;
+
+	if (git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos) < 0)
+		goto passthrough;
+
+	if (type == GIT_OBJ_OFS_DELTA || type == GIT_OBJ_REF_DELTA) {
+		if (!po->reuse_delta)
+			goto passthrough;
+
+		if (get_delta_base(p, &w_curs, &curpos, type, po->in_pack_offset) <= 0)
+			goto passthrough;
+
+		type = GIT_OBJ_REF_DELTA;
+	} else if (po->reuse_delta) {
+		goto passthrough;
+	}
+
+	git_mwindow_close(&w_curs);
+
+	if (git_packfile_raw_entry(NULL, &raw_size, &crc, p, po->in_pack_offset) < 0 ||
+		check_pack_crc(p, po->in_pack_offset, raw_size, crc) < 0)
+		goto passthrough;
+
+	/* The header (and the base of a delta) is written anew */
+	hdr_len = git_packfile__object_header(hdr, size, type);
+
+	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+		return error;
+
+	if (type == GIT_OBJ_REF_DELTA) {
+		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
+			(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
+			return error;
+	}
+
+	data_len = po->in_pack_offset + raw_size - curpos;
+	return copy_pack_data(pb, p, curpos, data_len, write_cb, cb_data);
+
+passthrough:
+	git_mwindow_close(&w_curs);
+	giterr_clear();
+
+	/* we cannot use the delta we had in mind; send the whole object */
+	if (po->reuse_delta) {
+		po->delta = NULL;
+		po->reuse_delta = 0;
+	}
+
+	return GIT_PASSTHROUGH;
+}
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -316,6 +532,13 @@ static int write_object(
 	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
 	int error;
 
+	if (po->in_pack &&
+		(error = write_reused_object(pb, po, write_cb, cb_data)) != GIT_PASSTHROUGH) {
+		if (!error)
+			pb->nr_written++;
+		return error;
+	}
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
@@ -426,8 +649,10 @@ static int write_one(
 			return error;
 
 		/* we cannot depend on this one */
-		if (*status == WRITE_ONE_RECURSIVE)
+		if (*status == WRITE_ONE_RECURSIVE) {
 			po->delta = NULL;
+			po->reuse_delta = 0;
+		}
 	}
 
 	*status = WRITE_ONE_WRITTEN;
@@ -744,8 +969,6 @@ static int try_delta(git_packbuilder *pb, struct unpacked *trg,
 
 	*ret = 0;
 
-	/* TODO: support reuse-delta */
-
 	/* Let's not bust the allowed depth. */
 	if (src->depth >= max_depth)
 		return 0;
@@ -1283,6 +1506,148 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 #define ll_find_deltas(pb, l, ls, w, d) find_deltas(pb, l, &ls, w, d)
 #endif
 
+/*
+ * Objects that are stored as a delta in a packfile can be sent as they
+ * are when their delta base is sent too, and its data comes from the
+ * same pack.  This saves inflating, deltifying and compressing them
+ * again, so they are left out of the search for deltas.
+ */
+static int break_delta_chains(git_packbuilder *pb);
+
+static int find_reusable_deltas(git_packbuilder *pb)
+{
+	git_pobject *po, *base, *b;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos, base_offset;
+	git_otype type;
+	git_oid base_id;
+	size_t size;
+	khiter_t pos;
+	uint32_t i;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+		po->delta_child = NULL;
+		po->delta_sibling = NULL;
+	}
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (!po->in_pack || po->delta)
+			continue;
+
+		curpos = po->in_pack_offset;
+		if (git_packfile_unpack_header(&size, &type,
+				&po->in_pack->mwf, &w_curs, &curpos) < 0 ||
+			(type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA))
+			goto next;
+
+		base_offset = get_delta_base(po->in_pack, &w_curs, &curpos,
+			type, po->in_pack_offset);
+		if (base_offset <= 0 ||
+			git_packfile_raw_entry(&base_id, NULL, NULL,
+				po->in_pack, base_offset) < 0)
+			goto next;
+
+		pos = kh_get(oid, pb->object_ix, &base_id);
+		if (pos == kh_end(pb->object_ix))
+			goto next;
+
+		base = kh_value(pb->object_ix, pos);
+		if (base->in_pack != po->in_pack ||
+			base->in_pack_offset != base_offset)
+			goto next;
+
+		/* a delta we found earlier may go the other way around */
+		for (b = base; b && b != po; b = b->delta)
+			; /* nothing */
+		if (b)
+			goto next;
+
+		po->delta = base;
+		po->delta_size = (unsigned long)size;
+		po->reuse_delta = 1;
+
+next:
+		git_mwindow_close(&w_curs);
+		giterr_clear();
+	}
+
+	if (break_delta_chains(pb) < 0)
+		return -1;
+
+	/* let the search for deltas know how deep the chains are */
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = pb->object_list + i;
+
+		if (!po->reuse_delta)
+			continue;
+
+		po->delta_sibling = po->delta->delta_child;
+		po->delta->delta_child = po;
+	}
+
+	return 0;
+}
+
+/*
+ * The chains of deltas in the pack may be deeper than we allow.  As git
+ * does in break_delta_chains(), send every `max_delta_depth + 1`th object
+ * of a chain without the delta it has in the pack, so that it either
+ * gets a new delta from the search or is sent whole.
+ */
+static int break_delta_chains(git_packbuilder *pb)
+{
+	git_array_t(git_pobject *) chain = GIT_ARRAY_INIT;
+	git_pobject *po, **link;
+	unsigned int *depths, depth;
+	uint32_t i;
+	int error = 0;
+
+	/* the depth of each object plus one, or 0 while it is unknown */
+	depths = git__calloc(pb->nr_objects, sizeof(*depths));
+	GITERR_CHECK_ALLOC(depths);
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		/* go up the chain to the first object whose depth we know */
+		po = pb->object_list + i;
+
+		while (po && !depths[po - pb->object_list]) {
+			if ((link = git_array_alloc(chain)) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			*link = po;
+
+			po = po->reuse_delta ? po->delta : NULL;
+		}
+
+		depth = po ? depths[po - pb->object_list] - 1 : 0;
+
+		/* and back down, breaking the chain where it gets too deep */
+		while ((link = git_array_pop(chain)) != NULL) {
+			po = *link;
+
+			if (!po->reuse_delta) {
+				depth = 0;
+			} else if (++depth > pb->max_delta_depth) {
+				po->delta = NULL;
+				po->reuse_delta = 0;
+				depth = 0;
+			}
+
+			depths[po - pb->object_list] = depth + 1;
+		}
+	}
+
+done:
+	git_array_clear(chain);
+	git__free(depths);
+	return error;
+}
+
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
@@ -1301,9 +1666,17 @@ static int prepare_pack(git_packbuilder *pb)
 	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
 	GITERR_CHECK_ALLOC(delta_list);
 
+	if (find_reusable_deltas(pb) < 0) {
+		git__free(delta_list);
+		return -1;
+	}
+
 	for (i = 0; i < pb->nr_objects; ++i) {
 		git_pobject *po = pb->object_list + i;
 
+		if (po->reuse_delta)
+			continue;
+
 		/* Make sure the item is within our size limits */
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
@@ -1315,7 +1688,7 @@ static int prepare_pack(git_packbuilder *pb)
 		git__tsort((void **)delta_list, n, type_size_sort);
 		if (ll_find_deltas(pb, delta_list, n,
 				   GIT_PACK_WINDOW + 1,
-				   GIT_PACK_DEPTH) < 0) {
+				   (int)pb->max_delta_depth) < 0) {
 			git__free(delta_list);
 			return -1;
 		}
@@ -1676,6 +2049,56 @@ cleanup:
 	return error;
 }
 
+static int insert_bitmap_object(
+	const git_oid *id, git_otype type, uint32_t name_hash, void *payload)
+{
+	GIT_UNUSED(type);
+	return packbuilder_insert(payload, id, name_hash);
+}
+
+/*
+ * When the repository has a reachability bitmap, the objects to send are
+ * the ones reachable from the pushed commits minus the ones reachable
+ * from the hidden ones, which we can compute without walking any tree
+ * that is covered by a bitmap.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	git_bitmap_index *idx;
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	git_commit_list *list;
+	int error = 0;
+
+	if (walk->hide_cb)
+		return GIT_PASSTHROUGH;
+
+	if (git_bitmap_index_load(&idx, pb->repo) < 0) {
+		giterr_clear();
+		return GIT_PASSTHROUGH;
+	}
+
+	for (list = walk->user_input; list && !error; list = list->next) {
+		error = git_bitmap_index_reachable(
+			list->item->uninteresting ? &haves : &wants, idx, &list->item->oid);
+	}
+
+	if (error < 0) {
+		/* the bitmap is only an accelerator; let the walk report real errors */
+		giterr_clear();
+		error = GIT_PASSTHROUGH;
+		goto cleanup;
+	}
+
+	git_bitmap_and_not(&wants, &haves);
+	error = git_bitmap_index_foreach(idx, &wants, insert_bitmap_object, pb);
+
+cleanup:
+	git_bitmap_free(&wants);
+	git_bitmap_free(&haves);
+	git_bitmap_index_free(idx);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1684,6 +2107,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_PASSTHROUGH)
+		return error;
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1725,6 +2151,9 @@ int git_packbuilder_set_callbacks(git_packbuilder *pb, git_packbuilder_progress
 
 void git_packbuilder_free(git_packbuilder *pb)
 {
+	struct git_pack_file *p;
+	size_t i;
+
 	if (pb == NULL)
 		return;
 
@@ -1748,6 +2177,10 @@ void git_packbuilder_free(git_packbuilder *pb)
 	git_oidmap_free(pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
 
+	git_vector_foreach(&pb->packs, i, p)
+		git_mwindow_put_pack(p);
+	git_vector_free(&pb->packs);
+
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
 
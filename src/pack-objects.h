@@ -16,6 +16,7 @@
 #include "netops.h"
 #include "zstream.h"
 #include "pool.h"
+#include "vector.h"
 
 #include "git2/oid.h"
 #include "git2/pack.h"
@@ -45,10 +46,14 @@ typedef struct git_pobject {
 	unsigned long delta_size;
 	unsigned long z_delta_size;
 
+	struct git_pack_file *in_pack; /* packfile we may copy the data from */
+	git_off_t in_pack_offset;
+
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    reuse_delta:1; /* the delta against `delta` is in `in_pack` */
 } git_pobject;
 
 typedef struct {
@@ -77,6 +82,8 @@ struct git_packbuilder {
 	git_oidmap *walk_objects;
 	git_pool object_pool;
 
+	git_vector packs; /* packs the objects are copied from, referenced */
+
 	git_oid pack_oid; /* hash of written pack */
 
 	/* synchronization objects */
@@ -90,6 +97,7 @@ struct git_packbuilder {
 	uint64_t cache_max_small_delta_size;
 	uint64_t big_file_threshold;
 	uint64_t window_memory_limit;
+	unsigned int max_delta_depth;
 
 	int nr_threads; /* nr of threads to use */
 
@@ -102,4 +110,7 @@ struct git_packbuilder {
 
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+/* The hash of an object's file name used to group delta candidates. */
+unsigned int git_packbuilder__name_hash(const char *name);
+
 #endif /* INCLUDE_pack_objects_h__ */
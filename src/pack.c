@@ -205,6 +205,10 @@ static void pack_index_free(struct git_pack_file *p)
 		git__free(p->oids);
 		p->oids = NULL;
 	}
+	if (p->revindex) {
+		git__free(p->revindex);
+		p->revindex = NULL;
+	}
 	if (p->index_map.data) {
 		git_futils_mmap_free(&p->index_map);
 		p->index_map.data = NULL;
@@ -1264,6 +1268,163 @@ int git_pack_foreach_entry(
 	return error;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	git_off_t offset;
+	uint32_t i;
+	int error = 0;
+
+	if (p->index_version == -1) {
+		if ((error = pack_index_open(p)) < 0)
+			return error;
+
+		assert(p->index_map.data);
+	}
+
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	for (i = 0; i < p->num_objects; i++) {
+		git_oid oid;
+
+		if (p->index_version > 1)
+			git_oid_fromraw(&oid, index + 20 * i);
+		else
+			git_oid_fromraw(&oid, index + 24 * i + 4);
+
+		if ((offset = nth_packed_object_offset(p, i)) < 0) {
+			giterr_set(GITERR_ODB, "packfile index is corrupt");
+			return -1;
+		}
+
+		if ((error = cb(&oid, offset, data)) != 0)
+			return giterr_set_after_callback(error);
+	}
+
+	return error;
+}
+
+static int revindex_cmp(const void *a, const void *b, void *payload)
+{
+	const struct git_pack_revindex_entry *entry_a = a, *entry_b = b;
+
+	GIT_UNUSED(payload);
+
+	if (entry_a->offset < entry_b->offset)
+		return -1;
+	return entry_a->offset > entry_b->offset;
+}
+
+static int pack_revindex_init(struct git_pack_file *p)
+{
+	struct git_pack_revindex_entry *revindex;
+	uint32_t i;
+
+	revindex = git__mallocarray(p->num_objects, sizeof(*revindex));
+	GITERR_CHECK_ALLOC(revindex);
+
+	for (i = 0; i < p->num_objects; i++) {
+		if ((revindex[i].offset = nth_packed_object_offset(p, i)) < 0) {
+			git__free(revindex);
+			giterr_set(GITERR_ODB, "packfile index is corrupt");
+			return -1;
+		}
+		revindex[i].nr = i;
+	}
+
+	git__qsort_r(revindex, p->num_objects, sizeof(*revindex),
+		revindex_cmp, NULL);
+
+	p->revindex = revindex;
+	return 0;
+}
+
+int git_packfile_raw_entry(
+		git_oid *id,
+		git_off_t *size,
+		uint32_t *crc,
+		struct git_pack_file *p,
+		git_off_t offset)
+{
+	const unsigned char *index;
+	git_off_t end;
+	uint32_t lo = 0, hi, pos;
+	int error = 0;
+
+	assert(p);
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (git_mutex_lock(&p->lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock packfile");
+		return -1;
+	}
+
+	if (!p->revindex)
+		error = pack_revindex_init(p);
+
+	git_mutex_unlock(&p->lock);
+
+	if (error < 0)
+		return error;
+
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	hi = p->num_objects;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (p->revindex[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	pos = lo;
+	if (pos >= p->num_objects || p->revindex[pos].offset != offset)
+		return git_odb__error_notfound("no object at the given pack offset", NULL, 0);
+
+	if (pos + 1 < p->num_objects)
+		end = p->revindex[pos + 1].offset;
+	else
+		end = p->mwf.size - GIT_OID_RAWSZ;
+
+	index = p->index_map.data;
+	if (p->index_version > 1)
+		index += 8;
+	index += 4 * 256;
+
+	if (id) {
+		if (p->index_version > 1)
+			git_oid_fromraw(id, index + 20 * p->revindex[pos].nr);
+		else
+			git_oid_fromraw(id, index + 24 * p->revindex[pos].nr + 4);
+	}
+
+	if (size)
+		*size = end - offset;
+
+	if (crc) {
+		if (p->index_version > 1)
+			*crc = ntohl(*((uint32_t *)(index + 20 * p->num_objects +
+				4 * p->revindex[pos].nr)));
+		else
+			*crc = 0;
+	}
+
+	return 0;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
@@ -1403,3 +1564,30 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_from_offset(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	int error;
+
+	assert(e && p && oid);
+
+	if (p->num_bad_objects) {
+		unsigned i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+				return packfile_error("bad object found in packfile");
+	}
+
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
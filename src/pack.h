@@ -84,6 +84,11 @@ typedef struct {
 	git_offmap *entries;
 } git_pack_cache;
 
+struct git_pack_revindex_entry {
+	git_off_t offset;
+	uint32_t nr; /* position in the index */
+};
+
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -99,6 +104,7 @@ struct git_pack_file {
 	unsigned pack_local:1, pack_keep:1, has_cache:1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
+	struct git_pack_revindex_entry *revindex; /* objects sorted by offset */
 
 	git_pack_cache bases; /* delta base cache */
 
@@ -160,4 +166,41 @@ int git_pack_foreach_entry(
 		git_odb_foreach_cb cb,
 		void *data);
 
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+/*
+ * Call `cb` with the id and the offset of every object in the pack, in
+ * the order of the pack index (that is, sorted by id).
+ */
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/*
+ * Fill in a pack entry for an object whose offset is already known (for
+ * instance from a multi-pack-index), making sure the pack is open.
+ */
+int git_pack_entry_from_offset(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
+
+/*
+ * Look up the object stored at `offset` in the pack: its id, the size
+ * of its raw representation (header and compressed data) and the CRC32
+ * of that representation as recorded in the index.  Version 1 indexes
+ * do not record a CRC32, in which case `*crc` is set to zero.
+ */
+int git_packfile_raw_entry(
+		git_oid *id,
+		git_off_t *size,
+		uint32_t *crc,
+		struct git_pack_file *p,
+		git_off_t offset);
+
 #endif
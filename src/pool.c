@@ -51,6 +51,30 @@ void git_pool_clear(git_pool *pool)
 	pool->pages = NULL;
 }
 
+int git_pool_merge(git_pool *into, git_pool *from)
+{
+	git_pool_page *last;
+
+	assert(into && from && into->item_size == from->item_size);
+
+	if (!from->pages)
+		return 0;
+
+	for (last = from->pages; last->next != NULL; last = last->next)
+		/* find the last page */;
+
+	/* keep allocating from the current page of `into` */
+	if (into->pages) {
+		last->next = into->pages->next;
+		into->pages->next = from->pages;
+	} else {
+		into->pages = from->pages;
+	}
+
+	from->pages = NULL;
+	return 0;
+}
+
 static void *pool_alloc_page(git_pool *pool, uint32_t size)
 {
 	git_pool_page *page;
@@ -133,6 +157,24 @@ void git_pool_clear(git_pool *pool)
 	git_vector_free_deep(&pool->allocations);
 }
 
+int git_pool_merge(git_pool *into, git_pool *from)
+{
+	void *ptr;
+	size_t i;
+
+	assert(into && from && into->item_size == from->item_size);
+
+	git_vector_foreach(&from->allocations, i, ptr) {
+		if (git_vector_insert_sorted(&into->allocations, ptr, NULL) < 0)
+			return -1;
+
+		from->allocations.contents[i] = NULL;
+	}
+
+	git_vector_clear(&from->allocations);
+	return 0;
+}
+
 static void *pool_alloc(git_pool *pool, uint32_t size) {
 	void *ptr = NULL;
 	if((ptr = git__malloc(size)) == NULL) {
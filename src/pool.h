@@ -87,6 +87,12 @@ extern void git_pool_clear(git_pool *pool);
  */
 extern void git_pool_swap(git_pool *a, git_pool *b);
 
+/**
+ * Move all the items of the pool `from` into the pool `into`, leaving
+ * `from` empty.  The pools must have the same item size.
+ */
+extern int git_pool_merge(git_pool *into, git_pool *from);
+
 /**
  * Allocate space for one or more items from a pool.
  */
@@ -862,6 +862,27 @@ static void free_refspecs(git_vector *vec)
 	git_vector_clear(vec);
 }
 
+/*
+ * Protocol v2 servers only list the refs we ask for, so the transport
+ * needs to see the refspecs passed for this fetch when it connects.
+ */
+static int set_requested_refspecs(git_remote *remote, const git_strarray *refspecs)
+{
+	size_t i;
+
+	if (!refspecs || !refspecs->count)
+		return 0;
+
+	free_refspecs(&remote->active_refspecs);
+
+	for (i = 0; i < refspecs->count; i++) {
+		if (add_refspec_to(&remote->active_refspecs, refspecs->strings[i], true) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 static int remote_head_cmp(const void *_a, const void *_b)
 {
 	const git_remote_head *a = (git_remote_head *) _a;
@@ -900,13 +921,15 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 	assert(remote);
 
 	if (opts) {
+		GITERR_CHECK_VERSION(opts, GIT_FETCH_OPTIONS_VERSION, "git_fetch_options");
 		GITERR_CHECK_VERSION(&opts->callbacks, GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
 		cbs = &opts->callbacks;
 		custom_headers = &opts->custom_headers;
 	}
 
 	if (!git_remote_connected(remote) &&
-	    (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) < 0)
+	    ((error = set_requested_refspecs(remote, refspecs)) < 0 ||
+	     (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) < 0))
 		goto on_error;
 
 	if (ls_to_vector(&refs, remote) < 0)
@@ -973,6 +996,7 @@ int git_remote_fetch(
 	const git_strarray *custom_headers = NULL;
 
 	if (opts) {
+		GITERR_CHECK_VERSION(opts, GIT_FETCH_OPTIONS_VERSION, "git_fetch_options");
 		GITERR_CHECK_VERSION(&opts->callbacks, GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
 		cbs = &opts->callbacks;
 		custom_headers = &opts->custom_headers;
@@ -981,7 +1005,8 @@ int git_remote_fetch(
 	}
 
 	/* Connect and download everything */
-	if ((error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) != 0)
+	if ((error = set_requested_refspecs(remote, refspecs)) < 0 ||
+	    (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) != 0)
 		return error;
 
 	error = git_remote_download(remote, refspecs, opts);
@@ -1659,6 +1684,9 @@ void git_remote_free(git_remote *remote)
 	git_vector_free(&remote->passive_refspecs);
 
 	git_push_free(remote->push);
+	git_strarray_free(&remote->shallow_exclude);
+	git_array_clear(remote->shallow_ids);
+	git_array_clear(remote->unshallow_ids);
 	git__free(remote->url);
 	git__free(remote->pushurl);
 	git__free(remote->name);
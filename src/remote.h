@@ -11,6 +11,7 @@
 #include "git2/transport.h"
 #include "git2/sys/transport.h"
 
+#include "oidarray.h"
 #include "refspec.h"
 #include "vector.h"
 
@@ -30,8 +31,18 @@ struct git_remote {
 	git_transfer_progress stats;
 	unsigned int need_pack;
 	git_remote_autotag_option_t download_tags;
+	git_fetch_negotiation_t negotiation;
 	int prune_refs;
 	int passed_refspecs;
+
+	/* how the current fetch moves the shallow boundary, see git_fetch_options */
+	int depth;
+	git_time_t shallow_since;
+	git_strarray shallow_exclude;
+
+	/* the boundary commits which the server told us to add and to remove */
+	git_array_oid_t shallow_ids;
+	git_array_oid_t unshallow_ids;
 };
 
 const char* git_remote__urlfordirection(struct git_remote *remote, int direction);
@@ -40,4 +51,11 @@ int git_remote__get_http_proxy(git_remote *remote, bool use_ssl, char **proxy_ur
 git_refspec *git_remote__matching_refspec(git_remote *remote, const char *refname);
 git_refspec *git_remote__matching_dst_refspec(git_remote *remote, const char *refname);
 
+/* Whether the current fetch asks the server to move the shallow boundary */
+GIT_INLINE(bool) git_remote__deepening(const git_remote *remote)
+{
+	return remote->depth > 0 || remote->shallow_since ||
+		remote->shallow_exclude.count > 0;
+}
+
 #endif
@@ -9,6 +9,7 @@
 #include "git2/object.h"
 #include "git2/refdb.h"
 #include "git2/sys/repository.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "common.h"
 #include "repository.h"
@@ -27,6 +28,7 @@
 #include "merge.h"
 #include "diff_driver.h"
 #include "annotated_commit.h"
+#include "shallow.h"
 
 #ifdef GIT_WIN32
 # include "win32/w32_util.h"
@@ -132,6 +134,14 @@ void git_repository_free(git_repository *repo)
 	git_diff_driver_registry_free(repo->diff_drivers);
 	repo->diff_drivers = NULL;
 
+	if (repo->_fsmonitor && repo->_fsmonitor->free)
+		repo->_fsmonitor->free(repo->_fsmonitor);
+	repo->_fsmonitor = NULL;
+
+	git_shallow_free(repo->_shallow);
+	repo->_shallow = NULL;
+	git_mutex_free(&repo->shallow_lock);
+
 	for (i = 0; i < repo->reserved_names.size; i++)
 		git_buf_free(git_array_get(repo->reserved_names, i));
 	git_array_clear(repo->reserved_names);
@@ -176,6 +186,11 @@ static git_repository *repository_alloc(void)
 		git_cache_init(&repo->objects) < 0)
 		goto on_error;
 
+	if (git_mutex_init(&repo->shallow_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize the shallow lock");
+		goto on_error;
+	}
+
 	git_array_init_to_size(repo->reserved_names, 4);
 	if (!repo->reserved_names.ptr)
 		goto on_error;
@@ -121,6 +121,9 @@ struct git_repository {
 	git_refdb *_refdb;
 	git_config *_config;
 	git_index *_index;
+	git_fsmonitor *_fsmonitor;
+	struct git_shallow *_shallow;
+	git_mutex shallow_lock; /* protects _shallow */
 
 	git_cache objects;
 	git_attr_cache *attrcache;
@@ -392,6 +392,140 @@ static int revwalk_next_toposort(git_commit_list_node **object_out, git_revwalk
 	}
 }
 
+/*
+ * Topological sorting with generation numbers
+ *
+ * A commit can be emitted once all of its children have been emitted.
+ * Instead of counting the children of every commit in the history up
+ * front, the in-degrees are counted lazily: since the generation of a
+ * commit is larger than those of its parents, once every commit at or
+ * above a given generation has been explored, the in-degree of any
+ * commit at that generation is final.
+ */
+static int toposort_enqueue(git_revwalk *walk, git_commit_list_node *commit)
+{
+	if (walk->sorting & GIT_SORT_TIME)
+		return git_pqueue_insert(&walk->iterator_time, commit);
+
+	return git_commit_list_insert(commit, &walk->iterator_topo) ? 0 : -1;
+}
+
+static git_commit_list_node *toposort_dequeue(git_revwalk *walk)
+{
+	if (walk->sorting & GIT_SORT_TIME)
+		return git_pqueue_pop(&walk->iterator_time);
+
+	return git_commit_list_pop(&walk->iterator_topo);
+}
+
+static int explore_to_generation(git_revwalk *walk, uint32_t generation)
+{
+	git_commit_list_node *commit;
+	unsigned short i, max;
+	int error;
+
+	while ((commit = git_pqueue_get(&walk->iterator_explore, 0)) != NULL &&
+		git_commit_list_generation(commit) >= generation) {
+		git_pqueue_pop(&walk->iterator_explore);
+
+		max = commit->out_degree;
+		if (walk->first_parent && commit->out_degree)
+			max = 1;
+
+		for (i = 0; i < max; ++i) {
+			git_commit_list_node *parent = commit->parents[i];
+
+			if ((error = git_commit_list_parse(walk, parent)) < 0)
+				return error;
+
+			parent->in_degree++;
+
+			if (parent->seen)
+				continue;
+
+			parent->seen = 1;
+			if ((error = git_pqueue_insert(&walk->iterator_explore, parent)) < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+static int revwalk_next_toposort_generation(git_commit_list_node **object_out, git_revwalk *walk)
+{
+	git_commit_list_node *next;
+	unsigned short i, max;
+	int error;
+
+	if ((next = toposort_dequeue(walk)) == NULL) {
+		giterr_clear();
+		return GIT_ITEROVER;
+	}
+
+	max = next->out_degree;
+	if (walk->first_parent && next->out_degree)
+		max = 1;
+
+	for (i = 0; i < max; ++i) {
+		git_commit_list_node *parent = next->parents[i];
+
+		if ((error = explore_to_generation(walk,
+				git_commit_list_generation(parent))) < 0)
+			return error;
+
+		if (--parent->in_degree == 0 &&
+			(error = toposort_enqueue(walk, parent)) < 0)
+			return error;
+	}
+
+	*object_out = next;
+	return 0;
+}
+
+static int prepare_toposort_generation(git_revwalk *walk)
+{
+	git_commit_list *list;
+	git_commit_list_node *commit;
+	uint32_t min_generation = GENERATION_INFINITY;
+	int error;
+
+	for (list = walk->user_input; list; list = list->next) {
+		commit = list->item;
+
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
+			return error;
+
+		if (commit->seen)
+			continue;
+
+		commit->seen = 1;
+		if ((error = git_pqueue_insert(&walk->iterator_explore, commit)) < 0)
+			return error;
+
+		if (git_commit_list_generation(commit) < min_generation)
+			min_generation = git_commit_list_generation(commit);
+	}
+
+	if ((error = explore_to_generation(walk, min_generation)) < 0)
+		return error;
+
+	/* `topo_delay` marks the tips that have already been queued */
+	for (list = walk->user_input; list; list = list->next) {
+		commit = list->item;
+
+		if (commit->in_degree > 0 || commit->topo_delay)
+			continue;
+
+		commit->topo_delay = 1;
+		if ((error = toposort_enqueue(walk, commit)) < 0)
+			return error;
+	}
+
+	walk->get_next = &revwalk_next_toposort_generation;
+	return 0;
+}
+
 static int revwalk_next_reverse(git_commit_list_node **object_out, git_revwalk *walk)
 {
 	*object_out = git_commit_list_pop(&walk->iterator_reverse);
@@ -484,6 +618,18 @@ static int prepare_walk(git_revwalk *walk)
 	if (walk->did_hide && (error = premark_uninteresting(walk)) < 0)
 		return error;
 
+	/*
+	 * With generation numbers available and nothing to hide, the
+	 * topological sort doesn't need to walk the whole history first.
+	 */
+	if ((walk->sorting & GIT_SORT_TOPOLOGICAL) &&
+		walk->cgraph && !walk->did_hide && !walk->hide_cb) {
+		if ((error = prepare_toposort_generation(walk)) < 0)
+			return error;
+
+		goto prepare_reverse;
+	}
+
 	for (list = walk->user_input; list; list = list->next) {
 		if (process_commit(walk, list->item, list->item->uninteresting) < 0)
 			return -1;
@@ -509,6 +655,7 @@ static int prepare_walk(git_revwalk *walk)
 		walk->get_next = &revwalk_next_toposort;
 	}
 
+prepare_reverse:
 	if (walk->sorting & GIT_SORT_REVERSE) {
 
 		while ((error = walk->get_next(&next, walk)) == 0)
@@ -534,7 +681,8 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 	walk->commits = git_oidmap_alloc();
 	GITERR_CHECK_ALLOC(walk->commits);
 
-	if (git_pqueue_init(&walk->iterator_time, 0, 8, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&walk->iterator_time, 0, 8, git_commit_list_time_cmp) < 0 ||
+		git_pqueue_init(&walk->iterator_explore, 0, 8, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	git_pool_init(&walk->commit_pool, COMMIT_ALLOC);
@@ -543,7 +691,16 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 
 	walk->repo = repo;
 
-	if (git_repository_odb(&walk->odb, repo) < 0) {
+	if (git_repository_odb(&walk->odb, repo) < 0 ||
+		git_shallow__refresh(repo) < 0 ||
+		/* the boundary of a shallow repository stays the same for the walk */
+		git_shallow__get(&walk->shallow, repo) < 0 ||
+		/*
+		 * As in git, the commit-graph isn't used in a shallow repository:
+		 * its parents and generations don't know about the boundary.
+		 */
+		(!git_array_size(walk->shallow->roots) &&
+		 git_odb__get_commit_graph_file(&walk->cgraph, walk->odb) < 0)) {
 		git_revwalk_free(walk);
 		return -1;
 	}
@@ -558,11 +715,14 @@ void git_revwalk_free(git_revwalk *walk)
 		return;
 
 	git_revwalk_reset(walk);
+	git_commit_graph_file_free(walk->cgraph);
+	git_shallow_free(walk->shallow);
 	git_odb_free(walk->odb);
 
 	git_oidmap_free(walk->commits);
 	git_pool_clear(&walk->commit_pool);
 	git_pqueue_free(&walk->iterator_time);
+	git_pqueue_free(&walk->iterator_explore);
 	git__free(walk);
 }
 
@@ -636,6 +796,7 @@ void git_revwalk_reset(git_revwalk *walk)
 		});
 
 	git_pqueue_clear(&walk->iterator_time);
+	git_pqueue_clear(&walk->iterator_explore);
 	git_commit_list_free(&walk->iterator_topo);
 	git_commit_list_free(&walk->iterator_rand);
 	git_commit_list_free(&walk->iterator_reverse);
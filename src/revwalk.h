@@ -13,12 +13,16 @@
 #include "pqueue.h"
 #include "pool.h"
 #include "vector.h"
+#include "commit_graph.h"
+#include "shallow.h"
 
 #include "oidmap.h"
 
 struct git_revwalk {
 	git_repository *repo;
 	git_odb *odb;
+	git_commit_graph_file *cgraph;
+	git_shallow *shallow;
 
 	git_oidmap *commits;
 	git_pool commit_pool;
@@ -27,6 +31,7 @@ struct git_revwalk {
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
 	git_pqueue iterator_time;
+	git_pqueue iterator_explore;
 
 	int (*get_next)(git_commit_list_node **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, git_commit_list_node *);
@@ -15,6 +15,8 @@
 #include "cache.h"
 #include "global.h"
 #include "object.h"
+#include "index.h"
+#include "stream_pool.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
 {
@@ -137,6 +139,14 @@ int git_libgit2_opts(int key, ...)
 		git_cache__max_storage = va_arg(ap, ssize_t);
 		break;
 
+	case GIT_OPT_SET_CACHE_TYPE_MAX_SIZE:
+		{
+			git_otype type = (git_otype)va_arg(ap, int);
+			ssize_t size = va_arg(ap, ssize_t);
+			error = git_cache_set_max_type_storage(type, size);
+			break;
+		}
+
 	case GIT_OPT_ENABLE_CACHING:
 		git_cache__enabled = (va_arg(ap, int) != 0);
 		break;
@@ -146,6 +156,29 @@ int git_libgit2_opts(int key, ...)
 		*(va_arg(ap, ssize_t *)) = git_cache__max_storage;
 		break;
 
+	case GIT_OPT_GET_CACHE_SHARDS:
+		*(va_arg(ap, size_t *)) = GIT_CACHE_SHARDS;
+		break;
+
+	case GIT_OPT_GET_CACHE_SHARD_STATS:
+		{
+			size_t shard = va_arg(ap, size_t);
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			error = git_cache_shard_stats(hits, misses, evictions, shard);
+			break;
+		}
+
+	case GIT_OPT_GET_CACHED_TYPE_MEMORY:
+		{
+			git_otype type = (git_otype)va_arg(ap, int);
+			ssize_t *current = va_arg(ap, ssize_t *);
+			ssize_t *allowed = va_arg(ap, ssize_t *);
+			error = git_cache_type_storage(current, allowed, type);
+			break;
+		}
+
 	case GIT_OPT_GET_TEMPLATE_PATH:
 		{
 			git_buf *out = va_arg(ap, git_buf *);
@@ -193,6 +226,26 @@ int git_libgit2_opts(int key, ...)
 		git_object__strict_input_validation = (va_arg(ap, int) != 0);
 		break;
 
+	case GIT_OPT_ENABLE_LAZY_INDEX_LOOKUP:
+		git_index__lazy_map = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_CONNECTION_POOL:
+		{
+			size_t max_idle = va_arg(ap, size_t);
+			int idle_timeout = va_arg(ap, int);
+			error = git_stream_pool_set_limits(max_idle, idle_timeout);
+			break;
+		}
+
+	case GIT_OPT_GET_CONNECTION_POOL_STATS:
+		{
+			size_t *idle = va_arg(ap, size_t *);
+			size_t *reused = va_arg(ap, size_t *);
+			git_stream_pool_stats(idle, reused);
+			break;
+		}
+
 	case GIT_OPT_SET_SSL_CIPHERS:
 #ifdef GIT_OPENSSL
 		{
@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "shallow.h"
+
+#include "filebuf.h"
+#include "oid.h"
+#include "repository.h"
+
+static int oid_cmp(const void *a, const void *b)
+{
+	return git_oid__cmp(a, b);
+}
+
+static int oid_sort_cmp(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid__cmp(a, b);
+}
+
+static int shallow_path(git_buf *out, git_repository *repo)
+{
+	return git_buf_joinpath(out, repo->path_repository, GIT_SHALLOW_FILE);
+}
+
+static int shallow_lock(git_repository *repo)
+{
+	if (git_mutex_lock(&repo->shallow_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock the shallow roots");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int shallow_add(git_shallow *shallow, const git_oid *id)
+{
+	git_oid *root = git_array_alloc(shallow->roots);
+	GITERR_CHECK_ALLOC(root);
+
+	git_oid_cpy(root, id);
+	return 0;
+}
+
+static void shallow_sort(git_shallow *shallow)
+{
+	git_oid *roots = shallow->roots.ptr;
+	size_t i, len = 0;
+
+	git__qsort_r(roots, git_array_size(shallow->roots), sizeof(git_oid),
+		oid_sort_cmp, NULL);
+
+	for (i = 0; i < git_array_size(shallow->roots); i++) {
+		if (!len || git_oid__cmp(&roots[len - 1], &roots[i]))
+			git_oid_cpy(&roots[len++], &roots[i]);
+	}
+
+	shallow->roots.size = len;
+}
+
+static int shallow_parse(git_shallow *shallow, const char *path, git_buf *contents)
+{
+	const char *line = contents->ptr, *end = line + contents->size;
+	git_oid id;
+
+	while (line < end) {
+		const char *eol = memchr(line, '\n', end - line);
+		size_t len = (eol ? eol : end) - line;
+
+		if (len != GIT_OID_HEXSZ || git_oid_fromstrn(&id, line, len) < 0) {
+			giterr_set(GITERR_REPOSITORY, "invalid shallow file '%s'", path);
+			return -1;
+		}
+
+		if (shallow_add(shallow, &id) < 0)
+			return -1;
+
+		line += len + 1;
+	}
+
+	shallow_sort(shallow);
+	return 0;
+}
+
+static int shallow_load(git_shallow **out, git_repository *repo)
+{
+	git_shallow *shallow;
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	int error = 0;
+
+	*out = NULL;
+
+	shallow = git__calloc(1, sizeof(git_shallow));
+	GITERR_CHECK_ALLOC(shallow);
+	GIT_REFCOUNT_INC(shallow);
+
+	/* a repository without a directory, as from git_repository_new() */
+	if (!repo->path_repository)
+		goto done;
+
+	if ((error = shallow_path(&path, repo)) < 0) {
+		git_shallow_free(shallow);
+		return error;
+	}
+
+	if (git_futils_filestamp_check(&shallow->stamp, path.ptr) == GIT_ENOTFOUND)
+		goto done;
+
+	if ((error = git_futils_readbuffer(&contents, path.ptr)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+		goto done;
+	}
+
+	if (error < 0 || (error = shallow_parse(shallow, path.ptr, &contents)) < 0) {
+		git_shallow_free(shallow);
+		shallow = NULL;
+	}
+
+done:
+	git_buf_free(&contents);
+	git_buf_free(&path);
+
+	*out = shallow;
+	return error;
+}
+
+/* Put the list in the repository; takes over the reference to it */
+static int set_shallow(git_repository *repo, git_shallow *shallow)
+{
+	git_shallow *old;
+
+	if (shallow_lock(repo) < 0) {
+		git_shallow_free(shallow);
+		return -1;
+	}
+
+	old = repo->_shallow;
+	repo->_shallow = shallow;
+	git_mutex_unlock(&repo->shallow_lock);
+
+	/* whoever still holds the old list keeps it alive */
+	git_shallow_free(old);
+	return 0;
+}
+
+int git_shallow__get(git_shallow **out, git_repository *repo)
+{
+	git_shallow *loaded = NULL;
+	int error;
+
+	assert(out && repo);
+
+	if (shallow_lock(repo) < 0)
+		return -1;
+
+	if ((*out = repo->_shallow) != NULL)
+		GIT_REFCOUNT_INC(*out);
+
+	git_mutex_unlock(&repo->shallow_lock);
+
+	if (*out)
+		return 0;
+
+	if ((error = shallow_load(&loaded, repo)) < 0)
+		return error;
+
+	if (shallow_lock(repo) < 0) {
+		git_shallow_free(loaded);
+		return -1;
+	}
+
+	if (repo->_shallow == NULL) {
+		repo->_shallow = loaded;
+		loaded = NULL;
+	}
+
+	*out = repo->_shallow;
+	GIT_REFCOUNT_INC(*out);
+	git_mutex_unlock(&repo->shallow_lock);
+
+	/* another thread put its list in first */
+	git_shallow_free(loaded);
+	return 0;
+}
+
+int git_shallow__is_root(bool *out, git_repository *repo, const git_oid *id)
+{
+	git_shallow *shallow;
+	int error;
+
+	if ((error = git_shallow__get(&shallow, repo)) < 0)
+		return error;
+
+	*out = git_shallow__contains(shallow, id);
+	git_shallow_free(shallow);
+	return 0;
+}
+
+int git_shallow__refresh(git_repository *repo)
+{
+	git_shallow *shallow;
+	git_futils_filestamp stamp;
+	git_buf path = GIT_BUF_INIT;
+	bool unchanged;
+	int error;
+
+	if (!repo->path_repository)
+		return 0;
+
+	if ((error = git_shallow__get(&shallow, repo)) < 0)
+		return error;
+
+	if ((error = shallow_path(&path, repo)) < 0) {
+		git_shallow_free(shallow);
+		return error;
+	}
+
+	git_futils_filestamp_set(&stamp, &shallow->stamp);
+	error = git_futils_filestamp_check(&stamp, path.ptr);
+
+	/* unchanged, or still missing */
+	unchanged = !error || (error == GIT_ENOTFOUND && !git_array_size(shallow->roots));
+
+	git_shallow_free(shallow);
+	git_buf_free(&path);
+
+	if (unchanged)
+		return 0;
+
+	if ((error = shallow_load(&shallow, repo)) < 0)
+		return error;
+
+	return set_shallow(repo, shallow);
+}
+
+bool git_shallow__contains(const git_shallow *shallow, const git_oid *id)
+{
+	if (!shallow || !git_array_size(shallow->roots))
+		return false;
+
+	return git_array_search(NULL, shallow->roots, oid_cmp, id) == 0;
+}
+
+static int shallow_write(git_repository *repo, const git_shallow *shallow)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	size_t i;
+	int error;
+
+	if ((error = shallow_path(&path, repo)) < 0)
+		return error;
+
+	if (!git_array_size(shallow->roots)) {
+		if ((error = p_unlink(path.ptr)) < 0 && errno == ENOENT)
+			error = 0;
+		else if (error < 0)
+			giterr_set(GITERR_OS, "failed to remove '%s'", path.ptr);
+
+		goto done;
+	}
+
+	if ((error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_FORCE, GIT_SHALLOW_FILE_MODE)) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(shallow->roots); i++) {
+		git_oid_tostr(hex, sizeof(hex), git_array_get(shallow->roots, i));
+
+		if ((error = git_filebuf_printf(&file, "%s\n", hex)) < 0)
+			break;
+	}
+
+	if (error < 0)
+		git_filebuf_cleanup(&file);
+	else
+		error = git_filebuf_commit(&file);
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static bool array_contains(const git_array_oid_t *ids, const git_oid *id)
+{
+	size_t i;
+
+	for (i = 0; i < git_array_size(*ids); i++) {
+		if (git_oid_equal(git_array_get(*ids, i), id))
+			return true;
+	}
+
+	return false;
+}
+
+int git_shallow__update(
+	git_repository *repo,
+	const git_array_oid_t *shallow_ids,
+	const git_array_oid_t *unshallow_ids)
+{
+	git_shallow *current, *shallow;
+	const git_oid *id;
+	size_t i;
+	int error;
+
+	if (!git_array_size(*shallow_ids) && !git_array_size(*unshallow_ids))
+		return 0;
+
+	if ((error = git_shallow__refresh(repo)) < 0 ||
+	    (error = git_shallow__get(&current, repo)) < 0)
+		return error;
+
+	if ((shallow = git__calloc(1, sizeof(git_shallow))) == NULL) {
+		git_shallow_free(current);
+		return -1;
+	}
+
+	GIT_REFCOUNT_INC(shallow);
+
+	for (i = 0; i < git_array_size(current->roots); i++) {
+		id = git_array_get(current->roots, i);
+
+		if (array_contains(unshallow_ids, id))
+			continue;
+
+		if ((error = shallow_add(shallow, id)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < git_array_size(*shallow_ids); i++) {
+		id = git_array_get(*shallow_ids, i);
+
+		if (!array_contains(unshallow_ids, id) &&
+		    (error = shallow_add(shallow, id)) < 0)
+			goto done;
+	}
+
+	shallow_sort(shallow);
+
+	if ((error = shallow_write(repo, shallow)) < 0)
+		goto done;
+
+	/* the commits we have already parsed may have lost or gained parents */
+	git_cache_clear(&repo->objects);
+
+	/* read it back, for the new stamp */
+	git_shallow_free(shallow);
+	git_shallow_free(current);
+
+	if ((error = shallow_load(&shallow, repo)) < 0)
+		return error;
+
+	return set_shallow(repo, shallow);
+
+done:
+	git_shallow_free(shallow);
+	git_shallow_free(current);
+	return error;
+}
+
+static void shallow_free(git_shallow *shallow)
+{
+	git_array_clear(shallow->roots);
+	git__free(shallow);
+}
+
+void git_shallow_free(git_shallow *shallow)
+{
+	if (shallow == NULL)
+		return;
+
+	GIT_REFCOUNT_DEC(shallow, shallow_free);
+}
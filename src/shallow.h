@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_shallow_h__
+#define INCLUDE_shallow_h__
+
+#include "common.h"
+#include "fileops.h"
+#include "oidarray.h"
+#include "util.h"
+
+#define GIT_SHALLOW_FILE "shallow"
+#define GIT_SHALLOW_FILE_MODE 0666
+
+/**
+ * The commits at the boundary of a shallow repository, as listed in
+ * `.git/shallow`: their parents were not fetched, so history walks
+ * treat them as root commits.
+ *
+ * A loaded list is never changed; `git_shallow__refresh` and
+ * `git_shallow__update` put a new one in the repository, under the
+ * repository's `shallow_lock`, and whoever holds a reference to the old
+ * one can go on using it from any thread.
+ */
+typedef struct git_shallow {
+	git_refcount rc;
+	git_futils_filestamp stamp;
+	git_array_oid_t roots; /* sorted */
+} git_shallow;
+
+/**
+ * A reference to the shallow roots of the repository as they were last
+ * read, reading them the first time; release it with `git_shallow_free`.
+ * The list is empty when the repository is not shallow.
+ */
+extern int git_shallow__get(git_shallow **out, git_repository *repo);
+
+/** Whether the commit is at the boundary of the repository's current list */
+extern int git_shallow__is_root(bool *out, git_repository *repo, const git_oid *id);
+
+/** Read `.git/shallow` again if it changed since it was last read */
+extern int git_shallow__refresh(git_repository *repo);
+
+/** Whether the commit is at the boundary; `shallow` may be NULL */
+extern bool git_shallow__contains(const git_shallow *shallow, const git_oid *id);
+
+/**
+ * Add the `shallow` commits to the boundary and remove the `unshallow`
+ * ones, as a server tells us to when we fetch, and write `.git/shallow`
+ * (or remove it when no boundary is left).
+ */
+extern int git_shallow__update(
+	git_repository *repo,
+	const git_array_oid_t *shallow_ids,
+	const git_array_oid_t *unshallow_ids);
+
+extern void git_shallow_free(git_shallow *shallow);
+
+#endif
@@ -192,13 +192,20 @@ int git_signature_default(git_signature **out, git_repository *repo)
 	return error;
 }
 
-int git_signature__parse(git_signature *sig, const char **buffer_out,
-		const char *buffer_end, const char *header, char ender)
+/*
+ * Find the parts of a signature line and parse its time, without
+ * copying the name and e-mail out of the buffer.
+ */
+static int signature_parse(
+	const char **name_out, const char **email_start_out,
+	const char **email_end_out, git_time *when,
+	const char **buffer_out, const char *buffer_end,
+	const char *header, char ender)
 {
 	const char *buffer = *buffer_out;
 	const char *email_start, *email_end;
 
-	memset(sig, 0, sizeof(git_signature));
+	memset(when, 0, sizeof(git_time));
 
 	if ((buffer_end = memchr(buffer, ender, buffer_end - buffer)) == NULL)
 		return signature_error("no newline given");
@@ -218,16 +225,16 @@ int git_signature__parse(git_signature *sig, const char **buffer_out,
 	if (!email_start || !email_end || email_end <= email_start)
 		return signature_error("malformed e-mail");
 
-	email_start += 1;
-	sig->name = extract_trimmed(buffer, email_start - buffer - 1);
-	sig->email = extract_trimmed(email_start, email_end - email_start);
+	*name_out = buffer;
+	*email_start_out = email_start + 1;
+	*email_end_out = email_end;
 
 	/* Do we even have a time at the end of the signature? */
 	if (email_end + 2 < buffer_end) {
 		const char *time_start = email_end + 2;
 		const char *time_end;
 
-		if (git__strtol64(&sig->when.time, time_start, &time_end, 10) < 0)
+		if (git__strtol64(&when->time, time_start, &time_end, 10) < 0)
 			return signature_error("invalid Unix timestamp");
 
 		/* do we have a timezone? */
@@ -251,9 +258,9 @@ int git_signature__parse(git_signature *sig, const char **buffer_out,
 			 * see http://www.worldtimezone.com/faq.html
 			 */
 			if (hours < 14 && mins < 59) {
-				sig->when.offset = (hours * 60) + mins;
+				when->offset = (hours * 60) + mins;
 				if (tz_start[0] == '-')
-					sig->when.offset = -sig->when.offset;
+					when->offset = -when->offset;
 			}
 		}
 	}
@@ -262,6 +269,32 @@ int git_signature__parse(git_signature *sig, const char **buffer_out,
 	return 0;
 }
 
+int git_signature__parse(git_signature *sig, const char **buffer_out,
+		const char *buffer_end, const char *header, char ender)
+{
+	const char *name, *email_start, *email_end;
+
+	memset(sig, 0, sizeof(git_signature));
+
+	if (signature_parse(&name, &email_start, &email_end, &sig->when,
+			buffer_out, buffer_end, header, ender) < 0)
+		return -1;
+
+	sig->name = extract_trimmed(name, email_start - name - 1);
+	sig->email = extract_trimmed(email_start, email_end - email_start);
+
+	return 0;
+}
+
+int git_signature__parse_time(git_time *when, const char **buffer_out,
+		const char *buffer_end, const char *header, char ender)
+{
+	const char *name, *email_start, *email_end;
+
+	return signature_parse(&name, &email_start, &email_end, when,
+		buffer_out, buffer_end, header, ender);
+}
+
 void git_signature__writebuf(git_buf *buf, const char *header, const git_signature *sig)
 {
 	int offset, hours, mins;
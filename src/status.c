@@ -323,6 +323,8 @@ int git_status_list_new(
 		diffopt.flags = diffopt.flags | GIT_DIFF_INCLUDE_UNREADABLE;
 	if ((flags & GIT_STATUS_OPT_INCLUDE_UNREADABLE_AS_UNTRACKED) != 0)
 		diffopt.flags = diffopt.flags | GIT_DIFF_INCLUDE_UNREADABLE_AS_UNTRACKED;
+	if ((flags & GIT_STATUS_OPT_PARALLEL_WORKDIR_SCAN) != 0)
+		diffopt.flags = diffopt.flags | GIT_DIFF_PARALLEL_WORKDIR_SCAN;
 
 	if ((flags & GIT_STATUS_OPT_RENAMES_FROM_REWRITES) != 0)
 		findopt.flags = findopt.flags |
@@ -13,6 +13,7 @@
 
 #include "git2/transport.h"
 
+#include "buffer.h"
 #include "socket_stream.h"
 #include "curl_stream.h"
 
@@ -230,6 +231,21 @@ void stransport_free(git_stream *stream)
 	git__free(st);
 }
 
+/* Secure Transport resumes the session of the last connection with the same peer id */
+static OSStatus set_peer_id(SSLContextRef ctx, const char *host, const char *port)
+{
+	git_buf peer = GIT_BUF_INIT;
+	OSStatus ret;
+
+	if (git_buf_printf(&peer, "%s:%s", host, port) < 0)
+		return errSecAllocate;
+
+	ret = SSLSetPeerID(ctx, peer.ptr, peer.size);
+	git_buf_free(&peer);
+
+	return ret;
+}
+
 int git_stransport_stream_new(git_stream **out, const char *host, const char *port)
 {
 	stransport_stream *st;
@@ -263,7 +279,8 @@ int git_stransport_stream_new(git_stream **out, const char *host, const char *po
 	    (ret = SSLSetSessionOption(st->ctx, kSSLSessionOptionBreakOnServerAuth, true)) != noErr ||
 	    (ret = SSLSetProtocolVersionMin(st->ctx, kTLSProtocol1)) != noErr ||
 	    (ret = SSLSetProtocolVersionMax(st->ctx, kTLSProtocol12)) != noErr ||
-	    (ret = SSLSetPeerDomainName(st->ctx, host, strlen(host))) != noErr) {
+	    (ret = SSLSetPeerDomainName(st->ctx, host, strlen(host))) != noErr ||
+	    (ret = set_peer_id(st->ctx, host, port)) != noErr) {
 		git_stream_free((git_stream *)st);
 		return stransport_error(ret);
 	}
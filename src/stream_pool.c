@@ -0,0 +1,254 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "stream_pool.h"
+
+#include "buffer.h"
+#include "global.h"
+#include "stream.h"
+#include "vector.h"
+
+typedef struct {
+	char *key;
+	git_stream *stream;
+	double idle_since;
+} pooled_stream;
+
+static git_mutex pool_lock;
+
+/* The idle connections, from the one which was put back first */
+static git_vector pool = GIT_VECTOR_INIT;
+
+static size_t pool_max_idle;
+static int pool_idle_timeout = 15;
+static size_t pool_reused;
+
+static void pooled_stream_free(pooled_stream *pooled)
+{
+	git_stream_close(pooled->stream);
+	git_stream_free(pooled->stream);
+	git__free(pooled->key);
+	git__free(pooled);
+}
+
+static void free_expired(git_vector *expired)
+{
+	pooled_stream *pooled;
+	size_t i;
+
+	git_vector_foreach(expired, i, pooled)
+		pooled_stream_free(pooled);
+
+	git_vector_free(expired);
+}
+
+/*
+ * Move the connections which have been idle for too long, and the
+ * oldest ones above `max_idle`, out of the pool.  The caller closes them
+ * once the lock is released.
+ */
+static void expire(git_vector *expired, size_t max_idle, double now)
+{
+	pooled_stream *pooled;
+	size_t i, keep = 0;
+
+	git_vector_foreach(&pool, i, pooled) {
+		bool over = pool.length - i > max_idle ||
+			now - pooled->idle_since > pool_idle_timeout;
+
+		/* without the memory to close it later, keep it for now */
+		if (!over || git_vector_insert(expired, pooled) < 0)
+			pool.contents[keep++] = pooled;
+	}
+
+	pool.length = keep;
+}
+
+static int pool_key(
+	git_buf *out,
+	const char *scheme,
+	const char *host,
+	const char *port,
+	const char *proxy)
+{
+	git_buf_printf(out, "%s://%s:%s", scheme, host, port);
+
+	if (proxy)
+		git_buf_printf(out, " via %s", proxy);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+int git_stream_pool_take(
+	git_stream **out,
+	const char *scheme,
+	const char *host,
+	const char *port,
+	const char *proxy)
+{
+	git_vector expired = GIT_VECTOR_INIT;
+	git_buf key = GIT_BUF_INIT;
+	pooled_stream *pooled = NULL;
+	size_t i;
+
+	*out = NULL;
+
+	if (pool_key(&key, scheme, host, port, proxy) < 0)
+		return -1;
+
+	if (git_mutex_lock(&pool_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock the connection pool");
+		git_buf_free(&key);
+		return -1;
+	}
+
+	expire(&expired, pool_max_idle, git__timer());
+
+	for (i = pool.length; i > 0; i--) {
+		pooled = git_vector_get(&pool, i - 1);
+
+		if (!strcmp(pooled->key, key.ptr)) {
+			git_vector_remove(&pool, i - 1);
+			pool_reused++;
+			break;
+		}
+
+		pooled = NULL;
+	}
+
+	git_mutex_unlock(&pool_lock);
+
+	free_expired(&expired);
+	git_buf_free(&key);
+
+	if (!pooled)
+		return GIT_ENOTFOUND;
+
+	*out = pooled->stream;
+	git__free(pooled->key);
+	git__free(pooled);
+
+	return 0;
+}
+
+void git_stream_pool_put(
+	git_stream *stream,
+	const char *scheme,
+	const char *host,
+	const char *port,
+	const char *proxy)
+{
+	git_vector expired = GIT_VECTOR_INIT;
+	git_buf key = GIT_BUF_INIT;
+	pooled_stream *pooled;
+
+	if (!stream)
+		return;
+
+	if (pool_key(&key, scheme, host, port, proxy) < 0 ||
+	    (pooled = git__calloc(1, sizeof(pooled_stream))) == NULL)
+		goto close;
+
+	pooled->key = git_buf_detach(&key);
+	pooled->stream = stream;
+	pooled->idle_since = git__timer();
+
+	if (git_mutex_lock(&pool_lock) < 0) {
+		pooled_stream_free(pooled);
+		return;
+	}
+
+	if (pool_max_idle) {
+		/* make room for the new connection */
+		expire(&expired, pool_max_idle - 1, pooled->idle_since);
+
+		if (git_vector_insert(&pool, pooled) == 0)
+			pooled = NULL;
+	}
+
+	git_mutex_unlock(&pool_lock);
+	free_expired(&expired);
+
+	if (pooled)
+		pooled_stream_free(pooled);
+
+	return;
+
+close:
+	git_buf_free(&key);
+	git_stream_close(stream);
+	git_stream_free(stream);
+}
+
+int git_stream_pool_set_limits(size_t max_idle, int idle_timeout)
+{
+	git_vector expired = GIT_VECTOR_INIT;
+
+	if (idle_timeout < 0) {
+		giterr_set(GITERR_INVALID, "invalid idle timeout %d", idle_timeout);
+		return -1;
+	}
+
+	if (git_mutex_lock(&pool_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to lock the connection pool");
+		return -1;
+	}
+
+	pool_max_idle = max_idle;
+	pool_idle_timeout = idle_timeout;
+	expire(&expired, pool_max_idle, git__timer());
+
+	git_mutex_unlock(&pool_lock);
+	free_expired(&expired);
+
+	return 0;
+}
+
+void git_stream_pool_stats(size_t *idle, size_t *reused)
+{
+	if (git_mutex_lock(&pool_lock) < 0)
+		return;
+
+	if (idle)
+		*idle = pool.length;
+	if (reused)
+		*reused = pool_reused;
+
+	git_mutex_unlock(&pool_lock);
+}
+
+void git_stream_pool_clear(void)
+{
+	git_vector expired = GIT_VECTOR_INIT;
+
+	if (git_mutex_lock(&pool_lock) < 0)
+		return;
+
+	expire(&expired, 0, git__timer());
+
+	git_mutex_unlock(&pool_lock);
+	free_expired(&expired);
+}
+
+static void stream_pool_shutdown(void)
+{
+	git_stream_pool_clear();
+	git_vector_free(&pool);
+
+	git_mutex_free(&pool_lock);
+}
+
+int git_stream_pool_global_init(void)
+{
+	if (git_mutex_init(&pool_lock) < 0) {
+		giterr_set(GITERR_OS, "failed to initialize the connection pool lock");
+		return -1;
+	}
+
+	git__on_shutdown(stream_pool_shutdown);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_stream_pool_h__
+#define INCLUDE_stream_pool_h__
+
+#include "common.h"
+#include "git2/sys/stream.h"
+
+/**
+ * A process-wide pool of idle connections, so that a later request to
+ * the same server can go out over a connection which is already open
+ * (and, for TLS, past the handshake) instead of a new one.  The
+ * connections are told apart by the scheme, host, port and proxy they
+ * were opened with.
+ *
+ * The pool is disabled (it keeps no connection) until a limit is set
+ * with `GIT_OPT_SET_CONNECTION_POOL`.
+ */
+
+extern int git_stream_pool_global_init(void);
+
+/**
+ * Take the connection to the given server which was put back last, if
+ * it has not been idle for longer than the idle timeout.  Returns
+ * GIT_ENOTFOUND when there is none; `proxy` may be NULL.
+ */
+extern int git_stream_pool_take(
+	git_stream **out,
+	const char *scheme,
+	const char *host,
+	const char *port,
+	const char *proxy);
+
+/**
+ * Keep a connected stream, which is done with its last response, for
+ * the next request to the same server.  The pool owns the stream from
+ * then on, and closes and frees it right away when it is disabled.
+ */
+extern void git_stream_pool_put(
+	git_stream *stream,
+	const char *scheme,
+	const char *host,
+	const char *port,
+	const char *proxy);
+
+/**
+ * Keep at most `max_idle` connections, each for at most `idle_timeout`
+ * seconds; the connections over the new limits are closed.
+ */
+extern int git_stream_pool_set_limits(size_t max_idle, int idle_timeout);
+
+/**
+ * The number of connections in the pool, and the number which have
+ * been taken out of it since the process started.
+ */
+extern void git_stream_pool_stats(size_t *idle, size_t *reused);
+
+/** Close all the connections in the pool. */
+extern void git_stream_pool_clear(void);
+
+#endif
@@ -11,6 +11,7 @@
 #include "git2/sys/transport.h"
 #include "stream.h"
 #include "socket_stream.h"
+#include "smart.h"
 
 #define OWNING_SUBTRANSPORT(s) ((git_subtransport *)(s)->parent.subtransport)
 
@@ -28,7 +29,7 @@ typedef struct {
 
 typedef struct {
 	git_smart_subtransport parent;
-	git_transport *owner;
+	transport_smart *owner;
 	git_proto_stream *current_stream;
 } git_subtransport;
 
@@ -36,11 +37,15 @@ typedef struct {
  * Create a git protocol request.
  *
  * For example: 0035git-upload-pack /libgit2/libgit2\0host=github.com\0
+ *
+ * Protocol v2 is asked for with an extra parameter after a second NUL,
+ * which servers that don't know about it ignore.
  */
-static int gen_proto(git_buf *request, const char *cmd, const char *url)
+static int gen_proto(git_buf *request, const char *cmd, const char *url, int version)
 {
 	char *delim, *repo;
 	char host[] = "host=";
+	char extra[] = "version=2";
 	size_t len;
 
 	delim = strchr(url, '/');
@@ -59,12 +64,20 @@ static int gen_proto(git_buf *request, const char *cmd, const char *url)
 
 	len = 4 + strlen(cmd) + 1 + strlen(repo) + 1 + strlen(host) + (delim - url) + 1;
 
+	if (version == 2)
+		len += 1 + strlen(extra) + 1;
+
 	git_buf_grow(request, len);
 	git_buf_printf(request, "%04x%s %s%c%s",
 		(unsigned int)(len & 0x0FFFF), cmd, repo, 0, host);
 	git_buf_put(request, url, delim - url);
 	git_buf_putc(request, '\0');
 
+	if (version == 2) {
+		git_buf_putc(request, '\0');
+		git_buf_put(request, extra, strlen(extra) + 1);
+	}
+
 	if (git_buf_oom(request))
 		return -1;
 
@@ -76,7 +89,8 @@ static int send_command(git_proto_stream *s)
 	int error;
 	git_buf request = GIT_BUF_INIT;
 
-	error = gen_proto(&request, s->cmd, s->url);
+	error = gen_proto(&request, s->cmd, s->url,
+		OWNING_SUBTRANSPORT(s)->owner->protocol_version);
 	if (error < 0)
 		goto cleanup;
 
@@ -358,7 +372,7 @@ int git_smart_subtransport_git(git_smart_subtransport **out, git_transport *owne
 	t = git__calloc(1, sizeof(git_subtransport));
 	GITERR_CHECK_ALLOC(t);
 
-	t->owner = owner;
+	t->owner = (transport_smart *)owner;
 	t->parent.action = _git_action;
 	t->parent.close = _git_close;
 	t->parent.free = _git_free;
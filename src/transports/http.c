@@ -18,6 +18,7 @@
 #include "tls_stream.h"
 #include "socket_stream.h"
 #include "curl_stream.h"
+#include "stream_pool.h"
 
 git_http_auth_scheme auth_schemes[] = {
 	{ GIT_AUTHTYPE_NEGOTIATE, "Negotiate", GIT_CREDTYPE_DEFAULT, git_http_auth_negotiate },
@@ -56,6 +57,7 @@ typedef struct {
 	const char *verb;
 	char *chunk_buffer;
 	unsigned chunk_buffer_len;
+	git_buf body;
 	unsigned sent_request : 1,
 		received_response : 1,
 		chunked : 1,
@@ -67,8 +69,18 @@ typedef struct {
 	transport_smart *owner;
 	git_stream *io;
 	gitno_connection_data connection_data;
+	char *proxy_url;
 	bool connected;
 
+	/* The connection has served a request before */
+	bool reused;
+
+	/* The connection can be given to the pool once we're done with it */
+	bool poolable;
+
+	/* The current action may take a connection from the pool */
+	bool use_pool;
+
 	/* Parser structures */
 	http_parser parser;
 	http_parser_settings settings;
@@ -82,7 +94,8 @@ typedef struct {
 	enum last_cb last_cb;
 	int parse_error;
 	int error;
-	unsigned parse_finished : 1;
+	unsigned parse_finished : 1,
+		response_started : 1;
 
 	/* Authentication */
 	git_cred *cred;
@@ -222,6 +235,9 @@ static int gen_request(
 	} else
 		git_buf_puts(buf, "Accept: */*\r\n");
 
+	if (t->owner->protocol_version == 2)
+		git_buf_puts(buf, "Git-Protocol: version=2\r\n");
+
 	for (i = 0; i < t->owner->custom_headers.count; i++) {
 		if (t->owner->custom_headers.strings[i])
 			git_buf_printf(buf, "%s\r\n", t->owner->custom_headers.strings[i]);
@@ -511,6 +527,7 @@ static void clear_parser_state(http_subtransport *t)
 	t->last_cb = NONE;
 	t->parse_error = 0;
 	t->parse_finished = 0;
+	t->response_started = 0;
 
 	git_buf_free(&t->parse_header_name);
 	git_buf_init(&t->parse_header_name, 0);
@@ -555,15 +572,40 @@ static int write_chunk(git_stream *io, const char *buffer, size_t len)
 	return 0;
 }
 
-static int http_connect(http_subtransport *t)
+static const char *connection_scheme(http_subtransport *t)
+{
+	return t->connection_data.use_ssl ? "https" : "http";
+}
+
+static void http_disconnect(http_subtransport *t)
+{
+	if (!t->io)
+		return;
+
+	/* Keep the connection for the next request, if the server lets us */
+	if (t->connected && t->poolable && t->parse_finished &&
+	    http_should_keep_alive(&t->parser)) {
+		git_stream_pool_put(t->io, connection_scheme(t),
+			t->connection_data.host, t->connection_data.port, t->proxy_url);
+	} else {
+		git_stream_close(t->io);
+		git_stream_free(t->io);
+	}
+
+	t->io = NULL;
+	t->connected = 0;
+}
+
+static int http_connect(http_subtransport *t, bool pooled)
 {
 	int error;
-	char *proxy_url;
 
 	if (t->connected &&
 		http_should_keep_alive(&t->parser) &&
-		t->parse_finished)
+		t->parse_finished) {
+		t->reused = 1;
 		return 0;
+	}
 
 	if (t->io) {
 		git_stream_close(t->io);
@@ -571,31 +613,48 @@ static int http_connect(http_subtransport *t)
 		t->io = NULL;
 	}
 
-	if (t->connection_data.use_ssl) {
-		error = git_tls_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+	git__free(t->proxy_url);
+	t->proxy_url = NULL;
+
+	if (t->owner->owner &&
+	    git_remote__get_http_proxy(t->owner->owner, !!t->connection_data.use_ssl, &t->proxy_url) < 0) {
+		giterr_clear();
+		t->proxy_url = NULL;
+	}
+
+	if (pooled && git_stream_pool_take(&t->io, connection_scheme(t),
+		t->connection_data.host, t->connection_data.port, t->proxy_url) == 0) {
+		/* Its certificate was valid; the callback below gets to check it again */
+		t->reused = 1;
+		t->poolable = 1;
+		error = 0;
 	} else {
+		t->reused = 0;
+
+		if (t->connection_data.use_ssl) {
+			error = git_tls_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+		} else {
 #ifdef GIT_CURL
-		error = git_curl_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+			error = git_curl_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
 #else
-		error = git_socket_stream_new(&t->io,  t->connection_data.host, t->connection_data.port);
+			error = git_socket_stream_new(&t->io,  t->connection_data.host, t->connection_data.port);
 #endif
-	}
-
-	if (error < 0)
-		return error;
+		}
 
-	GITERR_CHECK_VERSION(t->io, GIT_STREAM_VERSION, "git_stream");
+		if (error < 0)
+			return error;
 
-	if (git_stream_supports_proxy(t->io) &&
-	    !git_remote__get_http_proxy(t->owner->owner, !!t->connection_data.use_ssl, &proxy_url)) {
-		error = git_stream_set_proxy(t->io, proxy_url);
-		git__free(proxy_url);
+		GITERR_CHECK_VERSION(t->io, GIT_STREAM_VERSION, "git_stream");
 
-		if (error < 0)
+		if (git_stream_supports_proxy(t->io) && t->proxy_url &&
+		    (error = git_stream_set_proxy(t->io, t->proxy_url)) < 0)
 			return error;
-	}
 
-	error = git_stream_connect(t->io);
+		error = git_stream_connect(t->io);
+
+		/* Only connections which needed no leniency are shared */
+		t->poolable = !error;
+	}
 
 #if defined(GIT_OPENSSL) || defined(GIT_SECURE_TRANSPORT) || defined(GIT_CURL)
 	if ((!error || error == GIT_ECERTIFICATE) && t->owner->certificate_check_cb != NULL &&
@@ -625,6 +684,41 @@ static int http_connect(http_subtransport *t)
 	return 0;
 }
 
+/*
+ * The server may close a connection which has been idle, without us
+ * noticing until we send the next request over it; when it did, the
+ * request is sent again over a new connection.
+ */
+static int http_reconnect(http_subtransport *t)
+{
+	giterr_clear();
+
+	t->connected = 0;
+	return http_connect(t, false);
+}
+
+static int send_request(http_subtransport *t, http_stream *s, const char *body, size_t len)
+{
+	git_buf request = GIT_BUF_INIT;
+	int error = -1;
+
+	clear_parser_state(t);
+
+	/* In one write, so that a closed connection fails in the read */
+	if (gen_request(&request, s, len) < 0 ||
+	    (len && git_buf_put(&request, body, len) < 0))
+		goto done;
+
+	if (git_stream_write(t->io, request.ptr, request.size, 0) < 0)
+		goto done;
+
+	error = 0;
+
+done:
+	git_buf_free(&request);
+	return error;
+}
+
 static int http_stream_read(
 	git_smart_subtransport_stream *stream,
 	char *buffer,
@@ -635,6 +729,7 @@ static int http_stream_read(
 	http_subtransport *t = OWNING_SUBTRANSPORT(s);
 	parser_context ctx;
 	size_t bytes_parsed;
+	int error;
 
 replay:
 	*bytes_read = 0;
@@ -642,20 +737,15 @@ replay:
 	assert(t->connected);
 
 	if (!s->sent_request) {
-		git_buf request = GIT_BUF_INIT;
-
-		clear_parser_state(t);
-
-		if (gen_request(&request, s, 0) < 0)
-			return -1;
+		if (send_request(t, s, s->body.ptr, s->body.size) < 0) {
+			if (!t->reused || s->chunked)
+				return -1;
 
-		if (git_stream_write(t->io, request.ptr, request.size, 0) < 0) {
-			git_buf_free(&request);
-			return -1;
+			if ((error = http_reconnect(t)) < 0 ||
+			    (error = send_request(t, s, s->body.ptr, s->body.size)) < 0)
+				return error;
 		}
 
-		git_buf_free(&request);
-
 		s->sent_request = 1;
 	}
 
@@ -680,7 +770,6 @@ replay:
 
 	while (!*bytes_read && !t->parse_finished) {
 		size_t data_offset;
-		int error;
 
 		/*
 		 * Make the parse_buffer think it's as full of data as
@@ -698,9 +787,21 @@ replay:
 
 		data_offset = t->parse_buffer.offset;
 
-		if (gitno_recv(&t->parse_buffer) < 0)
+		if ((error = gitno_recv(&t->parse_buffer)) <= 0 &&
+		    t->reused && !t->response_started && !s->chunked) {
+			s->sent_request = 0;
+
+			if ((error = http_reconnect(t)) < 0)
+				return error;
+
+			goto replay;
+		}
+
+		if (error < 0)
 			return -1;
 
+		t->response_started = 1;
+
 		/* This call to http_parser_execute will result in invocations of the
 		 * on_* family of callbacks. The most interesting of these is
 		 * on_body_fill_buffer, which is called when data is ready to be copied
@@ -727,7 +828,7 @@ replay:
 		if (PARSE_ERROR_REPLAY == t->parse_error) {
 			s->sent_request = 0;
 
-			if ((error = http_connect(t)) < 0)
+			if ((error = http_connect(t, t->use_pool)) < 0)
 				return error;
 
 			goto replay;
@@ -829,7 +930,6 @@ static int http_stream_write_single(
 {
 	http_stream *s = (http_stream *)stream;
 	http_subtransport *t = OWNING_SUBTRANSPORT(s);
-	git_buf request = GIT_BUF_INIT;
 
 	assert(t->connected);
 
@@ -838,25 +938,19 @@ static int http_stream_write_single(
 		return -1;
 	}
 
-	clear_parser_state(t);
-
-	if (gen_request(&request, s, len) < 0)
+	/* Keep the body, in case the request has to go out again */
+	if (t->reused && git_buf_put(&s->body, buffer, len) < 0)
 		return -1;
 
-	if (git_stream_write(t->io, request.ptr, request.size, 0) < 0)
-		goto on_error;
-
-	if (len && git_stream_write(t->io, buffer, len, 0) < 0)
-		goto on_error;
+	if (send_request(t, s, buffer, len) < 0) {
+		if (!t->reused || http_reconnect(t) < 0 ||
+		    send_request(t, s, buffer, len) < 0)
+			return -1;
+	}
 
-	git_buf_free(&request);
 	s->sent_request = 1;
 
 	return 0;
-
-on_error:
-	git_buf_free(&request);
-	return -1;
 }
 
 static void http_stream_free(git_smart_subtransport_stream *stream)
@@ -869,6 +963,7 @@ static void http_stream_free(git_smart_subtransport_stream *stream)
 	if (s->redirect_url)
 		git__free(s->redirect_url);
 
+	git_buf_free(&s->body);
 	git__free(s);
 }
 
@@ -984,7 +1079,13 @@ static int http_action(
 		 (ret = gitno_connection_data_from_url(&t->connection_data, url, NULL)) < 0)
 		return ret;
 
-	if ((ret = http_connect(t)) < 0)
+	/*
+	 * A push streams its request, which we couldn't send again if the
+	 * server turned out to have closed an idle connection.
+	 */
+	t->use_pool = (action != GIT_SERVICE_RECEIVEPACK);
+
+	if ((ret = http_connect(t, t->use_pool)) < 0)
 		return ret;
 
 	switch (action) {
@@ -1011,13 +1112,11 @@ static int http_close(git_smart_subtransport *subtransport)
 	git_http_auth_context *context;
 	size_t i;
 
+	http_disconnect(t);
 	clear_parser_state(t);
 
-	if (t->io) {
-		git_stream_close(t->io);
-		git_stream_free(t->io);
-		t->io = NULL;
-	}
+	git__free(t->proxy_url);
+	t->proxy_url = NULL;
 
 	if (t->cred) {
 		t->cred->free(t->cred);
@@ -272,6 +272,11 @@ static int local_negotiate_fetch(
 	GIT_UNUSED(refs);
 	GIT_UNUSED(count);
 
+	if (t->owner && git_remote__deepening(t->owner)) {
+		giterr_set(GITERR_NET, "shallow fetches are not supported by the local transport");
+		return -1;
+	}
+
 	/* Fill in the loids */
 	git_vector_foreach(&t->refs, i, rhead) {
 		git_object *obj;
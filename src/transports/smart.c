@@ -8,6 +8,7 @@
 #include "smart.h"
 #include "refs.h"
 #include "refspec.h"
+#include "repository.h"
 
 static int git_smart__recv_cb(gitno_buffer *buf)
 {
@@ -194,6 +195,41 @@ static void free_symrefs(git_vector *symrefs)
 	git_vector_free(symrefs);
 }
 
+/*
+ * The wire protocol version to ask for, from `protocol.version`. Only
+ * fetches have a v2, and anything but 2 means the original protocol.
+ */
+static int protocol_version(int *out, transport_smart *t)
+{
+	git_config *cfg;
+	int32_t version = 0;
+	int error;
+
+	*out = 0;
+
+	if (t->direction != GIT_DIRECTION_FETCH || !t->owner ||
+	    !git_remote_owner(t->owner))
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&cfg, git_remote_owner(t->owner))) < 0)
+		return error;
+
+	if ((error = git_config_get_int32(&version, cfg, "protocol.version")) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		giterr_clear();
+	}
+
+	if (version < 0 || version > 2) {
+		giterr_set(GITERR_CONFIG, "unknown value for protocol.version: %d", version);
+		return -1;
+	}
+
+	*out = (version == 2) ? 2 : 0;
+	return 0;
+}
+
 static int git_smart__connect(
 	git_transport *transport,
 	const char *url,
@@ -230,6 +266,9 @@ static int git_smart__connect(
 		return -1;
 	}
 
+	if ((error = protocol_version(&t->protocol_version, t)) < 0)
+		return error;
+
 	if ((error = t->wrapped->action(&stream, t->wrapped, t->url, service)) < 0)
 		return error;
 
@@ -238,6 +277,35 @@ static int git_smart__connect(
 
 	gitno_buffer_setup_callback(&t->buffer, t->buffer_data, sizeof(t->buffer_data), git_smart__recv_cb, t);
 
+	/*
+	 * A v2 server only lists its capabilities up front, and we ask
+	 * for the refs we want. Servers which don't know about v2 send
+	 * the v0 advertisement instead, which we read as usual.
+	 */
+	if (t->protocol_version == 2 &&
+	    (error = git_smart__detect_v2(t)) <= 0) {
+		if (error < 0)
+			return error;
+
+		t->protocol_version = 0;
+	}
+
+	if (t->protocol_version == 2) {
+		if ((error = git_smart__ls_refs(t)) < 0)
+			return error;
+
+		t->have_refs = 1;
+
+		if ((error = git_smart__update_heads(t, NULL)) < 0)
+			return error;
+
+		if (t->rpc && git_smart__reset_stream(t, false) < 0)
+			return -1;
+
+		t->connected = 1;
+		return 0;
+	}
+
 	/* 2 flushes for RPC; 1 for stateful */
 	if ((error = git_smart__store_refs(t, t->rpc ? 2 : 1)) < 0)
 		return error;
@@ -25,6 +25,13 @@
 #define GIT_CAP_REPORT_STATUS "report-status"
 #define GIT_CAP_THIN_PACK "thin-pack"
 #define GIT_CAP_SYMREF "symref"
+#define GIT_CAP_SHALLOW "shallow"
+#define GIT_CAP_DEEPEN_SINCE "deepen-since"
+#define GIT_CAP_DEEPEN_NOT "deepen-not"
+
+/* Protocol v2 capabilities, which name the commands the server knows */
+#define GIT_CAP_LS_REFS "ls-refs"
+#define GIT_CAP_FETCH "fetch"
 
 enum git_pkt_type {
 	GIT_PKT_CMD,
@@ -41,6 +48,8 @@ enum git_pkt_type {
 	GIT_PKT_OK,
 	GIT_PKT_NG,
 	GIT_PKT_UNPACK,
+	GIT_PKT_DELIM,
+	GIT_PKT_LINE,
 };
 
 /* Used for multi_ack and mutli_ack_detailed */
@@ -122,7 +131,12 @@ typedef struct transport_smart_caps {
 		include_tag:1,
 		delete_refs:1,
 		report_status:1,
-		thin_pack:1;
+		thin_pack:1,
+		shallow:1,
+		deepen_since:1,
+		deepen_not:1,
+		ls_refs:1,
+		fetch:1;
 } transport_smart_caps;
 
 typedef int (*packetsize_cb)(size_t received, void *payload);
@@ -142,6 +156,8 @@ typedef struct {
 	git_strarray custom_headers;
 	git_smart_subtransport *wrapped;
 	git_smart_subtransport_stream *current_stream;
+	/* wire protocol version; the subtransports ask for it when it's 2 */
+	int protocol_version;
 	transport_smart_caps caps;
 	git_vector refs;
 	git_vector heads;
@@ -159,6 +175,8 @@ typedef struct {
 /* smart_protocol.c */
 int git_smart__store_refs(transport_smart *t, int flushes);
 int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vector *symrefs);
+int git_smart__detect_v2(transport_smart *t);
+int git_smart__ls_refs(transport_smart *t);
 int git_smart__push(git_transport *transport, git_push *push, const git_remote_callbacks *cbs);
 
 int git_smart__negotiate_fetch(
@@ -182,6 +200,9 @@ int git_smart__update_heads(transport_smart *t, git_vector *symrefs);
 
 /* smart_pkt.c */
 int git_pkt_parse_line(git_pkt **head, const char *line, const char **out, size_t len);
+int git_pkt_parse_raw(enum git_pkt_type *type, const char **data, size_t *data_len, const char *line, const char **out, size_t bufflen);
+int git_pkt_buffer_printf(git_buf *buf, const char *fmt, ...) GIT_FORMAT_PRINTF(2, 3);
+int git_pkt_buffer_delim(git_buf *buf);
 int git_pkt_buffer_flush(git_buf *buf);
 int git_pkt_send_flush(GIT_SOCKET s);
 int git_pkt_buffer_done(git_buf *buf);
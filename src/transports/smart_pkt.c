@@ -23,6 +23,7 @@
 #define PKT_LEN_SIZE 4
 static const char pkt_done_str[] = "0009done\n";
 static const char pkt_flush_str[] = "0000";
+static const char pkt_delim_str[] = "0001";
 static const char pkt_have_prefix[] = "0032have ";
 static const char pkt_want_prefix[] = "0032want ";
 
@@ -39,6 +40,19 @@ static int flush_pkt(git_pkt **out)
 	return 0;
 }
 
+static int delim_pkt(git_pkt **out)
+{
+	git_pkt *pkt;
+
+	pkt = git__malloc(sizeof(git_pkt));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_DELIM;
+	*out = pkt;
+
+	return 0;
+}
+
 /* the rest of the line will be useful for multi_ack and multi_ack_detailed */
 static int ack_pkt(git_pkt **out, const char *line, size_t len)
 {
@@ -442,6 +456,16 @@ int git_pkt_parse_line(
 		return flush_pkt(head);
 	}
 
+	if (len == 1) { /* Delim pkt, which separates the sections of a v2 command */
+		*out = line;
+		return delim_pkt(head);
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
 	len -= PKT_LEN_SIZE; /* the encoded length includes its own size */
 
 	if (*line == GIT_SIDE_BAND_DATA)
@@ -472,6 +496,56 @@ int git_pkt_parse_line(
 	return ret;
 }
 
+/*
+ * Split the next pkt-line off the buffer without looking at its
+ * payload. Protocol v2 lines only make sense in the context of the
+ * command that was sent, so it's up to the caller to interpret them.
+ * The type is GIT_PKT_FLUSH, GIT_PKT_DELIM or GIT_PKT_LINE, and a
+ * line's payload comes without its trailing LF.
+ */
+int git_pkt_parse_raw(
+	enum git_pkt_type *type,
+	const char **data,
+	size_t *data_len,
+	const char *line,
+	const char **out,
+	size_t bufflen)
+{
+	int32_t len;
+
+	if (bufflen < PKT_LEN_SIZE)
+		return GIT_EBUFS;
+
+	if ((len = parse_len(line)) < 0)
+		return (int)len;
+
+	if (bufflen < (size_t)len)
+		return GIT_EBUFS;
+
+	*data = line + PKT_LEN_SIZE;
+	*data_len = 0;
+
+	if (len == 0 || len == 1) {
+		*type = len ? GIT_PKT_DELIM : GIT_PKT_FLUSH;
+		*out = *data;
+		return 0;
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
+	*type = GIT_PKT_LINE;
+	*data_len = len - PKT_LEN_SIZE;
+	*out = *data + *data_len;
+
+	if (*data_len && (*data)[*data_len - 1] == '\n')
+		(*data_len)--;
+
+	return 0;
+}
+
 void git_pkt_free(git_pkt *pkt)
 {
 	if (pkt->type == GIT_PKT_REF) {
@@ -526,6 +600,12 @@ static int buffer_want_with_caps(const git_remote_head *head, transport_smart_ca
 	if (caps->ofs_delta)
 		git_buf_puts(&str, GIT_CAP_OFS_DELTA " ");
 
+	if (caps->deepen_since)
+		git_buf_puts(&str, GIT_CAP_DEEPEN_SINCE " ");
+
+	if (caps->deepen_not)
+		git_buf_puts(&str, GIT_CAP_DEEPEN_NOT " ");
+
 	if (git_buf_oom(&str))
 		return -1;
 
@@ -551,7 +631,8 @@ static int buffer_want_with_caps(const git_remote_head *head, transport_smart_ca
 
 /*
  * All "want" packets have the same length and format, so what we do
- * is overwrite the OID each time.
+ * is overwrite the OID each time. The caller adds the flush, after
+ * whatever else goes along with the wants.
  */
 
 int git_pkt_buffer_wants(
@@ -591,7 +672,7 @@ int git_pkt_buffer_wants(
 			return -1;
 	}
 
-	return git_pkt_buffer_flush(buf);
+	return 0;
 }
 
 int git_pkt_buffer_have(git_oid *oid, git_buf *buf)
@@ -607,3 +688,40 @@ int git_pkt_buffer_done(git_buf *buf)
 {
 	return git_buf_puts(buf, pkt_done_str);
 }
+
+int git_pkt_buffer_delim(git_buf *buf)
+{
+	return git_buf_put(buf, pkt_delim_str, strlen(pkt_delim_str));
+}
+
+/*
+ * Append a pkt-line with the formatted text and a trailing LF, which
+ * is how the lines of a v2 command look.
+ */
+int git_pkt_buffer_printf(git_buf *buf, const char *fmt, ...)
+{
+	git_buf line = GIT_BUF_INIT;
+	va_list ap;
+	int error;
+
+	va_start(ap, fmt);
+	error = git_buf_vprintf(&line, fmt, ap);
+	va_end(ap);
+
+	if (error < 0)
+		goto done;
+
+	if (line.size + PKT_LEN_SIZE + 1 > 0xffff) {
+		giterr_set(GITERR_NET,
+			"Tried to produce packet with invalid length %" PRIuZ, line.size + PKT_LEN_SIZE + 1);
+		error = -1;
+		goto done;
+	}
+
+	error = git_buf_printf(buf, "%04x%s\n",
+		(unsigned int)(line.size + PKT_LEN_SIZE + 1), line.ptr);
+
+done:
+	git_buf_free(&line);
+	return error;
+}
@@ -13,6 +13,9 @@
 #include "push.h"
 #include "pack-objects.h"
 #include "remote.h"
+#include "refspec.h"
+#include "fetch_negotiator.h"
+#include "shallow.h"
 #include "util.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
@@ -188,6 +191,24 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 			continue;
 		}
 
+		if (!git__prefixcmp(ptr, GIT_CAP_SHALLOW)) {
+			caps->common = caps->shallow = 1;
+			ptr += strlen(GIT_CAP_SHALLOW);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_DEEPEN_SINCE)) {
+			caps->common = caps->deepen_since = 1;
+			ptr += strlen(GIT_CAP_DEEPEN_SINCE);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_DEEPEN_NOT)) {
+			caps->common = caps->deepen_not = 1;
+			ptr += strlen(GIT_CAP_DEEPEN_NOT);
+			continue;
+		}
+
 		if (!git__prefixcmp(ptr, GIT_CAP_SYMREF)) {
 			int error;
 
@@ -204,6 +225,377 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 	return 0;
 }
 
+/*
+ * Find the pkt-line which starts at `at` in the buffer, receiving more
+ * data until it's all there. Nothing is consumed, so that we can look
+ * ahead at what the server said.
+ */
+static int peek_raw(
+	enum git_pkt_type *type,
+	const char **data,
+	size_t *data_len,
+	const char **end,
+	gitno_buffer *buf,
+	const char *at)
+{
+	int error, recvd;
+
+	while ((error = git_pkt_parse_raw(type, data, data_len,
+			at, end, buf->offset - (at - buf->data))) == GIT_EBUFS) {
+		if ((recvd = gitno_recv(buf)) < 0)
+			return recvd;
+
+		if (recvd == 0) {
+			giterr_set(GITERR_NET, "early EOF");
+			return GIT_EEOF;
+		}
+	}
+
+	return error;
+}
+
+static int recv_raw(
+	enum git_pkt_type *type,
+	git_buf *line,
+	gitno_buffer *buf)
+{
+	const char *data, *end;
+	size_t data_len;
+	int error;
+
+	if ((error = peek_raw(type, &data, &data_len, &end, buf, buf->data)) < 0)
+		return error;
+
+	git_buf_clear(line);
+	error = git_buf_put(line, data, data_len);
+	gitno_consume(buf, end);
+
+	if (!error && *type == GIT_PKT_LINE && !git__prefixcmp(line->ptr, "ERR ")) {
+		giterr_set(GITERR_NET, "Remote error: %s", line->ptr + strlen("ERR "));
+		return -1;
+	}
+
+	return error;
+}
+
+static bool is_version_2(enum git_pkt_type type, const char *data, size_t data_len)
+{
+	return type == GIT_PKT_LINE && data_len == strlen("version 2") &&
+		!memcmp(data, "version 2", data_len);
+}
+
+/* Whether the space-separated list of features has this one */
+static bool has_feature(const char *features, const char *name)
+{
+	size_t len = strlen(name), feature_len;
+
+	while (*features) {
+		feature_len = strcspn(features, " ");
+
+		if (feature_len == len && !strncmp(features, name, len))
+			return true;
+
+		features += feature_len;
+		features += strspn(features, " ");
+	}
+
+	return false;
+}
+
+static void detect_caps_v2(transport_smart_caps *caps, const char *line)
+{
+	size_t len = strcspn(line, "=");
+
+	if (len == strlen(GIT_CAP_LS_REFS) && !strncmp(line, GIT_CAP_LS_REFS, len)) {
+		caps->ls_refs = 1;
+	} else if (len == strlen(GIT_CAP_FETCH) && !strncmp(line, GIT_CAP_FETCH, len)) {
+		caps->fetch = 1;
+
+		/* the "shallow" feature covers all of the deepen arguments */
+		if (line[len] == '=' && has_feature(line + len + 1, GIT_CAP_SHALLOW))
+			caps->shallow = caps->deepen_since = caps->deepen_not = 1;
+	}
+}
+
+/*
+ * Look at the start of the advertisement for a "version 2" line, which
+ * may come after the service announcement over HTTP. If it's there,
+ * read the capabilities which follow it and return 1. Otherwise the
+ * server doesn't speak v2 and nothing is consumed, so the refs can be
+ * read as usual.
+ */
+int git_smart__detect_v2(transport_smart *t)
+{
+	gitno_buffer *buf = &t->buffer;
+	enum git_pkt_type type;
+	const char *data, *end;
+	size_t data_len;
+	git_buf line = GIT_BUF_INIT;
+	int error;
+
+	if ((error = peek_raw(&type, &data, &data_len, &end, buf, buf->data)) < 0)
+		return error;
+
+	if (type == GIT_PKT_LINE && data_len && *data == '#') {
+		if ((error = peek_raw(&type, &data, &data_len, &end, buf, end)) < 0)
+			return error;
+
+		if (type != GIT_PKT_FLUSH)
+			return 0;
+
+		if ((error = peek_raw(&type, &data, &data_len, &end, buf, end)) < 0)
+			return error;
+	}
+
+	if (!is_version_2(type, data, data_len))
+		return 0;
+
+	gitno_consume(buf, end);
+	memset(&t->caps, 0, sizeof(t->caps));
+
+	while ((error = recv_raw(&type, &line, buf)) == 0 && type == GIT_PKT_LINE)
+		detect_caps_v2(&t->caps, line.ptr);
+
+	git_buf_free(&line);
+
+	if (error < 0)
+		return error;
+
+	if (type != GIT_PKT_FLUSH) {
+		giterr_set(GITERR_NET, "Invalid response");
+		return -1;
+	}
+
+	/* These are part of every v2 fetch */
+	t->caps.common = t->caps.ofs_delta = t->caps.thin_pack =
+		t->caps.include_tag = t->caps.side_band_64k = 1;
+
+	return 1;
+}
+
+static int add_ref_prefix(git_vector *prefixes, const char *fmt, const char *name)
+{
+	git_buf prefix = GIT_BUF_INIT;
+	size_t i;
+	char *p;
+
+	if (git_buf_printf(&prefix, fmt, name) < 0)
+		return -1;
+
+	git_vector_foreach(prefixes, i, p) {
+		if (!strcmp(p, prefix.ptr)) {
+			git_buf_free(&prefix);
+			return 0;
+		}
+	}
+
+	return git_vector_insert(prefixes, git_buf_detach(&prefix));
+}
+
+static int add_refspec_prefixes(git_vector *prefixes, git_vector *refspecs)
+{
+	git_refspec *spec;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(refspecs, i, spec) {
+		const char *src = spec->src, *star;
+
+		if (spec->push)
+			continue;
+
+		if (spec->pattern && (star = strchr(src, '*')) != NULL) {
+			git_buf prefix = GIT_BUF_INIT;
+
+			if ((error = git_buf_put(&prefix, src, star - src)) == 0)
+				error = add_ref_prefix(prefixes, "%s", prefix.ptr);
+
+			git_buf_free(&prefix);
+		} else if (!git__prefixcmp(src, GIT_REFS_DIR) || !strcmp(src, GIT_HEAD_FILE)) {
+			error = add_ref_prefix(prefixes, "%s", src);
+		} else {
+			/* a short name, which may end up matching any of these */
+			if ((error = add_ref_prefix(prefixes, "%s", src)) < 0 ||
+			    (error = add_ref_prefix(prefixes, GIT_REFS_DIR "%s", src)) < 0 ||
+			    (error = add_ref_prefix(prefixes, GIT_REFS_TAGS_DIR "%s", src)) < 0 ||
+			    (error = add_ref_prefix(prefixes, GIT_REFS_HEADS_DIR "%s", src)) < 0 ||
+			    (error = add_ref_prefix(prefixes, GIT_REFS_REMOTES_DIR "%s", src)) < 0)
+				break;
+
+			error = add_ref_prefix(prefixes, GIT_REFS_REMOTES_DIR "%s/" GIT_HEAD_FILE, src);
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	return error;
+}
+
+/*
+ * The prefixes of the refs that the remote's fetch refspecs can match,
+ * so the server leaves out the ones we'd ignore anyway. Without any
+ * refspecs to go by we ask for everything.
+ */
+static int ls_refs_prefixes(git_vector *prefixes, git_remote *remote)
+{
+	if (!remote)
+		return 0;
+
+	if (add_refspec_prefixes(prefixes, &remote->refspecs) < 0 ||
+	    add_refspec_prefixes(prefixes, &remote->active_refspecs) < 0)
+		return -1;
+
+	if (!prefixes->length)
+		return 0;
+
+	/* HEAD tells a clone which branch to check out */
+	if (add_ref_prefix(prefixes, "%s", GIT_HEAD_FILE) < 0)
+		return -1;
+
+	if (remote->download_tags != GIT_REMOTE_DOWNLOAD_TAGS_NONE &&
+	    add_ref_prefix(prefixes, "%s", GIT_REFS_TAGS_DIR) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int ls_refs_ref(git_vector *refs, const char *line)
+{
+	git_pkt_ref *pkt = NULL, *peeled = NULL;
+	const char *name, *attr;
+	size_t name_len;
+
+	pkt = git__calloc(1, sizeof(git_pkt_ref));
+	GITERR_CHECK_ALLOC(pkt);
+	pkt->type = GIT_PKT_REF;
+
+	if (git_oid_fromstrn(&pkt->head.oid, line, GIT_OID_HEXSZ) < 0 ||
+	    line[GIT_OID_HEXSZ] != ' ')
+		goto on_invalid;
+
+	name = line + GIT_OID_HEXSZ + 1;
+	name_len = strcspn(name, " ");
+	if (!name_len)
+		goto on_invalid;
+
+	if ((pkt->head.name = git__strndup(name, name_len)) == NULL)
+		goto on_error;
+
+	for (attr = name + name_len; *attr == ' '; attr += strcspn(attr + 1, " ") + 1) {
+		const char *value;
+		size_t value_len;
+
+		if (!git__prefixcmp(attr + 1, "symref-target:")) {
+			value = attr + 1 + strlen("symref-target:");
+			value_len = strcspn(value, " ");
+
+			git__free(pkt->head.symref_target);
+			if ((pkt->head.symref_target = git__strndup(value, value_len)) == NULL)
+				goto on_error;
+		} else if (!git__prefixcmp(attr + 1, "peeled:") && !peeled) {
+			/* v0 advertises the peeled value as a ref of its own */
+			value = attr + 1 + strlen("peeled:");
+
+			if ((peeled = git__calloc(1, sizeof(git_pkt_ref))) == NULL)
+				goto on_error;
+			peeled->type = GIT_PKT_REF;
+
+			if (git_oid_fromstrn(&peeled->head.oid, value, GIT_OID_HEXSZ) < 0 ||
+			    (value[GIT_OID_HEXSZ] != ' ' && value[GIT_OID_HEXSZ] != '\0'))
+				goto on_invalid;
+
+			if ((peeled->head.name = git__malloc(name_len + strlen("^{}") + 1)) == NULL)
+				goto on_error;
+			memcpy(peeled->head.name, name, name_len);
+			memcpy(peeled->head.name + name_len, "^{}", strlen("^{}") + 1);
+		}
+	}
+
+	if (git_vector_insert(refs, pkt) < 0) {
+		git_pkt_free((git_pkt *)pkt);
+		pkt = NULL;
+		goto on_error;
+	}
+
+	if (peeled && git_vector_insert(refs, peeled) < 0)
+		goto on_error;
+
+	return 0;
+
+on_invalid:
+	giterr_set(GITERR_NET, "Invalid ls-refs response");
+on_error:
+	if (pkt)
+		git_pkt_free((git_pkt *)pkt);
+	if (peeled)
+		git_pkt_free((git_pkt *)peeled);
+	return -1;
+}
+
+/*
+ * List the remote's refs with the v2 "ls-refs" command, asking only for
+ * the ones which the remote's refspecs can use.
+ */
+int git_smart__ls_refs(transport_smart *t)
+{
+	git_buf data = GIT_BUF_INIT, line = GIT_BUF_INIT;
+	git_vector prefixes = GIT_VECTOR_INIT;
+	enum git_pkt_type type;
+	git_pkt *pkt;
+	char *prefix;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&t->refs, i, pkt)
+		git_pkt_free(pkt);
+	git_vector_clear(&t->refs);
+
+	if (!t->caps.ls_refs) {
+		giterr_set(GITERR_NET, "the server does not support ls-refs");
+		return -1;
+	}
+
+	if ((error = ls_refs_prefixes(&prefixes, t->owner)) < 0)
+		goto done;
+
+	git_pkt_buffer_printf(&data, "command=%s", GIT_CAP_LS_REFS);
+	git_pkt_buffer_delim(&data);
+	git_pkt_buffer_printf(&data, "peel");
+	git_pkt_buffer_printf(&data, "symrefs");
+
+	git_vector_foreach(&prefixes, i, prefix)
+		git_pkt_buffer_printf(&data, "ref-prefix %s", prefix);
+
+	git_pkt_buffer_flush(&data);
+
+	if (git_buf_oom(&data)) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+		goto done;
+
+	while ((error = recv_raw(&type, &line, &t->buffer)) == 0 && type == GIT_PKT_LINE) {
+		if ((error = ls_refs_ref(&t->refs, line.ptr)) < 0)
+			goto done;
+	}
+
+	if (!error && type != GIT_PKT_FLUSH) {
+		giterr_set(GITERR_NET, "Invalid ls-refs response");
+		error = -1;
+	}
+
+done:
+	git_vector_foreach(&prefixes, i, prefix)
+		git__free(prefix);
+	git_vector_free(&prefixes);
+	git_buf_free(&line);
+	git_buf_free(&data);
+	return error;
+}
+
 static int recv_pkt(git_pkt **out, gitno_buffer *buf)
 {
 	const char *ptr = buf->data, *line_end = ptr;
@@ -259,74 +651,453 @@ static int store_common(transport_smart *t)
 	return 0;
 }
 
-static int fetch_setup_walk(git_revwalk **out, git_repository *repo)
+static int wait_while_ack(gitno_buffer *buf)
 {
-	git_revwalk *walk = NULL;
-	git_strarray refs;
-	unsigned int i;
-	git_reference *ref;
 	int error;
+	git_pkt_ack *pkt = NULL;
 
-	if ((error = git_reference_list(&refs, repo)) < 0)
-		return error;
+	while (1) {
+		git__free(pkt);
+
+		if ((error = recv_pkt((git_pkt **)&pkt, buf)) < 0)
+			return error;
+
+		if (pkt->type == GIT_PKT_NAK)
+			break;
+
+		if (pkt->type == GIT_PKT_ACK &&
+		    (pkt->status != GIT_ACK_CONTINUE &&
+		     pkt->status != GIT_ACK_COMMON)) {
+			git__free(pkt);
+			return 0;
+		}
+	}
+
+	git__free(pkt);
+	return 0;
+}
+
+static git_fetch_negotiation_t negotiation(transport_smart *t)
+{
+	return t->owner ? t->owner->negotiation : GIT_FETCH_NEGOTIATION_UNSPECIFIED;
+}
+
+static bool deepening(transport_smart *t)
+{
+	return t->owner && git_remote__deepening(t->owner);
+}
+
+/* Make sure the server can work with where our history stops */
+static int check_shallow(transport_smart *t, const git_shallow *shallow)
+{
+	git_remote *remote = t->owner;
+
+	if (!git_array_size(shallow->roots) && !deepening(t))
+		return 0;
 
-	if ((error = git_revwalk_new(&walk, repo)) < 0)
+	if (!t->caps.shallow) {
+		giterr_set(GITERR_NET, "the server does not support shallow repositories");
+		return -1;
+	}
+
+	if (remote->shallow_since && !t->caps.deepen_since) {
+		giterr_set(GITERR_NET, "the server does not support fetching since a date");
+		return -1;
+	}
+
+	if (remote->shallow_exclude.count && !t->caps.deepen_not) {
+		giterr_set(GITERR_NET, "the server does not support excluding refs");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Tell the server which of our commits we don't have the parents of,
+ * and how far back in history we want it to go.
+ */
+static int buffer_shallow(git_buf *buf, transport_smart *t, const git_shallow *shallow)
+{
+	git_remote *remote = t->owner;
+	char oid[GIT_OID_HEXSZ + 1];
+	size_t i;
+
+	for (i = 0; i < git_array_size(shallow->roots); i++) {
+		git_oid_tostr(oid, sizeof(oid), git_array_get(shallow->roots, i));
+
+		if (git_pkt_buffer_printf(buf, "shallow %s", oid) < 0)
+			return -1;
+	}
+
+	if (!deepening(t))
+		return 0;
+
+	if (remote->depth > 0 &&
+	    git_pkt_buffer_printf(buf, "deepen %d", remote->depth) < 0)
+		return -1;
+
+	if (remote->shallow_since &&
+	    git_pkt_buffer_printf(buf, "deepen-since %" PRId64, (int64_t)remote->shallow_since) < 0)
+		return -1;
+
+	for (i = 0; i < remote->shallow_exclude.count; i++) {
+		if (git_pkt_buffer_printf(buf, "deepen-not %s",
+				remote->shallow_exclude.strings[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int add_shallow_id(git_array_oid_t *ids, const char *hex)
+{
+	git_oid *id = git_array_alloc(*ids);
+	GITERR_CHECK_ALLOC(id);
+
+	if (strlen(hex) != GIT_OID_HEXSZ || git_oid_fromstr(id, hex) < 0) {
+		giterr_set(GITERR_NET, "Invalid shallow line");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the "shallow" and "unshallow" lines with which the server moves
+ * our shallow boundary, up to the packet which ends them; the remote
+ * keeps them until we have the pack.
+ */
+static int recv_shallow_lines(enum git_pkt_type *type, transport_smart *t)
+{
+	git_array_oid_t shallow_ids = GIT_ARRAY_INIT, unshallow_ids = GIT_ARRAY_INIT;
+	git_buf line = GIT_BUF_INIT;
+	int error;
+
+	while ((error = recv_raw(type, &line, &t->buffer)) == 0 && *type == GIT_PKT_LINE) {
+		if (!git__prefixcmp(line.ptr, "shallow "))
+			error = add_shallow_id(&shallow_ids, line.ptr + strlen("shallow "));
+		else if (!git__prefixcmp(line.ptr, "unshallow "))
+			error = add_shallow_id(&unshallow_ids, line.ptr + strlen("unshallow "));
+		else {
+			giterr_set(GITERR_NET, "Unexpected line in the shallow list");
+			error = -1;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	if (!error && t->owner) {
+		git_array_clear(t->owner->shallow_ids);
+		git_array_clear(t->owner->unshallow_ids);
+
+		t->owner->shallow_ids = shallow_ids;
+		t->owner->unshallow_ids = unshallow_ids;
+	} else {
+		git_array_clear(shallow_ids);
+		git_array_clear(unshallow_ids);
+	}
+
+	git_buf_free(&line);
+	return error;
+}
+
+/*
+ * When we ask it to deepen, the server sends the new boundary before
+ * its first answer; a stateless one sends it before every answer.
+ */
+static int recv_shallow_info(transport_smart *t, bool *pending)
+{
+	enum git_pkt_type type;
+	int error;
+
+	if (!*pending)
+		return 0;
+
+	*pending = t->rpc;
+
+	if ((error = recv_shallow_lines(&type, t)) < 0)
 		return error;
 
-	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	if (type != GIT_PKT_FLUSH) {
+		giterr_set(GITERR_NET, "Invalid shallow list");
+		return -1;
+	}
 
-	for (i = 0; i < refs.count; ++i) {
-		/* No tags */
-		if (!git__prefixcmp(refs.strings[i], GIT_REFS_TAGS_DIR))
-			continue;
+	return 0;
+}
 
-		if ((error = git_reference_lookup(&ref, repo, refs.strings[i])) < 0)
-			goto on_error;
+/* The wants, and what goes along with them */
+static int buffer_wants(
+	git_buf *buf,
+	transport_smart *t,
+	const git_shallow *shallow,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	if (git_pkt_buffer_wants(wants, count, &t->caps, buf) < 0 ||
+	    buffer_shallow(buf, t, shallow) < 0)
+		return -1;
+
+	return git_pkt_buffer_flush(buf);
+}
+
+/*
+ * Tell the negotiator about the commits which the server acknowledged
+ * since we had `known` of them. Returns 1 when the server is ready to
+ * send the pack.
+ */
+static int ack_common(transport_smart *t, git_fetch_negotiator *negotiator, size_t known)
+{
+	git_pkt_ack *ack;
+	int ready = 0;
+
+	for (; known < t->common.length; known++) {
+		ack = git_vector_get(&t->common, known);
+
+		if (git_fetch_negotiator_ack(negotiator, &ack->oid) < 0)
+			return -1;
 
-		if (git_reference_type(ref) == GIT_REF_SYMBOLIC)
+		if (ack->status == GIT_ACK_READY)
+			ready = 1;
+	}
+
+	return ready;
+}
+
+/*
+ * A v2 fetch request: the arguments, the wants and whatever we already
+ * know to be common. The server keeps no state between requests, so
+ * every round repeats these.
+ */
+static int buffer_fetch_v2(
+	git_buf *buf,
+	transport_smart *t,
+	const git_shallow *shallow,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	char oid[GIT_OID_HEXSZ + 1];
+	git_pkt_ack *ack;
+	size_t i;
+
+	git_pkt_buffer_printf(buf, "command=%s", GIT_CAP_FETCH);
+	git_pkt_buffer_delim(buf);
+	git_pkt_buffer_printf(buf, GIT_CAP_THIN_PACK);
+	git_pkt_buffer_printf(buf, GIT_CAP_OFS_DELTA);
+	git_pkt_buffer_printf(buf, GIT_CAP_INCLUDE_TAG);
+
+	for (i = 0; i < count; i++) {
+		if (wants[i]->local)
 			continue;
 
-		if ((error = git_revwalk_push(walk, git_reference_target(ref))) < 0)
-			goto on_error;
+		git_oid_tostr(oid, sizeof(oid), &wants[i]->oid);
+		git_pkt_buffer_printf(buf, "want %s", oid);
+	}
+
+	if (buffer_shallow(buf, t, shallow) < 0)
+		return -1;
+
+	git_vector_foreach(&t->common, i, ack)
+		git_pkt_buffer_have(&ack->oid, buf);
+
+	return git_buf_oom(buf) ? -1 : 0;
+}
+
+/*
+ * Read the "acknowledgments" section of a v2 fetch response. Returns 1
+ * when the server is ready and the pack follows, 0 when it wants more
+ * haves.
+ */
+static int recv_acknowledgments_v2(transport_smart *t)
+{
+	git_buf line = GIT_BUF_INIT;
+	enum git_pkt_type type;
+	git_pkt_ack *ack;
+	int error, ready = 0;
+
+	if ((error = recv_raw(&type, &line, &t->buffer)) < 0)
+		goto done;
+
+	if (type != GIT_PKT_LINE || strcmp(line.ptr, "acknowledgments"))
+		goto on_invalid;
+
+	while ((error = recv_raw(&type, &line, &t->buffer)) == 0 && type == GIT_PKT_LINE) {
+		if (!strcmp(line.ptr, "ready")) {
+			ready = 1;
+		} else if (!git__prefixcmp(line.ptr, "ACK ")) {
+			if ((ack = git__calloc(1, sizeof(git_pkt_ack))) == NULL) {
+				error = -1;
+				goto done;
+			}
+
+			ack->type = GIT_PKT_ACK;
+			ack->status = GIT_ACK_COMMON;
 
-		git_reference_free(ref);
+			if (git_oid_fromstr(&ack->oid, line.ptr + strlen("ACK ")) < 0 ||
+			    git_vector_insert(&t->common, ack) < 0) {
+				git__free(ack);
+				error = -1;
+				goto done;
+			}
+		} else if (strcmp(line.ptr, "NAK")) {
+			goto on_invalid;
+		}
 	}
 
-	git_strarray_free(&refs);
-	*out = walk;
-	return 0;
+	if (error < 0)
+		goto done;
 
-on_error:
-	git_revwalk_free(walk);
-	git_reference_free(ref);
-	git_strarray_free(&refs);
+	if (type == GIT_PKT_DELIM && ready)
+		error = 1;
+	else if (type != GIT_PKT_FLUSH || ready)
+		goto on_invalid;
+
+	goto done;
+
+on_invalid:
+	giterr_set(GITERR_NET, "Invalid fetch response");
+	error = -1;
+done:
+	git_buf_free(&line);
 	return error;
 }
 
-static int wait_while_ack(gitno_buffer *buf)
+/*
+ * Read the shallow boundary, if the server sent one, and skip any
+ * other sections we have no use for, up to where the pack starts
+ */
+static int recv_packfile_v2(transport_smart *t)
 {
+	git_buf line = GIT_BUF_INIT;
+	enum git_pkt_type type;
 	int error;
-	git_pkt_ack *pkt = NULL;
 
-	while (1) {
-		git__free(pkt);
+	while ((error = recv_raw(&type, &line, &t->buffer)) == 0) {
+		if (type != GIT_PKT_LINE)
+			break;
 
-		if ((error = recv_pkt((git_pkt **)&pkt, buf)) < 0)
-			return error;
+		if (!strcmp(line.ptr, "packfile"))
+			goto done;
 
-		if (pkt->type == GIT_PKT_NAK)
+		if (!strcmp(line.ptr, "shallow-info"))
+			error = recv_shallow_lines(&type, t);
+		else
+			while ((error = recv_raw(&type, &line, &t->buffer)) == 0 && type == GIT_PKT_LINE)
+				/* skip */;
+
+		if (error < 0 || type != GIT_PKT_DELIM)
 			break;
+	}
 
-		if (pkt->type == GIT_PKT_ACK &&
-		    (pkt->status != GIT_ACK_CONTINUE &&
-		     pkt->status != GIT_ACK_COMMON)) {
-			git__free(pkt);
-			return 0;
+	if (!error) {
+		giterr_set(GITERR_NET, "Invalid fetch response");
+		error = -1;
+	}
+
+done:
+	git_buf_free(&line);
+	return error;
+}
+
+static int negotiate_fetch_v2(
+	transport_smart *t,
+	git_repository *repo,
+	const git_shallow *shallow,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	git_buf data = GIT_BUF_INIT;
+	git_fetch_negotiator *negotiator = NULL;
+	unsigned int in_vain = 0, sent;
+	int error, ready = 0;
+	bool exhausted = false;
+	size_t known;
+	git_oid oid;
+
+	if (!t->caps.fetch) {
+		giterr_set(GITERR_NET, "the server does not support fetch");
+		return -1;
+	}
+
+	if ((error = git_fetch_negotiator_new(&negotiator, repo, negotiation(t))) < 0)
+		goto done;
+
+	/*
+	 * As with v0, we give up once we've sent 256 haves without the
+	 * server knowing any of them.
+	 */
+	while (!ready && !exhausted && in_vain < 256) {
+		git_buf_clear(&data);
+		if ((error = buffer_fetch_v2(&data, t, shallow, wants, count)) < 0)
+			goto done;
+
+		for (sent = 0; sent < 20 && in_vain < 256; sent++, in_vain++) {
+			if ((error = git_fetch_negotiator_next(&oid, negotiator)) == GIT_ITEROVER) {
+				exhausted = true;
+				error = 0;
+				break;
+			} else if (error < 0) {
+				goto done;
+			}
+
+			git_pkt_buffer_have(&oid, &data);
+		}
+
+		if (!sent)
+			break;
+
+		if ((error = git_pkt_buffer_flush(&data)) < 0)
+			goto done;
+
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto done;
+		}
+
+		known = t->common.length;
+
+		if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0 ||
+		    (error = recv_acknowledgments_v2(t)) < 0)
+			goto done;
+
+		ready = error;
+
+		if (t->common.length > known) {
+			in_vain = 0;
+
+			if ((error = ack_common(t, negotiator, known)) < 0)
+				goto done;
 		}
 	}
 
-	git__free(pkt);
-	return 0;
+	/* Tell the other end that we're done negotiating */
+	if (!ready) {
+		git_buf_clear(&data);
+
+		if ((error = buffer_fetch_v2(&data, t, shallow, wants, count)) < 0 ||
+		    (error = git_pkt_buffer_done(&data)) < 0 ||
+		    (error = git_pkt_buffer_flush(&data)) < 0)
+			goto done;
+
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto done;
+		}
+
+		if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+			goto done;
+	}
+
+	error = recv_packfile_v2(t);
+
+done:
+	git_fetch_negotiator_free(negotiator);
+	git_buf_free(&data);
+	return error;
 }
 
 int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, const git_remote_head * const *wants, size_t count)
@@ -334,26 +1105,46 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 	transport_smart *t = (transport_smart *)transport;
 	gitno_buffer *buf = &t->buffer;
 	git_buf data = GIT_BUF_INIT;
-	git_revwalk *walk = NULL;
-	int error = -1, pkt_type;
-	unsigned int i;
+	git_fetch_negotiator *negotiator = NULL;
+	git_shallow *shallow;
+	int error = -1, pkt_type, ready = 0;
+	unsigned int i, in_vain;
+	bool shallow_info;
+	size_t known;
 	git_oid oid;
 
-	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
+	if ((error = git_shallow__get(&shallow, repo)) < 0)
+		return error;
+
+	if ((error = check_shallow(t, shallow)) < 0) {
+		git_shallow_free(shallow);
 		return error;
+	}
+
+	if (t->protocol_version == 2) {
+		error = negotiate_fetch_v2(t, repo, shallow, wants, count);
+		git_shallow_free(shallow);
+		return error;
+	}
 
-	if ((error = fetch_setup_walk(&walk, repo)) < 0)
+	shallow_info = deepening(t);
+
+	if ((error = buffer_wants(&data, t, shallow, wants, count)) < 0)
+		goto on_error;
+
+	if ((error = git_fetch_negotiator_new(&negotiator, repo, negotiation(t))) < 0)
 		goto on_error;
 
 	/*
-	 * Our support for ACK extensions is simply to parse them. On
-	 * the first ACK we will accept that as enough common
-	 * objects. We give up if we haven't found an answer in the
-	 * first 256 we send.
+	 * Our support for ACK extensions is simply to parse them and
+	 * pass them on to the negotiator, which decides whether to keep
+	 * going; the consecutive one accepts the first ACK as enough
+	 * common objects. We give up if we haven't found an answer in
+	 * the 256 haves since the last one.
 	 */
-	i = 0;
-	while (i < 256) {
-		error = git_revwalk_next(&oid, walk);
+	i = in_vain = 0;
+	while (in_vain < 256 && !ready) {
+		error = git_fetch_negotiator_next(&oid, negotiator);
 
 		if (error < 0) {
 			if (GIT_ITEROVER == error)
@@ -364,6 +1155,7 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 
 		git_pkt_buffer_have(&oid, &data);
 		i++;
+		in_vain++;
 		if (i % 20 == 0) {
 			if (t->cancelled.val) {
 				giterr_set(GITERR_NET, "The fetch was cancelled by the user");
@@ -381,9 +1173,21 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 				goto on_error;
 
 			git_buf_clear(&data);
+
+			if ((error = recv_shallow_info(t, &shallow_info)) < 0)
+				goto on_error;
+
 			if (t->caps.multi_ack || t->caps.multi_ack_detailed) {
-				if ((error = store_common(t)) < 0)
+				known = t->common.length;
+
+				if ((error = store_common(t)) < 0 ||
+				    (error = ack_common(t, negotiator, known)) < 0)
 					goto on_error;
+
+				ready = error;
+
+				if (t->common.length > known)
+					in_vain = 0;
 			} else {
 				pkt_type = recv_pkt(NULL, buf);
 
@@ -403,14 +1207,14 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 			}
 		}
 
-		if (t->common.length > 0)
+		if (ready)
 			break;
 
 		if (i % 20 == 0 && t->rpc) {
 			git_pkt_ack *pkt;
 			unsigned int i;
 
-			if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
+			if ((error = buffer_wants(&data, t, shallow, wants, count)) < 0)
 				goto on_error;
 
 			git_vector_foreach(&t->common, i, pkt) {
@@ -425,12 +1229,15 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		}
 	}
 
-	/* Tell the other end that we're done negotiating */
-	if (t->rpc && t->common.length > 0) {
+	/*
+	 * Tell the other end that we're done negotiating; if we just
+	 * sent a batch of haves, the wants have to be repeated first
+	 */
+	if (t->rpc && !git_buf_len(&data)) {
 		git_pkt_ack *pkt;
 		unsigned int i;
 
-		if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
+		if ((error = buffer_wants(&data, t, shallow, wants, count)) < 0)
 			goto on_error;
 
 		git_vector_foreach(&t->common, i, pkt) {
@@ -456,7 +1263,11 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 		goto on_error;
 
 	git_buf_free(&data);
-	git_revwalk_free(walk);
+	git_fetch_negotiator_free(negotiator);
+	git_shallow_free(shallow);
+
+	if ((error = recv_shallow_info(t, &shallow_info)) < 0)
+		return error;
 
 	/* Now let's eat up whatever the server gives us */
 	if (!t->caps.multi_ack && !t->caps.multi_ack_detailed) {
@@ -475,7 +1286,8 @@ int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, c
 	return error;
 
 on_error:
-	git_revwalk_free(walk);
+	git_fetch_negotiator_free(negotiator);
+	git_shallow_free(shallow);
 	git_buf_free(&data);
 	return error;
 }
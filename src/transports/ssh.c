@@ -108,6 +108,22 @@ static int send_command(ssh_stream *s)
 	if (error < 0)
 		goto cleanup;
 
+	if (OWNING_SUBTRANSPORT(s)->owner->protocol_version == 2) {
+		error = libssh2_channel_setenv(s->channel, "GIT_PROTOCOL", "version=2");
+
+		/*
+		 * Servers which do not accept the variable deny the
+		 * request, and will answer with the v0 advertisement.
+		 */
+		if (error == LIBSSH2_ERROR_CHANNEL_REQUEST_DENIED)
+			error = 0;
+
+		if (error < LIBSSH2_ERROR_NONE) {
+			ssh_error(s->session, "SSH could not set the protocol version");
+			goto cleanup;
+		}
+	}
+
 	error = libssh2_channel_exec(s->channel, request.ptr);
 	if (error < LIBSSH2_ERROR_NONE) {
 		ssh_error(s->session, "SSH could not execute request");
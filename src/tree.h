@@ -12,20 +12,24 @@
 #include "odb.h"
 #include "vector.h"
 #include "strmap.h"
-#include "pool.h"
+#include "array.h"
 
+/*
+ * The entries of a tree point into its raw object data, where the
+ * filename is followed by a NUL and then the raw id; entries that
+ * are not part of a tree carry that data after themselves.
+ */
 struct git_tree_entry {
 	uint16_t attr;
 	uint16_t filename_len;
-	git_oid oid;
-	bool pooled;
-	char filename[GIT_FLEX_ARRAY];
+	const git_oid *oid;
+	const char *filename;
 };
 
 struct git_tree {
 	git_object object;
-	git_vector entries;
-	git_pool pool;
+	git_odb_object *odb_obj;
+	git_array_t(git_tree_entry) entries;
 };
 
 struct git_treebuilder {
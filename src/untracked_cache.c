@@ -0,0 +1,1139 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked_cache.h"
+#include "index.h"
+#include "ignore.h"
+#include "attrcache.h"
+#include "config.h"
+#include "repository.h"
+#include "odb.h"
+#include "ewah.h"
+#include "varint.h"
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+/*
+ * The UNTR extension starts with the location the cache was made for,
+ * the stat data and blob ids of `$GIT_DIR/info/exclude` and of
+ * `core.excludesfile`, the flags of the directory walk that made the
+ * cache and the name of the per-directory ignore files.  It is followed
+ * by the directories in depth first order, each one with its untracked
+ * entries, and by three bitmaps telling which directories are valid,
+ * which ones were only checked for the presence of an untracked entry
+ * and which ones have an ignore file.  The stat data of the valid
+ * directories and the blob ids of the ignore files come last.
+ */
+
+#define UNTRACKED_STAT_SIZE (9 * sizeof(uint32_t))
+#define UNTRACKED_MAX_DEPTH 1024
+
+static int untracked_error_invalid(const char *message)
+{
+	giterr_set(GITERR_INDEX, "Invalid untracked cache in index - %s", message);
+	return -1;
+}
+
+static void untracked_stat_init(git_untracked_cache_stat *out, struct stat *st)
+{
+	memset(out, 0, sizeof(*out));
+
+	out->ctime.seconds = (int32_t)st->st_ctime;
+	out->mtime.seconds = (int32_t)st->st_mtime;
+#if defined(GIT_USE_NSEC)
+	out->ctime.nanoseconds = st->st_ctime_nsec;
+	out->mtime.nanoseconds = st->st_mtime_nsec;
+#endif
+	out->dev = (uint32_t)st->st_dev;
+	out->ino = (uint32_t)st->st_ino;
+	out->uid = (uint32_t)st->st_uid;
+	out->gid = (uint32_t)st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+/* Like core git, do not trust the device number, it is not stable on
+ * network filesystems.
+ */
+static bool untracked_stat_equal(
+	const git_untracked_cache_stat *one, const git_untracked_cache_stat *two)
+{
+	return git_index_time_eq(&one->mtime, &two->mtime) &&
+		git_index_time_eq(&one->ctime, &two->ctime) &&
+		one->ino == two->ino &&
+		one->uid == two->uid &&
+		one->gid == two->gid &&
+		one->size == two->size;
+}
+
+/* A directory modified no earlier than the index was written may have
+ * changed again without its timestamp showing it.
+ */
+static bool untracked_stat_is_racy(
+	git_untracked_cache *uc, const git_untracked_cache_stat *st)
+{
+	if (!uc->index_mtime.seconds)
+		return false;
+
+	if (uc->index_mtime.seconds != st->mtime.seconds)
+		return uc->index_mtime.seconds < st->mtime.seconds;
+
+#if defined(GIT_USE_NSEC)
+	return uc->index_mtime.nanoseconds <= st->mtime.nanoseconds;
+#else
+	return true;
+#endif
+}
+
+static void untracked_stat_read(
+	git_untracked_cache_stat *out, const unsigned char *data)
+{
+	uint32_t fields[9];
+	size_t i;
+
+	memcpy(fields, data, sizeof(fields));
+	for (i = 0; i < ARRAY_SIZE(fields); i++)
+		fields[i] = ntohl(fields[i]);
+
+	out->ctime.seconds = (int32_t)fields[0];
+	out->ctime.nanoseconds = fields[1];
+	out->mtime.seconds = (int32_t)fields[2];
+	out->mtime.nanoseconds = fields[3];
+	out->dev = fields[4];
+	out->ino = fields[5];
+	out->uid = fields[6];
+	out->gid = fields[7];
+	out->size = fields[8];
+}
+
+static int untracked_stat_write(git_buf *out, const git_untracked_cache_stat *st)
+{
+	uint32_t fields[9];
+	size_t i;
+
+	fields[0] = (uint32_t)st->ctime.seconds;
+	fields[1] = st->ctime.nanoseconds;
+	fields[2] = (uint32_t)st->mtime.seconds;
+	fields[3] = st->mtime.nanoseconds;
+	fields[4] = st->dev;
+	fields[5] = st->ino;
+	fields[6] = st->uid;
+	fields[7] = st->gid;
+	fields[8] = st->size;
+
+	for (i = 0; i < ARRAY_SIZE(fields); i++)
+		fields[i] = htonl(fields[i]);
+
+	return git_buf_put(out, (const char *)fields, sizeof(fields));
+}
+
+static int untracked_put_varint(git_buf *out, uintmax_t value)
+{
+	unsigned char buf[16];
+	int len = git_encode_varint(buf, sizeof(buf), value);
+
+	return git_buf_put(out, (const char *)buf, len);
+}
+
+static int untracked_get_varint(
+	size_t *out, const unsigned char **data, const unsigned char *end)
+{
+	uintmax_t value;
+	size_t len;
+
+	if (*data >= end)
+		return untracked_error_invalid("ran out of data");
+
+	value = git_decode_varint(*data, &len);
+
+	if (!len || *data + len > end || value > SIZE_MAX)
+		return untracked_error_invalid("invalid number");
+
+	*out = (size_t)value;
+	*data += len;
+	return 0;
+}
+
+static const char *untracked_get_string(
+	const unsigned char **data, const unsigned char *end)
+{
+	const char *str = (const char *)*data;
+	const unsigned char *nul;
+
+	if (*data >= end || (nul = memchr(*data, '\0', end - *data)) == NULL)
+		return NULL;
+
+	*data = nul + 1;
+	return str;
+}
+
+static int untracked_dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_cache_dir *one = a, *two = b;
+	return strcmp(one->name, two->name);
+}
+
+static git_untracked_cache_dir *untracked_dir_new(const char *name, size_t len)
+{
+	git_untracked_cache_dir *dir;
+	size_t alloclen;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(*dir), len) ||
+		GIT_ADD_SIZET_OVERFLOW(&alloclen, alloclen, 1) ||
+		(dir = git__calloc(1, alloclen)) == NULL)
+		return NULL;
+
+	memcpy(dir->name, name, len);
+	git_vector_set_cmp(&dir->dirs, untracked_dir_cmp);
+	return dir;
+}
+
+static void untracked_dir_clear_untracked(git_untracked_cache_dir *dir)
+{
+	char *name;
+	size_t i;
+
+	git_vector_foreach(&dir->untracked, i, name)
+		git__free(name);
+	git_vector_clear(&dir->untracked);
+}
+
+static void untracked_dir_free(git_untracked_cache_dir *dir);
+
+static void untracked_dir_clear_dirs(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		untracked_dir_free(child);
+	git_vector_clear(&dir->dirs);
+}
+
+static void untracked_dir_free(git_untracked_cache_dir *dir)
+{
+	if (!dir)
+		return;
+
+	untracked_dir_clear_untracked(dir);
+	untracked_dir_clear_dirs(dir);
+	git_vector_free(&dir->untracked);
+	git_vector_free(&dir->dirs);
+	git__free(dir);
+}
+
+static git_untracked_cache_dir *untracked_dir_find(
+	git_untracked_cache_dir *dir, const char *name, size_t len)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (!strncmp(child->name, name, len) && child->name[len] == '\0')
+			return child;
+	}
+
+	return NULL;
+}
+
+static int untracked_dir_add_untracked(
+	git_untracked_cache_dir *dir, const char *name, size_t len, bool is_dir)
+{
+	git_buf buf = GIT_BUF_INIT;
+	const char *existing;
+	size_t i;
+
+	if (git_buf_put(&buf, name, len) < 0 ||
+		(is_dir && git_buf_putc(&buf, '/') < 0))
+		return -1;
+
+	git_vector_foreach(&dir->untracked, i, existing) {
+		if (!strcmp(existing, buf.ptr)) {
+			git_buf_free(&buf);
+			return 0;
+		}
+	}
+
+	return git_vector_insert(&dir->untracked, git_buf_detach(&buf));
+}
+
+typedef struct {
+	const unsigned char *data;
+	const unsigned char *end;
+	git_vector dirs; /* every directory, in the order they are stored */
+} untracked_reader;
+
+static int read_one_dir(
+	git_untracked_cache_dir **out, untracked_reader *reader, size_t depth)
+{
+	git_untracked_cache_dir *dir = NULL, *child;
+	const char *name;
+	size_t untracked_nr, dirs_nr, i;
+
+	*out = NULL;
+
+	if (depth > UNTRACKED_MAX_DEPTH)
+		return untracked_error_invalid("directories are nested too deeply");
+
+	if (untracked_get_varint(&untracked_nr, &reader->data, reader->end) < 0 ||
+		untracked_get_varint(&dirs_nr, &reader->data, reader->end) < 0)
+		return -1;
+
+	if ((name = untracked_get_string(&reader->data, reader->end)) == NULL)
+		return untracked_error_invalid("invalid directory name");
+
+	dir = untracked_dir_new(name, strlen(name));
+	GITERR_CHECK_ALLOC(dir);
+
+	if (git_vector_insert(&reader->dirs, dir) < 0) {
+		untracked_dir_free(dir);
+		return -1;
+	}
+
+	/* from now on `reader->dirs` owns `dir` */
+	for (i = 0; i < untracked_nr; i++) {
+		char *entry;
+
+		if ((name = untracked_get_string(&reader->data, reader->end)) == NULL)
+			return untracked_error_invalid("invalid untracked entry");
+
+		if ((entry = git__strdup(name)) == NULL ||
+			git_vector_insert(&dir->untracked, entry) < 0) {
+			git__free(entry);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < dirs_nr; i++) {
+		if (read_one_dir(&child, reader, depth + 1) < 0 ||
+			git_vector_insert(&dir->dirs, child) < 0)
+			return -1;
+	}
+
+	*out = dir;
+	return 0;
+}
+
+static int untracked_read_bitmap(
+	git_bitmap *out, const unsigned char **data, const unsigned char *end)
+{
+	size_t consumed;
+
+	if (git_ewah_parse(out, &consumed, *data, end - *data) < 0)
+		return -1;
+
+	*data += consumed;
+	return 0;
+}
+
+static int read_dirs(git_untracked_cache *uc, untracked_reader *reader)
+{
+	git_bitmap valid = GIT_BITMAP_INIT, check_only = GIT_BITMAP_INIT,
+		exclude_valid = GIT_BITMAP_INIT;
+	git_untracked_cache_dir *dir;
+	size_t dirs_nr, i;
+	int error = -1;
+
+	if (untracked_get_varint(&dirs_nr, &reader->data, reader->end) < 0)
+		return -1;
+
+	if (!dirs_nr)
+		return 0;
+
+	if (read_one_dir(&uc->root, reader, 0) < 0)
+		goto done;
+
+	if (reader->dirs.length != dirs_nr) {
+		untracked_error_invalid("wrong number of directories");
+		goto done;
+	}
+
+	if (untracked_read_bitmap(&valid, &reader->data, reader->end) < 0 ||
+		untracked_read_bitmap(&check_only, &reader->data, reader->end) < 0 ||
+		untracked_read_bitmap(&exclude_valid, &reader->data, reader->end) < 0)
+		goto done;
+
+	git_vector_foreach(&reader->dirs, i, dir) {
+		dir->check_only = git_bitmap_get(&check_only, i);
+
+		if (!git_bitmap_get(&valid, i))
+			continue;
+
+		if ((size_t)(reader->end - reader->data) < UNTRACKED_STAT_SIZE) {
+			untracked_error_invalid("truncated stat data");
+			goto done;
+		}
+
+		dir->valid = 1;
+		untracked_stat_read(&dir->stat, reader->data);
+		reader->data += UNTRACKED_STAT_SIZE;
+	}
+
+	git_vector_foreach(&reader->dirs, i, dir) {
+		if (!git_bitmap_get(&exclude_valid, i))
+			continue;
+
+		if ((size_t)(reader->end - reader->data) < GIT_OID_RAWSZ) {
+			untracked_error_invalid("truncated ignore file ids");
+			goto done;
+		}
+
+		git_oid_fromraw(&dir->exclude_oid, reader->data);
+		reader->data += GIT_OID_RAWSZ;
+	}
+
+	error = 0;
+
+done:
+	/* every directory is in the list, whether its parent has it or not */
+	if (error < 0) {
+		git_vector_foreach(&reader->dirs, i, dir) {
+			git_vector_free(&dir->dirs);
+			untracked_dir_free(dir);
+		}
+		uc->root = NULL;
+	}
+
+	git_bitmap_free(&valid);
+	git_bitmap_free(&check_only);
+	git_bitmap_free(&exclude_valid);
+	return error;
+}
+
+int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *uc;
+	untracked_reader reader = { 0 };
+	const char *exclude_per_dir;
+	size_t ident_len;
+	int error = -1;
+
+	*out = NULL;
+
+	/* the extension always ends with a NUL byte */
+	if (buffer_size <= 1 || buffer[buffer_size - 1] != '\0')
+		return untracked_error_invalid("missing terminator");
+
+	reader.data = (const unsigned char *)buffer;
+	reader.end = reader.data + buffer_size - 1;
+
+	uc = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(uc);
+
+	if (untracked_get_varint(&ident_len, &reader.data, reader.end) < 0)
+		goto done;
+
+	if ((size_t)(reader.end - reader.data) < ident_len) {
+		untracked_error_invalid("truncated location");
+		goto done;
+	}
+
+	if (git_buf_put(&uc->ident, (const char *)reader.data, ident_len) < 0)
+		goto done;
+	reader.data += ident_len;
+
+	if ((size_t)(reader.end - reader.data) <
+		2 * UNTRACKED_STAT_SIZE + sizeof(uint32_t) + 2 * GIT_OID_RAWSZ) {
+		untracked_error_invalid("truncated header");
+		goto done;
+	}
+
+	untracked_stat_read(&uc->info_exclude_stat, reader.data);
+	reader.data += UNTRACKED_STAT_SIZE;
+	untracked_stat_read(&uc->excludes_file_stat, reader.data);
+	reader.data += UNTRACKED_STAT_SIZE;
+
+	memcpy(&uc->dir_flags, reader.data, sizeof(uint32_t));
+	uc->dir_flags = ntohl(uc->dir_flags);
+	reader.data += sizeof(uint32_t);
+
+	git_oid_fromraw(&uc->info_exclude_oid, reader.data);
+	reader.data += GIT_OID_RAWSZ;
+	git_oid_fromraw(&uc->excludes_file_oid, reader.data);
+	reader.data += GIT_OID_RAWSZ;
+
+	if ((exclude_per_dir = untracked_get_string(&reader.data, reader.end)) == NULL) {
+		untracked_error_invalid("invalid ignore file name");
+		goto done;
+	}
+
+	uc->exclude_per_dir = git__strdup(exclude_per_dir);
+	GITERR_CHECK_ALLOC(uc->exclude_per_dir);
+
+	/* a cache without any directory ends here */
+	if (reader.data < reader.end) {
+		if (git_vector_init(&reader.dirs, 16, NULL) < 0 ||
+			read_dirs(uc, &reader) < 0)
+			goto done;
+	}
+
+	if (reader.data != reader.end) {
+		untracked_error_invalid("trailing data");
+		goto done;
+	}
+
+	*out = uc;
+	error = 0;
+
+done:
+	git_vector_free(&reader.dirs);
+
+	if (error < 0)
+		git_untracked_cache_free(uc);
+
+	return error;
+}
+
+typedef struct {
+	git_buf dirs;
+	git_buf stats;
+	git_buf exclude_oids;
+	git_bitmap valid;
+	git_bitmap check_only;
+	git_bitmap exclude_valid;
+	size_t index;
+} untracked_writer;
+
+static int write_one_dir(untracked_writer *writer, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	const char *name;
+	size_t pos = writer->index++, i;
+
+	/* an invalid directory has no untracked entries worth keeping */
+	if (!dir->valid) {
+		untracked_dir_clear_untracked(dir);
+		dir->check_only = 0;
+	}
+
+	if (dir->check_only && git_bitmap_set(&writer->check_only, pos) < 0)
+		return -1;
+
+	if (dir->valid &&
+		(git_bitmap_set(&writer->valid, pos) < 0 ||
+		 untracked_stat_write(&writer->stats, &dir->stat) < 0))
+		return -1;
+
+	if (!git_oid_iszero(&dir->exclude_oid) &&
+		(git_bitmap_set(&writer->exclude_valid, pos) < 0 ||
+		 git_buf_put(&writer->exclude_oids,
+			(const char *)dir->exclude_oid.id, GIT_OID_RAWSZ) < 0))
+		return -1;
+
+	if (untracked_put_varint(&writer->dirs, dir->untracked.length) < 0 ||
+		untracked_put_varint(&writer->dirs, dir->dirs.length) < 0 ||
+		git_buf_put(&writer->dirs, dir->name, strlen(dir->name) + 1) < 0)
+		return -1;
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		if (git_buf_put(&writer->dirs, name, strlen(name) + 1) < 0)
+			return -1;
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (write_one_dir(writer, child) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_write(git_buf *out, git_untracked_cache *uc)
+{
+	untracked_writer writer;
+	uint32_t dir_flags = htonl(uc->dir_flags);
+	int error = -1;
+
+	memset(&writer, 0, sizeof(writer));
+
+	if (untracked_put_varint(out, uc->ident.size) < 0 ||
+		git_buf_put(out, uc->ident.ptr, uc->ident.size) < 0 ||
+		untracked_stat_write(out, &uc->info_exclude_stat) < 0 ||
+		untracked_stat_write(out, &uc->excludes_file_stat) < 0 ||
+		git_buf_put(out, (const char *)&dir_flags, sizeof(dir_flags)) < 0 ||
+		git_buf_put(out, (const char *)uc->info_exclude_oid.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, (const char *)uc->excludes_file_oid.id, GIT_OID_RAWSZ) < 0 ||
+		git_buf_put(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1) < 0)
+		return -1;
+
+	if (!uc->root) {
+		if (untracked_put_varint(out, 0) < 0)
+			return -1;
+	} else {
+		if (write_one_dir(&writer, uc->root) < 0 ||
+			untracked_put_varint(out, writer.index) < 0 ||
+			git_buf_put(out, writer.dirs.ptr, writer.dirs.size) < 0 ||
+			git_ewah_serialize_bits(out, &writer.valid) < 0 ||
+			git_ewah_serialize_bits(out, &writer.check_only) < 0 ||
+			git_ewah_serialize_bits(out, &writer.exclude_valid) < 0 ||
+			git_buf_put(out, writer.stats.ptr, writer.stats.size) < 0 ||
+			git_buf_put(out, writer.exclude_oids.ptr, writer.exclude_oids.size) < 0)
+			goto done;
+	}
+
+	error = git_buf_putc(out, '\0');
+
+done:
+	git_buf_free(&writer.dirs);
+	git_buf_free(&writer.stats);
+	git_buf_free(&writer.exclude_oids);
+	git_bitmap_free(&writer.valid);
+	git_bitmap_free(&writer.check_only);
+	git_bitmap_free(&writer.exclude_valid);
+	return error;
+}
+
+static void untracked_dir_invalidate(git_untracked_cache_dir *dir)
+{
+	dir->valid = 0;
+	untracked_dir_clear_untracked(dir);
+}
+
+void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc, const char *path)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+
+	if (!uc || !(dir = uc->root))
+		return;
+
+	untracked_dir_invalidate(dir);
+
+	while ((end = strchr(path, '/')) != NULL) {
+		if ((dir = untracked_dir_find(dir, path, end - path)) == NULL)
+			return;
+
+		untracked_dir_invalidate(dir);
+		path = end + 1;
+	}
+}
+
+void git_untracked_cache_free(git_untracked_cache *uc)
+{
+	if (!uc)
+		return;
+
+	untracked_dir_free(uc->root);
+	git_buf_free(&uc->ident);
+	git_buf_free(&uc->workdir);
+	git__free(uc->exclude_per_dir);
+	git__free(uc);
+}
+
+enum {
+	UNTRACKED_CACHE_KEEP = 0,
+	UNTRACKED_CACHE_DISABLED,
+	UNTRACKED_CACHE_ENABLED,
+};
+
+/* `core.untrackedCache` is a boolean or "keep", which uses a cache that
+ * is already in the index without creating one.
+ */
+static int untracked_cache_mode(int *out, git_repository *repo)
+{
+	git_config *cfg;
+	git_config_entry *entry = NULL;
+	int enabled, error;
+
+	*out = UNTRACKED_CACHE_KEEP;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0 ||
+		(error = git_config__lookup_entry(
+			&entry, cfg, "core.untrackedcache", false)) < 0)
+		return error;
+
+	if (!entry)
+		return 0;
+
+	if (!entry->value)
+		*out = UNTRACKED_CACHE_ENABLED;
+	else if (!strcasecmp(entry->value, "keep"))
+		*out = UNTRACKED_CACHE_KEEP;
+	else if (git_config_parse_bool(&enabled, entry->value) < 0)
+		giterr_clear();
+	else
+		*out = enabled ? UNTRACKED_CACHE_ENABLED : UNTRACKED_CACHE_DISABLED;
+
+	git_config_entry_free(entry);
+	return 0;
+}
+
+/* The same string as core git, so that both can use the cache */
+static int untracked_cache_ident(git_buf *out, git_repository *repo)
+{
+	const char *workdir = git_repository_workdir(repo), *system;
+	size_t len = strlen(workdir);
+#ifdef GIT_WIN32
+	system = "Windows";
+#else
+	struct utsname uts;
+
+	if (uname(&uts) < 0) {
+		giterr_set(GITERR_OS, "Failed to get the name of the system");
+		return -1;
+	}
+
+	system = uts.sysname;
+#endif
+
+	while (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	git_buf_printf(out, "Location %.*s, system %s", (int)len, workdir, system);
+	git_buf_putc(out, '\0');
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static int untracked_cache_new(git_untracked_cache **out, const git_buf *ident)
+{
+	git_untracked_cache *uc = git__calloc(1, sizeof(git_untracked_cache));
+	GITERR_CHECK_ALLOC(uc);
+
+	uc->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	uc->exclude_per_dir = git__strdup(GIT_IGNORE_FILE);
+
+	if (!uc->exclude_per_dir ||
+		git_buf_put(&uc->ident, ident->ptr, ident->size) < 0) {
+		git_untracked_cache_free(uc);
+		return -1;
+	}
+
+	*out = uc;
+	return 0;
+}
+
+/* The blob id of the ignore file of the directory at `path` */
+static int untracked_exclude_oid(git_oid *out, git_buf *path)
+{
+	size_t len = path->size;
+	struct stat st;
+	int error = 0;
+
+	memset(out, 0, sizeof(git_oid));
+
+	if (git_buf_puts(path, GIT_IGNORE_FILE) < 0)
+		return -1;
+
+	if (p_stat(path->ptr, &st) == 0 && S_ISREG(st.st_mode))
+		error = git_odb_hashfile(out, path->ptr, GIT_OBJ_BLOB);
+
+	git_buf_truncate(path, len);
+	return error;
+}
+
+/* Update the stat data and blob id recorded for a global ignore file,
+ * telling whether its contents changed.
+ */
+static int untracked_global_exclude(
+	bool *modified,
+	git_untracked_cache *uc,
+	git_untracked_cache_stat *cached_st,
+	git_oid *cached_oid,
+	const char *path)
+{
+	git_untracked_cache_stat now;
+	git_oid oid;
+	struct stat st;
+
+	*modified = false;
+
+	memset(&now, 0, sizeof(now));
+	memset(&oid, 0, sizeof(oid));
+
+	if (path && p_stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+		untracked_stat_init(&now, &st);
+
+		if (untracked_stat_equal(&now, cached_st) &&
+			!untracked_stat_is_racy(uc, &now) &&
+			!git_oid_iszero(cached_oid))
+			return 0;
+
+		if (git_odb_hashfile(&oid, path, GIT_OBJ_BLOB) < 0)
+			return -1;
+	}
+
+	*modified = !git_oid_equal(&oid, cached_oid);
+
+	if (*modified || memcmp(&now, cached_st, sizeof(now)) != 0) {
+		memcpy(cached_st, &now, sizeof(now));
+		git_oid_cpy(cached_oid, &oid);
+		uc->changed = 1;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache__prepare(
+	git_untracked_cache **out,
+	bool *changed,
+	git_repository *repo,
+	git_index *index)
+{
+	git_untracked_cache *uc;
+	git_buf ident = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	bool custom_rules, info_modified, global_modified;
+	int mode, error;
+
+	*out = NULL;
+	*changed = false;
+
+	if ((error = untracked_cache_mode(&mode, repo)) < 0)
+		return error;
+
+	if (mode == UNTRACKED_CACHE_DISABLED) {
+		if (index->untracked) {
+			git_untracked_cache_free(index->untracked);
+			index->untracked = NULL;
+			*changed = true;
+		}
+		return 0;
+	}
+
+	if (!index->untracked && mode != UNTRACKED_CACHE_ENABLED)
+		return 0;
+
+	if ((error = untracked_cache_ident(&ident, repo)) < 0)
+		goto done;
+
+	/* a cache made for another location or system is of no use */
+	if (index->untracked && strcmp(index->untracked->ident.ptr, ident.ptr)) {
+		if (mode != UNTRACKED_CACHE_ENABLED)
+			goto done;
+
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+	}
+
+	if (!index->untracked) {
+		if ((error = untracked_cache_new(&index->untracked, &ident)) < 0)
+			goto done;
+		*changed = true;
+	}
+
+	uc = index->untracked;
+
+	if (uc->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS ||
+		strcmp(uc->exclude_per_dir, GIT_IGNORE_FILE) != 0)
+		goto done;
+
+	/* the cache knows nothing about rules that only live in memory */
+	if ((error = git_ignore__has_internal_rules(&custom_rules, repo)) < 0 ||
+		custom_rules)
+		goto done;
+
+	uc->changed = 0;
+	uc->index_mtime.seconds = (int32_t)index->stamp.mtime.tv_sec;
+	uc->index_mtime.nanoseconds = (uint32_t)index->stamp.mtime.tv_nsec;
+
+	if ((error = git_attr_cache__init(repo)) < 0 ||
+		(error = git_buf_joinpath(&path,
+			git_repository_path(repo), GIT_IGNORE_FILE_INREPO)) < 0 ||
+		(error = untracked_global_exclude(&info_modified, uc,
+			&uc->info_exclude_stat, &uc->info_exclude_oid, path.ptr)) < 0 ||
+		(error = untracked_global_exclude(&global_modified, uc,
+			&uc->excludes_file_stat, &uc->excludes_file_oid,
+			git_repository_attr_cache(repo)->cfg_excl_file)) < 0)
+		goto done;
+
+	/* everything depends on the global ignore files */
+	if (info_modified || global_modified) {
+		untracked_dir_free(uc->root);
+		uc->root = NULL;
+	}
+
+	if (!uc->root && (uc->root = untracked_dir_new("", 0)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_buf_sets(&uc->workdir, git_repository_workdir(repo))) < 0)
+		goto done;
+
+	uc->generation++;
+
+	*changed = *changed || uc->changed;
+	*out = uc;
+
+done:
+	git_buf_free(&ident);
+	git_buf_free(&path);
+	return error;
+}
+
+/* Check the ignore file of a directory containing the one being looked
+ * up, once per use of the cache; when it changed, nothing below the
+ * directory can be trusted anymore.
+ */
+static int untracked_dir_check_exclude(
+	git_untracked_cache *uc, git_untracked_cache_dir *dir, git_buf *path)
+{
+	git_oid oid;
+
+	if (dir->checked == uc->generation)
+		return 0;
+
+	if (untracked_exclude_oid(&oid, path) < 0)
+		return -1;
+
+	if (!git_oid_equal(&oid, &dir->exclude_oid)) {
+		untracked_dir_invalidate(dir);
+		untracked_dir_clear_dirs(dir);
+		git_oid_cpy(&dir->exclude_oid, &oid);
+		uc->changed = 1;
+	}
+
+	dir->checked = uc->generation;
+	return 0;
+}
+
+/* Find the directory for `path` (which ends with a '/'), checking the
+ * directories that contain it and creating the missing ones if asked.
+ */
+static int untracked_dir_lookup(
+	git_untracked_cache_dir **out,
+	git_untracked_cache *uc,
+	const char *path,
+	bool create)
+{
+	git_untracked_cache_dir *dir = uc->root, *child;
+	git_buf full = GIT_BUF_INIT;
+	const char *scan = path, *end;
+	int error;
+
+	*out = NULL;
+
+	if ((error = git_buf_set(&full, uc->workdir.ptr, uc->workdir.size)) < 0 ||
+		(error = untracked_dir_check_exclude(uc, dir, &full)) < 0)
+		goto done;
+
+	while ((end = strchr(scan, '/')) != NULL) {
+		if ((child = untracked_dir_find(dir, scan, end - scan)) == NULL) {
+			if (!create) {
+				error = GIT_ENOTFOUND;
+				goto done;
+			}
+
+			if ((child = untracked_dir_new(scan, end - scan)) == NULL ||
+				git_vector_insert_sorted(&dir->dirs, child, NULL) < 0) {
+				git__free(child);
+				error = -1;
+				goto done;
+			}
+
+			uc->changed = 1;
+		}
+
+		dir = child;
+
+		if ((error = git_buf_put(&full, scan, end - scan + 1)) < 0)
+			goto done;
+
+		/* the directory itself is checked with its contents */
+		if (end[1] != '\0' &&
+			(error = untracked_dir_check_exclude(uc, dir, &full)) < 0)
+			goto done;
+
+		scan = end + 1;
+	}
+
+	*out = dir;
+
+done:
+	git_buf_free(&full);
+	return error;
+}
+
+/* Work out from the cache whether the directory at `path` contains an
+ * untracked entry, or return GIT_ENOTFOUND if it has to be scanned.
+ */
+static int untracked_dir_status(
+	git_iterator_status_t *status,
+	git_untracked_cache *uc,
+	git_untracked_cache_dir *dir,
+	git_buf *path)
+{
+	git_untracked_cache_stat now;
+	git_untracked_cache_dir *child;
+	const char *name;
+	struct stat st;
+	git_oid oid;
+	size_t len = path->size, i;
+	int error;
+
+	if (!dir->valid || !dir->check_only)
+		return GIT_ENOTFOUND;
+
+	if (p_lstat(path->ptr, &st) < 0 || !S_ISDIR(st.st_mode))
+		return GIT_ENOTFOUND;
+
+	untracked_stat_init(&now, &st);
+
+	if (!untracked_stat_equal(&now, &dir->stat) ||
+		untracked_stat_is_racy(uc, &now))
+		return GIT_ENOTFOUND;
+
+	if ((error = untracked_exclude_oid(&oid, path)) < 0)
+		return error;
+
+	if (!git_oid_equal(&oid, &dir->exclude_oid))
+		return GIT_ENOTFOUND;
+
+	*status = GIT_ITERATOR_STATUS_NORMAL;
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		size_t namelen = strlen(name);
+
+		if (!namelen || name[namelen - 1] != '/')
+			return 0;
+
+		/* an untracked directory is only as good as what we know of it */
+		if (!untracked_dir_find(dir, name, namelen - 1))
+			return GIT_ENOTFOUND;
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if (git_buf_puts(path, child->name) < 0 || git_buf_putc(path, '/') < 0)
+			return -1;
+
+		error = untracked_dir_status(status, uc, child, path);
+		git_buf_truncate(path, len);
+
+		if (error < 0 || *status == GIT_ITERATOR_STATUS_NORMAL)
+			return error;
+	}
+
+	*status = GIT_ITERATOR_STATUS_EMPTY;
+	return 0;
+}
+
+typedef struct {
+	git_untracked_cache *uc;
+	size_t base_len;
+	git_buf path;
+} untracked_scan;
+
+/* Start over with a directory the scan is about to look into */
+static int untracked_scan_dir(untracked_scan *scan, const char *path)
+{
+	git_untracked_cache_dir *dir;
+	struct stat st;
+	int error;
+
+	if ((error = untracked_dir_lookup(&dir, scan->uc, path, true)) < 0)
+		return error;
+
+	untracked_dir_invalidate(dir);
+	untracked_dir_clear_dirs(dir);
+	scan->uc->changed = 1;
+
+	if ((error = git_buf_joinpath(&scan->path, scan->uc->workdir.ptr, path)) < 0)
+		return error;
+
+	if (p_lstat(scan->path.ptr, &st) < 0 || !S_ISDIR(st.st_mode))
+		return 0;
+
+	if ((error = untracked_exclude_oid(&dir->exclude_oid, &scan->path)) < 0)
+		return error;
+
+	untracked_stat_init(&dir->stat, &st);
+	dir->checked = scan->uc->generation;
+	dir->valid = 1;
+	dir->check_only = 1;
+
+	return 0;
+}
+
+/* Record the untracked item the scan found in each of the directories
+ * leading to it.
+ */
+static int untracked_scan_found(
+	untracked_scan *scan, const char *path, uint32_t mode)
+{
+	git_untracked_cache_dir *dir;
+	const char *scan_path = path + scan->base_len, *end;
+	size_t len;
+	int error;
+
+	if ((error = git_buf_set(&scan->path, path, scan->base_len)) < 0 ||
+		(error = untracked_dir_lookup(&dir, scan->uc, scan->path.ptr, false)) < 0)
+		return error;
+
+	while ((end = strchr(scan_path, '/')) != NULL && end[1] != '\0') {
+		if ((error = untracked_dir_add_untracked(
+				dir, scan_path, end - scan_path, true)) < 0)
+			return error;
+
+		if ((dir = untracked_dir_find(dir, scan_path, end - scan_path)) == NULL)
+			return 0;
+
+		scan_path = end + 1;
+	}
+
+	len = end ? (size_t)(end - scan_path) : strlen(scan_path);
+
+	return untracked_dir_add_untracked(dir, scan_path, len,
+		S_ISDIR(mode) || S_ISGITLINK(mode));
+}
+
+static int untracked_scan_cb(
+	const git_index_entry *entry, git_iterator_status_t status, void *payload)
+{
+	untracked_scan *scan = payload;
+
+	if (status == GIT_ITERATOR_STATUS_EMPTY) {
+		if (!scan->base_len)
+			scan->base_len = strlen(entry->path);
+
+		return untracked_scan_dir(scan, entry->path);
+	}
+
+	return scan->base_len ?
+		untracked_scan_found(scan, entry->path, entry->mode) : 0;
+}
+
+int git_untracked_cache__advance_over(
+	const git_index_entry **entry,
+	git_iterator_status_t *status,
+	git_untracked_cache *uc,
+	git_iterator *iter)
+{
+	git_untracked_cache_dir *dir;
+	const git_index_entry *current;
+	untracked_scan scan = { 0 };
+	int error;
+
+	*status = GIT_ITERATOR_STATUS_NORMAL;
+
+	if ((error = git_iterator_current(&current, iter)) < 0)
+		return error;
+
+	if (S_ISDIR(current->mode)) {
+		if ((error = untracked_dir_lookup(&dir, uc, current->path, false)) == 0 &&
+			(error = git_buf_joinpath(&scan.path, uc->workdir.ptr, current->path)) == 0)
+			error = untracked_dir_status(status, uc, dir, &scan.path);
+
+		if (!error) {
+			git_buf_free(&scan.path);
+			return git_iterator_advance(entry, iter);
+		}
+
+		if (error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	scan.uc = uc;
+	error = git_iterator_advance_over_with_status_cb(
+		entry, status, iter, untracked_scan_cb, &scan);
+
+done:
+	git_buf_free(&scan.path);
+	return error;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "vector.h"
+#include "iterator.h"
+#include "git2/oid.h"
+#include "git2/index.h"
+
+/* The `dir_flags` of the caches we can use: those written by
+ * `git status -unormal`, which shows untracked directories as a whole
+ * and hides directories that contain nothing untracked.
+ */
+#define GIT_UNTRACKED_CACHE_SHOW_OTHER_DIRECTORIES (1u << 1)
+#define GIT_UNTRACKED_CACHE_HIDE_EMPTY_DIRECTORIES (1u << 2)
+
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS \
+	(GIT_UNTRACKED_CACHE_SHOW_OTHER_DIRECTORIES | \
+	 GIT_UNTRACKED_CACHE_HIDE_EMPTY_DIRECTORIES)
+
+typedef struct {
+	git_index_time ctime;
+	git_index_time mtime;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_cache_stat;
+
+typedef struct git_untracked_cache_dir {
+	git_vector untracked; /* names of untracked entries, dirs end in '/' */
+	git_vector dirs; /* git_untracked_cache_dir of the subdirectories */
+
+	git_untracked_cache_stat stat; /* of the directory itself */
+	git_oid exclude_oid; /* blob id of its .gitignore, zero if none */
+
+	unsigned int valid:1,
+		check_only:1;
+	unsigned int checked; /* `generation` its .gitignore was checked */
+
+	char name[GIT_FLEX_ARRAY];
+} git_untracked_cache_dir;
+
+typedef struct git_untracked_cache {
+	git_buf ident; /* where the cache was made, NUL terminated */
+
+	git_untracked_cache_stat info_exclude_stat;
+	git_untracked_cache_stat excludes_file_stat;
+	git_oid info_exclude_oid;
+	git_oid excludes_file_oid;
+
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+
+	git_untracked_cache_dir *root;
+
+	/* not stored: the working directory the cache is being used for */
+	git_buf workdir;
+	git_index_time index_mtime;
+	unsigned int generation;
+	unsigned int changed:1;
+} git_untracked_cache;
+
+/* Parse the data of an UNTR index extension */
+extern int git_untracked_cache_read(
+	git_untracked_cache **out, const char *buffer, size_t buffer_size);
+
+/* Serialize the cache as the data of an UNTR index extension */
+extern int git_untracked_cache_write(git_buf *out, git_untracked_cache *uc);
+
+/* Forget what is known about the directories containing `path`, for
+ * when it is added to or removed from the index.
+ */
+extern void git_untracked_cache_invalidate_path(
+	git_untracked_cache *uc, const char *path);
+
+extern void git_untracked_cache_free(git_untracked_cache *uc);
+
+/* Decide from `core.untrackedCache` and the state of the repository
+ * whether the untracked cache of `index` can be used to look at the
+ * working directory, creating, resetting or removing it as required.
+ * `out` is NULL when it can't be used, and `changed` tells whether the
+ * index now needs to be written.
+ */
+extern int git_untracked_cache__prepare(
+	git_untracked_cache **out,
+	bool *changed,
+	git_repository *repo,
+	git_index *index);
+
+/* Advance over an untracked directory of the working directory like
+ * `git_iterator_advance_over_with_status`, answering from the cache
+ * when the directory has not changed and recording what the scan finds
+ * otherwise.
+ */
+extern int git_untracked_cache__advance_over(
+	const git_index_entry **entry,
+	git_iterator_status_t *status,
+	git_untracked_cache *uc,
+	git_iterator *iter);
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_varint_h__
+#define INCLUDE_varint_h__
+
+#include <stdint.h>
+
+/*
+ * The variable width integers of the index extensions: seven bits per
+ * byte, most significant group first, with the high bit set on all but
+ * the last byte.  Every continuation adds one to the value so that each
+ * number has exactly one encoding.
+ */
+
+/*
+ * Encode `value` into `buf`, returning the number of bytes it takes or
+ * -1 if `bufsize` is too small.  A NULL `buf` only computes the length.
+ */
+extern int git_encode_varint(unsigned char *buf, size_t bufsize, uintmax_t value);
+
+/*
+ * Decode the number at `bufp`, storing the number of bytes it took in
+ * `varint_len`, which is set to 0 when the number does not fit.  The
+ * buffer must be terminated by a byte without the high bit set.
+ */
+extern uintmax_t git_decode_varint(const unsigned char *bufp, size_t *varint_len);
+
+#endif
@@ -0,0 +1,233 @@
+#include "clar_libgit2.h"
+#include "checkout_helpers.h"
+
+#include <ctype.h>
+
+#include "git2/checkout.h"
+#include "git2/sys/filter.h"
+#include "fileops.h"
+
+static git_repository *g_repo;
+
+static const char *regular_files[] = {
+	"README", "branch_file.txt", "new.txt"
+};
+
+void test_checkout_parallel__initialize(void)
+{
+	git_object *head;
+
+	g_repo = cl_git_sandbox_init("testrepo");
+
+	cl_git_pass(git_revparse_single(&head, g_repo, "HEAD"));
+	reset_index_to_treeish(head);
+	git_object_free(head);
+
+	cl_repo_set_string(g_repo, "checkout.thresholdForParallelism", "0");
+}
+
+void test_checkout_parallel__cleanup(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_STRICT_OBJECT_CREATION, 1);
+	cl_git_sandbox_cleanup();
+}
+
+/* The sandbox starts without a working directory; later checkouts must
+ * write all of the files again too
+ */
+static void remove_workdir_files(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	struct stat st;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(regular_files); i++) {
+		cl_git_pass(git_buf_joinpath(&path, "testrepo", regular_files[i]));
+
+		if (git_path_exists(path.ptr))
+			cl_must_pass(p_unlink(path.ptr));
+	}
+
+	if (p_lstat("testrepo/link_to_new.txt", &st) == 0)
+		cl_must_pass(p_unlink("testrepo/link_to_new.txt"));
+
+	git_buf_free(&path);
+}
+
+static void checkout_head(git_checkout_options *opts)
+{
+	remove_workdir_files();
+
+	opts->checkout_strategy = GIT_CHECKOUT_FORCE;
+	cl_git_pass(git_checkout_head(g_repo, opts));
+}
+
+/* Every file has the content of its blob, and the index knows it */
+static void assert_checked_out(void)
+{
+	git_buf path = GIT_BUF_INIT, expected = GIT_BUF_INIT;
+	git_status_options status_opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	git_index *index;
+	git_blob *blob;
+	size_t i;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (i = 0; i < ARRAY_SIZE(regular_files); i++) {
+		const git_index_entry *entry =
+			git_index_get_bypath(index, regular_files[i], 0);
+
+		cl_assert(entry != NULL);
+		cl_assert(entry->file_size > 0);
+
+		cl_git_pass(git_blob_lookup(&blob, g_repo, &entry->id));
+		cl_git_pass(git_buf_set(&expected,
+			git_blob_rawcontent(blob), (size_t)git_blob_rawsize(blob)));
+		git_blob_free(blob);
+
+		cl_git_pass(git_buf_joinpath(&path, "testrepo", regular_files[i]));
+		cl_assert_equal_file(expected.ptr, expected.size, path.ptr);
+	}
+
+	status_opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED;
+	cl_git_pass(git_status_list_new(&status, g_repo, &status_opts));
+	cl_assert_equal_sz(0, git_status_list_entrycount(status));
+
+	git_status_list_free(status);
+	git_index_free(index);
+	git_buf_free(&expected);
+	git_buf_free(&path);
+}
+
+void test_checkout_parallel__writes_the_files(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+
+	cl_repo_set_string(g_repo, "checkout.workers", "4");
+	checkout_head(&opts);
+
+	assert_checked_out();
+	cl_assert(git_path_islink("testrepo/link_to_new.txt") ||
+		git_path_isfile("testrepo/link_to_new.txt"));
+}
+
+void test_checkout_parallel__workers_can_be_set_in_the_options(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+
+	opts.workers = -1;
+	checkout_head(&opts);
+	assert_checked_out();
+
+	opts.workers = 2;
+	checkout_head(&opts);
+	assert_checked_out();
+}
+
+static void record_progress(
+	const char *path, size_t completed_steps, size_t total_steps, void *payload)
+{
+	size_t *steps = payload;
+
+	GIT_UNUSED(path);
+
+	cl_assert_equal_sz(*steps, completed_steps);
+	cl_assert(completed_steps <= total_steps);
+	(*steps)++;
+}
+
+void test_checkout_parallel__progress_is_reported_in_order(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	size_t steps = 0;
+
+	opts.workers = 3;
+	opts.progress_cb = record_progress;
+	opts.progress_payload = &steps;
+	checkout_head(&opts);
+
+	/* the baseline, and then one step for each file */
+	cl_assert_equal_sz(5, steps);
+}
+
+void test_checkout_parallel__builtin_filters_are_applied(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+
+	cl_repo_set_bool(g_repo, "core.autocrlf", true);
+
+	opts.workers = 3;
+	checkout_head(&opts);
+
+	check_file_contents("testrepo/README", "hey there\r\n");
+	check_file_contents("testrepo/new.txt", "my new file\r\n");
+}
+
+static int upcase_filter_apply(
+	git_filter *self,
+	void **payload,
+	git_buf *to,
+	const git_buf *from,
+	const git_filter_source *source)
+{
+	size_t i;
+
+	GIT_UNUSED(self); GIT_UNUSED(payload); GIT_UNUSED(source);
+
+	if (git_buf_set(to, from->ptr, from->size) < 0)
+		return -1;
+
+	for (i = 0; i < to->size; i++)
+		to->ptr[i] = (char)toupper(to->ptr[i]);
+
+	return 0;
+}
+
+void test_checkout_parallel__other_filters_are_applied(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_filter upcase;
+
+	memset(&upcase, 0, sizeof(git_filter));
+	upcase.version = GIT_FILTER_VERSION;
+	upcase.attributes = "+upcase";
+	upcase.apply = upcase_filter_apply;
+
+	cl_git_pass(git_filter_register("upcase", &upcase, 0));
+	cl_git_mkfile("testrepo/.gitattributes", "new.txt upcase\n");
+
+	opts.workers = 3;
+	checkout_head(&opts);
+
+	check_file_contents("testrepo/new.txt", "MY NEW FILE\n");
+	check_file_contents("testrepo/README", "hey there\n");
+
+	cl_git_pass(git_filter_unregister("upcase"));
+}
+
+void test_checkout_parallel__errors_are_returned(void)
+{
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	git_index_entry entry;
+	git_index *index;
+
+	git_libgit2_opts(GIT_OPT_ENABLE_STRICT_OBJECT_CREATION, 0);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	memset(&entry, 0, sizeof(git_index_entry));
+	entry.mode = GIT_FILEMODE_BLOB;
+	entry.path = "missing.txt";
+	cl_git_pass(git_oid_fromstr(&entry.id,
+		"deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_git_pass(git_index_add(index, &entry));
+
+	remove_workdir_files();
+
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
+	opts.workers = 3;
+	cl_git_fail_with(GIT_ENOTFOUND, git_checkout_index(g_repo, index, &opts));
+
+	git_index_free(index);
+}
@@ -274,18 +274,23 @@ a simple commit which works",
 static int parse_commit(git_commit **out, const char *buffer)
 {
 	git_commit *commit;
-	git_odb_object fake_odb_object;
+	git_odb_object *fake_odb_object;
 	int error;
 
 	commit = (git_commit*)git__malloc(sizeof(git_commit));
 	memset(commit, 0x0, sizeof(git_commit));
 	commit->object.repo = g_repo;
 
-	memset(&fake_odb_object, 0x0, sizeof(git_odb_object));
-	fake_odb_object.buffer = (char *)buffer;
-	fake_odb_object.cached.size = strlen(fake_odb_object.buffer);
+	/* the commit keeps a reference to the object it was parsed from */
+	fake_odb_object = git__calloc(1, sizeof(git_odb_object));
+	cl_assert(fake_odb_object);
+	fake_odb_object->buffer = git__strdup(buffer);
+	fake_odb_object->cached.size = strlen(buffer);
+	fake_odb_object->cached.flags = GIT_CACHE_STORE_RAW;
+	fake_odb_object->cached.refcount.val = 1;
 
-	error = git_commit__parse(commit, &fake_odb_object);
+	error = git_commit__parse(commit, fake_odb_object);
+	git_odb_object_free(fake_odb_object);
 
 	*out = commit;
 	return error;
@@ -399,6 +404,44 @@ This commit has a few LF at the start of the commit message";
 	git_commit__free(commit);
 }
 
+void test_commit_parse__fields_are_read_when_asked_for(void)
+{
+	git_commit *commit;
+	const git_signature *author;
+	const char *buffer =
+"tree 1810dff58d8a660512d4832e740f692884338ccd\n\
+parent e90810b8df3e80c413d903f631643c716887138d\n\
+author Vicent Marti <tanoku@gmail.com> 1273848544 +0200\n\
+committer Scott Chacon <schacon@gmail.com> 1273848545 -0700\n\
+encoding ISO-8859-1\n\
+\n\
+a lazy commit\n";
+
+	cl_git_pass(parse_commit(&commit, buffer));
+
+	cl_assert_equal_i(1273848545, git_commit_time(commit));
+	cl_assert_equal_i(-420, git_commit_time_offset(commit));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+
+	cl_assert(commit->author == NULL);
+	cl_assert(commit->committer == NULL);
+	cl_assert(commit->raw_message == NULL);
+
+	author = git_commit_author(commit);
+	cl_assert_equal_s("Vicent Marti", author->name);
+	cl_assert_equal_s("tanoku@gmail.com", author->email);
+	cl_assert_equal_i(1273848544, author->when.time);
+	cl_assert_equal_p(author, git_commit_author(commit));
+
+	cl_assert_equal_s("Scott Chacon", git_commit_committer(commit)->name);
+	cl_assert_equal_s("ISO-8859-1", git_commit_message_encoding(commit));
+	cl_assert_equal_s("a lazy commit\n", git_commit_message(commit));
+	cl_assert(git__suffixcmp(git_commit_raw_header(commit),
+		"encoding ISO-8859-1\n") == 0);
+
+	git_commit__free(commit);
+}
+
 void test_commit_parse__only_lf(void)
 {
 	git_commit *commit;
@@ -0,0 +1,59 @@
+#include "clar_libgit2.h"
+#include "varint.h"
+
+void test_core_varint__decode(void)
+{
+	const unsigned char *buf;
+	size_t size;
+
+	buf = (unsigned char *)"AB";
+	cl_assert(git_decode_varint(buf, &size) == 65);
+	cl_assert(size == 1);
+
+	buf = (unsigned char *)"\xfe\xdc\xbaXY";
+	cl_assert(git_decode_varint(buf, &size) == 267869656);
+	cl_assert(size == 4);
+
+	buf = (unsigned char *)"\xaa\xaa\xfe\xdc\xbaXY";
+	cl_assert(git_decode_varint(buf, &size) == 1489279344088ULL);
+	cl_assert(size == 6);
+
+	/* values that do not fit are rejected */
+	buf = (unsigned char *)"\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x7f";
+	cl_assert(git_decode_varint(buf, &size) == 0);
+	cl_assert(size == 0);
+}
+
+void test_core_varint__encode(void)
+{
+	unsigned char buf[100];
+
+	cl_assert(git_encode_varint(buf, 100, 65) == 1);
+	cl_assert(buf[0] == 'A');
+
+	cl_assert(git_encode_varint(buf, 100, 128) == 2);
+	cl_assert(!memcmp(buf, "\x80\x00", 2));
+
+	cl_assert(git_encode_varint(buf, 100, 65535) == 3);
+	cl_assert(!memcmp(buf, "\x82\xfe\x7f", 3));
+
+	cl_assert(git_encode_varint(buf, 100, 267869656) == 4);
+	cl_assert(!memcmp(buf, "\xfe\xdc\xbaX", 4));
+
+	cl_assert(git_encode_varint(buf, 1, 267869656) == -1);
+	cl_assert(git_encode_varint(NULL, 0, 1489279344088ULL) == 6);
+}
+
+void test_core_varint__roundtrip(void)
+{
+	unsigned char buf[16];
+	uintmax_t value;
+	size_t size;
+	int len;
+
+	for (value = 0; value < ((uintmax_t)1 << 40); value = value * 3 + 1) {
+		cl_assert((len = git_encode_varint(buf, sizeof(buf), value)) > 0);
+		cl_assert(git_decode_varint(buf, &size) == value);
+		cl_assert_equal_sz(len, size);
+	}
+}
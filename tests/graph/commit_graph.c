@@ -0,0 +1,403 @@
+#include "clar_libgit2.h"
+
+#include "git2/sys/commit_graph.h"
+#include "commit_graph.h"
+#include "fileops.h"
+#include "odb.h"
+#include "repository.h"
+#include "shallow.h"
+
+static git_repository *repo;
+
+void test_graph_commit_graph__initialize(void)
+{
+	repo = cl_git_sandbox_init("merge-recursive");
+}
+
+void test_graph_commit_graph__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void write_commit_graph(void)
+{
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+	git_buf path = GIT_BUF_INIT;
+	git_odb *odb;
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_commit_graph_writer_free(w);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	git_buf_free(&path);
+}
+
+static void open_commit_graph(git_commit_graph_file **file)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(repo), "objects/info/commit-graph"));
+	cl_git_pass(git_commit_graph_open(file, git_buf_cstr(&path)));
+	git_buf_free(&path);
+}
+
+void test_graph_commit_graph__roundtrip(void)
+{
+	git_commit_graph_file *file;
+	git_commit_graph_entry e, parent;
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid id;
+	size_t i, count = 0;
+
+	write_commit_graph();
+	open_commit_graph(&file);
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+		cl_git_pass(git_commit_graph_entry_find(&e, file, &id));
+
+		cl_assert_equal_oid(&id, &e.sha1);
+		cl_assert_equal_oid(git_commit_tree_id(commit), &e.tree_oid);
+		cl_assert_equal_i(git_commit_time(commit), e.commit_time);
+		cl_assert_equal_sz(git_commit_parentcount(commit), e.parent_count);
+
+		if (e.parent_count == 0)
+			cl_assert_equal_i(1, e.generation);
+
+		for (i = 0; i < e.parent_count; i++) {
+			cl_git_pass(git_commit_graph_entry_parent(&parent, file, &e, i));
+			cl_assert_equal_oid(git_commit_parent_id(commit, (unsigned int)i), &parent.sha1);
+			cl_assert(parent.generation < e.generation);
+		}
+
+		git_commit_free(commit);
+		count++;
+	}
+
+	cl_assert_equal_sz(count, file->num_commits);
+	cl_assert(file->num_extra_edge_list > 0);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000000"));
+	cl_git_fail_with(git_commit_graph_entry_find(&e, file, &id), GIT_ENOTFOUND);
+
+	git_revwalk_free(walk);
+	git_commit_graph_file_free(file);
+}
+
+void test_graph_commit_graph__needs_refresh(void)
+{
+	git_commit_graph_file *file;
+	git_buf path = GIT_BUF_INIT;
+
+	write_commit_graph();
+	open_commit_graph(&file);
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(repo), "objects/info/commit-graph"));
+	cl_assert(!git_commit_graph_needs_refresh(file, git_buf_cstr(&path)));
+
+	cl_must_pass(p_unlink(git_buf_cstr(&path)));
+	cl_assert(git_commit_graph_needs_refresh(file, git_buf_cstr(&path)));
+
+	git_commit_graph_file_free(file);
+	git_buf_free(&path);
+}
+
+static void walk_all(git_vector *out, unsigned int sorting)
+{
+	git_revwalk *walk;
+	git_oid id;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	git_revwalk_sorting(walk, sorting);
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		cl_git_pass(git_vector_insert(out, git_oid_allocfmt(&id)));
+
+	git_revwalk_free(walk);
+}
+
+void test_graph_commit_graph__revwalk_is_unchanged(void)
+{
+	git_vector before = GIT_VECTOR_INIT, after = GIT_VECTOR_INIT;
+	unsigned int sortings[] = {
+		GIT_SORT_NONE, GIT_SORT_TIME, GIT_SORT_TIME | GIT_SORT_REVERSE
+	};
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sortings); i++) {
+		cl_git_sandbox_cleanup();
+		repo = cl_git_sandbox_init("merge-recursive");
+
+		walk_all(&before, sortings[i]);
+		write_commit_graph();
+		walk_all(&after, sortings[i]);
+
+		cl_assert_equal_sz(before.length, after.length);
+		for (j = 0; j < before.length; j++)
+			cl_assert_equal_s(before.contents[j], after.contents[j]);
+
+		git_vector_free_deep(&before);
+		git_vector_free_deep(&after);
+	}
+}
+
+static void assert_topological(git_vector *ids)
+{
+	git_commit *commit;
+	git_oid id;
+	char parent_id[GIT_OID_HEXSZ + 1];
+	size_t i, j, pos;
+	unsigned int p;
+
+	for (i = 0; i < ids->length; i++) {
+		cl_git_pass(git_oid_fromstr(&id, ids->contents[i]));
+		cl_git_pass(git_commit_lookup(&commit, repo, &id));
+
+		for (p = 0; p < git_commit_parentcount(commit); p++) {
+			git_oid_tostr(parent_id, sizeof(parent_id), git_commit_parent_id(commit, p));
+
+			for (pos = 0, j = 0; j < ids->length; j++) {
+				if (strcmp(ids->contents[j], parent_id) == 0)
+					pos = j;
+			}
+
+			cl_assert(pos > i);
+		}
+
+		git_commit_free(commit);
+	}
+}
+
+static int strcmp_cb(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+void test_graph_commit_graph__toposort_uses_generations(void)
+{
+	git_vector before = GIT_VECTOR_INIT, after = GIT_VECTOR_INIT;
+	unsigned int sortings[] = {
+		GIT_SORT_TOPOLOGICAL, GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME
+	};
+	size_t i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sortings); i++) {
+		cl_git_sandbox_cleanup();
+		repo = cl_git_sandbox_init("merge-recursive");
+
+		walk_all(&before, sortings[i]);
+		write_commit_graph();
+		walk_all(&after, sortings[i]);
+
+		assert_topological(&before);
+		assert_topological(&after);
+
+		before._cmp = after._cmp = strcmp_cb;
+		git_vector_sort(&before);
+		git_vector_sort(&after);
+
+		cl_assert_equal_sz(before.length, after.length);
+		for (j = 0; j < before.length; j++)
+			cl_assert_equal_s(before.contents[j], after.contents[j]);
+
+		git_vector_free_deep(&before);
+		git_vector_free_deep(&after);
+	}
+}
+
+static int count_descendants(const char **specs, size_t count, int results[8][8])
+{
+	git_object *one, *two;
+	size_t i, j;
+	int total = 0;
+
+	for (i = 0; i < count; i++) {
+		cl_git_pass(git_revparse_single(&one, repo, specs[i]));
+
+		for (j = 0; j < count; j++) {
+			cl_git_pass(git_revparse_single(&two, repo, specs[j]));
+
+			results[i][j] = git_graph_descendant_of(
+				repo, git_object_id(one), git_object_id(two));
+			cl_assert(results[i][j] >= 0);
+			total += results[i][j];
+
+			git_object_free(two);
+		}
+
+		git_object_free(one);
+	}
+
+	return total;
+}
+
+void test_graph_commit_graph__descendant_of(void)
+{
+	const char *specs[] = {
+		"branchE-1", "branchE-1~1", "branchE-2", "branchE-3",
+		"bd97980", "8abda8d", "branchG-2", "branchC-2"
+	};
+	int before[8][8], after[8][8];
+	size_t i, j;
+
+	cl_assert_equal_i(10, count_descendants(specs, ARRAY_SIZE(specs), before));
+
+	write_commit_graph();
+
+	cl_assert_equal_i(10, count_descendants(specs, ARRAY_SIZE(specs), after));
+
+	for (i = 0; i < ARRAY_SIZE(specs); i++) {
+		for (j = 0; j < ARRAY_SIZE(specs); j++)
+			cl_assert_equal_i(before[i][j], after[i][j]);
+	}
+}
+
+void test_graph_commit_graph__merge_base_is_unchanged(void)
+{
+	git_oid one, two, before, after;
+	size_t ahead_before, behind_before, ahead_after, behind_after;
+
+	cl_git_pass(git_reference_name_to_id(&one, repo, "refs/heads/branchA-1"));
+	cl_git_pass(git_reference_name_to_id(&two, repo, "refs/heads/branchH-2"));
+
+	cl_git_pass(git_merge_base(&before, repo, &one, &two));
+	cl_git_pass(git_graph_ahead_behind(&ahead_before, &behind_before, repo, &one, &two));
+
+	write_commit_graph();
+
+	cl_git_pass(git_merge_base(&after, repo, &one, &two));
+	cl_git_pass(git_graph_ahead_behind(&ahead_after, &behind_after, repo, &one, &two));
+
+	cl_assert_equal_oid(&before, &after);
+	cl_assert_equal_sz(ahead_before, ahead_after);
+	cl_assert_equal_sz(behind_before, behind_after);
+}
+
+void test_graph_commit_graph__toposort_with_commits_outside_graph(void)
+{
+	git_vector ids = GIT_VECTOR_INIT;
+	git_signature *sig;
+	git_commit *parent;
+	git_tree *tree;
+	git_oid id, parent_id;
+	size_t count;
+
+	walk_all(&ids, GIT_SORT_TOPOLOGICAL);
+	count = ids.length;
+	git_vector_free_deep(&ids);
+
+	write_commit_graph();
+
+	cl_git_pass(git_reference_name_to_id(&parent_id, repo, "refs/heads/branchE-1"));
+	cl_git_pass(git_commit_lookup(&parent, repo, &parent_id));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_signature_new(&sig, "Someone", "someone@example.com", 1500000000, 0));
+	cl_git_pass(git_commit_create_v(&id, repo, "refs/heads/branchE-1", sig, sig,
+		NULL, "outside of the commit-graph", tree, 1, parent));
+
+	walk_all(&ids, GIT_SORT_TOPOLOGICAL);
+	cl_assert_equal_sz(count + 1, ids.length);
+	assert_topological(&ids);
+
+	git_vector_free_deep(&ids);
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(parent);
+}
+
+static void update_shallow(const git_oid *id, bool shallow)
+{
+	git_array_oid_t ids = GIT_ARRAY_INIT, none = GIT_ARRAY_INIT;
+	git_oid *oid = git_array_alloc(ids);
+
+	cl_assert(oid != NULL);
+	git_oid_cpy(oid, id);
+
+	cl_git_pass(git_shallow__update(repo,
+		shallow ? &ids : &none, shallow ? &none : &ids));
+
+	git_array_clear(ids);
+}
+
+/* Walks from branchA-1, returning the number of parents of `merge` */
+static int walk_and_count_parents(int *count, const git_oid *merge)
+{
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid id;
+	int parents = -1;
+
+	*count = 0;
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/branchA-1"));
+
+	while (!git_revwalk_next(&id, walk)) {
+		(*count)++;
+
+		if (git_oid_equal(&id, merge)) {
+			cl_git_pass(git_commit_lookup(&commit, repo, &id));
+			parents = (int)git_commit_parentcount(commit);
+			git_commit_free(commit);
+		}
+	}
+
+	git_revwalk_free(walk);
+	return parents;
+}
+
+void test_graph_commit_graph__not_used_while_shallow(void)
+{
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+	git_object *merge;
+	git_buf path = GIT_BUF_INIT;
+	int count;
+
+	write_commit_graph();
+
+	cl_git_pass(git_revparse_single(&merge, repo, "branchA-1~1"));
+	cl_assert_equal_i(2, walk_and_count_parents(&count, git_object_id(merge)));
+	cl_assert_equal_i(5, count);
+
+	update_shallow(git_object_id(merge), true);
+
+	/* the graph still has the parents of the boundary */
+	cl_assert_equal_i(0, walk_and_count_parents(&count, git_object_id(merge)));
+	cl_assert_equal_i(2, count);
+
+	/* and none is written for the shallow history */
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_fail(git_commit_graph_writer_add_revwalk(w, walk));
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+
+	update_shallow(git_object_id(merge), false);
+
+	cl_assert_equal_i(2, walk_and_count_parents(&count, git_object_id(merge)));
+	cl_assert_equal_i(5, count);
+
+	git_object_free(merge);
+	git_buf_free(&path);
+}
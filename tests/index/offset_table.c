@@ -0,0 +1,176 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "fileops.h"
+#include "hash.h"
+
+static git_repository *repo;
+static git_index *repo_index;
+
+#define TEST_INDEX_PATH "indexv4/.git/index"
+
+void test_index_offset_table__initialize(void)
+{
+	repo = cl_git_sandbox_init("indexv4");
+	cl_git_pass(git_repository_index(&repo_index, repo));
+}
+
+void test_index_offset_table__cleanup(void)
+{
+	git_index_free(repo_index);
+	repo_index = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static const char *fixture_paths[] = {
+	"dir/a.txt", "dir/sub/b.txt", "dir/sub/bc.txt",
+	"file.txt", "file2.txt", "zzz.txt"
+};
+
+static void assert_paths(git_index *index)
+{
+	size_t i;
+
+	cl_assert_equal_sz(ARRAY_SIZE(fixture_paths), git_index_entrycount(index));
+
+	for (i = 0; i < ARRAY_SIZE(fixture_paths); i++)
+		cl_assert_equal_s(fixture_paths[i], git_index_get_byindex(index, i)->path);
+}
+
+/* The data of the extension with the given signature, if any */
+static const char *find_extension(git_buf *contents, const char *sig)
+{
+	const char *ptr = contents->ptr + contents->size - GIT_OID_RAWSZ;
+
+	while (ptr > contents->ptr) {
+		if (memcmp(--ptr, sig, 4) == 0)
+			return ptr + 8;
+	}
+
+	return NULL;
+}
+
+static void assert_extensions(bool offset_table, bool end_of_entries)
+{
+	git_buf contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&contents, TEST_INDEX_PATH));
+	cl_assert_equal_b(offset_table, find_extension(&contents, "IEOT") != NULL);
+	cl_assert_equal_b(end_of_entries, find_extension(&contents, "EOIE") != NULL);
+	git_buf_free(&contents);
+}
+
+static void write_and_read_back(unsigned int version)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_set_version(repo_index, version));
+	cl_git_pass(git_index_write(repo_index));
+	assert_extensions(true, true);
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	cl_assert_equal_i(version, git_index_version(index));
+	assert_paths(index);
+	cl_assert(git_index_get_bypath(index, "dir/sub/bc.txt", 0) != NULL);
+	git_index_free(index);
+
+	/* the index of the repository reads the blocks on several threads */
+	cl_git_pass(git_index_read(repo_index, true));
+	cl_assert_equal_i(version, git_index_version(repo_index));
+	assert_paths(repo_index);
+	cl_assert(git_index_get_bypath(repo_index, "dir/sub/bc.txt", 0) != NULL);
+}
+
+void test_index_offset_table__not_written_by_default(void)
+{
+	cl_git_pass(git_index_write(repo_index));
+	assert_extensions(false, false);
+}
+
+void test_index_offset_table__written_when_reading_with_threads(void)
+{
+	cl_repo_set_string(repo, "index.threads", "3");
+
+	write_and_read_back(2);
+}
+
+void test_index_offset_table__paths_are_compressed_per_block(void)
+{
+	cl_repo_set_string(repo, "index.threads", "4");
+
+	write_and_read_back(4);
+}
+
+void test_index_offset_table__end_of_entries_can_be_asked_for(void)
+{
+	git_index *index;
+
+	cl_repo_set_bool(repo, "index.recordEndOfIndexEntries", true);
+	cl_git_pass(git_index_write(repo_index));
+	assert_extensions(false, true);
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index);
+	git_index_free(index);
+}
+
+void test_index_offset_table__can_be_turned_off(void)
+{
+	cl_repo_set_string(repo, "index.threads", "3");
+	cl_repo_set_bool(repo, "index.recordOffsetTable", false);
+	cl_repo_set_bool(repo, "index.recordEndOfIndexEntries", false);
+
+	cl_git_pass(git_index_write(repo_index));
+	assert_extensions(false, false);
+}
+
+void test_index_offset_table__ignored_without_threads(void)
+{
+	git_index *index;
+
+	cl_repo_set_string(repo, "index.threads", "3");
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_repo_set_bool(repo, "index.threads", false);
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index);
+	git_index_free(index);
+}
+
+void test_index_offset_table__blocks_must_match_the_entries(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_index *index;
+	git_oid checksum;
+	uint32_t count;
+	char *table;
+
+	cl_repo_set_string(repo, "index.threads", "3");
+	cl_git_pass(git_index_write(repo_index));
+
+	/* claim that the first block is one entry shorter, and the second
+	 * one entry longer, than they are */
+	cl_git_pass(git_futils_readbuffer(&contents, TEST_INDEX_PATH));
+	cl_assert((table = (char *)find_extension(&contents, "IEOT")) != NULL);
+
+	memcpy(&count, table + 8, sizeof(uint32_t));
+	count = htonl(ntohl(count) - 1);
+	memcpy(table + 8, &count, sizeof(uint32_t));
+
+	memcpy(&count, table + 16, sizeof(uint32_t));
+	count = htonl(ntohl(count) + 1);
+	memcpy(table + 16, &count, sizeof(uint32_t));
+
+	cl_git_pass(git_hash_buf(&checksum, contents.ptr, contents.size - GIT_OID_RAWSZ));
+	memcpy(contents.ptr + contents.size - GIT_OID_RAWSZ, checksum.id, GIT_OID_RAWSZ);
+	cl_git_pass(git_futils_writebuffer(&contents, TEST_INDEX_PATH, O_WRONLY | O_TRUNC, 0666));
+	git_buf_free(&contents);
+
+	/* only an index of a repository knows to use threads */
+	cl_git_fail(git_index_read(repo_index, true));
+
+	/* while one that reads the entries in order does not look at the table */
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index);
+	git_index_free(index);
+}
@@ -0,0 +1,255 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "fileops.h"
+
+static git_repository *repo;
+static git_index *repo_index;
+
+#define TEST_INDEX_PATH "splitindex/.git/index"
+#define SHARED_INDEX_ID "bab31604a70bcd38f25799fa09d4379345d53008"
+
+void test_index_splitindex__initialize(void)
+{
+	repo = cl_git_sandbox_init("splitindex");
+	cl_git_pass(git_repository_index(&repo_index, repo));
+}
+
+void test_index_splitindex__cleanup(void)
+{
+	git_index_free(repo_index);
+	repo_index = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static const char *fixture_paths[] = {
+	"dir/six.txt", "five.txt", "new.txt", "one.txt", "three.txt", "two.txt"
+};
+
+static void assert_paths(git_index *index, const char **paths, size_t count)
+{
+	size_t i;
+
+	cl_assert_equal_sz(count, git_index_entrycount(index));
+
+	for (i = 0; i < count; i++)
+		cl_assert_equal_s(paths[i], git_index_get_byindex(index, i)->path);
+}
+
+/* The number of entries in the index file itself */
+static uint32_t entries_on_disk(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	uint32_t count;
+
+	cl_git_pass(git_futils_readbuffer(&contents, TEST_INDEX_PATH));
+	cl_assert(contents.size > 12);
+
+	memcpy(&count, contents.ptr + 8, sizeof(count));
+	git_buf_free(&contents);
+
+	return ntohl(count);
+}
+
+static int count_shared_index(void *payload, git_buf *path)
+{
+	size_t *count = payload;
+
+	if (strstr(path->ptr, "/sharedindex.") != NULL)
+		(*count)++;
+
+	return 0;
+}
+
+static size_t shared_indexes(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t count = 0;
+
+	cl_git_pass(git_buf_sets(&path, "splitindex/.git"));
+	cl_git_pass(git_path_direach(&path, 0, count_shared_index, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void assert_shared_index(git_index *index, const char *id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_assert(index->split);
+	cl_assert(index->shared != NULL);
+
+	git_oid_tostr(hex, sizeof(hex), &index->shared->checksum);
+	cl_assert_equal_s(id, hex);
+}
+
+void test_index_splitindex__read_index_from_core_git(void)
+{
+	const git_index_entry *entry;
+
+	assert_paths(repo_index, fixture_paths, ARRAY_SIZE(fixture_paths));
+	assert_shared_index(repo_index, SHARED_INDEX_ID);
+
+	/* the shared index still has the entries of the initial commit */
+	cl_assert_equal_sz(6, repo_index->shared->entries.length);
+
+	cl_assert((entry = git_index_get_bypath(repo_index, "two.txt", 0)) != NULL);
+	cl_assert_equal_s("6333d309717a57d69a89f7952e6acba59bc86de6",
+		git_oid_tostr_s(&entry->id));
+	cl_assert_equal_i(7, entry->flags & GIT_IDXENTRY_NAMEMASK);
+
+	cl_assert(git_index_get_bypath(repo_index, "four.txt", 0) == NULL);
+}
+
+void test_index_splitindex__write_relative_to_the_shared_index(void)
+{
+	const char *expected[] = {
+		"dir/six.txt", "five.txt", "new.txt", "one.txt", "seven.txt", "two.txt"
+	};
+	const git_index_entry *entry;
+	git_index *index;
+	git_oid one_id;
+
+	cl_repo_set_string(repo, "splitIndex.maxPercentChange", "100");
+
+	cl_git_rewritefile("splitindex/one.txt", "ONE\n");
+	cl_git_mkfile("splitindex/seven.txt", "seven\n");
+	cl_git_pass(git_index_add_bypath(repo_index, "one.txt"));
+	cl_git_pass(git_index_add_bypath(repo_index, "seven.txt"));
+	cl_git_pass(git_index_remove_bypath(repo_index, "three.txt"));
+	cl_git_pass(git_index_write(repo_index));
+
+	git_oid_cpy(&one_id, &git_index_get_bypath(repo_index, "one.txt", 0)->id);
+	assert_shared_index(repo_index, SHARED_INDEX_ID);
+
+	/* one.txt and two.txt replace shared entries; new.txt and seven.txt
+	 * are new */
+	cl_assert_equal_i(4, entries_on_disk());
+	cl_assert_equal_sz(1, shared_indexes());
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index, expected, ARRAY_SIZE(expected));
+	assert_shared_index(index, SHARED_INDEX_ID);
+
+	cl_assert((entry = git_index_get_bypath(index, "one.txt", 0)) != NULL);
+	cl_assert_equal_oid(&one_id, &entry->id);
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__unchanged_index_keeps_its_entries(void)
+{
+	git_index *index;
+
+	cl_repo_set_string(repo, "splitIndex.maxPercentChange", "100");
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_assert_equal_i(2, entries_on_disk());
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index, fixture_paths, ARRAY_SIZE(fixture_paths));
+	git_index_free(index);
+}
+
+void test_index_splitindex__too_many_changes_write_a_new_shared_index(void)
+{
+	git_index *index;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	/* two of the six entries already differ from the shared index */
+	cl_git_pass(git_index_write(repo_index));
+
+	git_oid_tostr(hex, sizeof(hex), &repo_index->shared->checksum);
+	cl_assert(strcmp(SHARED_INDEX_ID, hex) != 0);
+	cl_assert_equal_sz(6, repo_index->shared->entries.length);
+
+	cl_assert_equal_i(0, entries_on_disk());
+	cl_assert_equal_sz(2, shared_indexes());
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index, fixture_paths, ARRAY_SIZE(fixture_paths));
+	assert_shared_index(index, hex);
+	git_index_free(index);
+}
+
+void test_index_splitindex__max_percent_change_of_zero_always_rewrites(void)
+{
+	cl_repo_set_string(repo, "splitIndex.maxPercentChange", "100");
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert_equal_i(2, entries_on_disk());
+
+	cl_repo_set_string(repo, "splitIndex.maxPercentChange", "0");
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert_equal_i(0, entries_on_disk());
+}
+
+void test_index_splitindex__expired_shared_indexes_are_removed(void)
+{
+	cl_repo_set_string(repo, "splitIndex.sharedIndexExpire", "now");
+
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert_equal_sz(1, shared_indexes());
+
+	cl_assert(!git_path_exists("splitindex/.git/sharedindex." SHARED_INDEX_ID));
+}
+
+void test_index_splitindex__never_expire_shared_indexes(void)
+{
+	cl_repo_set_string(repo, "splitIndex.sharedIndexExpire", "never");
+	cl_repo_set_string(repo, "splitIndex.maxPercentChange", "0");
+
+	cl_git_rewritefile("splitindex/one.txt", "ONE\n");
+	cl_git_pass(git_index_add_bypath(repo_index, "one.txt"));
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_git_rewritefile("splitindex/one.txt", "one again\n");
+	cl_git_pass(git_index_add_bypath(repo_index, "one.txt"));
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_assert_equal_sz(3, shared_indexes());
+}
+
+void test_index_splitindex__can_be_turned_off_and_on(void)
+{
+	git_index *index;
+
+	cl_repo_set_bool(repo, "core.splitIndex", false);
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_assert(!repo_index->split && !repo_index->shared);
+	cl_assert_equal_i(6, entries_on_disk());
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index, fixture_paths, ARRAY_SIZE(fixture_paths));
+	cl_assert(!index->split && !index->shared);
+	git_index_free(index);
+
+	cl_repo_set_bool(repo, "core.splitIndex", true);
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_assert(repo_index->split && repo_index->shared);
+	cl_assert_equal_i(0, entries_on_disk());
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index, fixture_paths, ARRAY_SIZE(fixture_paths));
+	cl_assert(index->split);
+	git_index_free(index);
+}
+
+void test_index_splitindex__missing_shared_index_fails(void)
+{
+	git_index *index;
+
+	cl_must_pass(p_unlink("splitindex/.git/sharedindex." SHARED_INDEX_ID));
+	cl_git_fail(git_index_open(&index, TEST_INDEX_PATH));
+}
+
+void test_index_splitindex__corrupt_shared_index_fails(void)
+{
+	git_index *index;
+
+	cl_git_rewritefile("splitindex/.git/sharedindex." SHARED_INDEX_ID,
+		"DIRC and not much else, really; surely not a checksum\n");
+	cl_git_fail(git_index_open(&index, TEST_INDEX_PATH));
+}
@@ -0,0 +1,254 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "fileops.h"
+#include "hash.h"
+#include "untracked_cache.h"
+
+static git_repository *repo;
+static git_index *repo_index;
+
+#define TEST_INDEX_PATH "untracked_cache/.git/index"
+
+void test_index_untracked_cache__initialize(void)
+{
+	repo = cl_git_sandbox_init("untracked_cache");
+	cl_git_pass(git_repository_index(&repo_index, repo));
+}
+
+void test_index_untracked_cache__cleanup(void)
+{
+	git_index_free(repo_index);
+	repo_index = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+/* Copy the data of the UNTR extension out of an index file */
+static bool read_extension(git_buf *out, const char *index_path)
+{
+	git_buf contents = GIT_BUF_INIT;
+	size_t i;
+	bool found = false;
+
+	cl_git_pass(git_futils_readbuffer(&contents, index_path));
+
+	for (i = 0; i + 8 <= contents.size; i++) {
+		uint32_t size;
+
+		if (memcmp(contents.ptr + i, "UNTR", 4) != 0)
+			continue;
+
+		memcpy(&size, contents.ptr + i + 4, 4);
+		size = ntohl(size);
+
+		cl_assert(i + 8 + size <= contents.size);
+		cl_git_pass(git_buf_set(out, contents.ptr + i + 8, size));
+		found = true;
+		break;
+	}
+
+	git_buf_free(&contents);
+	return found;
+}
+
+static git_untracked_cache_dir *find_dir(
+	git_untracked_cache_dir *parent, const char *name)
+{
+	git_untracked_cache_dir *dir;
+	size_t i;
+
+	git_vector_foreach(&parent->dirs, i, dir) {
+		if (!strcmp(dir->name, name))
+			return dir;
+	}
+
+	return NULL;
+}
+
+static void assert_untracked(
+	git_untracked_cache_dir *dir, const char **expected, size_t count)
+{
+	size_t i;
+
+	cl_assert_equal_sz(count, dir->untracked.length);
+
+	for (i = 0; i < count; i++)
+		cl_assert_equal_s(expected[i], git_vector_get(&dir->untracked, i));
+}
+
+void test_index_untracked_cache__read(void)
+{
+	git_untracked_cache *uc = repo_index->untracked;
+	git_untracked_cache_dir *dir;
+	git_oid oid;
+	const char *root_untracked[] = { "untracked.txt", "newdir/", "build/" };
+	const char *newdir_untracked[] = { "deep/" };
+
+	cl_assert(uc != NULL);
+	cl_assert_equal_s(
+		"Location /tmp/untracked_cache, system Linux", uc->ident.ptr);
+	cl_assert_equal_i(GIT_UNTRACKED_CACHE_DIR_FLAGS, uc->dir_flags);
+	cl_assert_equal_s(".gitignore", uc->exclude_per_dir);
+	cl_assert(!git_oid_iszero(&uc->info_exclude_oid));
+	cl_assert(git_oid_iszero(&uc->excludes_file_oid));
+
+	cl_assert(uc->root != NULL);
+	cl_assert(uc->root->valid);
+	cl_assert(!uc->root->check_only);
+	assert_untracked(uc->root, root_untracked, ARRAY_SIZE(root_untracked));
+
+	cl_assert((dir = find_dir(uc->root, "newdir")) != NULL);
+	cl_assert(dir->valid && dir->check_only);
+	assert_untracked(dir, newdir_untracked, ARRAY_SIZE(newdir_untracked));
+
+	cl_git_pass(git_odb_hash(&oid, "*.o\n", 4, GIT_OBJ_BLOB));
+	cl_assert((dir = find_dir(uc->root, "src")) != NULL);
+	cl_assert_equal_oid(&oid, &dir->exclude_oid);
+
+	cl_assert((dir = find_dir(dir, "lib")) != NULL);
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(0, dir->untracked.length);
+}
+
+void test_index_untracked_cache__write_matches_git(void)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	cl_assert(read_extension(&expected, TEST_INDEX_PATH));
+	cl_git_pass(git_untracked_cache_write(&actual, repo_index->untracked));
+
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_index_untracked_cache__kept_when_writing_the_index(void)
+{
+	git_buf before = GIT_BUF_INIT, after = GIT_BUF_INIT;
+
+	cl_assert(read_extension(&before, TEST_INDEX_PATH));
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert(read_extension(&after, TEST_INDEX_PATH));
+
+	cl_assert_equal_sz(before.size, after.size);
+	cl_assert(memcmp(before.ptr, after.ptr, before.size) == 0);
+
+	git_buf_free(&before);
+	git_buf_free(&after);
+}
+
+void test_index_untracked_cache__adding_invalidates_the_parents(void)
+{
+	git_untracked_cache_dir *newdir, *deep, *build;
+	git_index *reread;
+
+	cl_git_pass(git_index_add_bypath(repo_index, "newdir/deep/file"));
+
+	newdir = find_dir(repo_index->untracked->root, "newdir");
+	deep = find_dir(newdir, "deep");
+	build = find_dir(repo_index->untracked->root, "build");
+
+	cl_assert(!repo_index->untracked->root->valid);
+	cl_assert_equal_sz(0, repo_index->untracked->root->untracked.length);
+	cl_assert(!newdir->valid);
+	cl_assert(!deep->valid);
+	cl_assert(build->valid);
+
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_git_pass(git_index_open(&reread, TEST_INDEX_PATH));
+	cl_assert(reread->untracked != NULL);
+	cl_assert(!reread->untracked->root->valid);
+	cl_assert(!find_dir(reread->untracked->root, "newdir")->valid);
+	cl_assert(find_dir(reread->untracked->root, "build")->valid);
+	git_index_free(reread);
+}
+
+void test_index_untracked_cache__removing_invalidates_the_parents(void)
+{
+	git_untracked_cache_dir *src, *lib;
+
+	src = find_dir(repo_index->untracked->root, "src");
+	lib = find_dir(src, "lib");
+	cl_assert(src->valid && lib->valid);
+
+	cl_git_pass(git_index_remove_bypath(repo_index, "src/lib/code.txt"));
+
+	cl_assert(!repo_index->untracked->root->valid);
+	cl_assert(!src->valid);
+	cl_assert(!lib->valid);
+	cl_assert(find_dir(repo_index->untracked->root, "build")->valid);
+}
+
+void test_index_untracked_cache__clearing_drops_the_cache(void)
+{
+	git_buf ext = GIT_BUF_INIT;
+
+	cl_git_pass(git_index_clear(repo_index));
+	cl_assert(repo_index->untracked == NULL);
+
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert(!read_extension(&ext, TEST_INDEX_PATH));
+
+	git_buf_free(&ext);
+}
+
+void test_index_untracked_cache__truncated_data_is_rejected(void)
+{
+	git_buf ext = GIT_BUF_INIT;
+	git_untracked_cache *uc;
+	size_t len;
+
+	cl_assert(read_extension(&ext, TEST_INDEX_PATH));
+
+	for (len = 0; len < ext.size; len++) {
+		uc = NULL;
+		cl_git_fail(git_untracked_cache_read(&uc, ext.ptr, len));
+		cl_assert(uc == NULL);
+	}
+
+	cl_git_pass(git_untracked_cache_read(&uc, ext.ptr, ext.size));
+	git_untracked_cache_free(uc);
+
+	git_buf_free(&ext);
+}
+
+void test_index_untracked_cache__corrupt_extension_is_ignored(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_index *reread;
+	git_oid checksum;
+	size_t i, excludes_len = strlen(".gitignore") + 1;
+
+	cl_git_pass(git_futils_readbuffer(&contents, TEST_INDEX_PATH));
+
+	for (i = 0; i + 4 <= contents.size; i++) {
+		if (!memcmp(contents.ptr + i, "UNTR", 4))
+			break;
+	}
+
+	/* claim many more directories than there are blocks */
+	for (; i + excludes_len < contents.size; i++) {
+		if (!memcmp(contents.ptr + i, ".gitignore", excludes_len))
+			break;
+	}
+	cl_assert(i + excludes_len < contents.size);
+	contents.ptr[i + excludes_len] = 0x7f;
+
+	cl_git_pass(git_hash_buf(&checksum,
+		contents.ptr, contents.size - GIT_OID_RAWSZ));
+	memcpy(contents.ptr + contents.size - GIT_OID_RAWSZ,
+		checksum.id, GIT_OID_RAWSZ);
+	cl_git_pass(git_futils_writebuffer(
+		&contents, TEST_INDEX_PATH, O_RDWR|O_CREAT|O_TRUNC, 0644));
+
+	cl_git_pass(git_index_open(&reread, TEST_INDEX_PATH));
+	cl_assert(reread->untracked == NULL);
+	cl_assert_equal_sz(
+		git_index_entrycount(repo_index), git_index_entrycount(reread));
+	git_index_free(reread);
+
+	git_buf_free(&contents);
+}
@@ -0,0 +1,197 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "fileops.h"
+
+static git_repository *repo;
+static git_index *repo_index;
+
+#define TEST_INDEX_PATH "indexv4/.git/index"
+
+void test_index_version__initialize(void)
+{
+	repo = cl_git_sandbox_init("indexv4");
+	cl_git_pass(git_repository_index(&repo_index, repo));
+}
+
+void test_index_version__cleanup(void)
+{
+	git_libgit2_opts(GIT_OPT_ENABLE_LAZY_INDEX_LOOKUP, 0);
+
+	git_index_free(repo_index);
+	repo_index = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static const char *fixture_paths[] = {
+	"dir/a.txt", "dir/sub/b.txt", "dir/sub/bc.txt",
+	"file.txt", "file2.txt", "zzz.txt"
+};
+
+static void assert_paths(git_index *index)
+{
+	size_t i;
+
+	cl_assert_equal_sz(ARRAY_SIZE(fixture_paths), git_index_entrycount(index));
+
+	for (i = 0; i < ARRAY_SIZE(fixture_paths); i++)
+		cl_assert_equal_s(fixture_paths[i], git_index_get_byindex(index, i)->path);
+}
+
+static uint32_t version_on_disk(const char *path)
+{
+	git_buf contents = GIT_BUF_INIT;
+	uint32_t version;
+
+	cl_git_pass(git_futils_readbuffer(&contents, path));
+	cl_assert(contents.size > 12);
+
+	memcpy(&version, contents.ptr + 4, sizeof(version));
+	git_buf_free(&contents);
+
+	return ntohl(version);
+}
+
+void test_index_version__read_index_from_core_git(void)
+{
+	const git_index_entry *entry;
+
+	cl_assert_equal_i(4, git_index_version(repo_index));
+	assert_paths(repo_index);
+
+	cl_assert((entry = git_index_get_bypath(repo_index, "dir/sub/bc.txt", 0)) != NULL);
+	cl_assert_equal_s("e6f7ac8d9fc2886218654356cffb8be9b7da896c",
+		git_oid_tostr_s(&entry->id));
+	cl_assert_equal_i(14, entry->flags & GIT_IDXENTRY_NAMEMASK);
+}
+
+void test_index_version__write_keeps_the_version(void)
+{
+	git_index *index;
+
+	cl_git_mkfile("indexv4/dir/sub/ba.txt", "ba\n");
+	cl_git_pass(git_index_add_bypath(repo_index, "dir/sub/ba.txt"));
+	cl_git_pass(git_index_remove_bypath(repo_index, "file.txt"));
+	cl_git_pass(git_index_write(repo_index));
+
+	cl_assert_equal_i(4, version_on_disk(TEST_INDEX_PATH));
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	cl_assert_equal_i(4, git_index_version(index));
+	cl_assert_equal_sz(6, git_index_entrycount(index));
+	cl_assert_equal_s("dir/sub/ba.txt", git_index_get_byindex(index, 2)->path);
+	cl_assert_equal_s("dir/sub/bc.txt", git_index_get_byindex(index, 3)->path);
+	cl_assert_equal_s("file2.txt", git_index_get_byindex(index, 4)->path);
+	cl_assert(git_index_get_bypath(index, "file.txt", 0) == NULL);
+	git_index_free(index);
+}
+
+void test_index_version__v4_is_smaller_than_v2(void)
+{
+	git_index *index;
+	struct stat st;
+	off_t v2_size;
+
+	cl_git_pass(git_index_set_version(repo_index, 2));
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert_equal_i(2, version_on_disk(TEST_INDEX_PATH));
+	cl_must_pass(p_stat(TEST_INDEX_PATH, &st));
+	v2_size = st.st_size;
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	cl_assert_equal_i(2, git_index_version(index));
+	assert_paths(index);
+	git_index_free(index);
+
+	cl_git_pass(git_index_set_version(repo_index, 4));
+	cl_git_pass(git_index_write(repo_index));
+	cl_assert_equal_i(4, version_on_disk(TEST_INDEX_PATH));
+	cl_must_pass(p_stat(TEST_INDEX_PATH, &st));
+	cl_assert(st.st_size < v2_size);
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	assert_paths(index);
+	git_index_free(index);
+}
+
+void test_index_version__large_index_round_trips(void)
+{
+	git_index *original, *index;
+	const git_index_entry *a, *b;
+	size_t i;
+
+	cl_git_pass(git_futils_cp(cl_fixture("gitgit.index"), "v4.index", 0666));
+
+	cl_git_pass(git_index_open(&original, cl_fixture("gitgit.index")));
+	cl_git_pass(git_index_open(&index, "v4.index"));
+	cl_git_pass(git_index_set_version(index, 4));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_assert_equal_i(4, version_on_disk("v4.index"));
+	cl_git_pass(git_index_open(&index, "v4.index"));
+	cl_assert_equal_sz(git_index_entrycount(original), git_index_entrycount(index));
+
+	for (i = 0; i < git_index_entrycount(index); i++) {
+		a = git_index_get_byindex(original, i);
+		b = git_index_get_byindex(index, i);
+
+		cl_assert_equal_s(a->path, b->path);
+		cl_assert_equal_oid(&a->id, &b->id);
+		cl_assert_equal_i(a->flags, b->flags);
+	}
+
+	git_index_free(index);
+	git_index_free(original);
+	cl_must_pass(p_unlink("v4.index"));
+}
+
+void test_index_version__only_known_versions_can_be_set(void)
+{
+	cl_git_fail(git_index_set_version(repo_index, 1));
+	cl_git_fail(git_index_set_version(repo_index, 5));
+	cl_assert_equal_i(4, git_index_version(repo_index));
+
+	cl_git_pass(git_index_set_version(repo_index, 3));
+	cl_assert_equal_i(3, git_index_version(repo_index));
+}
+
+void test_index_version__in_memory_index_defaults_to_v2(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_new(&index));
+	cl_assert_equal_i(2, git_index_version(index));
+	git_index_free(index);
+}
+
+void test_index_version__lazy_lookup_builds_the_map_when_needed(void)
+{
+	git_index *index;
+	git_index_entry entry;
+	const git_index_entry *found;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_LAZY_INDEX_LOOKUP, 1));
+
+	cl_git_pass(git_index_open(&index, TEST_INDEX_PATH));
+	cl_assert(index->entries_map_pending);
+	assert_paths(index);
+
+	/* entries added while the map is pending are found after all */
+	memset(&entry, 0, sizeof(entry));
+	entry.path = "new.txt";
+	entry.mode = GIT_FILEMODE_BLOB;
+	git_oid_cpy(&entry.id, &git_index_get_byindex(index, 0)->id);
+	cl_git_pass(git_index_add(index, &entry));
+	cl_assert(index->entries_map_pending);
+
+	cl_assert((found = git_index_get_bypath(index, "new.txt", 0)) != NULL);
+	cl_assert(!index->entries_map_pending);
+	cl_assert((found = git_index_get_bypath(index, "zzz.txt", 0)) != NULL);
+	cl_assert(git_index_get_bypath(index, "nope.txt", 0) == NULL);
+
+	cl_git_pass(git_index_remove_bypath(index, "zzz.txt"));
+	cl_assert(git_index_get_bypath(index, "zzz.txt", 0) == NULL);
+
+	git_index_free(index);
+}
@@ -0,0 +1,154 @@
+#include "clar_libgit2.h"
+#include "git2/sys/stream.h"
+#include "stream_pool.h"
+
+/* A stream which only remembers whether it was closed and freed */
+typedef struct {
+	git_stream parent;
+	int closed;
+	int freed;
+} test_stream;
+
+static test_stream _streams[4];
+
+static int test_close(git_stream *stream)
+{
+	((test_stream *)stream)->closed++;
+	return 0;
+}
+
+static void test_free(git_stream *stream)
+{
+	((test_stream *)stream)->freed++;
+}
+
+void test_network_connectionpool__initialize(void)
+{
+	size_t i;
+
+	memset(_streams, 0, sizeof(_streams));
+
+	for (i = 0; i < ARRAY_SIZE(_streams); i++) {
+		_streams[i].parent.version = GIT_STREAM_VERSION;
+		_streams[i].parent.close = test_close;
+		_streams[i].parent.free = test_free;
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)2, 60));
+}
+
+void test_network_connectionpool__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)0, 15));
+}
+
+void test_network_connectionpool__gives_back_the_connection_to_the_same_server(void)
+{
+	git_stream *stream;
+	size_t idle, reused, reused_before;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CONNECTION_POOL_STATS, &idle, &reused_before));
+	cl_assert_equal_sz(0, idle);
+
+	git_stream_pool_put(&_streams[0].parent, "https", "example.com", "443", NULL);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CONNECTION_POOL_STATS, &idle, &reused));
+	cl_assert_equal_sz(1, idle);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "http", "example.com", "443", NULL));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.org", "443", NULL));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.com", "8443", NULL));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.com", "443", "http://proxy:3128"));
+
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+	cl_assert_equal_p(&_streams[0].parent, stream);
+	cl_assert_equal_i(0, _streams[0].closed);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CONNECTION_POOL_STATS, &idle, &reused));
+	cl_assert_equal_sz(0, idle);
+	cl_assert_equal_sz(reused_before + 1, reused);
+}
+
+void test_network_connectionpool__proxies_are_part_of_the_key(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_put(&_streams[0].parent, "http", "example.com", "80", "http://proxy:3128");
+	git_stream_pool_put(&_streams[1].parent, "http", "example.com", "80", NULL);
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80", "http://proxy:3128"));
+	cl_assert_equal_p(&_streams[0].parent, stream);
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80", NULL));
+	cl_assert_equal_p(&_streams[1].parent, stream);
+}
+
+void test_network_connectionpool__keeps_the_latest_connections(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_put(&_streams[0].parent, "https", "example.com", "443", NULL);
+	git_stream_pool_put(&_streams[1].parent, "https", "example.com", "443", NULL);
+	git_stream_pool_put(&_streams[2].parent, "https", "example.com", "443", NULL);
+
+	/* the first one made room for the last one */
+	cl_assert_equal_i(1, _streams[0].closed);
+	cl_assert_equal_i(1, _streams[0].freed);
+
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+	cl_assert_equal_p(&_streams[2].parent, stream);
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+	cl_assert_equal_p(&_streams[1].parent, stream);
+
+	cl_assert_equal_i(0, _streams[1].closed + _streams[2].closed);
+}
+
+void test_network_connectionpool__closes_idle_connections(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_put(&_streams[0].parent, "https", "example.com", "443", NULL);
+	git_stream_pool_put(&_streams[1].parent, "https", "example.org", "443", NULL);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)2, 0));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+
+	cl_assert_equal_i(1, _streams[0].closed);
+	cl_assert_equal_i(1, _streams[0].freed);
+	cl_assert_equal_i(1, _streams[1].closed);
+	cl_assert_equal_i(1, _streams[1].freed);
+}
+
+void test_network_connectionpool__disabled_pool_closes_connections(void)
+{
+	git_stream *stream;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)0, 15));
+
+	git_stream_pool_put(&_streams[0].parent, "https", "example.com", "443", NULL);
+	cl_assert_equal_i(1, _streams[0].closed);
+	cl_assert_equal_i(1, _streams[0].freed);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_stream_pool_take(&stream, "https", "example.com", "443", NULL));
+}
+
+void test_network_connectionpool__shrinking_closes_connections(void)
+{
+	git_stream_pool_put(&_streams[0].parent, "https", "example.com", "443", NULL);
+	git_stream_pool_put(&_streams[1].parent, "https", "example.org", "443", NULL);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)1, 60));
+	cl_assert_equal_i(1, _streams[0].freed);
+	cl_assert_equal_i(0, _streams[1].freed);
+
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, (size_t)1, -1));
+}
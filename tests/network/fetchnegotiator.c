@@ -0,0 +1,240 @@
+#include "clar_libgit2.h"
+
+#include "git2/sys/commit_graph.h"
+#include "fetch_negotiator.h"
+#include "odb.h"
+#include "repository.h"
+
+static git_repository *_repo;
+static git_fetch_negotiator *_negotiator;
+static git_oid _chain[100];
+
+static void commit_at(
+	git_oid *out,
+	const char *ref,
+	git_time_t time,
+	const git_oid *parent_id)
+{
+	git_signature *sig;
+	git_commit *parent = NULL;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_oid tree_id;
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	git_treebuilder_free(builder);
+
+	if (parent_id)
+		cl_git_pass(git_commit_lookup(&parent, _repo, parent_id));
+
+	cl_git_pass(git_signature_new(&sig, "nulltoken", "emeric.fermas@gmail.com", time, 0));
+	cl_git_pass(git_commit_create(out, _repo, NULL, sig, sig, NULL, "commit\n",
+		tree, parent ? 1 : 0, (const git_commit **)&parent));
+
+	if (ref) {
+		git_reference *reference;
+		cl_git_pass(git_reference_create(&reference, _repo, ref, out, 1, NULL));
+		git_reference_free(reference);
+	}
+
+	git_commit_free(parent);
+	git_tree_free(tree);
+	git_signature_free(sig);
+}
+
+/* A hundred commits in a line, a minute apart */
+static void create_chain(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(_chain); i++)
+		commit_at(&_chain[i], i == ARRAY_SIZE(_chain) - 1 ? "refs/heads/master" : NULL,
+			1400000000 + i * 60, i ? &_chain[i - 1] : NULL);
+}
+
+static size_t count_haves(void)
+{
+	git_oid oid;
+	size_t count = 0;
+	int error;
+
+	while ((error = git_fetch_negotiator_next(&oid, _negotiator)) == 0)
+		count++;
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	return count;
+}
+
+void test_network_fetchnegotiator__initialize(void)
+{
+	cl_git_pass(git_repository_init(&_repo, "./negotiator", 1));
+}
+
+void test_network_fetchnegotiator__cleanup(void)
+{
+	git_fetch_negotiator_free(_negotiator);
+	_negotiator = NULL;
+
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_fixture_cleanup("./negotiator");
+}
+
+void test_network_fetchnegotiator__consecutive_stops_at_the_first_ack(void)
+{
+	git_oid oid;
+	size_t i;
+
+	create_chain();
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_CONSECUTIVE));
+
+	for (i = 0; i < 10; i++) {
+		cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+		cl_assert_equal_oid(&_chain[99 - i], &oid);
+	}
+
+	cl_git_pass(git_fetch_negotiator_ack(_negotiator, &_chain[95]));
+	cl_assert_equal_i(GIT_ITEROVER, git_fetch_negotiator_next(&oid, _negotiator));
+}
+
+void test_network_fetchnegotiator__consecutive_sends_every_commit(void)
+{
+	create_chain();
+
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_UNSPECIFIED));
+	cl_assert_equal_sz(100, count_haves());
+}
+
+void test_network_fetchnegotiator__skipping_skips_further_each_time(void)
+{
+	git_oid oid;
+
+	create_chain();
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_SKIPPING));
+
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[99], &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[97], &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[94], &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[89], &oid);
+
+	/* the root is always sent */
+	cl_assert(count_haves() < 20);
+	git_fetch_negotiator_free(_negotiator);
+
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_SKIPPING));
+	while (git_fetch_negotiator_next(&oid, _negotiator) == 0)
+		/* nothing */;
+	cl_assert_equal_oid(&_chain[0], &oid);
+}
+
+void test_network_fetchnegotiator__skipping_sends_nothing_the_server_has(void)
+{
+	git_oid oid;
+
+	create_chain();
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_SKIPPING));
+
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[97], &oid);
+
+	cl_git_pass(git_fetch_negotiator_ack(_negotiator, &_chain[97]));
+	cl_assert_equal_i(GIT_ITEROVER, git_fetch_negotiator_next(&oid, _negotiator));
+}
+
+void test_network_fetchnegotiator__skipping_continues_down_other_branches(void)
+{
+	git_oid base, side, oid;
+
+	create_chain();
+	commit_at(&base, NULL, 1300000000, NULL);
+	commit_at(&side, "refs/heads/side", 1300000060, &base);
+
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_SKIPPING));
+
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[99], &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&_chain[97], &oid);
+
+	cl_git_pass(git_fetch_negotiator_ack(_negotiator, &_chain[97]));
+
+	/* all of the line is common now, but the side branch isn't */
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&side, &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&base, &oid);
+	cl_assert_equal_i(GIT_ITEROVER, git_fetch_negotiator_next(&oid, _negotiator));
+}
+
+void test_network_fetchnegotiator__generation_follows_the_commit_graph(void)
+{
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+	git_buf path = GIT_BUF_INIT;
+	git_oid r, p, q, s, u, oid;
+	git_odb *odb;
+
+	/*
+	 * r - p - q - s
+	 *  \
+	 *   u
+	 *
+	 * q's clock is behind, so by date u would come before q and p.
+	 */
+	commit_at(&r, NULL, 10, NULL);
+	commit_at(&p, NULL, 100, &r);
+	commit_at(&q, NULL, 20, &p);
+	commit_at(&s, "refs/heads/master", 300, &q);
+	commit_at(&u, "refs/heads/other", 50, &r);
+
+	cl_git_pass(git_buf_joinpath(&path, git_repository_path(_repo), "objects/info"));
+	cl_git_pass(git_commit_graph_writer_new(&w, git_buf_cstr(&path)));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+	git_buf_free(&path);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, _repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo,
+		GIT_FETCH_NEGOTIATION_CONSECUTIVE_GENERATION));
+
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&s, &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&q, &oid);
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&p, &oid);
+
+	/* the server has p, and so r; only u is left */
+	cl_git_pass(git_fetch_negotiator_ack(_negotiator, &p));
+	cl_git_pass(git_fetch_negotiator_next(&oid, _negotiator));
+	cl_assert_equal_oid(&u, &oid);
+	cl_assert_equal_i(GIT_ITEROVER, git_fetch_negotiator_next(&oid, _negotiator));
+}
+
+void test_network_fetchnegotiator__noop_sends_nothing(void)
+{
+	create_chain();
+
+	cl_git_pass(git_fetch_negotiator_new(&_negotiator, _repo, GIT_FETCH_NEGOTIATION_NOOP));
+	cl_assert_equal_sz(0, count_haves());
+}
+
+void test_network_fetchnegotiator__invalid_algorithm(void)
+{
+	cl_git_fail(git_fetch_negotiator_new(&_negotiator, _repo, (git_fetch_negotiation_t)42));
+	cl_assert_equal_p(NULL, _negotiator);
+}
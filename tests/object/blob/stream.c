@@ -0,0 +1,104 @@
+#include "clar_libgit2.h"
+#include "git2/odb_backend.h"
+#include "git2/pack.h"
+#include "blob.h"
+
+static git_repository *repo;
+
+void test_object_blob_stream__initialize(void)
+{
+	repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_object_blob_stream__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0));
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_blob_stream(const git_oid *id, const git_buf *expected, bool by_backend)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_odb_stream *stream;
+	char buf[1000];
+	int read;
+
+	cl_git_pass(git_blob_open_rstream(&stream, repo, id));
+	cl_assert_equal_b(by_backend, stream->backend != NULL);
+	cl_assert_equal_i(expected->size, stream->declared_size);
+
+	while ((read = git_odb_stream_read(stream, buf, sizeof(buf))) > 0)
+		cl_git_pass(git_buf_put(&contents, buf, read));
+	cl_git_pass(read);
+
+	cl_assert_equal_sz(expected->size, contents.size);
+	cl_assert(memcmp(expected->ptr, contents.ptr, contents.size) == 0);
+
+	git_odb_stream_free(stream);
+	git_buf_free(&contents);
+}
+
+void test_object_blob_stream__reads_large_blobs_in_chunks(void)
+{
+	git_buf data = GIT_BUF_INIT, pack_dir = GIT_BUF_INIT;
+	git_packbuilder *pb;
+	git_odb *odb;
+	git_oid id;
+	size_t i;
+
+	for (i = 0; i < 1024 * 1024; i++)
+		cl_git_pass(git_buf_putc(&data, (char)((i * 7919) >> (i % 13))));
+
+	cl_git_pass(git_blob_create_frombuffer(&id, repo, data.ptr, data.size));
+	assert_blob_stream(&id, &data, true);
+
+	/* the packfile backend is looked at before the loose one */
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_packbuilder_insert(pb, &id, NULL));
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, pack_dir.ptr, 0, NULL, NULL));
+	git_packbuilder_free(pb);
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+	assert_blob_stream(&id, &data, true);
+
+	git_buf_free(&pack_dir);
+	git_buf_free(&data);
+}
+
+void test_object_blob_stream__reads_loaded_blobs_from_memory(void)
+{
+	git_buf expected = GIT_BUF_INIT;
+	git_blob *blob;
+	git_oid id;
+
+	/* blobs are not cached by default */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)1024));
+
+	cl_git_pass(git_oid_fromstr(&id, "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd"));
+	cl_git_pass(git_blob_lookup(&blob, repo, &id));
+	cl_git_pass(git_blob__getbuf(&expected, blob));
+
+	assert_blob_stream(&id, &expected, false);
+
+	/* the stream keeps its own reference to the contents */
+	git_blob_free(blob);
+	assert_blob_stream(&id, &expected, false);
+
+	git_buf_free(&expected);
+}
+
+void test_object_blob_stream__only_blobs_can_be_read(void)
+{
+	git_odb_stream *stream;
+	git_commit *commit;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_blob_open_rstream(&stream, repo, &id));
+
+	cl_git_pass(git_commit_lookup(&commit, repo, &id));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_blob_open_rstream(&stream, repo, &id));
+	git_commit_free(commit);
+}
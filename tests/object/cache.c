@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
 #include "repository.h"
+#include "cache.h"
+#include "odb.h"
 
 static git_repository *g_repo;
 
@@ -14,6 +16,8 @@ void test_object_cache__cleanup(void)
 	g_repo = NULL;
 
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJ_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
+	git_libgit2_opts(GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJ_TREE, (ssize_t)0);
 }
 
 static struct {
@@ -140,6 +144,215 @@ void test_object_cache__cache_no_blobs(void)
 	git_odb_free(odb);
 }
 
+struct shard_stats {
+	size_t hits, misses, evictions;
+};
+
+static void get_shard_stats(struct shard_stats *stats, const git_oid *oid)
+{
+	size_t shards;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_SHARDS, &shards));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_SHARD_STATS,
+		(size_t)(oid->id[GIT_OID_RAWSZ - 1] % shards),
+		&stats->hits, &stats->misses, &stats->evictions));
+}
+
+void test_object_cache__shard_stats(void)
+{
+	struct shard_stats before, after;
+	size_t shards, unused;
+	git_object *obj;
+	git_oid oid;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_SHARDS, &shards));
+	cl_assert(shards > 0);
+	cl_git_fail(git_libgit2_opts(GIT_OPT_GET_CACHE_SHARD_STATS,
+		shards, &unused, &unused, &unused));
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+
+	get_shard_stats(&before, &oid);
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+	get_shard_stats(&after, &oid);
+
+	cl_assert(after.misses > before.misses);
+
+	get_shard_stats(&before, &oid);
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJ_ANY));
+	git_object_free(obj);
+	get_shard_stats(&after, &oid);
+
+	cl_assert(after.hits > before.hits);
+	cl_assert_equal_sz(before.misses, after.misses);
+}
+
+void test_object_cache__shard_stats_count_evictions(void)
+{
+	struct shard_stats before, after;
+	git_object *obj;
+	git_oid first, second;
+	size_t shards;
+
+	/* ab/c and ab/de/fgh end up in the same shard */
+	cl_git_pass(git_oid_fromstr(&first, g_data[6].sha));
+	cl_git_pass(git_oid_fromstr(&second, g_data[10].sha));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_SHARDS, &shards));
+	cl_assert_equal_i(first.id[GIT_OID_RAWSZ - 1] % shards,
+		second.id[GIT_OID_RAWSZ - 1] % shards);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &first, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	/* storing the second tree must now make room by evicting the first */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)1));
+	get_shard_stats(&before, &first);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &second, GIT_OBJ_ANY));
+	git_object_free(obj);
+
+	get_shard_stats(&after, &first);
+	cl_assert(after.evictions > before.evictions);
+}
+
+/* A tree of `size` bytes whose id ends up in the given shard */
+static git_odb_object *fake_tree(int n, int shard, size_t size)
+{
+	git_odb_object *obj = git__calloc(1, sizeof(git_odb_object));
+	cl_assert(obj);
+
+	obj->cached.oid.id[0] = (unsigned char)n;
+	obj->cached.oid.id[GIT_OID_RAWSZ - 1] = (unsigned char)shard;
+	obj->cached.type = GIT_OBJ_TREE;
+	obj->cached.size = size;
+	obj->buffer = git__malloc(1);
+
+	return obj;
+}
+
+static bool is_cached(git_cache *cache, int n, int shard)
+{
+	git_oid id = {{ 0 }};
+	git_odb_object *obj;
+
+	id.id[0] = (unsigned char)n;
+	id.id[GIT_OID_RAWSZ - 1] = (unsigned char)shard;
+	if ((obj = git_cache_get_raw(cache, &id)) == NULL)
+		return false;
+
+	git_odb_object_free(obj);
+	return true;
+}
+
+void test_object_cache__type_budget_evicts_cold_objects_first(void)
+{
+	git_cache cache;
+	ssize_t current, allowed;
+	int i;
+
+	cl_git_pass(git_cache_init(&cache));
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJ_TREE, (ssize_t)300));
+
+	for (i = 1; i <= 3; i++)
+		git_odb_object_free(git_cache_store_raw(&cache, fake_tree(i, 0, 100)));
+
+	/* tree 1 is hot, trees 2 and 3 are not */
+	cl_assert(is_cached(&cache, 1, 0));
+
+	/* there is room for three trees; one has to go */
+	git_odb_object_free(git_cache_store_raw(&cache, fake_tree(4, 0, 100)));
+	cl_assert(is_cached(&cache, 1, 0));
+	cl_assert(!is_cached(&cache, 2, 0));
+	cl_assert(is_cached(&cache, 3, 0));
+	cl_assert(is_cached(&cache, 4, 0));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY,
+		(int)GIT_OBJ_TREE, &current, &allowed));
+	cl_assert_equal_i(300, allowed);
+	cl_assert(current <= 300);
+
+	/* every tree has been looked up; the hand goes all the way round */
+	git_odb_object_free(git_cache_store_raw(&cache, fake_tree(5, 0, 200)));
+	cl_assert_equal_i(2, (int)git_cache_size(&cache));
+	cl_assert(is_cached(&cache, 5, 0));
+
+	git_cache_free(&cache);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY,
+		(int)GIT_OBJ_TREE, &current, &allowed));
+	cl_assert_equal_i(0, current);
+}
+
+void test_object_cache__total_budget_holds_across_shards(void)
+{
+	git_cache cache;
+	ssize_t current, allowed;
+	int i;
+
+	cl_git_pass(git_cache_init(&cache));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)300));
+
+	/* every tree goes to a shard of its own */
+	for (i = 1; i <= 8; i++) {
+		git_odb_object_free(git_cache_store_raw(&cache, fake_tree(i, i, 100)));
+		cl_assert(is_cached(&cache, i, i));
+
+		cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY,
+			&current, &allowed));
+		cl_assert(current <= 300);
+	}
+
+	cl_assert_equal_i(3, (int)git_cache_size(&cache));
+
+	/* a tree which can never fit is not cached */
+	git_odb_object_free(git_cache_store_raw(&cache, fake_tree(9, 9, 400)));
+	cl_assert(!is_cached(&cache, 9, 9));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY,
+		&current, &allowed));
+	cl_assert(current <= 300);
+
+	git_cache_free(&cache);
+}
+
+void test_object_cache__type_budget_holds_across_shards(void)
+{
+	git_cache cache;
+	ssize_t current, allowed;
+	int i;
+
+	cl_git_pass(git_cache_init(&cache));
+	cl_git_pass(git_libgit2_opts(
+		GIT_OPT_SET_CACHE_TYPE_MAX_SIZE, (int)GIT_OBJ_TREE, (ssize_t)300));
+
+	/* every tree goes to a shard of its own */
+	for (i = 1; i <= 8; i++) {
+		git_odb_object_free(git_cache_store_raw(&cache, fake_tree(i, i, 100)));
+		cl_assert(is_cached(&cache, i, i));
+
+		cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY,
+			(int)GIT_OBJ_TREE, &current, &allowed));
+		cl_assert(current <= 300);
+	}
+
+	cl_assert_equal_i(3, (int)git_cache_size(&cache));
+
+	/* a tree which can never fit is not cached */
+	git_odb_object_free(git_cache_store_raw(&cache, fake_tree(9, 9, 400)));
+	cl_assert(!is_cached(&cache, 9, 9));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHED_TYPE_MEMORY,
+		(int)GIT_OBJ_TREE, &current, &allowed));
+	cl_assert(current <= 300);
+
+	git_cache_free(&cache);
+}
+
 static void *cache_parsed(void *arg)
 {
 	int i;
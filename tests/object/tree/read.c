@@ -73,3 +73,38 @@ void test_object_tree_read__two(void)
 	git_object_free(obj);
 	git_tree_free(tree);
 }
+
+void test_object_tree_read__duplicated_entries_outlive_the_tree(void)
+{
+	git_oid id;
+	git_tree *tree;
+	git_tree_entry *entry;
+
+	git_oid_fromstr(&id, tree_oid);
+	cl_git_pass(git_tree_lookup(&tree, g_repo, &id));
+
+	cl_git_pass(git_tree_entry_dup(&entry,
+		git_tree_entry_byname(tree, "README")));
+	git_tree_free(tree);
+
+	cl_assert_equal_s("README", git_tree_entry_name(entry));
+	cl_assert_equal_i(GIT_FILEMODE_BLOB, git_tree_entry_filemode(entry));
+	cl_assert(git_oid_streq(git_tree_entry_id(entry),
+		"a8233120f6ad708f843d861ce2b7228ec4e3dec6") == 0);
+
+	git_tree_entry_free(entry);
+}
+
+void test_object_tree_read__truncated_ids_are_rejected(void)
+{
+	const char data[] = "100644 README\0\xa8\x23\x31\x20";
+	git_oid id;
+	git_odb *odb;
+	git_tree *tree;
+
+	cl_git_pass(git_repository_odb(&odb, g_repo));
+	cl_git_pass(git_odb_write(&id, odb, data, sizeof(data) - 1, GIT_OBJ_TREE));
+	git_odb_free(odb);
+
+	cl_git_fail(git_tree_lookup(&tree, g_repo, &id));
+}
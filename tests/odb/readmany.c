@@ -0,0 +1,135 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+
+static git_odb *_odb;
+
+/* the objects of pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a, by offset */
+static const char *packed[] = {
+	"e90810b8df3e80c413d903f631643c716887138d",
+	"6dcf9bf7541ee10456529833502442f385010c3d",
+	"53fc32d17276939fc79ed05badaef2db09990016",
+	"0266163a49e280c4f5ed1e08facd36a2bd716bcf",
+	"bed08a0b30b72a9d4aed7f1af8c8ca124e8d64b9",
+	"6336846bd5c88d32f93ae57d846683e61ab5c530",
+};
+
+static const char *loose = "181037049a54a1eb5fab404658a3a250b44335d7";
+
+typedef struct {
+	size_t positions[16];
+	size_t count;
+	const git_oid *ids;
+	int stop_after;
+} read_many_data;
+
+static int record_object(git_odb_object *object, size_t position, void *payload)
+{
+	read_many_data *data = payload;
+	git_odb_object *expected;
+
+	cl_assert_equal_oid(&data->ids[position], git_odb_object_id(object));
+
+	cl_git_pass(git_odb_read(&expected, _odb, &data->ids[position]));
+	cl_assert_equal_i(git_odb_object_type(expected), git_odb_object_type(object));
+	cl_assert_equal_sz(git_odb_object_size(expected), git_odb_object_size(object));
+	cl_assert(memcmp(git_odb_object_data(expected), git_odb_object_data(object),
+		git_odb_object_size(object)) == 0);
+	git_odb_object_free(expected);
+
+	cl_assert(data->count < ARRAY_SIZE(data->positions));
+	data->positions[data->count++] = position;
+
+	if (data->stop_after && data->count == (size_t)data->stop_after)
+		return 42;
+
+	return 0;
+}
+
+void test_odb_readmany__initialize(void)
+{
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+}
+
+void test_odb_readmany__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+}
+
+void test_odb_readmany__reads_in_storage_order(void)
+{
+	read_many_data data = {{0}};
+	git_oid ids[7];
+	size_t i;
+
+	/* ask for the packed objects backwards, then for a loose one */
+	for (i = 0; i < ARRAY_SIZE(packed); i++)
+		cl_git_pass(git_oid_fromstr(&ids[i], packed[ARRAY_SIZE(packed) - 1 - i]));
+	cl_git_pass(git_oid_fromstr(&ids[6], loose));
+
+	data.ids = ids;
+	cl_git_pass(git_odb_read_many(_odb, ids, 7, record_object, &data));
+
+	cl_assert_equal_sz(7, data.count);
+	cl_assert_equal_sz(6, data.positions[0]);
+	for (i = 1; i < 7; i++)
+		cl_assert_equal_sz(6 - i, data.positions[i]);
+}
+
+void test_odb_readmany__duplicates_are_read_each_time(void)
+{
+	read_many_data data = {{0}};
+	git_oid ids[3];
+
+	cl_git_pass(git_oid_fromstr(&ids[0], packed[3]));
+	cl_git_pass(git_oid_fromstr(&ids[1], packed[1]));
+	cl_git_pass(git_oid_fromstr(&ids[2], packed[3]));
+
+	data.ids = ids;
+	cl_git_pass(git_odb_read_many(_odb, ids, 3, record_object, &data));
+
+	cl_assert_equal_sz(3, data.count);
+	cl_assert_equal_sz(1, data.positions[0]);
+	cl_assert_equal_sz(0, data.positions[1]);
+	cl_assert_equal_sz(2, data.positions[2]);
+}
+
+void test_odb_readmany__nothing_to_read(void)
+{
+	read_many_data data = {{0}};
+
+	cl_git_pass(git_odb_read_many(_odb, NULL, 0, record_object, &data));
+	cl_assert_equal_sz(0, data.count);
+}
+
+void test_odb_readmany__missing_objects_fail(void)
+{
+	read_many_data data = {{0}};
+	git_oid ids[2];
+
+	cl_git_pass(git_oid_fromstr(&ids[0], packed[0]));
+	cl_git_pass(git_oid_fromstr(&ids[1],
+		"deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+
+	data.ids = ids;
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_odb_read_many(_odb, ids, 2, record_object, &data));
+}
+
+void test_odb_readmany__callback_can_stop_reading(void)
+{
+	read_many_data data = {{0}};
+	git_oid ids[4];
+	size_t i;
+
+	for (i = 0; i < 4; i++)
+		cl_git_pass(git_oid_fromstr(&ids[i], packed[i]));
+
+	data.ids = ids;
+	data.stop_after = 2;
+	cl_git_fail_with(42, git_odb_read_many(_odb, ids, 4, record_object, &data));
+
+	cl_assert_equal_sz(2, data.count);
+	cl_assert_equal_sz(0, data.positions[0]);
+	cl_assert_equal_sz(1, data.positions[1]);
+}
@@ -0,0 +1,168 @@
+#include "clar_libgit2.h"
+#include "git2/odb_backend.h"
+#include "git2/sys/odb_backend.h"
+#include "odb.h"
+
+/* 8b137891791fe96927ad78e64b0aad7bded08bdc, in the old pack-like format */
+static const unsigned char packlike_bytes[] = {
+	0x31, 0x78, 0x9c, 0xe3, 0x02, 0x00, 0x00, 0x0b,
+	0x00, 0x0b,
+};
+
+static git_odb *_odb;
+
+void test_odb_streamread__initialize(void)
+{
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+}
+
+void test_odb_streamread__cleanup(void)
+{
+	git_odb_free(_odb);
+	_odb = NULL;
+}
+
+static void read_stream(git_buf *out, git_odb_stream *stream, size_t chunk)
+{
+	char buf[4096];
+	int read;
+
+	cl_assert(chunk <= sizeof(buf));
+
+	while ((read = git_odb_stream_read(stream, buf, chunk)) > 0)
+		cl_git_pass(git_buf_put(out, buf, read));
+
+	cl_git_pass(read);
+	cl_assert_equal_i(stream->declared_size, stream->received_bytes);
+}
+
+static void assert_stream_matches(git_odb *odb, const git_oid *id, size_t chunk)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_odb_stream *stream;
+	git_odb_object *obj;
+	git_otype type;
+	size_t len;
+
+	cl_git_pass(git_odb_open_rstream(&stream, &len, &type, odb, id));
+	read_stream(&contents, stream, chunk);
+	git_odb_stream_free(stream);
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	cl_assert_equal_i(git_odb_object_type(obj), type);
+	cl_assert_equal_sz(git_odb_object_size(obj), len);
+	cl_assert_equal_sz(len, contents.size);
+	cl_assert(memcmp(git_odb_object_data(obj), contents.ptr, len) == 0);
+	git_odb_object_free(obj);
+
+	git_buf_free(&contents);
+}
+
+static int stream_matches_cb(const git_oid *id, void *payload)
+{
+	size_t *chunk = payload;
+
+	assert_stream_matches(_odb, id, *chunk);
+	return 0;
+}
+
+void test_odb_streamread__matches_read(void)
+{
+	size_t chunk = 7;
+	cl_git_pass(git_odb_foreach(_odb, stream_matches_cb, &chunk));
+
+	/* everything is in the cache now */
+	chunk = 4096;
+	cl_git_pass(git_odb_foreach(_odb, stream_matches_cb, &chunk));
+}
+
+static void assert_streamed_by_backend(const char *sha, bool by_backend)
+{
+	git_odb_stream *stream;
+	git_otype type;
+	git_oid id;
+	size_t len;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_odb_open_rstream(&stream, &len, &type, _odb, &id));
+	cl_assert_equal_b(by_backend, stream->backend != NULL);
+	cl_assert_equal_i(len, stream->declared_size);
+	git_odb_stream_free(stream);
+}
+
+void test_odb_streamread__inflates_as_it_reads(void)
+{
+	/* loose blob */
+	assert_streamed_by_backend("a71586c1dfe8a71c6cbf6c129f404c5642ff31bd", true);
+	/* whole packed commit */
+	assert_streamed_by_backend("41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9", true);
+}
+
+void test_odb_streamread__reads_deltas_whole(void)
+{
+	/* deltified in the pack */
+	assert_streamed_by_backend("edc438eedf6854c51e1a0d7954a6849046f5a4f6", false);
+}
+
+void test_odb_streamread__version_1_backends_are_read_whole(void)
+{
+	git_odb_backend *loose;
+	git_oid id;
+
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_new(&_odb));
+
+	/* its `readstream` has the arguments of version 2; it must not be called */
+	cl_git_pass(git_odb_backend_loose(&loose,
+		cl_fixture("testrepo.git/objects"), -1, 0, 0, 0));
+	loose->version = 1;
+	cl_git_pass(git_odb_add_backend(_odb, loose, 1));
+
+	assert_streamed_by_backend("a71586c1dfe8a71c6cbf6c129f404c5642ff31bd", false);
+
+	cl_git_pass(git_oid_fromstr(&id, "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd"));
+	assert_stream_matches(_odb, &id, 7);
+}
+
+void test_odb_streamread__reads_packlike_loose_objects_whole(void)
+{
+	git_odb_stream *stream;
+	git_buf contents = GIT_BUF_INIT;
+	git_otype type;
+	git_oid id;
+	size_t len;
+	int fd;
+
+	git_odb_free(_odb);
+
+	cl_must_pass(p_mkdir("test-objects", GIT_OBJECT_DIR_MODE));
+	cl_must_pass(p_mkdir("test-objects/8b", GIT_OBJECT_DIR_MODE));
+	cl_assert((fd = p_creat("test-objects/8b/137891791fe96927ad78e64b0aad7bded08bdc", 0644)) >= 0);
+	cl_must_pass(p_write(fd, packlike_bytes, sizeof(packlike_bytes)));
+	p_close(fd);
+
+	cl_git_pass(git_odb_open(&_odb, "test-objects"));
+	cl_git_pass(git_oid_fromstr(&id, "8b137891791fe96927ad78e64b0aad7bded08bdc"));
+	cl_git_pass(git_odb_open_rstream(&stream, &len, &type, _odb, &id));
+	cl_assert_equal_i(GIT_OBJ_BLOB, type);
+	cl_assert_equal_sz(1, len);
+
+	read_stream(&contents, stream, 1);
+	cl_assert_equal_s("\n", contents.ptr);
+
+	git_odb_stream_free(stream);
+	git_buf_free(&contents);
+	cl_fixture_cleanup("test-objects");
+}
+
+void test_odb_streamread__missing_object(void)
+{
+	git_odb_stream *stream;
+	git_otype type;
+	git_oid id;
+	size_t len;
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_odb_open_rstream(&stream, &len, &type, _odb, &id));
+}
@@ -0,0 +1,312 @@
+#include "clar_libgit2.h"
+
+#include "git2/sys/pack_bitmap.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
+#include "fileops.h"
+#include "odb.h"
+#include "repository.h"
+
+static git_repository *repo;
+static git_buf idx_path = GIT_BUF_INIT, bitmap_path = GIT_BUF_INIT;
+
+static const char *tips[] = {
+	"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+	"e90810b8df3e80c413d903f631643c716887138d",
+	"41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+	"d07b0f9a8c89f1d9e74dc4fce6421dec5ef8a659",
+};
+
+static int cmp_oid(const void *a, const void *b)
+{
+	return git_oid_cmp(a, b);
+}
+
+/* Collect the ids of the objects the packbuilder would send */
+static void collect_walk(git_vector *out, const char *push, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_oid id;
+	uint32_t i;
+
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+
+	cl_git_pass(git_oid_fromstr(&id, push));
+	cl_git_pass(git_revwalk_push(walk, &id));
+	if (hide) {
+		cl_git_pass(git_oid_fromstr(&id, hide));
+		cl_git_pass(git_revwalk_hide(walk, &id));
+	}
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(git_vector_init(out, pb->nr_objects, cmp_oid));
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_oid *copy = git__malloc(sizeof(git_oid));
+		cl_assert(copy);
+		git_oid_cpy(copy, &pb->object_list[i].id);
+		cl_git_pass(git_vector_insert(out, copy));
+	}
+	git_vector_sort(out);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+static void free_oids(git_vector *oids)
+{
+	git_oid *id;
+	size_t i;
+
+	git_vector_foreach(oids, i, id)
+		git__free(id);
+	git_vector_free(oids);
+}
+
+static void assert_same_oids(git_vector *a, git_vector *b)
+{
+	size_t i;
+
+	cl_assert_equal_sz(a->length, b->length);
+	for (i = 0; i < a->length; i++)
+		cl_assert(git_oid_equal(git_vector_get(a, i), git_vector_get(b, i)));
+}
+
+void test_pack_bitmap__initialize(void)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_buf pack_dir = GIT_BUF_INIT;
+	git_oid id;
+	git_odb *odb;
+	size_t i;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	/* gather the whole history in a single pack */
+	cl_git_pass(git_packbuilder_new(&pb, repo));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	for (i = 0; i < ARRAY_SIZE(tips); i++) {
+		cl_git_pass(git_oid_fromstr(&id, tips[i]));
+		cl_git_pass(git_revwalk_push(walk, &id));
+	}
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_packbuilder_write(pb, pack_dir.ptr, 0, NULL, NULL));
+
+	cl_git_pass(git_buf_printf(&idx_path, "%s/pack-%s.idx",
+		pack_dir.ptr, git_oid_tostr_s(git_packbuilder_hash(pb))));
+	cl_git_pass(git_buf_printf(&bitmap_path, "%s/pack-%s.bitmap",
+		pack_dir.ptr, git_oid_tostr_s(git_packbuilder_hash(pb))));
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	git_buf_free(&pack_dir);
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+void test_pack_bitmap__cleanup(void)
+{
+	git_buf_free(&idx_path);
+	git_buf_free(&bitmap_path);
+	cl_git_sandbox_cleanup();
+}
+
+static void write_bitmap(size_t ntips)
+{
+	git_bitmap_writer *w;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_bitmap_writer_new(&w, repo, idx_path.ptr));
+	for (i = 0; i < ntips; i++) {
+		cl_git_pass(git_oid_fromstr(&id, tips[i]));
+		cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	}
+	cl_git_pass(git_bitmap_writer_commit(w));
+	git_bitmap_writer_free(w);
+}
+
+void test_pack_bitmap__ewah_roundtrip(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT, parsed;
+	git_buf buf = GIT_BUF_INIT;
+	size_t i, consumed;
+
+	for (i = 0; i < 64 * 5; i++)
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+	for (i = 64 * 9; i < 64 * 20; i += 3)
+		cl_git_pass(git_bitmap_set(&bitmap, i));
+	cl_git_pass(git_bitmap_set(&bitmap, 64 * 40 + 1));
+
+	cl_git_pass(git_ewah_serialize(&buf, &bitmap));
+	cl_git_pass(git_ewah_parse(&parsed, &consumed,
+		(const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(buf.size, consumed);
+
+	cl_assert_equal_sz(git_bitmap_popcount(&bitmap), git_bitmap_popcount(&parsed));
+	for (i = 0; i < 64 * 48; i++)
+		cl_assert_equal_b(git_bitmap_get(&bitmap, i), git_bitmap_get(&parsed, i));
+
+	/* the declared size bounds the bitmap */
+	git_bitmap_free(&parsed);
+	buf.ptr[2] = 0;
+	buf.ptr[3] = 64;
+	cl_git_fail(git_ewah_parse(&parsed, &consumed,
+		(const unsigned char *)buf.ptr, buf.size));
+
+	git_bitmap_free(&bitmap);
+	git_bitmap_free(&parsed);
+	git_buf_free(&buf);
+}
+
+static int collect_bitmap_cb(
+	const git_oid *id, git_otype type, uint32_t name_hash, void *payload)
+{
+	git_oid *copy = git__malloc(sizeof(git_oid));
+	GITERR_CHECK_ALLOC(copy);
+
+	GIT_UNUSED(type);
+	GIT_UNUSED(name_hash);
+
+	git_oid_cpy(copy, id);
+	return git_vector_insert(payload, copy);
+}
+
+void test_pack_bitmap__reachable(void)
+{
+	const char *commits[] = {
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		"a4a7dce85cf63874e984719f4fdd239f5145052f",
+		"9fd738e8f7967c078dceed8190330fc8648ee56a",
+		"763d71aadf09a7951596c9746c024e7eece7c7af",
+		"8496071c1b46c854b31185ea97743be6a8774479",
+	};
+	git_vector expected[ARRAY_SIZE(commits)];
+	git_bitmap_index *idx;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(commits); i++)
+		collect_walk(&expected[i], commits[i], NULL);
+
+	write_bitmap(2);
+	cl_git_pass(git_bitmap_index_open(&idx, repo, idx_path.ptr));
+
+	for (i = 0; i < ARRAY_SIZE(commits); i++) {
+		git_bitmap reachable = GIT_BITMAP_INIT;
+		git_vector actual;
+		git_oid id;
+
+		cl_git_pass(git_oid_fromstr(&id, commits[i]));
+		cl_git_pass(git_bitmap_index_reachable(&reachable, idx, &id));
+
+		cl_git_pass(git_vector_init(&actual, 0, cmp_oid));
+		cl_git_pass(git_bitmap_index_foreach(idx, &reachable, collect_bitmap_cb, &actual));
+		git_vector_sort(&actual);
+
+		assert_same_oids(&expected[i], &actual);
+
+		free_oids(&actual);
+		free_oids(&expected[i]);
+		git_bitmap_free(&reachable);
+	}
+
+	git_bitmap_index_free(idx);
+}
+
+void test_pack_bitmap__insert_walk_excludes_hidden(void)
+{
+	const char *hidden = "5b5b025afb0b4c913b4c338a42934a3863bf3644";
+	git_vector pushed, haves, expected, actual;
+	git_oid *id;
+	size_t i;
+
+	collect_walk(&pushed, tips[0], NULL);
+	collect_walk(&haves, hidden, NULL);
+
+	/*
+	 * The tree walk only skips the trees of the hidden commits at the
+	 * edge of the walk; with a bitmap nothing reachable from them is sent.
+	 */
+	cl_git_pass(git_vector_init(&expected, 0, cmp_oid));
+	git_vector_foreach(&pushed, i, id) {
+		if (git_vector_search(NULL, &haves, id) == GIT_ENOTFOUND)
+			cl_git_pass(git_vector_insert(&expected, id));
+	}
+
+	write_bitmap(ARRAY_SIZE(tips));
+	cl_assert(git_path_exists(bitmap_path.ptr));
+
+	collect_walk(&actual, tips[0], hidden);
+	assert_same_oids(&expected, &actual);
+
+	git_vector_free(&expected);
+	free_oids(&pushed);
+	free_oids(&haves);
+	free_oids(&actual);
+}
+
+void test_pack_bitmap__dump_matches_commit(void)
+{
+	git_bitmap_writer *w;
+	git_buf dump = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_oid id;
+
+	write_bitmap(ARRAY_SIZE(tips));
+	cl_git_pass(git_futils_readbuffer(&contents, bitmap_path.ptr));
+
+	cl_git_pass(git_bitmap_writer_new(&w, repo, idx_path.ptr));
+	cl_git_pass(git_oid_fromstr(&id, tips[3]));
+	cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	cl_git_pass(git_oid_fromstr(&id, tips[0]));
+	cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	cl_git_pass(git_oid_fromstr(&id, tips[1]));
+	cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	cl_git_pass(git_oid_fromstr(&id, tips[2]));
+	cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	cl_git_pass(git_bitmap_writer_dump(&dump, w));
+
+	cl_assert_equal_sz(contents.size, dump.size);
+	cl_assert(memcmp(contents.ptr, dump.ptr, dump.size) == 0);
+
+	git_bitmap_writer_free(w);
+	git_buf_free(&dump);
+	git_buf_free(&contents);
+}
+
+void test_pack_bitmap__only_commits_can_have_a_bitmap(void)
+{
+	git_bitmap_writer *w;
+	git_buf dump = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_bitmap_writer_new(&w, repo, idx_path.ptr));
+	cl_git_pass(git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6"));
+	cl_git_pass(git_bitmap_writer_add_commit(w, &id));
+	cl_git_fail(git_bitmap_writer_dump(&dump, w));
+
+	git_bitmap_writer_free(w);
+	git_buf_free(&dump);
+}
+
+void test_pack_bitmap__invalid_bitmap_is_ignored(void)
+{
+	git_bitmap_index *idx;
+	git_vector before, after;
+
+	collect_walk(&before, tips[0], NULL);
+
+	cl_git_mkfile(bitmap_path.ptr, "BITM but not really");
+	cl_git_fail(git_bitmap_index_open(&idx, repo, idx_path.ptr));
+
+	collect_walk(&after, tips[0], NULL);
+	assert_same_oids(&before, &after);
+
+	free_oids(&before);
+	free_oids(&after);
+}
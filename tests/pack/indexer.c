@@ -125,3 +125,70 @@ void test_pack_indexer__fix_thin(void)
 		git_indexer_free(idx);
 	}
 }
+
+/* Index testrepo's packfile and check we come up with the same index */
+static void index_existing_pack(unsigned int threads, int streaming, size_t chunk)
+{
+	git_indexer *idx;
+	git_transfer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT, expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+	const char *name = "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695";
+	size_t pos;
+
+	cl_git_pass(git_futils_readbuffer(&pack,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack")));
+	cl_git_pass(git_futils_readbuffer(&expected,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	git_indexer_set_threads(idx, threads);
+	git_indexer_set_streaming(idx, streaming);
+
+	for (pos = 0; pos < pack.size; pos += chunk)
+		cl_git_pass(git_indexer_append(idx, pack.ptr + pos,
+			min(chunk, pack.size - pos), &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(1628, stats.total_objects);
+	cl_assert_equal_i(1628, stats.indexed_objects);
+	cl_assert_equal_i(1142, stats.indexed_deltas);
+	cl_assert_equal_s(name + strlen("pack-"), git_oid_tostr_s(git_indexer_hash(idx)));
+
+	cl_git_pass(git_futils_readbuffer(&actual,
+		"pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_assert_equal_i(expected.size, actual.size);
+	cl_assert(memcmp(expected.ptr, actual.ptr, expected.size) == 0);
+
+	git_indexer_free(idx);
+	git_buf_free(&pack);
+	git_buf_free(&expected);
+	git_buf_free(&actual);
+}
+
+void test_pack_indexer__threaded_matches_existing_index(void)
+{
+	index_existing_pack(4, 0, SIZE_MAX);
+}
+
+void test_pack_indexer__streaming_matches_existing_index(void)
+{
+	index_existing_pack(0, 1, 1000);
+}
+
+void test_pack_indexer__streaming_can_be_abandoned(void)
+{
+	git_indexer *idx;
+	git_transfer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&pack,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack")));
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	git_indexer_set_streaming(idx, 1);
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size / 2, &stats));
+
+	/* the deltas resolved so far are thrown away with the rest */
+	git_indexer_free(idx);
+	git_buf_free(&pack);
+}
@@ -0,0 +1,202 @@
+#include "clar_libgit2.h"
+
+#include "git2/sys/midx.h"
+#include "midx.h"
+#include "fileops.h"
+#include "odb.h"
+#include "repository.h"
+
+static git_repository *repo;
+static git_buf pack_dir = GIT_BUF_INIT, midx_path = GIT_BUF_INIT;
+
+void test_pack_midx__initialize(void)
+{
+	repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_buf_joinpath(&pack_dir, git_repository_path(repo), "objects/pack"));
+	cl_git_pass(git_buf_joinpath(&midx_path, pack_dir.ptr, "multi-pack-index"));
+}
+
+void test_pack_midx__cleanup(void)
+{
+	git_buf_free(&pack_dir);
+	git_buf_free(&midx_path);
+	cl_git_sandbox_cleanup();
+}
+
+static int add_idx_cb(void *payload, git_buf *path)
+{
+	git_midx_writer *w = payload;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	return git_midx_writer_add(w, path->ptr);
+}
+
+static void write_midx_file(void)
+{
+	git_midx_writer *w;
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_midx_writer_new(&w, pack_dir.ptr));
+
+	cl_git_pass(git_buf_sets(&path, pack_dir.ptr));
+	cl_git_pass(git_path_direach(&path, 0, add_idx_cb, w));
+
+	cl_git_pass(git_midx_writer_commit(w));
+	git_midx_writer_free(w);
+
+	git_buf_free(&path);
+}
+
+static void write_midx(void)
+{
+	git_odb *odb;
+
+	write_midx_file();
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+}
+
+static int collect_oids_cb(const git_oid *id, void *payload)
+{
+	git_vector *oids = payload;
+	git_oid *copy = git__malloc(sizeof(git_oid));
+	GITERR_CHECK_ALLOC(copy);
+
+	git_oid_cpy(copy, id);
+	return git_vector_insert(oids, copy);
+}
+
+void test_pack_midx__parse(void)
+{
+	git_midx_file *idx;
+	git_midx_entry e;
+	git_oid id;
+
+	write_midx();
+
+	cl_git_pass(git_midx_open(&idx, midx_path.ptr));
+	cl_assert_equal_sz(3, git_vector_length(&idx->packfile_names));
+	cl_assert_equal_s("pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx",
+		git_vector_get(&idx->packfile_names, 0));
+	cl_assert(!git_midx_needs_refresh(idx, midx_path.ptr));
+
+	cl_git_pass(git_oid_fromstr(&id, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&id, &e.sha1);
+	cl_assert(e.pack_index < 3);
+	cl_assert(e.offset > 0);
+
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 7));
+	cl_assert_equal_oid(&id, &e.sha1);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000000"));
+	cl_git_fail_with(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ), GIT_ENOTFOUND);
+
+	git_midx_free(idx);
+}
+
+void test_pack_midx__lookup(void)
+{
+	git_vector before = GIT_VECTOR_INIT, after = GIT_VECTOR_INIT;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *id, found;
+	git_object *object;
+	size_t i;
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_foreach(odb, collect_oids_cb, &before));
+
+	write_midx();
+	cl_assert(git_path_isfile(midx_path.ptr));
+
+	cl_git_pass(git_odb_foreach(odb, collect_oids_cb, &after));
+	cl_assert_equal_sz(before.length, after.length);
+
+	git_vector_foreach(&after, i, id) {
+		cl_assert(git_odb_exists(odb, id));
+
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		cl_assert_equal_oid(id, git_odb_object_id(obj));
+		git_odb_object_free(obj);
+
+		cl_git_pass(git_odb_exists_prefix(&found, odb, id, 10));
+		cl_assert_equal_oid(id, &found);
+	}
+
+	cl_git_pass(git_revparse_single(&object, repo, "41bc8c6"));
+	cl_assert_equal_s("41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9",
+		git_oid_tostr_s(git_object_id(object)));
+	git_object_free(object);
+
+	git_vector_free_deep(&before);
+	git_vector_free_deep(&after);
+}
+
+void test_pack_midx__dump_matches_commit(void)
+{
+	git_midx_writer *w;
+	git_buf contents = GIT_BUF_INIT, on_disk = GIT_BUF_INIT;
+
+	write_midx();
+
+	cl_git_pass(git_midx_writer_new(&w, pack_dir.ptr));
+	cl_git_pass(git_midx_writer_add(w, "pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(git_midx_writer_add(w, "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.idx"));
+	cl_git_pass(git_midx_writer_dump(&contents, w));
+
+	cl_git_pass(git_futils_readbuffer(&on_disk, midx_path.ptr));
+	cl_assert_equal_sz(on_disk.size, contents.size);
+	cl_assert(memcmp(on_disk.ptr, contents.ptr, contents.size) == 0);
+
+	cl_git_fail(git_midx_writer_add(w, "../../HEAD"));
+
+	git_midx_writer_free(w);
+	git_buf_free(&contents);
+	git_buf_free(&on_disk);
+}
+
+void test_pack_midx__invalid_index_is_ignored(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_mkfile(midx_path.ptr, "this is not a multi-pack-index");
+
+	cl_git_pass(git_repository_odb__weakptr(&odb, repo));
+	cl_git_pass(git_odb_refresh(odb));
+
+	cl_git_pass(git_oid_fromstr(&id, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_assert(git_odb_exists(odb, &id));
+}
+
+void test_pack_midx__missing_pack_is_ignored(void)
+{
+	git_repository *other;
+	git_odb *odb;
+	git_oid id;
+	git_buf path = GIT_BUF_INIT;
+
+	write_midx_file();
+
+	/* drop a pack that the multi-pack-index refers to */
+	cl_git_pass(git_buf_joinpath(&path, pack_dir.ptr,
+		"pack-d85f5d483273108c9d8dd0e4728ccf0b2982423a.pack"));
+	cl_must_pass(p_unlink(path.ptr));
+
+	cl_git_pass(git_repository_open(&other, git_repository_path(repo)));
+	cl_git_pass(git_repository_odb__weakptr(&odb, other));
+
+	cl_git_pass(git_oid_fromstr(&id, "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_oid_fromstr(&id, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	git_repository_free(other);
+	git_buf_free(&path);
+}
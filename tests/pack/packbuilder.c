@@ -1,6 +1,8 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-objects.h"
+#include "git2/sys/odb_backend.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -223,3 +225,71 @@ void test_pack_packbuilder__foreach_with_cancel(void)
 		git_packbuilder_foreach(_packbuilder, foreach_cancel_cb, idx), -1111);
 	git_indexer_free(idx);
 }
+
+static int insert_oid_cb(const git_oid *id, void *payload)
+{
+	return git_packbuilder_insert(payload, id, NULL);
+}
+
+void test_pack_packbuilder__reuses_packed_deltas(void)
+{
+	git_odb_backend *backend;
+	git_indexer *idx;
+
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		"objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(backend->foreach(backend, insert_oid_cb, _packbuilder));
+	backend->free(backend);
+
+	/* keep the search for deltas from finding any */
+	_packbuilder->big_file_threshold = 0;
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, foreach_cb, idx));
+	cl_git_pass(git_indexer_commit(idx, &_stats));
+	git_indexer_free(idx);
+
+	/* every delta of the original pack has its base in the new one */
+	cl_assert_equal_i(1628, _stats.total_objects);
+	cl_assert_equal_i(1142, _stats.indexed_deltas);
+}
+
+void test_pack_packbuilder__breaks_deep_packed_delta_chains(void)
+{
+	git_odb_backend *backend;
+	git_indexer *idx;
+	git_pobject *po, *base;
+	unsigned int depth, deepest = 0;
+	uint32_t i;
+
+	/* the chains in this pack go 50 deltas deep */
+	cl_git_pass(git_odb_backend_one_pack(&backend,
+		"objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"));
+	cl_git_pass(backend->foreach(backend, insert_oid_cb, _packbuilder));
+	backend->free(backend);
+
+	_packbuilder->big_file_threshold = 0;
+	_packbuilder->max_delta_depth = 10;
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, foreach_cb, idx));
+	cl_git_pass(git_indexer_commit(idx, &_stats));
+	git_indexer_free(idx);
+
+	for (i = 0; i < _packbuilder->nr_objects; i++) {
+		po = _packbuilder->object_list + i;
+
+		for (depth = 0, base = po->delta; base; base = base->delta)
+			depth++;
+
+		if (depth > deepest)
+			deepest = depth;
+	}
+
+	cl_assert_equal_i(10, deepest);
+
+	/* the objects where the chains were broken are sent whole */
+	cl_assert_equal_i(1628, _stats.total_objects);
+	cl_assert(_stats.indexed_deltas < 1142);
+	cl_assert(_stats.indexed_deltas > 0);
+}
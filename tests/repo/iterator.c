@@ -900,6 +900,43 @@ void test_repo_iterator__workdir_depth(void)
 	git_iterator_free(iter);
 }
 
+void test_repo_iterator__workdir_parallel_scan(void)
+{
+	git_iterator *iter;
+	git_iterator_options iter_opts = GIT_ITERATOR_OPTIONS_INIT;
+	const char *paths[] = { "a", "k/1", "k/a", "L/1" };
+	const char *expected[] = { "L/1", "a", "k/1", "k/a" };
+
+	g_repo = cl_git_sandbox_init("icase");
+
+	build_workdir_tree("icase", 10, 10);
+	build_workdir_tree("icase/DIR01/sUB01", 50, 0);
+	build_workdir_tree("icase/dir02/sUB01", 50, 0);
+
+	iter_opts.flags = GIT_ITERATOR_PARALLEL_SCAN;
+	cl_git_pass(git_iterator_for_workdir(&iter, g_repo, NULL, NULL, &iter_opts));
+	expect_iterator_items(iter, 125, NULL, 125, NULL);
+	git_iterator_free(iter);
+
+	iter_opts.flags = GIT_ITERATOR_PARALLEL_SCAN | GIT_ITERATOR_INCLUDE_TREES;
+	cl_git_pass(git_iterator_for_workdir(&iter, g_repo, NULL, NULL, &iter_opts));
+	expect_iterator_items(iter, 337, NULL, 337, NULL);
+	git_iterator_free(iter);
+
+	/* most prefetched directories are skipped over */
+	iter_opts.flags = GIT_ITERATOR_PARALLEL_SCAN | GIT_ITERATOR_DONT_AUTOEXPAND;
+	cl_git_pass(git_iterator_for_workdir(&iter, g_repo, NULL, NULL, &iter_opts));
+	expect_iterator_items(iter, 22, NULL, 337, NULL);
+	git_iterator_free(iter);
+
+	iter_opts.flags = GIT_ITERATOR_PARALLEL_SCAN | GIT_ITERATOR_DONT_IGNORE_CASE;
+	iter_opts.pathlist.strings = (char **)paths;
+	iter_opts.pathlist.count = ARRAY_SIZE(paths);
+	cl_git_pass(git_iterator_for_workdir(&iter, g_repo, NULL, NULL, &iter_opts));
+	expect_iterator_items(iter, 4, expected, 4, expected);
+	git_iterator_free(iter);
+}
+
 void test_repo_iterator__fs(void)
 {
 	git_iterator *i;
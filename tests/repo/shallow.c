@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
+#include "git2/sys/repository.h"
 #include "fileops.h"
+#include "shallow.h"
 
 static git_repository *g_repo;
 
@@ -37,3 +39,150 @@ void test_repo_shallow__clears_errors(void)
 	cl_assert_equal_i(0, git_repository_is_shallow(g_repo));
 	cl_assert_equal_p(NULL, giterr_last());
 }
+
+#define TIP_OID "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"
+#define FOURTH_OID "9fd738e8f7967c078dceed8190330fc8648ee56a"
+#define BRANCH_OID "c47800c7266a2be04c571c04d5a6614691ea99bd"
+
+static int count_commits(const char *from)
+{
+	git_revwalk *walk;
+	git_oid id;
+	int count = 0, error;
+
+	cl_git_pass(git_revwalk_new(&walk, g_repo));
+	cl_git_pass(git_oid_fromstr(&id, from));
+	cl_git_pass(git_revwalk_push(walk, &id));
+
+	while ((error = git_revwalk_next(&id, walk)) == 0)
+		count++;
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_revwalk_free(walk);
+
+	return count;
+}
+
+void test_repo_shallow__shallow_commits_have_no_parents(void)
+{
+	git_commit *commit;
+	git_oid id;
+
+	g_repo = cl_git_sandbox_init("shallow.git");
+
+	cl_git_pass(git_oid_fromstr(&id, "be3563ae3f795b2b4353bcce3a527ad0a4f7f644"));
+	cl_git_pass(git_commit_lookup(&commit, g_repo, &id));
+	cl_assert_equal_i(0, git_commit_parentcount(commit));
+	git_commit_free(commit);
+
+	cl_assert_equal_i(2, count_commits(TIP_OID));
+}
+
+void test_repo_shallow__walks_stop_at_the_boundary(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_assert_equal_i(7, count_commits(TIP_OID));
+
+	cl_git_mkfile("testrepo.git/shallow", FOURTH_OID "\n" BRANCH_OID "\n");
+	cl_assert_equal_i(4, count_commits(TIP_OID));
+
+	cl_git_pass(p_unlink("testrepo.git/shallow"));
+	cl_assert_equal_i(7, count_commits(TIP_OID));
+}
+
+void test_repo_shallow__boundary_commits_have_no_merge_base(void)
+{
+	git_oid one, two, base;
+
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_mkfile("testrepo.git/shallow", FOURTH_OID "\n" BRANCH_OID "\n");
+
+	cl_git_pass(git_oid_fromstr(&one, FOURTH_OID));
+	cl_git_pass(git_oid_fromstr(&two, BRANCH_OID));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_merge_base(&base, g_repo, &one, &two));
+}
+
+void test_repo_shallow__repository_without_a_directory(void)
+{
+	git_repository *repo;
+	git_commit *commit;
+	git_revwalk *walk;
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_repository_new(&repo));
+	cl_git_pass(git_odb_open(&odb, cl_fixture("testrepo.git/objects")));
+	git_repository_set_odb(repo, odb);
+
+	cl_git_pass(git_oid_fromstr(&id, TIP_OID));
+	cl_git_pass(git_commit_lookup(&commit, repo, &id));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+	git_commit_free(commit);
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	git_revwalk_free(walk);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_repo_shallow__invalid_shallow_file(void)
+{
+	git_revwalk *walk;
+
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_mkfile("testrepo.git/shallow", "not an id\n");
+
+	cl_git_fail(git_revwalk_new(&walk, g_repo));
+}
+
+static void assert_shallow_file(const char *expected)
+{
+	git_buf contents = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&contents, "testrepo.git/shallow"));
+	cl_assert_equal_s(expected, contents.ptr);
+	git_buf_free(&contents);
+}
+
+void test_repo_shallow__update(void)
+{
+	git_array_oid_t shallow_ids = GIT_ARRAY_INIT, unshallow_ids = GIT_ARRAY_INIT;
+	git_commit *commit;
+	git_oid *id;
+
+	g_repo = cl_git_sandbox_init("testrepo.git");
+
+	/* parsed with its parents, before the repository was shallow */
+	id = git_array_alloc(shallow_ids);
+	cl_git_pass(git_oid_fromstr(id, FOURTH_OID));
+	cl_git_pass(git_commit_lookup(&commit, g_repo, id));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+	git_commit_free(commit);
+
+	id = git_array_alloc(shallow_ids);
+	cl_git_pass(git_oid_fromstr(id, BRANCH_OID));
+
+	cl_git_pass(git_shallow__update(g_repo, &shallow_ids, &unshallow_ids));
+	cl_assert_equal_i(1, git_repository_is_shallow(g_repo));
+	assert_shallow_file(FOURTH_OID "\n" BRANCH_OID "\n");
+
+	cl_git_pass(git_commit_lookup(&commit, g_repo, git_array_get(shallow_ids, 0)));
+	cl_assert_equal_i(0, git_commit_parentcount(commit));
+	git_commit_free(commit);
+
+	git_array_clear(shallow_ids);
+	id = git_array_alloc(unshallow_ids);
+	cl_git_pass(git_oid_fromstr(id, BRANCH_OID));
+
+	cl_git_pass(git_shallow__update(g_repo, &shallow_ids, &unshallow_ids));
+	assert_shallow_file(FOURTH_OID "\n");
+	cl_assert_equal_i(6, count_commits(TIP_OID));
+
+	cl_git_pass(git_oid_fromstr(id, FOURTH_OID));
+	cl_git_pass(git_shallow__update(g_repo, &shallow_ids, &unshallow_ids));
+	cl_assert_equal_i(0, git_repository_is_shallow(g_repo));
+	cl_assert(!git_path_exists("testrepo.git/shallow"));
+
+	git_array_clear(unshallow_ids);
+}
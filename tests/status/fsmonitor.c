@@ -0,0 +1,406 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "git2/sys/diff.h"
+#include "git2/sys/fsmonitor.h"
+
+static git_repository *g_repo;
+
+typedef struct {
+	git_fsmonitor parent;
+	int queries;
+	char *token; /* given to the last query */
+	const char *changed[4];
+	bool fail;
+} test_fsmonitor;
+
+static test_fsmonitor *g_monitor;
+
+static int test_fsmonitor_query(
+	git_fsmonitor *monitor,
+	git_buf *token_out,
+	const char *token,
+	git_fsmonitor_path_cb path_cb,
+	void *payload)
+{
+	test_fsmonitor *t = (test_fsmonitor *)monitor;
+	size_t i;
+	int error;
+
+	t->queries++;
+
+	git__free(t->token);
+	t->token = token ? git__strdup(token) : NULL;
+
+	if (t->fail) {
+		giterr_set(GITERR_INVALID, "the monitor has stopped");
+		return -1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(t->changed) && t->changed[i]; i++) {
+		if ((error = path_cb(t->changed[i], payload)) < 0)
+			return error;
+	}
+
+	memset(t->changed, 0, sizeof(t->changed));
+
+	return git_buf_printf(token_out, "token-%d", t->queries);
+}
+
+static void test_fsmonitor_free(git_fsmonitor *monitor)
+{
+	test_fsmonitor *t = (test_fsmonitor *)monitor;
+
+	if (t == g_monitor)
+		g_monitor = NULL;
+
+	git__free(t->token);
+	git__free(t);
+}
+
+static void age(const char *path)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = 1234567890;
+	times[0].tv_usec = 0;
+	times[1].tv_sec = 1234567890;
+	times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes(path, times));
+}
+
+static const char *g_files[] = {
+	"a.txt", "dir/b.txt", "dir/sub/c.txt", "e.txt"
+};
+
+void test_status_fsmonitor__initialize(void)
+{
+	git_index *index;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_git_pass(git_futils_mkdir_r("empty_standard_repo/dir/sub", 0777));
+	cl_git_pass(git_repository_index(&index, g_repo));
+
+	for (i = 0; i < ARRAY_SIZE(g_files); i++) {
+		cl_git_pass(git_buf_joinpath(&path, "empty_standard_repo", g_files[i]));
+		cl_git_mkfile(path.ptr, g_files[i]);
+		age(path.ptr);
+		cl_git_pass(git_index_add_bypath(index, g_files[i]));
+	}
+
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+	git_buf_free(&path);
+
+	g_monitor = git__calloc(1, sizeof(test_fsmonitor));
+	cl_assert(g_monitor);
+	cl_git_pass(git_fsmonitor_init(&g_monitor->parent, GIT_FSMONITOR_VERSION));
+	g_monitor->parent.query = test_fsmonitor_query;
+	g_monitor->parent.free = test_fsmonitor_free;
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &g_monitor->parent));
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	cl_assert(g_monitor == NULL);
+}
+
+/* Run status, checking that the files listed in `modified` are the
+ * only ones found to be modified, and return the number of stat calls.
+ */
+static size_t assert_modified(const char **modified, size_t count)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	size_t i;
+
+	opts.show = GIT_STATUS_SHOW_WORKDIR_ONLY;
+	opts.flags = GIT_STATUS_OPT_UPDATE_INDEX;
+
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(count, git_status_list_entrycount(status));
+
+	for (i = 0; i < count; i++) {
+		const git_status_entry *entry = git_status_byindex(status, i);
+
+		cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, entry->status);
+		cl_assert_equal_s(modified[i], entry->index_to_workdir->new_file.path);
+	}
+
+	cl_git_pass(git_status_list_get_perfdata(&perf, status));
+	git_status_list_free(status);
+
+	return perf.stat_calls;
+}
+
+static git_index *index_on_disk(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	return index;
+}
+
+static bool is_valid(git_index *index, const char *path)
+{
+	const git_index_entry *entry = git_index_get_bypath(index, path, 0);
+
+	cl_assert(entry);
+	return (entry->flags_extended & GIT_IDXENTRY_FSMONITOR_VALID) != 0;
+}
+
+void test_status_fsmonitor__unchanged_entries_are_marked_valid(void)
+{
+	git_index *index;
+	size_t i;
+
+	assert_modified(NULL, 0);
+
+	cl_assert_equal_i(1, g_monitor->queries);
+	cl_assert(g_monitor->token == NULL);
+
+	index = index_on_disk();
+	cl_assert_equal_s("token-1", index->fsmonitor_token);
+
+	for (i = 0; i < ARRAY_SIZE(g_files); i++)
+		cl_assert(is_valid(index, g_files[i]));
+
+	git_index_free(index);
+
+	assert_modified(NULL, 0);
+
+	cl_assert_equal_i(2, g_monitor->queries);
+	cl_assert_equal_s("token-1", g_monitor->token);
+
+	index = index_on_disk();
+	cl_assert_equal_s("token-2", index->fsmonitor_token);
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__unchanged_files_are_not_statted(void)
+{
+	size_t first, second;
+
+	first = assert_modified(NULL, 0);
+	second = assert_modified(NULL, 0);
+
+	cl_assert_equal_sz(first - ARRAY_SIZE(g_files), second);
+}
+
+void test_status_fsmonitor__only_reported_files_are_checked(void)
+{
+	const char *modified[] = { "a.txt" };
+	git_index *index;
+
+	assert_modified(NULL, 0);
+
+	/* the monitor is trusted, so a change it misses goes unnoticed */
+	cl_git_rewritefile("empty_standard_repo/a.txt", "changed\n");
+	assert_modified(NULL, 0);
+
+	g_monitor->changed[0] = "a.txt";
+	assert_modified(modified, ARRAY_SIZE(modified));
+
+	index = index_on_disk();
+	cl_assert(!is_valid(index, "a.txt"));
+	cl_assert(is_valid(index, "e.txt"));
+	git_index_free(index);
+
+	/* a modified file stays dirty until it is added again */
+	assert_modified(modified, ARRAY_SIZE(modified));
+}
+
+void test_status_fsmonitor__directories_cover_their_contents(void)
+{
+	const char *modified[] = { "dir/sub/c.txt" };
+	git_index *index;
+
+	assert_modified(NULL, 0);
+
+	cl_git_rewritefile("empty_standard_repo/dir/sub/c.txt", "changed\n");
+	g_monitor->changed[0] = "dir/";
+	assert_modified(modified, ARRAY_SIZE(modified));
+
+	index = index_on_disk();
+	cl_assert(is_valid(index, "a.txt"));
+	cl_assert(is_valid(index, "dir/b.txt"));
+	cl_assert(!is_valid(index, "dir/sub/c.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__root_covers_everything(void)
+{
+	size_t first, second;
+
+	first = assert_modified(NULL, 0);
+
+	g_monitor->changed[0] = "/";
+	second = assert_modified(NULL, 0);
+
+	cl_assert_equal_sz(first, second);
+}
+
+void test_status_fsmonitor__failing_monitor_checks_everything(void)
+{
+	const char *modified[] = { "e.txt" };
+	git_index *index;
+
+	assert_modified(NULL, 0);
+
+	cl_git_rewritefile("empty_standard_repo/e.txt", "changed\n");
+	g_monitor->fail = true;
+	assert_modified(modified, ARRAY_SIZE(modified));
+
+	index = index_on_disk();
+	cl_assert(index->fsmonitor_token == NULL);
+	cl_assert(!is_valid(index, "a.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__removing_the_monitor_drops_its_state(void)
+{
+	git_index *index;
+
+	assert_modified(NULL, 0);
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	cl_assert(g_monitor == NULL);
+
+	assert_modified(NULL, 0);
+
+	index = index_on_disk();
+	cl_assert(index->fsmonitor_token == NULL);
+	cl_assert(!is_valid(index, "a.txt"));
+	git_index_free(index);
+}
+
+void test_status_fsmonitor__adding_a_file_clears_its_flag(void)
+{
+	git_index *index;
+
+	assert_modified(NULL, 0);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert(is_valid(index, "a.txt"));
+
+	cl_git_rewritefile("empty_standard_repo/a.txt", "changed\n");
+	cl_git_pass(git_index_add_bypath(index, "a.txt"));
+	cl_assert(!is_valid(index, "a.txt"));
+	cl_assert(is_valid(index, "e.txt"));
+
+	git_index_free(index);
+}
+
+#ifndef GIT_WIN32
+
+static void set_hook(const char *script)
+{
+	cl_git_mkfile("empty_standard_repo/.git/fsmonitor-hook", script);
+	cl_must_pass(p_chmod("empty_standard_repo/.git/fsmonitor-hook", 0755));
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	cl_repo_set_string(g_repo, "core.fsmonitor", ".git/fsmonitor-hook");
+}
+
+static void assert_hook_args(const char *expected)
+{
+	git_buf args = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&args, "empty_standard_repo/.git/args"));
+	cl_assert_equal_s(expected, args.ptr);
+	git_buf_free(&args);
+}
+
+void test_status_fsmonitor__hook(void)
+{
+	const char *modified[] = { "a.txt" };
+	git_index *index;
+
+	set_hook(
+		"#!/bin/sh\n"
+		"echo \"$1 $2\" >>.git/args\n"
+		"printf 'hook-token\\0a.txt\\0'\n");
+
+	assert_modified(NULL, 0);
+	assert_hook_args("2 builtin:fake\n");
+
+	/* what the hook reports is checked, and found unchanged */
+	index = index_on_disk();
+	cl_assert_equal_s("hook-token", index->fsmonitor_token);
+	cl_assert(is_valid(index, "a.txt"));
+	cl_assert(is_valid(index, "e.txt"));
+	git_index_free(index);
+
+	cl_git_rewritefile("empty_standard_repo/a.txt", "changed\n");
+	assert_modified(modified, ARRAY_SIZE(modified));
+	assert_hook_args("2 builtin:fake\n2 hook-token\n");
+}
+
+void test_status_fsmonitor__hook_version_1(void)
+{
+	const char *modified[] = { "a.txt" };
+	git_buf args = GIT_BUF_INIT;
+	git_index *index;
+
+	set_hook(
+		"#!/bin/sh\n"
+		"echo \"$1 $2\" >>.git/args\n"
+		"printf 'a.txt\\0'\n");
+	cl_repo_set_string(g_repo, "core.fsmonitorHookVersion", "1");
+
+	/* there is nothing to ask for without a timestamp */
+	assert_modified(NULL, 0);
+	cl_assert(!git_path_exists("empty_standard_repo/.git/args"));
+
+	index = index_on_disk();
+	cl_assert(index->fsmonitor_token != NULL);
+	cl_assert(is_valid(index, "a.txt"));
+	git_index_free(index);
+
+	cl_git_rewritefile("empty_standard_repo/a.txt", "changed\n");
+	assert_modified(modified, ARRAY_SIZE(modified));
+
+	cl_git_pass(git_futils_readbuffer(&args, "empty_standard_repo/.git/args"));
+	cl_assert(!git__prefixcmp(args.ptr, "1 "));
+	cl_assert_equal_sz(args.size - 3, strspn(args.ptr + 2, "0123456789"));
+	git_buf_free(&args);
+}
+
+void test_status_fsmonitor__failing_hook_checks_everything(void)
+{
+	const char *modified[] = { "e.txt" };
+	git_index *index;
+
+	set_hook("#!/bin/sh\nprintf 'hook-token\\0'\n");
+	assert_modified(NULL, 0);
+
+	set_hook("#!/bin/sh\nexit 1\n");
+	cl_repo_set_string(g_repo, "core.fsmonitorHookVersion", "2");
+	cl_git_rewritefile("empty_standard_repo/e.txt", "changed\n");
+	assert_modified(modified, ARRAY_SIZE(modified));
+
+	index = index_on_disk();
+	cl_assert(index->fsmonitor_token == NULL);
+	git_index_free(index);
+}
+
+#endif
+
+void test_status_fsmonitor__boolean_config_is_not_a_hook(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	cl_repo_set_bool(g_repo, "core.fsmonitor", true);
+
+	assert_modified(NULL, 0);
+
+	index = index_on_disk();
+	cl_assert(index->fsmonitor_token == NULL);
+	git_index_free(index);
+}
@@ -0,0 +1,303 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "untracked_cache.h"
+#include "git2/sys/diff.h"
+
+static git_repository *g_repo;
+
+static void age_dir(const char *path)
+{
+	struct p_timeval times[2];
+
+	times[0].tv_sec = 1234567890;
+	times[0].tv_usec = 0;
+	times[1].tv_sec = 1234567890;
+	times[1].tv_usec = 0;
+
+	cl_must_pass(p_utimes(path, times));
+}
+
+void test_status_untracked_cache__initialize(void)
+{
+	git_index *index;
+
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+
+	cl_git_mkfile("empty_standard_repo/tracked.txt", "tracked\n");
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "tracked.txt"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	cl_git_rewritefile("empty_standard_repo/.git/info/exclude", "*.o\n");
+
+	cl_git_pass(git_futils_mkdir_r("empty_standard_repo/untracked/sub", 0777));
+	cl_git_mkfile("empty_standard_repo/untracked/sub/file.txt", "untracked\n");
+	cl_git_pass(git_futils_mkdir_r("empty_standard_repo/ignored", 0777));
+	cl_git_mkfile("empty_standard_repo/ignored/.gitignore", "*\n");
+	cl_git_mkfile("empty_standard_repo/ignored/junk.txt", "junk\n");
+	cl_git_pass(git_futils_mkdir_r("empty_standard_repo/objs", 0777));
+	cl_git_mkfile("empty_standard_repo/objs/a.o", "object\n");
+	cl_git_pass(git_futils_mkdir_r("empty_standard_repo/empty", 0777));
+
+	/* keep the directories clear of the index timestamp */
+	age_dir("empty_standard_repo/untracked/sub");
+	age_dir("empty_standard_repo/untracked");
+	age_dir("empty_standard_repo/ignored");
+	age_dir("empty_standard_repo/objs");
+	age_dir("empty_standard_repo/empty");
+	age_dir("empty_standard_repo");
+}
+
+void test_status_untracked_cache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static git_status_list *status_untracked(
+	size_t *stat_calls, unsigned int flags, const char **expected, size_t count)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *status;
+	git_diff_perfdata perf = GIT_DIFF_PERFDATA_INIT;
+	size_t i;
+
+	opts.show = GIT_STATUS_SHOW_WORKDIR_ONLY;
+	opts.flags = flags;
+
+	cl_git_pass(git_status_list_new(&status, g_repo, &opts));
+	cl_assert_equal_sz(count, git_status_list_entrycount(status));
+
+	for (i = 0; i < count; i++) {
+		const git_status_entry *entry = git_status_byindex(status, i);
+
+		cl_assert_equal_i(GIT_STATUS_WT_NEW, entry->status);
+		cl_assert_equal_s(expected[i], entry->index_to_workdir->new_file.path);
+	}
+
+	if (stat_calls) {
+		cl_git_pass(git_status_list_get_perfdata(&perf, status));
+		*stat_calls = perf.stat_calls;
+	}
+
+	return status;
+}
+
+#define NORMAL_FLAGS \
+	(GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_UPDATE_INDEX)
+
+static size_t assert_untracked(const char **expected, size_t count)
+{
+	size_t stat_calls;
+
+	git_status_list_free(status_untracked(
+		&stat_calls, NORMAL_FLAGS, expected, count));
+
+	return stat_calls;
+}
+
+static git_untracked_cache *untracked_cache_on_disk(git_index **index)
+{
+	cl_git_pass(git_index_open(index, "empty_standard_repo/.git/index"));
+	return (*index)->untracked;
+}
+
+static git_untracked_cache_dir *find_dir(
+	git_untracked_cache_dir *parent, const char *name)
+{
+	git_untracked_cache_dir *dir;
+	size_t i;
+
+	git_vector_foreach(&parent->dirs, i, dir) {
+		if (!strcmp(dir->name, name))
+			return dir;
+	}
+
+	return NULL;
+}
+
+static const char *only_untracked[] = { "untracked/" };
+
+void test_status_untracked_cache__is_written_to_the_index(void)
+{
+	git_index *index;
+	git_untracked_cache *uc;
+	git_untracked_cache_dir *dir;
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	/* directories holding tracked files are walked anyway */
+	cl_assert((uc = untracked_cache_on_disk(&index)) != NULL);
+	cl_assert(!uc->root->valid);
+
+	cl_assert((dir = find_dir(uc->root, "untracked")) != NULL);
+	cl_assert(dir->valid && dir->check_only);
+	cl_assert((dir = find_dir(uc->root, "ignored")) != NULL);
+	cl_assert(dir->valid && !git_oid_iszero(&dir->exclude_oid));
+	cl_assert_equal_sz(0, dir->untracked.length);
+	cl_assert((dir = find_dir(uc->root, "empty")) != NULL);
+	cl_assert(dir->valid);
+	cl_assert_equal_sz(0, dir->untracked.length);
+
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__unchanged_directories_are_not_scanned(void)
+{
+	size_t first, second;
+
+	first = assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+	second = assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_assert(second < first);
+}
+
+void test_status_untracked_cache__notices_new_files(void)
+{
+	const char *expected[] = { "empty/", "untracked/" };
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_git_mkfile("empty_standard_repo/empty/new.txt", "new\n");
+	assert_untracked(expected, ARRAY_SIZE(expected));
+	assert_untracked(expected, ARRAY_SIZE(expected));
+}
+
+void test_status_untracked_cache__notices_removed_files(void)
+{
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_must_pass(p_unlink("empty_standard_repo/untracked/sub/file.txt"));
+	assert_untracked(NULL, 0);
+	assert_untracked(NULL, 0);
+}
+
+void test_status_untracked_cache__notices_gitignore_changes(void)
+{
+	const char *expected[] = { "ignored/", "untracked/" };
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_git_rewritefile("empty_standard_repo/ignored/.gitignore", "*.txt\n");
+	assert_untracked(expected, ARRAY_SIZE(expected));
+	assert_untracked(expected, ARRAY_SIZE(expected));
+}
+
+void test_status_untracked_cache__notices_global_exclude_changes(void)
+{
+	const char *expected[] = { "objs/", "untracked/" };
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_git_rewritefile("empty_standard_repo/.git/info/exclude", "# none\n");
+	assert_untracked(expected, ARRAY_SIZE(expected));
+	assert_untracked(expected, ARRAY_SIZE(expected));
+}
+
+void test_status_untracked_cache__notices_files_added_to_the_index(void)
+{
+	git_index *index;
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "untracked/sub/file.txt"));
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+
+	assert_untracked(NULL, 0);
+}
+
+void test_status_untracked_cache__ignores_rules_added_in_memory(void)
+{
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_git_pass(git_ignore_add_rule(g_repo, "file.txt\n"));
+	assert_untracked(NULL, 0);
+}
+
+void test_status_untracked_cache__is_not_used_when_recursing(void)
+{
+	const char *expected[] = { "untracked/sub/file.txt" };
+	git_index *index;
+
+	git_status_list_free(status_untracked(NULL,
+		NORMAL_FLAGS | GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS,
+		expected, ARRAY_SIZE(expected)));
+
+	cl_assert(untracked_cache_on_disk(&index) == NULL);
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__false_removes_the_cache(void)
+{
+	git_index *index;
+
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+	cl_assert(untracked_cache_on_disk(&index) != NULL);
+	git_index_free(index);
+
+	cl_repo_set_bool(g_repo, "core.untrackedCache", false);
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+	cl_assert(untracked_cache_on_disk(&index) == NULL);
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__keep_does_not_create_a_cache(void)
+{
+	git_index *index;
+
+	cl_repo_set_string(g_repo, "core.untrackedCache", "keep");
+	assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+	cl_assert(untracked_cache_on_disk(&index) == NULL);
+	git_index_free(index);
+}
+
+void test_status_untracked_cache__keep_uses_an_existing_cache(void)
+{
+	size_t first, second;
+
+	first = assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_repo_set_string(g_repo, "core.untrackedCache", "keep");
+	second = assert_untracked(only_untracked, ARRAY_SIZE(only_untracked));
+
+	cl_assert(second < first);
+}
+
+void test_status_untracked_cache__cache_from_elsewhere(void)
+{
+	const char *expected[] = { "build/", "newdir/", "untracked.txt" };
+	git_index *index;
+	git_buf ident = GIT_BUF_INIT;
+
+	cl_git_sandbox_cleanup();
+	g_repo = cl_git_sandbox_init("untracked_cache");
+
+	/* with `keep` the cache made in /tmp is left alone */
+	cl_repo_set_string(g_repo, "core.untrackedCache", "keep");
+	assert_untracked(expected, ARRAY_SIZE(expected));
+
+	cl_git_pass(git_index_open(&index, "untracked_cache/.git/index"));
+	cl_assert_equal_s(
+		"Location /tmp/untracked_cache, system Linux", index->untracked->ident.ptr);
+	git_index_free(index);
+
+	/* with `true` it is replaced by one for this working directory */
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+	assert_untracked(expected, ARRAY_SIZE(expected));
+	assert_untracked(expected, ARRAY_SIZE(expected));
+
+	cl_git_pass(git_buf_printf(&ident, "Location %s",
+		git_repository_workdir(g_repo)));
+	git_buf_rtrim(&ident);
+	git_buf_truncate(&ident, ident.size - 1); /* trailing slash */
+
+	cl_git_pass(git_index_open(&index, "untracked_cache/.git/index"));
+	cl_assert(!git__prefixcmp(index->untracked->ident.ptr, ident.ptr));
+	git_index_free(index);
+
+	git_buf_free(&ident);
+}
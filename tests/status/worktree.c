@@ -89,6 +89,18 @@ void test_status_worktree__show_workdir_only(void)
 		cl_git_sandbox_init("status"), GIT_STATUS_SHOW_WORKDIR_ONLY, 0);
 }
 
+void test_status_worktree__parallel_workdir_scan(void)
+{
+	git_repository *repo = cl_git_sandbox_init("status");
+
+	assert_show(entry_count0, entry_paths0, entry_statuses0,
+		repo, GIT_STATUS_SHOW_INDEX_AND_WORKDIR,
+		GIT_STATUS_OPT_PARALLEL_WORKDIR_SCAN);
+	assert_show(entry_count6, entry_paths6, entry_statuses6,
+		repo, GIT_STATUS_SHOW_WORKDIR_ONLY,
+		GIT_STATUS_OPT_PARALLEL_WORKDIR_SCAN);
+}
+
 /* this test is equivalent to t18-status.c:statuscb1 */
 void test_status_worktree__empty_repository(void)
 {
@@ -0,0 +1,62 @@
+#include "clar_libgit2.h"
+#include "thread_helpers.h"
+#include "shallow.h"
+
+#define FOURTH_OID "9fd738e8f7967c078dceed8190330fc8648ee56a"
+
+static git_repository *g_repo;
+static git_oid g_fourth;
+
+void test_threads_shallow__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_oid_fromstr(&g_fourth, FOURTH_OID));
+}
+
+void test_threads_shallow__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+/*
+ * The first thread keeps moving the boundary while the others look at
+ * it; the lists they hold must stay whole.
+ */
+static void *move_or_read_boundary(void *arg)
+{
+	int i, id = *(int *)arg;
+
+	for (i = 0; i < 50; i++) {
+		if (id == 0) {
+			git_array_oid_t ids = GIT_ARRAY_INIT, none = GIT_ARRAY_INIT;
+			git_oid *oid = git_array_alloc(ids);
+
+			cl_assert(oid != NULL);
+			git_oid_cpy(oid, &g_fourth);
+
+			cl_git_pass(git_shallow__update(g_repo,
+				(i % 2) ? &none : &ids, (i % 2) ? &ids : &none));
+
+			git_array_clear(ids);
+		} else {
+			git_shallow *shallow;
+
+			cl_git_pass(git_shallow__get(&shallow, g_repo));
+			cl_assert(git_array_size(shallow->roots) <= 1);
+
+			if (git_array_size(shallow->roots))
+				cl_assert(git_shallow__contains(shallow, &g_fourth));
+
+			git_shallow_free(shallow);
+		}
+	}
+
+	giterr_clear();
+	return arg;
+}
+
+void test_threads_shallow__boundary_moves_while_read(void)
+{
+	run_in_parallel(5, 8, move_or_read_boundary, NULL, NULL);
+}
@@ -0,0 +1,620 @@
+#include "clar_libgit2.h"
+#include "git2/sys/transport.h"
+#include "buffer.h"
+#include "fileops.h"
+
+#define MASTER_OID "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"
+#define TAG_OID "7b4384978d2493e851f9cca7858815fac9b10980"
+
+/*
+ * A smart subtransport which answers each request with the next of a
+ * list of canned responses, and remembers what was sent. A stateless
+ * one opens a stream per request; a stateful one keeps the same stream
+ * and answers on it whenever we write.
+ */
+typedef struct {
+	git_smart_subtransport_stream parent;
+	git_buf *response;
+	size_t offset;
+} scripted_stream;
+
+typedef struct {
+	git_smart_subtransport parent;
+	git_buf requests;
+	git_buf responses[4];
+	size_t count, next;
+	bool stateful;
+	scripted_stream *current;
+} scripted_subtransport;
+
+static scripted_subtransport _scripted;
+static git_repository *_repo;
+static git_remote *_remote;
+
+static int scripted_read(
+	git_smart_subtransport_stream *stream,
+	char *buffer,
+	size_t buf_size,
+	size_t *bytes_read)
+{
+	scripted_stream *s = (scripted_stream *)stream;
+	size_t len = min(buf_size, s->response->size - s->offset);
+
+	memcpy(buffer, s->response->ptr + s->offset, len);
+	s->offset += len;
+	*bytes_read = len;
+
+	return 0;
+}
+
+static int scripted_write(
+	git_smart_subtransport_stream *stream, const char *buffer, size_t len)
+{
+	scripted_stream *s = (scripted_stream *)stream;
+
+	if (_scripted.stateful && _scripted.next < _scripted.count) {
+		s->response = &_scripted.responses[_scripted.next++];
+		s->offset = 0;
+	}
+
+	return git_buf_put(&_scripted.requests, buffer, len);
+}
+
+static void scripted_stream_free(git_smart_subtransport_stream *stream)
+{
+	if (stream == &_scripted.current->parent)
+		_scripted.current = NULL;
+
+	git__free(stream);
+}
+
+static int scripted_action(
+	git_smart_subtransport_stream **out,
+	git_smart_subtransport *transport,
+	const char *url,
+	git_smart_service_t action)
+{
+	scripted_stream *s;
+
+	GIT_UNUSED(url);
+	GIT_UNUSED(action);
+
+	if (_scripted.stateful && _scripted.current) {
+		*out = &_scripted.current->parent;
+		return 0;
+	}
+
+	cl_assert(_scripted.next < _scripted.count);
+
+	s = git__calloc(1, sizeof(scripted_stream));
+	GITERR_CHECK_ALLOC(s);
+
+	s->parent.subtransport = transport;
+	s->parent.read = scripted_read;
+	s->parent.write = scripted_write;
+	s->parent.free = scripted_stream_free;
+	s->response = &_scripted.responses[_scripted.next++];
+	_scripted.current = s;
+
+	*out = &s->parent;
+	return 0;
+}
+
+static int scripted_close(git_smart_subtransport *transport)
+{
+	GIT_UNUSED(transport);
+	return 0;
+}
+
+static void scripted_free(git_smart_subtransport *transport)
+{
+	GIT_UNUSED(transport);
+}
+
+static int scripted_subtransport_cb(
+	git_smart_subtransport **out, git_transport *owner, void *param)
+{
+	GIT_UNUSED(owner);
+	GIT_UNUSED(param);
+
+	_scripted.parent.action = scripted_action;
+	_scripted.parent.close = scripted_close;
+	_scripted.parent.free = scripted_free;
+
+	*out = &_scripted.parent;
+	return 0;
+}
+
+static int scripted_transport_cb(git_transport **out, git_remote *owner, void *param)
+{
+	git_smart_subtransport_definition definition = {
+		scripted_subtransport_cb, 1, NULL
+	};
+
+	GIT_UNUSED(param);
+
+	definition.rpc = !_scripted.stateful;
+	return git_transport_smart(out, owner, &definition);
+}
+
+static void pkt_n(git_buf *buf, const char *data, size_t len)
+{
+	cl_git_pass(git_buf_printf(buf, "%04x", (unsigned int)len + 4));
+	cl_git_pass(git_buf_put(buf, data, len));
+}
+
+static void pkt(git_buf *buf, const char *line)
+{
+	pkt_n(buf, line, strlen(line));
+}
+
+static git_buf *response(void)
+{
+	cl_assert(_scripted.count < ARRAY_SIZE(_scripted.responses));
+	return &_scripted.responses[_scripted.count++];
+}
+
+static void advertise_v2(void)
+{
+	git_buf *buf = response();
+
+	pkt(buf, "# service=git-upload-pack\n");
+	git_buf_puts(buf, "0000");
+	pkt(buf, "version 2\n");
+	pkt(buf, "agent=git/2.20.0\n");
+	pkt(buf, "ls-refs\n");
+	pkt(buf, "fetch=shallow\n");
+	git_buf_puts(buf, "0000");
+}
+
+static void list_refs(void)
+{
+	git_buf *buf = response();
+
+	pkt(buf, MASTER_OID " HEAD symref-target:refs/heads/master\n");
+	pkt(buf, MASTER_OID " refs/heads/master\n");
+	pkt(buf, TAG_OID " refs/tags/v1 peeled:" MASTER_OID "\n");
+	git_buf_puts(buf, "0000");
+}
+
+static void connect_remote(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+
+	callbacks.transport = scripted_transport_cb;
+	cl_git_pass(git_remote_connect(_remote, GIT_DIRECTION_FETCH, &callbacks, NULL));
+}
+
+void test_transport_protocolv2__initialize(void)
+{
+	git_config *cfg;
+
+	memset(&_scripted, 0, sizeof(_scripted));
+
+	cl_git_pass(git_repository_init(&_repo, "./protocolv2", 0));
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_int32(cfg, "protocol.version", 2));
+	git_config_free(cfg);
+
+	cl_git_pass(git_remote_create(&_remote, _repo, "test", "https://example.com/repo.git"));
+}
+
+void test_transport_protocolv2__cleanup(void)
+{
+	size_t i;
+
+	git_remote_free(_remote);
+	_remote = NULL;
+
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	git_buf_free(&_scripted.requests);
+	for (i = 0; i < ARRAY_SIZE(_scripted.responses); i++)
+		git_buf_free(&_scripted.responses[i]);
+
+	cl_fixture_cleanup("./protocolv2");
+}
+
+void test_transport_protocolv2__asks_for_the_refs_the_refspecs_match(void)
+{
+	git_buf expected = GIT_BUF_INIT;
+	const git_remote_head **heads;
+	size_t count;
+
+	advertise_v2();
+	list_refs();
+	connect_remote();
+
+	pkt(&expected, "command=ls-refs\n");
+	git_buf_puts(&expected, "0001");
+	pkt(&expected, "peel\n");
+	pkt(&expected, "symrefs\n");
+	pkt(&expected, "ref-prefix refs/heads/\n");
+	pkt(&expected, "ref-prefix HEAD\n");
+	pkt(&expected, "ref-prefix refs/tags/\n");
+	git_buf_puts(&expected, "0000");
+	cl_assert_equal_s(expected.ptr, _scripted.requests.ptr);
+
+	cl_git_pass(git_remote_ls(&heads, &count, _remote));
+	cl_assert_equal_sz(4, count);
+
+	cl_assert_equal_s("HEAD", heads[0]->name);
+	cl_assert_equal_s("refs/heads/master", heads[0]->symref_target);
+	cl_assert_equal_s("refs/heads/master", heads[1]->name);
+	cl_assert_equal_p(NULL, heads[1]->symref_target);
+	cl_assert_equal_s("refs/tags/v1", heads[2]->name);
+	cl_assert_equal_s(TAG_OID, git_oid_tostr_s(&heads[2]->oid));
+	cl_assert_equal_s("refs/tags/v1^{}", heads[3]->name);
+	cl_assert_equal_s(MASTER_OID, git_oid_tostr_s(&heads[3]->oid));
+
+	git_buf_free(&expected);
+}
+
+void test_transport_protocolv2__short_refspecs_ask_for_each_expansion(void)
+{
+	git_remote_free(_remote);
+	cl_git_pass(git_remote_create_with_fetchspec(&_remote, _repo, "short",
+		"https://example.com/repo.git", "topic:refs/remotes/short/topic"));
+	cl_git_pass(git_remote_set_autotag(_repo, "short", GIT_REMOTE_DOWNLOAD_TAGS_NONE));
+	git_remote_free(_remote);
+	cl_git_pass(git_remote_lookup(&_remote, _repo, "short"));
+
+	advertise_v2();
+	list_refs();
+	connect_remote();
+
+	cl_assert(strstr(_scripted.requests.ptr, "ref-prefix topic\n"));
+	cl_assert(strstr(_scripted.requests.ptr, "ref-prefix refs/heads/topic\n"));
+	cl_assert(strstr(_scripted.requests.ptr, "ref-prefix refs/remotes/topic/HEAD\n"));
+	cl_assert(strstr(_scripted.requests.ptr, "ref-prefix HEAD\n"));
+	cl_assert(!strstr(_scripted.requests.ptr, "ref-prefix refs/tags/\n"));
+}
+
+void test_transport_protocolv2__falls_back_to_v0(void)
+{
+	static const char first[] = MASTER_OID " HEAD\0"
+		"multi_ack side-band-64k ofs-delta symref=HEAD:refs/heads/master\n";
+	git_buf *buf = response();
+	const git_remote_head **heads;
+	size_t count;
+
+	pkt(buf, "# service=git-upload-pack\n");
+	git_buf_puts(buf, "0000");
+	pkt_n(buf, first, sizeof(first) - 1);
+	pkt(buf, MASTER_OID " refs/heads/master\n");
+	pkt(buf, MASTER_OID " refs/pull/1/head\n");
+	git_buf_puts(buf, "0000");
+
+	connect_remote();
+
+	/* the whole advertisement, and no ls-refs request */
+	cl_assert_equal_sz(0, _scripted.requests.size);
+
+	cl_git_pass(git_remote_ls(&heads, &count, _remote));
+	cl_assert_equal_sz(3, count);
+	cl_assert_equal_s("HEAD", heads[0]->name);
+	cl_assert_equal_s("refs/heads/master", heads[0]->symref_target);
+	cl_assert_equal_s("refs/pull/1/head", heads[2]->name);
+}
+
+void test_transport_protocolv2__fetches_with_the_fetch_command(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_buf pack = GIT_BUF_INIT, *buf;
+	git_reference *ref;
+	git_commit *commit;
+
+	advertise_v2();
+	list_refs();
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.pack")));
+
+	buf = response();
+	pkt(buf, "packfile\n");
+	cl_git_pass(git_buf_printf(buf, "%04x\1", (unsigned int)pack.size + 5));
+	cl_git_pass(git_buf_put(buf, pack.ptr, pack.size));
+	git_buf_puts(buf, "0000");
+
+	opts.callbacks.transport = scripted_transport_cb;
+	opts.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+	cl_git_pass(git_remote_fetch(_remote, NULL, &opts, NULL));
+
+	cl_assert(strstr(_scripted.requests.ptr, "command=fetch\n0001"));
+	cl_assert(strstr(_scripted.requests.ptr, "want " MASTER_OID "\n"));
+	cl_assert(strstr(_scripted.requests.ptr, "done\n0000"));
+	cl_assert(!strstr(_scripted.requests.ptr, "have "));
+
+	cl_git_pass(git_reference_lookup(&ref, _repo, "refs/remotes/test/master"));
+	cl_assert_equal_s(MASTER_OID, git_oid_tostr_s(git_reference_target(ref)));
+	cl_git_pass(git_commit_lookup(&commit, _repo, git_reference_target(ref)));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+
+	git_commit_free(commit);
+	git_reference_free(ref);
+	git_buf_free(&pack);
+}
+
+void test_transport_protocolv2__server_errors_are_reported(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+	git_buf *buf;
+
+	advertise_v2();
+	buf = response();
+	pkt(buf, "ERR ls-refs is not allowed\n");
+
+	callbacks.transport = scripted_transport_cb;
+	cl_git_fail(git_remote_connect(_remote, GIT_DIRECTION_FETCH, &callbacks, NULL));
+	cl_assert(strstr(giterr_last()->message, "ls-refs is not allowed"));
+}
+
+static void fetch_with_a_local_commit(git_fetch_options *opts, bool negotiates)
+{
+	git_buf pack = GIT_BUF_INIT, *buf;
+	git_signature *sig;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_oid tree_id, commit_id;
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	cl_git_pass(git_signature_now(&sig, "nulltoken", "emeric.fermas@gmail.com"));
+	cl_git_pass(git_commit_create(&commit_id, _repo, "refs/heads/local", sig, sig,
+		NULL, "local\n", tree, 0, NULL));
+
+	advertise_v2();
+	list_refs();
+
+	if (negotiates) {
+		buf = response();
+		pkt(buf, "acknowledgments\n");
+		pkt(buf, "NAK\n");
+		git_buf_puts(buf, "0000");
+	}
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.pack")));
+
+	buf = response();
+	pkt(buf, "packfile\n");
+	cl_git_pass(git_buf_printf(buf, "%04x\1", (unsigned int)pack.size + 5));
+	cl_git_pass(git_buf_put(buf, pack.ptr, pack.size));
+	git_buf_puts(buf, "0000");
+
+	opts->callbacks.transport = scripted_transport_cb;
+	opts->download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+	cl_git_pass(git_remote_fetch(_remote, NULL, opts, NULL));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+	git_buf_free(&pack);
+}
+
+void test_transport_protocolv2__sends_the_local_commits(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+
+	fetch_with_a_local_commit(&opts, true);
+	cl_assert(strstr(_scripted.requests.ptr, "have "));
+	cl_assert(strstr(_scripted.requests.ptr, "done\n0000"));
+}
+
+void test_transport_protocolv2__negotiation_algorithm_from_config(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_string(cfg, "fetch.negotiationAlgorithm", "noop"));
+	git_config_free(cfg);
+
+	/* with nothing to negotiate, the first request is the last one */
+	fetch_with_a_local_commit(&opts, false);
+	cl_assert(!strstr(_scripted.requests.ptr, "have "));
+}
+
+void test_transport_protocolv2__fetches_shallow(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_buf pack = GIT_BUF_INIT, shallow = GIT_BUF_INIT, *buf;
+	git_commit *commit;
+	git_oid id;
+
+	advertise_v2();
+	list_refs();
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.pack")));
+
+	buf = response();
+	pkt(buf, "shallow-info\n");
+	pkt(buf, "shallow " MASTER_OID "\n");
+	git_buf_puts(buf, "0001");
+	pkt(buf, "packfile\n");
+	cl_git_pass(git_buf_printf(buf, "%04x\1", (unsigned int)pack.size + 5));
+	cl_git_pass(git_buf_put(buf, pack.ptr, pack.size));
+	git_buf_puts(buf, "0000");
+
+	opts.callbacks.transport = scripted_transport_cb;
+	opts.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+	opts.depth = 1;
+	cl_git_pass(git_remote_fetch(_remote, NULL, &opts, NULL));
+
+	cl_assert(strstr(_scripted.requests.ptr, "deepen 1\n"));
+	cl_assert(!strstr(_scripted.requests.ptr, "shallow "));
+
+	cl_git_pass(git_futils_readbuffer(&shallow, "./protocolv2/.git/shallow"));
+	cl_assert_equal_s(MASTER_OID "\n", shallow.ptr);
+
+	cl_git_pass(git_oid_fromstr(&id, MASTER_OID));
+	cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+	cl_assert_equal_i(0, git_commit_parentcount(commit));
+
+	git_commit_free(commit);
+	git_buf_free(&shallow);
+	git_buf_free(&pack);
+}
+
+void test_transport_protocolv2__shallow_needs_server_support(void)
+{
+	static const char first[] = MASTER_OID " HEAD\0"
+		"multi_ack side-band-64k ofs-delta symref=HEAD:refs/heads/master\n";
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_buf *buf = response();
+
+	pkt(buf, "# service=git-upload-pack\n");
+	git_buf_puts(buf, "0000");
+	pkt_n(buf, first, sizeof(first) - 1);
+	pkt(buf, MASTER_OID " refs/heads/master\n");
+	git_buf_puts(buf, "0000");
+
+	opts.callbacks.transport = scripted_transport_cb;
+	opts.depth = 1;
+	cl_git_fail(git_remote_fetch(_remote, NULL, &opts, NULL));
+	cl_assert(strstr(giterr_last()->message, "does not support shallow"));
+}
+
+void test_transport_protocolv2__version_1_options_have_no_negotiation(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_string(cfg, "fetch.negotiationAlgorithm", "noop"));
+	git_config_free(cfg);
+
+	/* the field isn't part of the options the caller was built with */
+	opts.version = 1;
+	opts.negotiation = GIT_FETCH_NEGOTIATION_CONSECUTIVE;
+
+	fetch_with_a_local_commit(&opts, false);
+	cl_assert(!strstr(_scripted.requests.ptr, "have "));
+}
+
+void test_transport_protocolv2__version_2_options_are_not_shallow(void)
+{
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+
+	opts.version = 2;
+	opts.depth = 1;
+
+	fetch_with_a_local_commit(&opts, true);
+	cl_assert(!strstr(_scripted.requests.ptr, "deepen"));
+	cl_assert_equal_i(0, git_repository_is_shallow(_repo));
+}
+
+static void commit_local_history(size_t count)
+{
+	git_signature *sig;
+	git_treebuilder *builder;
+	git_tree *tree;
+	git_commit *parent = NULL;
+	git_oid tree_id, commit_id;
+	size_t i;
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+	cl_git_pass(git_signature_now(&sig, "nulltoken", "emeric.fermas@gmail.com"));
+
+	for (i = 0; i < count; i++) {
+		const git_commit *parents[] = { parent };
+
+		cl_git_pass(git_commit_create(&commit_id, _repo, "refs/heads/local", sig, sig,
+			NULL, "local\n", tree, parent ? 1 : 0, parents));
+
+		git_commit_free(parent);
+		cl_git_pass(git_commit_lookup(&parent, _repo, &commit_id));
+	}
+
+	git_commit_free(parent);
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+}
+
+static void shallow_list(git_buf *buf)
+{
+	pkt(buf, "shallow " MASTER_OID "\n");
+	git_buf_puts(buf, "0000");
+}
+
+/*
+ * A v0 depth fetch with a full round of haves before the last one, so
+ * the server answers twice; the stateful one only sends the shallow
+ * list before its first answer.
+ */
+static void fetch_shallow_v0(bool stateful)
+{
+	static const char first[] = MASTER_OID " HEAD\0"
+		"side-band-64k ofs-delta shallow symref=HEAD:refs/heads/master\n";
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+	git_buf pack = GIT_BUF_INIT, shallow = GIT_BUF_INIT, *buf;
+	const char *deepen;
+	git_commit *commit;
+	git_oid id;
+
+	_scripted.stateful = stateful;
+	commit_local_history(20);
+
+	buf = response();
+	if (!stateful) {
+		pkt(buf, "# service=git-upload-pack\n");
+		git_buf_puts(buf, "0000");
+	}
+	pkt_n(buf, first, sizeof(first) - 1);
+	pkt(buf, MASTER_OID " refs/heads/master\n");
+	git_buf_puts(buf, "0000");
+
+	buf = response();
+	shallow_list(buf);
+	pkt(buf, "NAK\n");
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(
+		"testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5.pack")));
+
+	buf = response();
+	if (!stateful)
+		shallow_list(buf);
+	pkt(buf, "NAK\n");
+	cl_git_pass(git_buf_printf(buf, "%04x\1", (unsigned int)pack.size + 5));
+	cl_git_pass(git_buf_put(buf, pack.ptr, pack.size));
+	git_buf_puts(buf, "0000");
+
+	opts.callbacks.transport = scripted_transport_cb;
+	opts.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+	opts.depth = 1;
+	cl_git_pass(git_remote_fetch(_remote, NULL, &opts, NULL));
+	cl_assert_equal_sz(_scripted.count, _scripted.next);
+
+	/* the deepen line goes out along with each copy of the wants */
+	cl_assert((deepen = strstr(_scripted.requests.ptr, "deepen 1\n")) != NULL);
+	cl_assert_equal_b(!stateful, strstr(deepen + 1, "deepen 1\n") != NULL);
+	cl_assert(strstr(_scripted.requests.ptr, "have "));
+	cl_assert(strstr(_scripted.requests.ptr, "done\n"));
+
+	cl_git_pass(git_futils_readbuffer(&shallow, "./protocolv2/.git/shallow"));
+	cl_assert_equal_s(MASTER_OID "\n", shallow.ptr);
+
+	cl_git_pass(git_oid_fromstr(&id, MASTER_OID));
+	cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+	cl_assert_equal_i(0, git_commit_parentcount(commit));
+
+	git_commit_free(commit);
+	git_buf_free(&shallow);
+	git_buf_free(&pack);
+}
+
+void test_transport_protocolv2__fetches_shallow_over_v0_rpc(void)
+{
+	fetch_shallow_v0(false);
+}
+
+void test_transport_protocolv2__fetches_shallow_over_v0_stateful(void)
+{
+	fetch_shallow_v0(true);
+}